@@ -1,6 +1,7 @@
 include(CheckCXXCompilerFlag)
 
 option(LW_DISABLE_FASTMATH "Disable math optimizations [Not recommended]" OFF)
+option(LW_ENABLE_AVX2 "Compile for CPUs with AVX2 support (enables 8-wide SIMD code paths)" OFF)
 
 if(NOT LW_DISABLE_FASTMATH)
 	if((CMAKE_CXX_COMPILER_ID MATCHES "MSVC") OR (CMAKE_CXX_COMPILER_FRONTEND_VARIANT MATCHES "MSVC"))
@@ -10,6 +11,14 @@ if(NOT LW_DISABLE_FASTMATH)
 	endif()
 endif()
 
+if(LW_ENABLE_AVX2)
+	if((CMAKE_CXX_COMPILER_ID MATCHES "MSVC") OR (CMAKE_CXX_COMPILER_FRONTEND_VARIANT MATCHES "MSVC"))
+		list(APPEND FF_FLAGS /arch:AVX2)
+	elseif((CMAKE_CXX_COMPILER_ID MATCHES "Clang") OR (CMAKE_CXX_COMPILER_ID MATCHES "GNU"))
+		list(APPEND FF_FLAGS -mavx2 -mfma)
+	endif()
+endif()
+
 if((CMAKE_CXX_COMPILER_ID MATCHES "Clang" AND NOT CMAKE_CXX_COMPILER_FRONTEND_VARIANT MATCHES "MSVC") OR (CMAKE_CXX_COMPILER_ID MATCHES "GNU"))
 	set(CMAKE_CXX_FLAGS_DEBUG "-g -Og" CACHE STRING "" FORCE)
 	set(CMAKE_CXX_FLAGS_RELEASE "-O3" CACHE STRING "" FORCE)
@@ -14,6 +14,7 @@
 #include <lightwave/registry.hpp>
 
 // MARK: - utilities
+#include <lightwave/distribution.hpp>
 #include <lightwave/hash.hpp>
 #include <lightwave/iterators.hpp>
 #include <lightwave/parallel.hpp>
@@ -18,6 +18,9 @@ struct BsdfSample {
     /// @brief The weight of the sample, given by @code cos(theta) * B(wi, wo) /
     /// p(wi) @endcode
     Color weight;
+    /// @brief The probability density of sampling @c wi with respect to solid
+    /// angle (infinite for specular reflection or refraction), which matches
+    /// the density reported by @ref Bsdf::evaluate .
     float pdf;
 
     /// @brief Return an invalid sample, used to denote that sampling has
@@ -40,11 +43,15 @@ struct BsdfEval {
     /// @brief The value of the Bsdf, given by @code cos(theta) * B(wi, wo)
     /// @endcode
     Color value;
+    /// @brief The probability density of @ref Bsdf::sample producing @c wi
+    /// with respect to solid angle (e.g., for multiple importance sampling).
+    float pdf;
 
     /// @brief Indicates that the Bsdf is zero for the given pair of directions.
     static BsdfEval invalid() {
         return {
             .value = Color(0),
+            .pdf   = 0,
         };
     }
 
@@ -69,6 +76,22 @@ public:
                               const Vector &wi) const {
         NOT_IMPLEMENTED
     }
+    /**
+     * @brief Returns the probability density of @ref sample producing @c wi
+     * for a given @c wo with respect to solid angle (zero for specular
+     * reflection or refraction), which matches the density reported by @ref
+     * evaluate . Algorithms that trace paths in both directions (e.g.,
+     * bidirectional path tracing) query it for swapped directions as well.
+     * @param uv The texture coordinates of the surface.
+     * @param wo The outgoing direction light is scattered in, pointing away
+     * from the surface, in local coordinates.
+     * @param wi The incoming direction light comes from, pointing away
+     * from the surface, in local coordinates.
+     */
+    virtual float pdf(const Point2 &uv, const Vector &wo,
+                      const Vector &wi) const {
+        return evaluate(uv, wo, wi).pdf;
+    }
     /**
      * @brief Samples a direction according to the distribution of the Bsdf in
      * local coordinates (i.e., the normal is assumed to be [0,0,1]).
@@ -22,6 +22,38 @@ struct CameraSample {
     Color weight;
 };
 
+/// @brief The result of connecting a point in the scene to the camera using
+/// @ref Camera::connect .
+struct CameraConnection {
+    /// @brief The direction from the point towards the camera.
+    Vector wi;
+    /// @brief The distance from the point to the camera.
+    float distance;
+    /// @brief The pixel the point is seen in.
+    Point2i pixel;
+    /// @brief The importance the camera assigns to light arriving from the
+    /// point, given by @code We * cos(theta) / distance^2 @endcode (where
+    /// theta is the angle to the viewing direction), normalized so that
+    /// adding it to a pixel for every one of @c samplesPerPixel * pixelCount
+    /// light paths and dividing by @c samplesPerPixel estimates the image.
+    Color weight;
+
+    /// @brief Return an invalid connection, used to denote that the point is
+    /// not seen by the camera.
+    static CameraConnection invalid() {
+        return {
+            .wi       = Vector(),
+            .distance = 0,
+            .pixel    = Point2i(),
+            .weight   = Color(),
+        };
+    }
+
+    /// @brief Tests whether the connection is invalid.
+    bool isInvalid() const { return weight == Color(0); }
+    explicit operator bool() const { return !isInvalid(); }
+};
+
 /// @brief A Camera, representing the relationship between pixel coordinates and
 /// rays.
 class Camera : public Object {
@@ -68,6 +100,32 @@ public:
      */
     virtual CameraSample sample(const Point2 &normalized,
                                 Sampler &rng) const = 0;
+
+    /**
+     * @brief Projects a point in world space onto the image, which allows
+     * tracing paths from lights that end at the camera (e.g., for
+     * bidirectional path tracing).
+     * Cameras that do not support this always report invalid connections
+     * (see @ref canBeConnected ).
+     * @param point The point in world space coordinates.
+     */
+    virtual CameraConnection connect(const Point &point) const {
+        return CameraConnection::invalid();
+    }
+
+    /**
+     * @brief Returns the probability density (with respect to solid angle) of
+     * sampling a ray into the given direction, when the pixel is picked
+     * uniformly at random. Directions outside of the image have a density of
+     * zero.
+     * @param direction The direction in world space coordinates, pointing
+     * away from the camera.
+     */
+    virtual float pdfDirection(const Vector &direction) const { return 0; }
+
+    /// @brief Returns whether points can be projected onto the image using
+    /// @ref connect .
+    virtual bool canBeConnected() const { return false; }
 };
 
 } // namespace lightwave
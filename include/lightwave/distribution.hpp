@@ -0,0 +1,141 @@
+/**
+ * @file distribution.hpp
+ * @brief Contains piecewise constant distributions, which importance sample
+ * tabulated functions (e.g., the brightness of an environment map).
+ */
+
+#pragma once
+
+#include <lightwave/math.hpp>
+
+#include <algorithm>
+#include <vector>
+
+namespace lightwave {
+
+/**
+ * @brief A distribution on the unit interval whose density is proportional to
+ * a piecewise constant function with equally sized intervals.
+ * Functions that are zero everywhere are sampled uniformly instead.
+ */
+class Distribution1D {
+    /// @brief The (non-negative) value of the function in each interval.
+    std::vector<float> m_function;
+    /// @brief The cumulative distribution at the start of each interval,
+    /// followed by a final entry of one.
+    std::vector<float> m_cdf;
+    /// @brief The integral of the function over the unit interval.
+    float m_integral;
+
+public:
+    Distribution1D() : m_integral(0) {}
+
+    /// @brief Builds the distribution of a function, given by its values on
+    /// equally sized intervals of [0,1).
+    explicit Distribution1D(std::vector<float> function)
+        : m_function(std::move(function)), m_cdf(m_function.size() + 1) {
+        const int n = size();
+        m_cdf[0]    = 0;
+        for (int i = 0; i < n; i++)
+            m_cdf[i + 1] = m_cdf[i] + m_function[i] / n;
+        m_integral = m_cdf[n];
+
+        for (int i = 1; i <= n; i++)
+            m_cdf[i] = m_integral > 0 ? m_cdf[i] / m_integral : float(i) / n;
+        m_cdf[n] = 1;
+    }
+
+    /// @brief The number of intervals of the function.
+    int size() const { return int(m_function.size()); }
+    /// @brief The integral of the function over the unit interval.
+    float integral() const { return m_integral; }
+
+    /**
+     * @brief Warps a uniformly distributed random number in [0,1) to the
+     * distribution.
+     * @param u The random number.
+     * @param pdf Receives the density of the returned point.
+     * @param interval Receives the index of the interval containing the
+     * returned point.
+     * @return A point in [0,1).
+     */
+    float sample(float u, float &pdf, int &interval) const {
+        // the last interval whose cdf does not exceed u
+        interval = int(std::upper_bound(m_cdf.begin(), m_cdf.end(), u) -
+                       m_cdf.begin()) -
+                   1;
+        interval = std::clamp(interval, 0, size() - 1);
+
+        const float width = m_cdf[interval + 1] - m_cdf[interval];
+        pdf               = width * size();
+        const float offset =
+            width > 0 ? clamp((u - m_cdf[interval]) / width, 0.f, 1.f) : 0.5f;
+        return min((interval + offset) / size(), OneMinusEpsilon);
+    }
+
+    /// @brief Returns the density of the distribution at a point in [0,1).
+    float pdf(float x) const {
+        const int interval = std::clamp(int(x * size()), 0, size() - 1);
+        return (m_cdf[interval + 1] - m_cdf[interval]) * size();
+    }
+};
+
+/**
+ * @brief A distribution on the unit square whose density is proportional to a
+ * piecewise constant function on a regular grid.
+ * Points are sampled by first picking a row from the marginal distribution of
+ * all rows, and then a position within the row from its conditional
+ * distribution.
+ */
+class Distribution2D {
+    /// @brief The distribution within each row.
+    std::vector<Distribution1D> m_conditional;
+    /// @brief The distribution of the rows, proportional to their integrals.
+    Distribution1D m_marginal;
+
+public:
+    Distribution2D() = default;
+
+    /**
+     * @brief Builds the distribution of a function, given by its values on a
+     * regular grid over [0,1)^2.
+     * @param function The values in row-major order, where rows correspond to
+     * the second coordinate.
+     * @param resolution The number of columns and rows of the grid.
+     */
+    Distribution2D(const std::vector<float> &function,
+                   const Point2i &resolution) {
+        std::vector<float> rows(resolution.y());
+        m_conditional.reserve(resolution.y());
+        for (int y = 0; y < resolution.y(); y++) {
+            const auto row = function.begin() + y * resolution.x();
+            m_conditional.emplace_back(
+                std::vector<float>(row, row + resolution.x()));
+            rows[y] = m_conditional.back().integral();
+        }
+        m_marginal = Distribution1D(std::move(rows));
+    }
+
+    /// @brief The integral of the function over the unit square.
+    float integral() const { return m_marginal.integral(); }
+
+    /// @brief Warps a uniformly distributed point in [0,1)^2 to the
+    /// distribution, returning its density in @c pdf .
+    Point2 sample(const Point2 &u, float &pdf) const {
+        float pdfRow, pdfColumn;
+        int row, column;
+        const float y = m_marginal.sample(u.y(), pdfRow, row);
+        const float x = m_conditional[row].sample(u.x(), pdfColumn, column);
+        pdf           = pdfRow * pdfColumn;
+        return { x, y };
+    }
+
+    /// @brief Returns the density of the distribution at a point in [0,1)^2.
+    float pdf(const Point2 &point) const {
+        const int row = std::clamp(
+            int(point.y() * m_marginal.size()), 0, m_marginal.size() - 1);
+        return m_marginal.pdf(point.y()) * m_conditional[row].pdf(point.x());
+    }
+};
+
+} // namespace lightwave
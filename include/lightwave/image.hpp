@@ -66,6 +66,9 @@ public:
     void setBasePath(const std::filesystem::path &basePath) {
         m_basePath = basePath;
     }
+    /// @brief Returns the folder the image will be stored in if no explicit
+    /// path is given.
+    const std::filesystem::path &basePath() const { return m_basePath; }
 
     /// @brief Copies the data and resolution from another image, but leaves all
     /// other attributes the same.
@@ -99,6 +99,28 @@ public:
      */
     bool intersect(const Ray &ray, Intersection &its,
                    Sampler &rng) const override;
+    /**
+     * @brief Reports whether the instance is hit by a given ray in world
+     * coordinates closer than @c tMax (without computing any surface
+     * attributes).
+     */
+    bool occluded(const Ray &ray, float tMax, Sampler &rng) const override;
+    /// @brief Intersects a packet of rays in world coordinates, passing it on
+    /// to the wrapped shape (see @ref intersect ).
+    int intersect8(const Packet<Ray> &rays, int mask, Packet<Intersection> &its,
+                   const Packet<Sampler *> &rng) const override;
+    /// @brief Tests a packet of rays in world coordinates for occlusion,
+    /// passing it on to the wrapped shape (see @ref occluded ).
+    int occluded8(const Packet<Ray> &rays, const Packet<float> &tMax, int mask,
+                  const Packet<Sampler *> &rng) const override;
+    /**
+     * @brief Computes the surface attributes of a hit of this instance found
+     * by @ref intersect , and transforms them to world coordinates.
+     * @param ray The ray that was used to find the intersection in world
+     * coordinates.
+     */
+    void computeSurfaceInteraction(const Ray &ray,
+                                   Intersection &its) const override;
     /// @brief Returns the bounding box of the instance in world coordinates.
     Bounds getBoundingBox() const override;
     /// @brief Returns the centroid of the instance in world coordinates.
@@ -5,15 +5,82 @@
 
 #pragma once
 
+#include <lightwave/bsdf.hpp>
 #include <lightwave/color.hpp>
 #include <lightwave/core.hpp>
 #include <lightwave/image.hpp>
+#include <lightwave/iterators.hpp>
+#include <lightwave/light.hpp>
 #include <lightwave/math.hpp>
+#include <lightwave/parallel.hpp>
 #include <lightwave/sampler.hpp>
 #include <lightwave/scene.hpp>
 
 namespace lightwave {
 
+/// @brief Options of the current run that affect sampling integrators, as
+/// given on the command line.
+struct RenderOptions {
+    /// @brief Whether to continue renders from their checkpoints.
+    bool resume = false;
+    /// @brief Identifies the scene description, so that checkpoints of other
+    /// scenes are not resumed from.
+    std::string sceneKey;
+};
+
+/// @brief The options of the current run.
+extern RenderOptions renderOptions;
+
+/**
+ * @brief Weighs a sample of one of two sampling strategies using the power
+ * heuristic of multiple importance sampling (Veach, 1997).
+ * @param pdf The density the sample was drawn with.
+ * @param otherPdf The density the other strategy would have drawn the sample
+ * with.
+ * @note Infinite densities (e.g., of specular reflection) receive the full
+ * weight, as the other strategy cannot produce such samples.
+ */
+inline float powerHeuristic(float pdf, float otherPdf) {
+    if (std::isinf(pdf))
+        return 1;
+    if (std::isinf(otherPdf))
+        return 0;
+    const float a = sqr(pdf), b = sqr(otherPdf);
+    return a + b > 0 ? a / (a + b) : 0;
+}
+
+/// @brief A light sample for a surface point that has been selected among
+/// several candidates (see @ref SamplingIntegrator::sampleLightResampled ).
+struct ResampledLightSample {
+    /// @brief The selected sample of the light.
+    DirectLightSample sample;
+    /// @brief The density with which the candidate was drawn (i.e., the
+    /// probability of picking its light times the density of sampling it),
+    /// which is used for multiple importance sampling.
+    float pdf;
+    /// @brief The BSDF of the surface point, evaluated for the direction of
+    /// the sample.
+    BsdfEval bsdf;
+    /// @brief The estimate of the reflected direct light if the sample is
+    /// not occluded.
+    Color contribution;
+
+    /// @brief Return an invalid sample, used to denote that no candidate
+    /// contributes.
+    static ResampledLightSample invalid() {
+        return {
+            .sample       = DirectLightSample::invalid(),
+            .pdf          = 0,
+            .bsdf         = BsdfEval::invalid(),
+            .contribution = Color(0),
+        };
+    }
+
+    /// @brief Tests whether the sample is invalid.
+    bool isInvalid() const { return contribution == Color(0); }
+    explicit operator bool() const { return !isInvalid(); }
+};
+
 /**
  * @brief Integrators are rendering algorithms that take a scene and produce an
  * image from them (e.g., using path tracing). The term integrator refers to the
@@ -30,9 +97,141 @@ public:
 /**
  * @brief A sampling integrator uses random numbers to solve the integration
  * problem, e.g., by using Monte Carlo integration.
+ *
+ * By default, the image is rendered tile by tile, and every pixel receives
+ * the number of samples specified by the sampler. Alternatively, the image
+ * can be rendered in passes over the whole frame, which is the case when
+ * - @c progressive is set, in which case every pass adds one sample per
+ * pixel, or a time @c budget such as "120s", "5m" or "1h" is given, in which
+ * case no pass is started that is not expected to finish within the budget
+ * (the sample count of the sampler still acts as upper limit),
+ * - an @c adaptiveThreshold is given, in which case the relative standard
+ * error of the mean luminance is estimated for blocks of pixels after every
+ * pass, and only blocks whose error exceeds the threshold receive further
+ * samples (noisiest first), until they converge or the budget of uniform
+ * sampling is used up.
+ * While rendering in passes, the image always holds the mean of all samples
+ * taken so far, and is sent to tev periodically.
+ *
+ * Renders in passes can be checkpointed: given a @c checkpointInterval (e.g.,
+ * "10m"), the samples taken so far are written to "<image id>.checkpoint"
+ * next to the image after the first pass that completes once the interval has
+ * elapsed, as well as after the last pass. When started with @c --resume ,
+ * rendering continues from the checkpoint and yields the same image as an
+ * uninterrupted render. Finished renders can be resumed with an increased
+ * sample count to add samples (adaptive sampling then distributes them
+ * differently than an uninterrupted render with that sample count would).
  */
 class SamplingIntegrator : public Integrator {
+    struct PixelStatistics;
+
+    /// @brief The relative error below which pixels stop being sampled, or 0
+    /// if adaptive sampling is disabled.
+    float m_adaptiveThreshold;
+    /// @brief The number of samples every pixel receives before its error is
+    /// estimated, which is also the number of samples added per pass.
+    int m_adaptiveMinSamples;
+    /// @brief The maximum number of samples a single pixel can receive.
+    int m_adaptiveMaxSamples;
+    /// @brief Whether to store the number of samples taken for each pixel as
+    /// additional image (with suffix "_samples").
+    bool m_saveSampleCounts;
+    /// @brief The wall-clock time in seconds after which rendering stops, or
+    /// 0 for no limit.
+    float m_timeBudget;
+    /// @brief Whether to render in passes over the whole frame even when not
+    /// sampling adaptively.
+    bool m_progressive;
+    /// @brief The wall-clock time in seconds between checkpoints, or 0 if
+    /// checkpoints should not be written.
+    float m_checkpointInterval;
+
+    /// @brief Computes a single sample of the given pixel.
+    Color samplePixel(const Point2i &pixel, int sampleIndex, Sampler &sampler);
+    /// @brief Computes a single sample for each pixel of a packet whose bit
+    /// is set in @c mask , tracing their camera rays together if the
+    /// integrator supports it.
+    void samplePixels(const Packet<Point2i> &pixels,
+                      const Packet<int> &sampleIndices, int mask,
+                      const Packet<Sampler *> &samplers,
+                      Packet<Color> &results);
+    /// @brief Renders the image in passes, as described above.
+    void renderPasses();
+    /// @brief Reads the samples of a previous render, returning false if no
+    /// matching checkpoint exists.
+    static bool restoreCheckpoint(const std::filesystem::path &path,
+                                  const std::string &key,
+                                  std::vector<PixelStatistics> &pixels,
+                                  int &passes);
+
 protected:
+    /// @brief The size below which blocks are not subdivided further when
+    /// workers run out of work towards the end of a frame.
+    static constexpr int MinimumBlockSize = 16;
+
+    /**
+     * @brief Invokes @c f for blocks covering the image in parallel. Blocks
+     * are handed out in spiral order, and are split into quadrants when
+     * workers run out of work towards the end of a frame, i.e., once fewer
+     * blocks remain unstarted than there are workers.
+     */
+    template <typename F>
+    static void forEachBlock(const Vector2i &resolution, F f) {
+        std::vector<Bounds2i> blocks;
+        for (auto block : BlockSpiral(resolution, Vector2i(64)))
+            blocks.push_back(block);
+        std::atomic<int> unstartedBlocks = int(blocks.size());
+        const int workers                = ThreadPool::global().threadCount();
+
+        const auto visit = [&](const auto &self,
+                               const Bounds2i &block) -> void {
+            const Vector2i size = block.diagonal();
+            if (unstartedBlocks < workers &&
+                ThreadPool::global().idleWorkers() > 0 &&
+                size.maxComponent() >= 2 * MinimumBlockSize) {
+                // the pool is running out of work, so split the block into
+                // quadrants that idle workers can steal
+                const Point2i center = block.min() + size / 2;
+                TaskGroup quadrants;
+                for (int i = 0; i < 4; i++) {
+                    const Point2i min(i & 1 ? center.x() : block.min().x(),
+                                      i & 2 ? center.y() : block.min().y());
+                    const Point2i max(i & 1 ? block.max().x() : center.x(),
+                                      i & 2 ? block.max().y() : center.y());
+                    const Bounds2i quadrant(min, max);
+                    if (!quadrant.isEmpty())
+                        quadrants.run(
+                            [&, quadrant]() { self(self, quadrant); });
+                }
+                quadrants.wait();
+                return;
+            }
+            f(block);
+        };
+        for_each_parallel(blocks.begin(), blocks.end(), [&](auto block) {
+            unstartedBlocks--;
+            visit(visit, block);
+        });
+    }
+
+    /// @brief Whether the image is rendered in passes (see above) rather
+    /// than tile by tile.
+    bool rendersInPasses() const {
+        return m_adaptiveThreshold > 0 || m_progressive;
+    }
+
+    /**
+     * @brief Samples the direct light reflected at a surface point by
+     * resampled importance sampling (Talbot et al., 2005): several candidate
+     * light samples are drawn, and one of them is selected proportional to
+     * its unshadowed contribution, so that only the selected candidate needs
+     * a shadow ray. For a single candidate, this is plain light sampling.
+     * @param candidates The number of candidates to draw.
+     */
+    ResampledLightSample sampleLightResampled(const Intersection &its,
+                                              int candidates,
+                                              Sampler &rng) const;
+
     /// @brief The random number generator used to steer sampling decisions.
     ref<Sampler> m_sampler;
     /// @brief The output image generated by the rendering algorithm.
@@ -45,8 +244,23 @@ public:
         m_sampler = properties.getChild<Sampler>();
         m_image   = properties.getOptionalChild<Image>();
         m_scene   = properties.getChild<Scene>();
+
+        m_adaptiveThreshold  = properties.get<float>("adaptiveThreshold", 0);
+        m_adaptiveMinSamples = properties.get<int>("adaptiveMinSamples", 16);
+        m_adaptiveMaxSamples = properties.get<int>(
+            "adaptiveMaxSamples", 4 * m_sampler->samplesPerPixel());
+        m_saveSampleCounts = properties.get<bool>("saveSampleCounts", false);
+        m_timeBudget =
+            parseDuration(properties.get<std::string>("budget", "0s"));
+        m_checkpointInterval = parseDuration(
+            properties.get<std::string>("checkpointInterval", "0s"));
+        m_progressive = properties.get<bool>(
+            "progressive", m_timeBudget > 0 || m_checkpointInterval > 0);
     }
 
+    /// @brief Parses a duration such as "120s", "5m" or "1h" into seconds.
+    static float parseDuration(const std::string &duration);
+
     /// @brief Sets the output image that should be populated by rendering.
     void setImage(const ref<Image> &image) { m_image = image; }
 
@@ -71,6 +285,21 @@ public:
      * @ref execute function of the integrator.
      */
     virtual Color Li(const Ray &ray, Sampler &rng) = 0;
+
+    /**
+     * @brief Returns (an estimate of) the incident radiance for a camera ray
+     * whose closest intersection has already been found.
+     * Integrators that report @ref tracesCameraPackets have their camera rays
+     * traced in packets of neighboring pixels, and are invoked through this
+     * method instead of @ref Li(const Ray &, Sampler &) .
+     */
+    virtual Color Li(const Ray &ray, const Intersection &its, Sampler &rng) {
+        return Li(ray, rng);
+    }
+
+    /// @brief Whether camera rays should be traced in packets, which pays off
+    /// for integrators that start by intersecting them with the scene.
+    virtual bool tracesCameraPackets() const { return false; }
 };
 
 } // namespace lightwave
@@ -9,6 +9,9 @@
 #include <lightwave/core.hpp>
 #include <lightwave/emission.hpp>
 #include <lightwave/math.hpp>
+#include <lightwave/properties.hpp>
+
+#include <optional>
 
 namespace lightwave {
 
@@ -23,6 +26,9 @@ struct DirectLightSample {
     /// @brief The distance from the query point to the sampled point on the
     /// light source.
     float distance;
+    /// @brief The probability density of sampling @c wi with respect to solid
+    /// angle (infinite for lights that only emit from a single point or into
+    /// a single direction), which matches @ref Light::pdfDirect .
     float pdf;
 
     /// @brief Return an invalid sample, used to denote that sampling has
@@ -41,6 +47,73 @@ struct DirectLightSample {
     explicit operator bool() const { return !isInvalid(); }
 };
 
+/// @brief The densities of @ref Light::sampleEmission producing a given ray.
+struct EmissionPdf {
+    /// @brief The density of the origin of the ray with respect to area (one
+    /// for lights that only emit from a single point).
+    float position;
+    /// @brief The density of the direction of the ray with respect to solid
+    /// angle (one for lights that only emit into a single direction).
+    float direction;
+};
+
+/// @brief The result of sampling a ray leaving a light source using @ref
+/// Light::sampleEmission .
+struct EmissionSample {
+    /// @brief The point the ray leaves from. For lights that have a surface,
+    /// this describes the surface (including its area density), otherwise
+    /// only the position is set.
+    SurfaceEvent origin;
+    /// @brief The direction of the ray, pointing away from the light.
+    Vector direction;
+    /// @brief The weight of the sample, given by @code Le * cos(theta) /
+    /// (pdf.position * pdf.direction) @endcode
+    Color weight;
+    /// @brief The densities with which the ray has been sampled.
+    EmissionPdf pdf;
+
+    /// @brief Return an invalid sample, used to denote that sampling has
+    /// failed.
+    static EmissionSample invalid() {
+        return {
+            .origin    = SurfaceEvent(),
+            .direction = Vector(),
+            .weight    = Color(),
+            .pdf       = { .position = 0, .direction = 0 },
+        };
+    }
+
+    /// @brief The sampled ray.
+    Ray ray() const { return Ray(origin.position, direction); }
+
+    /// @brief Tests whether the sample is invalid (i.e., sampling has failed).
+    bool isInvalid() const { return weight == Color(0); }
+    explicit operator bool() const { return !isInvalid(); }
+};
+
+/**
+ * @brief Bounds on where and in which directions a light emits, used to
+ * estimate how much it contributes to a given point without sampling it.
+ * Directions are bounded by a cone of surface normals, around which light is
+ * emitted up to a given angle.
+ */
+struct LightBounds {
+    /// @brief The region of space the light occupies.
+    Bounds bounds;
+    /// @brief The central direction of the cone of surface normals.
+    Vector axis;
+    /// @brief The cosine of the opening angle of the cone of surface normals
+    /// (-1 if the light can face in any direction).
+    float cosThetaNormals;
+    /// @brief The cosine of the largest angle between a surface normal and
+    /// a direction light is emitted in (0 for surfaces that emit into their
+    /// hemisphere).
+    float cosThetaEmission;
+    /// @brief The largest radiant intensity (as luminance) the light emits
+    /// into any direction.
+    float intensity;
+};
+
 /**
  * @brief A light source that can be sampled for direct connections.
  * Some light sources can also be intersected by rays (e.g., area lights or the
@@ -50,26 +123,73 @@ struct DirectLightSample {
 class Light : public Object {
 protected:
     /**
-     * @brief How likely this light will be selected when picking a random light
-     * source. A value of zero indicates that this light should never be
-     * sampled. The probability of sampling this light will be its weight
-     * divided by the total weight of all light sources in the scene.
+     * @brief A factor that scales how likely this light will be selected when
+     * picking a random light source. A value of zero indicates that this light
+     * should never be sampled.
      */
     float m_samplingWeight;
+    /// @brief The probability of this light being picked by @ref
+    /// Scene::sampleLight independently of a point, stored here so that it can
+    /// be queried for every hit without any lookup.
+    float m_samplingProbability;
+    /// @brief The position of this light among the lights of the scene, which
+    /// the scene uses to look up data it keeps about the light.
+    int m_samplingIndex;
 
 public:
-    Light(const Properties &properties) {
+    Light(const Properties &properties)
+        : m_samplingProbability(0), m_samplingIndex(-1) {
         m_samplingWeight = properties.get<float>("weight", 1.f);
     }
 
     /**
-     * @brief How likely this light will be selected when picking a random light
-     * source. A value of zero indicates that this light should never be
-     * sampled. The probability of sampling this light will be its weight
-     * divided by the total weight of all light sources in the scene.
+     * @brief A factor that scales how likely this light will be selected when
+     * picking a random light source. A value of zero indicates that this light
+     * should never be sampled. By default, lights are picked proportional to
+     * their estimated power multiplied by this weight.
      */
     float samplingWeight() const { return m_samplingWeight; }
 
+    /// @brief The probability of this light being picked by @ref
+    /// Scene::sampleLight independently of a point (zero for lights that are
+    /// never sampled).
+    float samplingProbability() const { return m_samplingProbability; }
+    /// @brief Sets the probability of this light being picked, which is done
+    /// by the scene once all lights are known.
+    void setSamplingProbability(float probability) {
+        m_samplingProbability = probability;
+    }
+
+    /// @brief The position of this light among the lights of the scene (-1
+    /// if the light is not part of a scene).
+    int samplingIndex() const { return m_samplingIndex; }
+    /// @brief Sets the position of this light among the lights of the scene.
+    void setSamplingIndex(int index) { m_samplingIndex = index; }
+
+    /**
+     * @brief Estimates the total power (as luminance) emitted by this light
+     * into the scene, which is used to pick bright lights more often.
+     * @param sceneBounds The bounding box of the scene geometry, which lights
+     * that are infinitely far away use to estimate how much of their emission
+     * reaches the scene.
+     * @param rng A random number generator for lights whose power can only be
+     * estimated by sampling them.
+     */
+    virtual float estimatePower(const Bounds &sceneBounds,
+                                Sampler &rng) const = 0;
+
+    /**
+     * @brief Bounds the emission of this light, which allows picking lights
+     * that are likely to contribute to a point more often.
+     * Lights that are infinitely far away (e.g., directional lights) do not
+     * have bounds and are picked independently of the point.
+     * @param rng A random number generator for lights whose bounds can only be
+     * estimated by sampling them.
+     */
+    virtual std::optional<LightBounds> lightBounds(Sampler &rng) const {
+        return std::nullopt;
+    }
+
     /**
      * @brief Samples a random point on the light source and computes its
      * emission and probability of sampling.
@@ -80,9 +200,76 @@ public:
     virtual DirectLightSample sampleDirect(const Point &origin,
                                            Sampler &rng) const = 0;
 
+    /**
+     * @brief Returns the probability density (with respect to solid angle) of
+     * @ref sampleDirect producing the direction towards a point where a ray
+     * has hit this light, which allows weighting emission that is found by
+     * sampling BSDFs against light sampling.
+     * Lights that cannot be hit by rays always report zero.
+     * @param origin The light receiving point that the ray originated from.
+     * @param its The intersection of the ray with this light.
+     */
+    virtual float pdfDirect(const Point &origin,
+                            const Intersection &its) const {
+        return 0;
+    }
+
     /// @brief Returns whether this light source can be hit by rays (i.e., has
     /// an area that has been placed within the scene).
     virtual bool canBeIntersected() const { return false; }
+
+    /**
+     * @brief Samples a ray leaving the light source, which allows tracing
+     * paths that start at lights (e.g., for bidirectional path tracing).
+     * Lights that are infinitely far away emit their rays from a disk that
+     * covers the scene, which is placed outside of the scene facing the
+     * sampled direction.
+     * Lights that cannot emit rays always report invalid samples.
+     * @param sceneBounds The bounding box of the scene geometry, which lights
+     * that are infinitely far away need to aim their rays at the scene.
+     * @param rng A random number generator used to steer the sampling.
+     */
+    virtual EmissionSample sampleEmission(const Bounds &sceneBounds,
+                                          Sampler &rng) const {
+        return EmissionSample::invalid();
+    }
+
+    /**
+     * @brief Returns the densities of @ref sampleEmission producing a ray that
+     * leaves a given point of the light into a given direction.
+     * @param origin The point on the light (for lights that are infinitely far
+     * away, only the direction matters).
+     * @param direction The direction of the ray, pointing away from the light.
+     * @param sceneBounds The bounding box of the scene geometry.
+     */
+    virtual EmissionPdf pdfEmission(const SurfaceEvent &origin,
+                                    const Vector &direction,
+                                    const Bounds &sceneBounds) const {
+        return { .position = 0, .direction = 0 };
+    }
+
+    /// @brief Returns whether this light only emits from a single point or
+    /// into a single direction, so that paths cannot find it by chance.
+    virtual bool isDelta() const { return false; }
+
+    /// @brief Returns whether this light is infinitely far away, so that rays
+    /// arriving from it are described by their direction alone.
+    virtual bool isInfinite() const { return false; }
+
+protected:
+    /**
+     * @brief Turns a direction sampled towards a light that is infinitely far
+     * away (see @ref sampleDirect ) into a ray entering the scene, whose origin
+     * is sampled uniformly on a disk that covers the scene and faces the
+     * direction.
+     */
+    static EmissionSample emitFromDisk(const DirectLightSample &sample,
+                                       const Bounds &sceneBounds,
+                                       Sampler &rng);
+
+    /// @brief The density of the origins of @ref emitFromDisk with respect to
+    /// area.
+    static float diskPdf(const Bounds &sceneBounds);
 };
 
 /**
@@ -110,6 +297,22 @@ public:
     }
 
     bool canBeIntersected() const override { return true; }
+
+    EmissionSample sampleEmission(const Bounds &sceneBounds,
+                                  Sampler &rng) const override {
+        // the direction does not depend on the point it is sampled for
+        return emitFromDisk(sampleDirect(Point(), rng), sceneBounds, rng);
+    }
+
+    EmissionPdf pdfEmission(const SurfaceEvent &origin,
+                            const Vector &direction,
+                            const Bounds &sceneBounds) const override {
+        // the light is found by rays travelling against the direction
+        return { .position  = diskPdf(sceneBounds),
+                 .direction = pdfDirect(Point(), Intersection(direction)) };
+    }
+
+    bool isInfinite() const override { return true; }
 };
 
 } // namespace lightwave
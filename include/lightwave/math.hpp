@@ -11,6 +11,7 @@
 
 #include <algorithm>
 #include <array>
+#include <bit>
 #include <cmath>
 #include <optional>
 
@@ -49,6 +50,10 @@ static constexpr float Rad2Deg = 180.0f * InvPi;
  */
 static constexpr float Epsilon = 1e-4f;
 
+/// @brief The largest float below one, which random numbers are clamped to
+/// when they are reused for the next decision.
+static constexpr float OneMinusEpsilon = 0x1.fffffep-1f;
+
 /// @brief Infinity
 static constexpr float Infinity = std::numeric_limits<float>::infinity();
 
@@ -793,6 +798,23 @@ struct Ray {
     }
 };
 
+/// @brief The number of rays that are traced together by packet queries such
+/// as @ref Shape::intersect8 .
+static constexpr int PacketSize = 8;
+
+/**
+ * @brief Holds one value per ray of a packet. Packet queries take a bit mask
+ * in addition, which tells which of the rays are valid (bit @c i for the ray
+ * at index @c i ), so that packets can also be partially filled.
+ */
+template <typename T> using Packet = std::array<T, PacketSize>;
+
+/// @brief Calls @c f with the index of every ray whose bit is set in @c mask.
+template <typename F> inline void forEachLane(int mask, F &&f) {
+    for (unsigned bits = unsigned(mask); bits; bits &= bits - 1)
+        f(std::countr_zero(bits));
+}
+
 /**
  * @brief Defines shading frames and common trigonometrical functions used
  * within them. In lightwave, we follow the convention that material functions
@@ -955,8 +977,8 @@ struct Intersection : public SurfaceEvent {
     float t;
     /**
      * @brief The probability of having picked the intersected light source
-     * using
-     * @c Scene::sampleLight , or zero if no light source was intersected.
+     * using @c Scene::sampleLight from the origin of the ray, or zero if no
+     * light source was intersected.
      */
     float lightProbability;
     /**
@@ -965,6 +987,22 @@ struct Intersection : public SurfaceEvent {
      */
     BackgroundLight *background = nullptr;
 
+    /**
+     * @brief Describes the closest hit found so far for shapes that defer the
+     * computation of surface attributes until traversal has finished (see
+     * @ref Shape::computeSurfaceInteraction ).
+     */
+    struct {
+        /// @brief The shape whose surface attributes still need to be
+        /// computed, or null if the intersection has already been populated.
+        const Shape *shape = nullptr;
+        /// @brief The index of the primitive of the shape that was hit.
+        int primitiveIndex = 0;
+        /// @brief The barycentric coordinates of the hit within the
+        /// primitive.
+        Vector2 barycentrics;
+    } hit;
+
     /// @brief Statistics recorded while traversing acceleration structures.
     struct {
         /// @brief The number of BVH nodes that have been tested for
@@ -988,6 +1026,13 @@ struct Intersection : public SurfaceEvent {
     /// @brief Samples the Bsdf of the underlying surface.
     BsdfSample sampleBsdf(Sampler &rng) const;
     BsdfEval evaluateBsdf(const Vector &wi) const;
+    /**
+     * @brief Returns the density of sampling the Bsdf of the underlying
+     * surface, for a pair of directions in world coordinates that need not
+     * include @c wo (e.g., to find how likely a path would have been traced
+     * in reverse direction).
+     */
+    float pdfBsdf(const Vector &wo, const Vector &wi) const;
 
     Light *light() const;
 };
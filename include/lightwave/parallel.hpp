@@ -5,8 +5,16 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 #include <lightwave/color.hpp>
 #include <lightwave/logger.hpp>
@@ -19,6 +27,140 @@
 
 namespace lightwave {
 
+class TaskGroup;
+
+/**
+ * @brief A persistent pool of worker threads that execute tasks by work
+ * stealing.
+ *
+ * Every worker owns a deque of tasks: tasks spawned by a worker are pushed to
+ * the back of its own deque and popped from there (depth first, which keeps
+ * the working set of recursive algorithms small), while idle workers steal
+ * from the front of other deques (which tends to hand out the largest pieces
+ * of work). Tasks spawned by other threads, e.g., the main thread, are placed
+ * in a shared queue that is processed in order. Workers without work sleep
+ * until new tasks arrive.
+ *
+ * Tasks are always spawned as part of a @ref TaskGroup . Threads that wait for
+ * a group help by executing tasks of that group (but never unrelated tasks,
+ * which might block on the group themselves).
+ */
+class ThreadPool {
+public:
+    /// @brief The pool shared by all parts of the renderer, which has one
+    /// worker per hardware thread.
+    static ThreadPool &global();
+
+    explicit ThreadPool(int threadCount);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &)            = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /// @brief The number of worker threads.
+    int threadCount() const { return m_threadCount; }
+    /// @brief The number of workers that are currently waiting for work,
+    /// which can be used to subdivide work further once the pool runs dry.
+    int idleWorkers() const { return m_idleWorkers; }
+
+private:
+    friend class TaskGroup;
+
+    struct Task {
+        std::function<void()> function;
+        TaskGroup *group;
+    };
+
+    /// @brief A deque of tasks, guarded by a lock.
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    /// @brief Adds a task to the deque of the calling worker, or to the shared
+    /// queue if the caller is not a worker of this pool.
+    void push(Task &&task);
+    /**
+     * @brief Executes a single task, if one can be found.
+     * @param group Only considers tasks of this group, or all tasks if
+     * nullptr.
+     */
+    bool runOne(TaskGroup *group);
+    /// @brief Removes the next task of the given group (or any task if
+    /// nullptr) from the front or back of a queue.
+    bool pop(Queue &queue, TaskGroup *group, bool fromBack, Task &task);
+    void work(int index);
+
+    /// @brief The number of workers (which is known before all of them have
+    /// been started).
+    const int m_threadCount;
+    std::vector<std::thread> m_workers;
+    /// @brief One deque per worker, followed by the queue shared by all other
+    /// threads.
+    std::vector<std::unique_ptr<Queue>> m_queues;
+
+    /// @brief The number of tasks waiting in any of the queues.
+    std::atomic<int> m_queuedTasks = 0;
+    std::atomic<int> m_idleWorkers = 0;
+    bool m_stop                    = false;
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wakeup;
+};
+
+/**
+ * @brief A set of tasks that are executed by the @ref ThreadPool and that can
+ * be waited for.
+ * The first exception thrown by any of the tasks is rethrown by wait().
+ * Groups must not be destroyed while tasks are pending, which the destructor
+ * ensures by waiting for them.
+ */
+class TaskGroup {
+public:
+    explicit TaskGroup(ThreadPool &pool = ThreadPool::global())
+        : m_pool(pool) {}
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup &)            = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+    /// @brief Spawns a task that invokes @c f .
+    void run(std::function<void()> f);
+
+    /// @brief Spawns a task that invokes @c f and returns a future for its
+    /// result (exceptions are reported through the future instead of wait()).
+    template <typename F> auto submit(F f) -> std::future<decltype(f())> {
+        auto task =
+            std::make_shared<std::packaged_task<decltype(f())()>>(std::move(f));
+        auto future = task->get_future();
+        run([task]() { (*task)(); });
+        return future;
+    }
+
+    /// @brief Waits for all tasks that have been spawned so far, helping to
+    /// execute them, and rethrows the first exception thrown by any of them.
+    void wait();
+
+    /// @brief Skips all tasks that have not been started yet (futures of
+    /// skipped tasks report a broken promise).
+    void cancel() { m_cancelled = true; }
+
+private:
+    friend class ThreadPool;
+
+    /// @brief Invokes a task that has been removed from a queue.
+    void execute(ThreadPool::Task &task);
+
+    ThreadPool &m_pool;
+    /// @brief Tasks that have been spawned but have not finished.
+    std::atomic<int> m_pending = 0;
+    /// @brief Tasks that have been spawned but have not been started.
+    std::atomic<int> m_queued     = 0;
+    std::atomic<bool> m_cancelled = false;
+    std::exception_ptr m_exception;
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+};
+
 /// @brief Invokes @c f for each element of the iterator, parallelized across
 /// all available cores.
 template <class ForwardIt, class UnaryFunction>
@@ -28,37 +170,11 @@ void for_each_parallel(ForwardIt first, ForwardIt last, UnaryFunction f) {
     return;
 #endif
 
-    std::mutex m_lock;
-
-    const int numThreads = std::thread::hardware_concurrency();
-    std::vector<std::thread> m_threads;
-    m_threads.reserve(numThreads);
-
-    // build a thread pool
-    for (int i = 0; i < numThreads; i++) {
-        m_threads.emplace_back([&]() {
-            while (true) {
-                m_lock.lock();
-                if (!(first != last)) {
-                    // no more work to do
-                    m_lock.unlock();
-                    break;
-                }
-
-                // grab a work item
-                auto obj = *first;
-                ++first;
-                m_lock.unlock();
-
-                // execute the work item
-                f(obj);
-            }
-        });
-    }
-
-    // wait until all threads have finished
-    for (auto &thread : m_threads)
-        thread.join();
+    // every element becomes a task, which idle workers steal in order
+    TaskGroup tasks;
+    for (; first != last; ++first)
+        tasks.run([&f, obj = *first]() { f(obj); });
+    tasks.wait();
 }
 
 /// @brief Invokes @c f for each element of the iterator, parallelized across
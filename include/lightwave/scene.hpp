@@ -6,6 +6,7 @@
 #pragma once
 
 #include <lightwave/core.hpp>
+#include <lightwave/math.hpp>
 #include <vector>
 
 namespace lightwave {
@@ -43,6 +44,19 @@ class Scene : public Object {
     /// the scene.
     ref<BackgroundLight> m_background;
 
+    /// @brief How the probability of picking each light is chosen.
+    enum class Strategy {
+        /// @brief Lights are picked from a hierarchy over their bounds, based
+        /// on their estimated contribution to the point they illuminate
+        /// (scaled by their weight).
+        Tree,
+        /// @brief Lights are picked proportional to their estimated power
+        /// (scaled by their weight).
+        Power,
+        /// @brief Lights are picked proportional to their weight.
+        Uniform,
+    };
+
     class LightSampling;
     /// @brief Contains all necessary data structures to randomly pick light
     /// sources.
@@ -60,12 +74,29 @@ public:
     /// @brief Reports whether any intersection up to a given maximal distance
     /// exists (used for testing visibility of light sources).
     bool intersect(const Ray &ray, float tMax, Sampler &rng) const;
+    /// @brief Finds the closest intersections for the rays of a packet whose
+    /// bit is set in @c mask , traversing the scene once for all of them.
+    void intersect8(const Packet<Ray> &rays, int mask,
+                    Packet<Intersection> &its,
+                    const Packet<Sampler *> &rng) const;
+    /// @brief Tests a packet of rays for occlusion up to their respective
+    /// maximal distances, returning a bit mask of the occluded rays.
+    int intersect8(const Packet<Ray> &rays, const Packet<float> &tMax, int mask,
+                   const Packet<Sampler *> &rng) const;
 
     /// @brief Reports whether at least one light exists that could be sampled.
     bool hasLights() const;
 
-    /// @brief Randomly picks a light from the list of sampleable light sources.
+    /// @brief Randomly picks a light from the list of sampleable light sources,
+    /// independently of where the light is received (i.e., proportional to
+    /// the power of the lights).
     LightSample sampleLight(Sampler &rng) const;
+    /// @brief Randomly picks a light that is likely to contribute to the given
+    /// point.
+    LightSample sampleLight(const Point &origin, Sampler &rng) const;
+    /// @brief Returns the probability of @ref sampleLight picking the given
+    /// light for the given point (e.g., for multiple importance sampling).
+    float lightProbability(const Point &origin, const Light *light) const;
     /// @brief Returns the bounding box of the scene geometry.
     Bounds getBoundingBox() const;
 };
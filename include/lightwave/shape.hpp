@@ -42,6 +42,63 @@ public:
      */
     virtual bool intersect(const Ray &ray, Intersection &its,
                            Sampler &rng) const = 0;
+    /**
+     * @brief Reports whether the shape is hit by a ray closer than @c tMax
+     * (used for testing visibility of light sources).
+     * @note The default implementation falls back to @ref intersect . Shapes
+     * can override this to stop at the first hit they find, and to skip the
+     * computation of surface attributes (e.g., normals and uv coordinates).
+     */
+    virtual bool occluded(const Ray &ray, float tMax, Sampler &rng) const {
+        Intersection its(-ray.direction, tMax);
+        return intersect(ray, its, rng);
+    }
+    /**
+     * @brief Intersects a packet of rays at once, which has the same effect
+     * as calling @ref intersect for every ray whose bit is set in @c mask .
+     * @return A bit mask of the rays for which an intersection was found.
+     * @note The default implementation intersects the rays one by one.
+     * Acceleration structures override this to traverse their nodes once for
+     * the whole packet, which pays off for coherent rays (e.g., camera rays
+     * of neighboring pixels).
+     */
+    virtual int intersect8(const Packet<Ray> &rays, int mask,
+                           Packet<Intersection> &its,
+                           const Packet<Sampler *> &rng) const {
+        int hitMask = 0;
+        forEachLane(mask, [&](int lane) {
+            if (intersect(rays[lane], its[lane], *rng[lane]))
+                hitMask |= 1 << lane;
+        });
+        return hitMask;
+    }
+    /**
+     * @brief Tests a packet of rays for occlusion at once, which has the same
+     * effect as calling @ref occluded for every ray whose bit is set in
+     * @c mask .
+     * @return A bit mask of the rays that are occluded.
+     */
+    virtual int occluded8(const Packet<Ray> &rays, const Packet<float> &tMax,
+                          int mask, const Packet<Sampler *> &rng) const {
+        int occludedMask = 0;
+        forEachLane(mask, [&](int lane) {
+            if (occluded(rays[lane], tMax[lane], *rng[lane]))
+                occludedMask |= 1 << lane;
+        });
+        return occludedMask;
+    }
+    /**
+     * @brief Computes the surface attributes (position, texture coordinates and
+     * shading frame) of the hit recorded in @c its.hit , once the closest
+     * intersection is known.
+     * @note Shapes that are expensive to populate should only record their
+     * hit in @ref intersect and compute the attributes here, so that no work
+     * is wasted on hits that are later replaced by closer ones. Shapes that
+     * populate the intersection directly in @ref intersect leave @c its.hit
+     * untouched and do not need to implement this.
+     */
+    virtual void computeSurfaceInteraction(const Ray &ray,
+                                           Intersection &its) const {}
     /// @brief Returns a bounding box that tightly encapsulates the shape.
     virtual Bounds getBoundingBox() const = 0;
     /**
@@ -0,0 +1,27 @@
+/**
+ * @file simd.hpp
+ * @brief Detects which SIMD instruction sets are available to the compiler and
+ * includes the corresponding intrinsics headers.
+ *
+ * Code that uses intrinsics should always provide a scalar fallback, guarded
+ * by the macros defined here:
+ * - @c LW_SIMD_SSE  -- 4-wide float vectors (SSE2, always available on x86-64)
+ * - @c LW_SIMD_AVX2 -- 8-wide float vectors (requires compiling with
+ * @c LW_ENABLE_AVX2 in CMake)
+ */
+
+#pragma once
+
+#include <lightwave/core.hpp>
+
+#if defined(LW_CPU_X86) &&                                                     \
+    (defined(__SSE2__) || defined(_M_X64) ||                                   \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define LW_SIMD_SSE
+#include <emmintrin.h>
+#endif
+
+#if defined(LW_SIMD_SSE) && defined(__AVX2__)
+#define LW_SIMD_AVX2
+#include <immintrin.h>
+#endif
@@ -33,6 +33,14 @@ public:
         // interface for scalar values)
         return evaluate(uv).r();
     }
+
+    /**
+     * @brief The number of distinct values the texture varies between along
+     * each axis of the unit square (e.g., the pixels of an image), which is
+     * the resolution needed to tabulate the texture. Textures without such a
+     * structure (e.g., constants) report a single value.
+     */
+    virtual Point2i resolution() const { return Point2i(1); }
 };
 
 } // namespace lightwave
@@ -82,4 +82,23 @@ inline float cosineHemispherePdf(const Vector &vector) {
     return InvPi * std::max(vector.z(), float(0));
 }
 
+/**
+ * @brief Warps a given point from the unit square ([0,0] to [1,1]) to a cone
+ * of directions around the z axis, whose opening angle has the given cosine,
+ * with uniform density given by @ref uniformConePdf .
+ */
+inline Vector squareToUniformCone(const Point2 &sample, float cosThetaMax) {
+    float z      = 1 - sample.y() * (1 - cosThetaMax);
+    float r      = safe_sqrt(1 - z * z);
+    float phi    = 2 * Pi * sample.x();
+    float cosPhi = std::cos(phi);
+    float sinPhi = std::sin(phi);
+    return { r * cosPhi, r * sinPhi, z };
+}
+
+/// @brief Returns the density of the @ref squareToUniformCone warping.
+inline float uniformConePdf(float cosThetaMax) {
+    return Inv2Pi / (1 - cosThetaMax);
+}
+
 } // namespace lightwave
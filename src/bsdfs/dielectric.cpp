@@ -37,7 +37,6 @@ public:
             cos_theta = -cos_theta;
         }
         float fresnel = fresnelDielectric(cos_theta, ior);
-        float pdf;
 
         // Decide whether to reflect or refract
         float dec = rng.next();
@@ -47,14 +46,16 @@ public:
             // Reflect
             wi    = reflect(wo, normal);
             color = m_reflectance->evaluate(uv);
-            pdf   = fresnel;
         } else {
             // Refract
             wi    = refract(wo, normal, ior);
             color = m_transmittance->evaluate(uv) / (sqr(ior));
-            pdf   = 1 - fresnel;
         }
-        return BsdfSample{ .wi = wi.normalized(), .weight = color, .pdf = pdf };
+        // directions are chosen from a discrete set, i.e., with a density of
+        // infinity
+        return BsdfSample{ .wi     = wi.normalized(),
+                           .weight = color,
+                           .pdf    = Infinity };
     }
 
     std::string toString() const override {
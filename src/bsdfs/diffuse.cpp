@@ -16,9 +16,16 @@ public:
         if (!Frame::sameHemisphere(wo, wi)) {
             return BsdfEval::invalid();
         }
-        Color color = m_albedo->evaluate(uv) * InvPi *
-                      Frame::absCosTheta(wi.normalized());
-        return BsdfEval{ .value = color };
+        float cosine = Frame::absCosTheta(wi.normalized());
+        Color color  = m_albedo->evaluate(uv) * InvPi * cosine;
+        return BsdfEval{ .value = color, .pdf = cosine * InvPi };
+    }
+
+    float pdf(const Point2 &uv, const Vector &wo,
+              const Vector &wi) const override {
+        if (!Frame::sameHemisphere(wo, wi))
+            return 0;
+        return Frame::absCosTheta(wi.normalized()) * InvPi;
     }
 
     BsdfSample sample(const Point2 &uv, const Vector &wo,
@@ -38,7 +45,7 @@ public:
         Vector wi = out_dir.normalized();
         return BsdfSample{ .wi     = wi,
                            .weight = m_albedo->evaluate(uv),
-                           .pdf    = cosineHemispherePdf(wi) };
+                           .pdf    = Frame::absCosTheta(wi) * InvPi };
     }
 
     Color albedo(const Point2 &uv) const override {
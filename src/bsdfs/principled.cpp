@@ -14,7 +14,7 @@ struct DiffuseLobe {
             return BsdfEval::invalid();
         }
         Color result = color * InvPi * Frame::absCosTheta(wi.normalized());
-        return BsdfEval{ .value = result };
+        return BsdfEval{ .value = result, .pdf = pdf(wo, wi) };
 
         // hints:
         // * copy your diffuse bsdf evaluate here
@@ -35,12 +35,18 @@ struct DiffuseLobe {
         Vector wi = out_dir.normalized();
         return BsdfSample{ .wi     = wi,
                            .weight = color,
-                           .pdf    = cosineHemispherePdf(wi) };
+                           .pdf    = pdf(wo, wi) };
 
         // hints:
         // * copy your diffuse bsdf evaluate here
         // * you do not need to query a texture, the albedo is given by `color`
     }
+
+    float pdf(const Vector &wo, const Vector &wi) const {
+        if (!Frame::sameHemisphere(wo, wi))
+            return 0;
+        return Frame::absCosTheta(wi.normalized()) * InvPi;
+    }
 };
 
 struct MetallicLobe {
@@ -57,7 +63,7 @@ struct MetallicLobe {
 
         Color result = (refl * dist * gi * go) / (4 * cos_theta);
 
-        return BsdfEval{ result };
+        return BsdfEval{ .value = result, .pdf = pdf(wo, wi) };
 
         // hints:
         // * copy your roughconductor bsdf evaluate here
@@ -75,11 +81,9 @@ struct MetallicLobe {
 
         Color result = color * gi;
 
-        float pdf = microfacet::detReflection(n, wo);
-
         return BsdfSample{ .wi     = wi.normalized(),
                            .weight = result,
-                           .pdf    = pdf };
+                           .pdf    = pdf(wo, wi) };
 
         // hints:
         // * copy your roughconductor bsdf sample here
@@ -87,6 +91,12 @@ struct MetallicLobe {
         //   * the reflectance is given by `color'
         //   * the variable `alpha' is already provided for you
     }
+
+    float pdf(const Vector &wo, const Vector &wi) const {
+        const Vector wm = (wi + wo).normalized();
+        return microfacet::pdfGGXVNDF(alpha, wm, wo) *
+               microfacet::detReflection(wm, wo);
+    }
 };
 
 class Principled : public Bsdf {
@@ -128,6 +138,14 @@ class Principled : public Bsdf {
         };
     }
 
+    /// @brief The density of sampling @c wi from either lobe.
+    static float combinedPdf(const Combination &combination,
+                             const Vector &wo, const Vector &wi) {
+        const float diffuseProb = combination.diffuseSelectionProb;
+        return diffuseProb * combination.diffuse.pdf(wo, wi) +
+               (1 - diffuseProb) * combination.metallic.pdf(wo, wi);
+    }
+
 public:
     Principled(const Properties &properties) {
         m_baseColor = properties.get<Texture>("baseColor");
@@ -147,12 +165,18 @@ public:
 
         Color color = diff_eval.value + metall_eval.value;
 
-        return BsdfEval{ color };
+        return BsdfEval{ .value = color,
+                         .pdf   = combinedPdf(combination, wo, wi) };
 
         // hint: evaluate `combination.diffuse` and `combination.metallic` and
         // combine their results
     }
 
+    float pdf(const Point2 &uv, const Vector &wo,
+              const Vector &wi) const override {
+        return combinedPdf(combine(uv, wo), wo, wi);
+    }
+
     BsdfSample sample(const Point2 &uv, const Vector &wo,
                       Sampler &rng) const override {
         PROFILE("Principled")
@@ -174,9 +198,12 @@ public:
 
         Color weight = sample.weight / pdf;
 
-        return BsdfSample{ .wi     = sample.wi.normalized(),
+        // the weight only accounts for the sampled lobe, but the direction
+        // could have been produced by either of them
+        const Vector wi = sample.wi.normalized();
+        return BsdfSample{ .wi     = wi,
                            .weight = weight,
-                           .pdf    = pdf };
+                           .pdf    = combinedPdf(combination, wo, wi) };
 
         // hint: sample either `combination.diffuse` (probability
         // `combination.diffuseSelectionProb`) or `combination.metallic`
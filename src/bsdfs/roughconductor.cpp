@@ -8,6 +8,13 @@ class RoughConductor : public Bsdf {
     ref<Texture> m_reflectance;
     ref<Texture> m_roughness;
 
+    /// @brief The density of sampling the direction reflected about the
+    /// microfacet normal @c wm , with respect to solid angle.
+    static float pdf(float alpha, const Vector &wo, const Vector &wm) {
+        return microfacet::pdfGGXVNDF(alpha, wm, wo) *
+               microfacet::detReflection(wm, wo);
+    }
+
 public:
     RoughConductor(const Properties &properties) {
         m_reflectance = properties.get<Texture>("reflectance");
@@ -30,12 +37,18 @@ public:
 
         Color color = (refl * dist * gi * go) / (4 * cos_theta);
 
-        return BsdfEval{ color };
+        return BsdfEval{ .value = color, .pdf = pdf(alpha, wo, wm) };
 
         // hints:
         // * the microfacet normal can be computed from `wi' and `wo'
     }
 
+    float pdf(const Point2 &uv, const Vector &wo,
+              const Vector &wi) const override {
+        const auto alpha = std::max(float(1e-3), sqr(m_roughness->scalar(uv)));
+        return pdf(alpha, wo, (wi + wo).normalized());
+    }
+
     BsdfSample sample(const Point2 &uv, const Vector &wo,
                       Sampler &rng) const override {
         const auto alpha = std::max(float(1e-3), sqr(m_roughness->scalar(uv)));
@@ -48,9 +61,9 @@ public:
 
         Color color = m_reflectance.get()->evaluate(uv) * gi;
 
-        float pdf = microfacet::detReflection(n, wo);
-
-        return BsdfSample{ .wi = wi, .weight = color, .pdf = pdf };
+        return BsdfSample{ .wi     = wi,
+                           .weight = color,
+                           .pdf    = pdf(alpha, wo, wm) };
 
         // hints:
         // * do not forget to cancel out as many terms from your equations as
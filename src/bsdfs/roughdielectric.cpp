@@ -10,6 +10,35 @@ class RoughDielectric : public Bsdf {
     ref<Texture> m_transmittance;
     ref<Texture> m_roughness;
 
+    /**
+     * @brief The density of sampling @c wi , with respect to solid angle.
+     * Reflection and refraction are chosen based on the Fresnel term of the
+     * macroscopic surface, and their directions are distributed according to
+     * the visible microfacet normals around the (generalized) half vector.
+     */
+    static float pdf(float alpha, float ior, const Vector &wo,
+                     const Vector &wi) {
+        float cos_theta = Frame::cosTheta(wo);
+        if (cos_theta < 0) {
+            ior       = 1 / ior;
+            cos_theta = -cos_theta;
+        }
+        const float fresnel = fresnelDielectric(cos_theta, ior);
+
+        if (Frame::sameHemisphere(wo, wi)) {
+            const Vector h = (wi + wo).normalized();
+            return microfacet::pdfGGXVNDF(alpha, h, wo) *
+                   microfacet::detReflection(h, wo) * fresnel;
+        }
+
+        // the half vector of refraction, oriented towards wo
+        Vector h = (wo + ior * wi).normalized();
+        if (h.dot(wo) < 0)
+            h = -h;
+        return microfacet::pdfGGXVNDF(alpha, h, wo) *
+               microfacet::detRefraction(h, wi, wo, ior) * (1 - fresnel);
+    }
+
 public:
     RoughDielectric(const Properties &properties) {
         // index of refraction
@@ -47,7 +76,14 @@ public:
             ((1 - f) * m_transmittance.get()->evaluate(uv) * d * gi * go) /
             (4 * cos_theta);
 
-        return BsdfEval{ refl + trans };
+        return BsdfEval{ .value = refl + trans,
+                         .pdf   = pdf(alpha, ior, wo, wi) };
+    }
+
+    float pdf(const Point2 &uv, const Vector &wo,
+              const Vector &wi) const override {
+        const auto alpha = std::max(float(1e-3), sqr(m_roughness->scalar(uv)));
+        return pdf(alpha, m_ior->scalar(uv), wo, wi);
     }
 
     BsdfSample sample(const Point2 &uv, const Vector &wo,
@@ -71,20 +107,20 @@ public:
         float dec = rng.next();
         Vector wi = refract(wo, normal, ior);
         Color color;
-        float pdf;
 
         if (dec <= fresnel || wi == Vector(0)) {
             // Reflect
             wi    = reflect(wo, normal);
             color = m_reflectance->evaluate(uv);
-            pdf   = microfacet::detReflection(normal, wo) * fresnel;
         } else {
             // Refract
             // wi = refract(wo, normal, ior);
             color = m_transmittance->evaluate(uv) / (sqr(ior));
-            pdf   = microfacet::detReflection(normal, wo) * (1.0f - fresnel);
         }
-        return BsdfSample{ .wi = wi.normalized(), .weight = color, .pdf = pdf };
+        wi = wi.normalized();
+        return BsdfSample{ .wi     = wi,
+                           .weight = color,
+                           .pdf    = pdf(alpha, m_ior->scalar(uv), wo, wi) };
     }
 
     std::string toString() const override {
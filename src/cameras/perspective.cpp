@@ -17,6 +17,9 @@ protected:
     float x_ratio;
     float y_ratio;
 
+    /// @brief The area of the image on the plane z = 1 in local coordinates.
+    float imageArea() const { return 4 * x_ratio * y_ratio; }
+
 public:
     Perspective(const Properties &properties) : Camera(properties) {
         const float fov = properties.get<float>("fov");
@@ -56,6 +59,54 @@ public:
         return CameraSample{ .ray = world_ray.normalized(), .weight = Color(1.0f) };
     }
 
+    CameraConnection connect(const Point &point) const override {
+        const Point origin   = m_transform->apply(Point(0));
+        Vector wi            = origin - point;
+        const float distance = wi.length();
+        if (distance == 0)
+            return CameraConnection::invalid();
+        wi /= distance;
+
+        // find the direction in local coordinates, where the image lies on
+        // the plane z = 1
+        const Vector local = m_transform->inverse(-wi).normalized();
+        if (local.z() <= 0)
+            return CameraConnection::invalid();
+        const Point2 normalized(local.x() / (local.z() * x_ratio),
+                                local.y() / (local.z() * y_ratio));
+        if (std::abs(normalized.x()) >= 1 || std::abs(normalized.y()) >= 1)
+            return CameraConnection::invalid();
+
+        const Point2i pixel(
+            min(int((normalized.x() + 1) / 2 * m_resolution.x()),
+                m_resolution.x() - 1),
+            min(int((normalized.y() + 1) / 2 * m_resolution.y()),
+                m_resolution.y() - 1));
+
+        // the importance is uniform over the image plane, whose area maps to
+        // solid angle by cos^3(theta)
+        const float cosTheta   = local.z();
+        const float importance = 1 / (imageArea() * sqr(sqr(cosTheta)));
+        return CameraConnection{
+            .wi       = wi,
+            .distance = distance,
+            .pixel    = pixel,
+            .weight   = Color(importance * cosTheta / sqr(distance)),
+        };
+    }
+
+    float pdfDirection(const Vector &direction) const override {
+        const Vector local = m_transform->inverse(direction).normalized();
+        if (local.z() <= 0)
+            return 0;
+        if (std::abs(local.x()) >= local.z() * x_ratio ||
+            std::abs(local.y()) >= local.z() * y_ratio)
+            return 0;
+        return 1 / (imageArea() * sqr(local.z()) * local.z());
+    }
+
+    bool canBeConnected() const override { return true; }
+
     std::string toString() const override {
         return tfm::format(
             "Perspective[\n"
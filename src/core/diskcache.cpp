@@ -0,0 +1,176 @@
+#include "diskcache.hpp"
+#include <lightwave/hash.hpp>
+#include <lightwave/logger.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+
+#ifndef LW_OS_WINDOWS
+#include <unistd.h>
+#endif
+
+namespace lightwave::diskcache {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+/// @brief Increment this whenever the layout of entries changes.
+constexpr uint32_t FormatVersion = 1;
+/// @brief Sections start at multiples of this many bytes.
+constexpr uint64_t SectionAlignment = 64;
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t sectionCount;
+    uint64_t keyLength;
+};
+
+struct SectionHeader {
+    uint64_t offset;
+    uint64_t size;
+};
+
+constexpr char Magic[8] = { 'L', 'W', 'C', 'A', 'C', 'H', 'E', '\0' };
+
+uint64_t align(uint64_t offset) {
+    return (offset + SectionAlignment - 1) / SectionAlignment *
+           SectionAlignment;
+}
+
+} // namespace
+
+fs::path directory() {
+    if (const char *path = std::getenv("LW_CACHE_DIR"))
+        return path;
+#ifdef LW_OS_WINDOWS
+    // the temporary directory already belongs to the user
+    return fs::temp_directory_path() / "lightwave-cache";
+#else
+    // the temporary directory is shared, so users must not see each other's
+    // entries
+    return fs::temp_directory_path() /
+           tfm::format("lightwave-cache-%d", getuid());
+#endif
+}
+
+std::string fileKey(const fs::path &path) {
+    const fs::path absolute = fs::absolute(path).lexically_normal();
+    return tfm::format("%s|%d|%d",
+                       absolute.generic_string(),
+                       fs::file_size(absolute),
+                       fs::last_write_time(absolute).time_since_epoch().count());
+}
+
+fs::path entryPath(const std::string &key) {
+    hash::fnv1a hash;
+    for (const char c : key)
+        hash << c;
+    return directory() / tfm::format("%016x.lwcache", uint64_t(hash));
+}
+
+bool Writer::writeAt(const fs::path &path, const std::string &key) const {
+    // a random suffix keeps concurrent writers apart
+    const fs::path temporary = fs::path(path).concat(
+        tfm::format(".%08x.tmp", std::random_device()()));
+    try {
+        if (path.has_parent_path())
+            fs::create_directories(path.parent_path());
+        std::ofstream stream(temporary, std::ios::binary);
+        if (!stream)
+            lightwave_throw("could not create %s", temporary);
+
+        FileHeader header;
+        std::memcpy(header.magic, Magic, sizeof(Magic));
+        header.version      = FormatVersion;
+        header.sectionCount = uint32_t(m_sections.size());
+        header.keyLength    = key.size();
+        stream.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        stream.write(key.data(), std::streamsize(key.size()));
+
+        std::vector<std::span<const uint8_t>> sections;
+        for (const auto &section : m_sections)
+            sections.push_back(section());
+
+        uint64_t offset = align(sizeof(header) + key.size() +
+                                sections.size() * sizeof(SectionHeader));
+        for (const auto &section : sections) {
+            const SectionHeader entry = { offset, section.size() };
+            stream.write(reinterpret_cast<const char *>(&entry), sizeof(entry));
+            offset = align(offset + section.size());
+        }
+
+        const char padding[SectionAlignment] = {};
+        for (const auto &section : sections) {
+            const uint64_t position = uint64_t(stream.tellp());
+            stream.write(padding, std::streamsize(align(position) - position));
+            stream.write(reinterpret_cast<const char *>(section.data()),
+                         std::streamsize(section.size()));
+        }
+
+        stream.close();
+        if (!stream)
+            lightwave_throw("could not write %s", temporary);
+        fs::rename(temporary, path);
+        return true;
+    } catch (const std::exception &e) {
+        logger(EWarn, "could not write cache entry %s: %s", path, e.what());
+        std::error_code error;
+        fs::remove(temporary, error);
+        return false;
+    }
+}
+
+Reader::Reader(const fs::path &path, const std::string &key) {
+    std::error_code error;
+    if (!fs::is_regular_file(path, error))
+        return;
+
+    try {
+        auto file         = std::make_unique<MappedFile>(path);
+        const uint8_t *data = file->data();
+        const size_t size   = file->size();
+
+        FileHeader header;
+        if (size < sizeof(header))
+            return;
+        std::memcpy(&header, data, sizeof(header));
+        if (std::memcmp(header.magic, Magic, sizeof(Magic)) != 0 ||
+            header.version != FormatVersion || header.keyLength != key.size())
+            return;
+
+        const uint64_t tableOffset = sizeof(header) + header.keyLength;
+        const uint64_t dataOffset =
+            tableOffset + uint64_t(header.sectionCount) * sizeof(SectionHeader);
+        if (size < dataOffset ||
+            std::memcmp(data + sizeof(header), key.data(), key.size()) != 0)
+            return;
+
+        for (uint32_t i = 0; i < header.sectionCount; i++) {
+            SectionHeader section;
+            std::memcpy(&section,
+                        data + tableOffset + i * sizeof(SectionHeader),
+                        sizeof(section));
+            if (section.offset < dataOffset || section.offset > size ||
+                section.size > size - section.offset)
+                return; // truncated entry
+            m_sections.emplace_back(data + section.offset, section.size);
+        }
+        m_file = std::move(file);
+    } catch (const std::exception &e) {
+        logger(EWarn, "could not read cache entry %s: %s", path, e.what());
+        m_sections.clear();
+    }
+}
+
+std::span<const uint8_t> Reader::next(size_t elementSize) {
+    if (m_next >= m_sections.size() ||
+        m_sections[m_next].size() % elementSize != 0)
+        lightwave_throw("malformed cache entry");
+    return m_sections[m_next++];
+}
+
+} // namespace lightwave::diskcache
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "mappedfile.hpp"
+#include <lightwave/core.hpp>
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace lightwave {
+
+/**
+ * @brief On-disk cache for data that is expensive to derive from input files,
+ * such as parsed meshes and their BVHs.
+ *
+ * An entry consists of a sequence of arrays ("sections") of trivially copyable
+ * data, each aligned to 64 bytes so that it can be used directly from a memory
+ * mapping. Entries are identified by a key string that must capture everything
+ * the data depends on (see fileKey()), and are stored in a file named after
+ * the hash of that key.
+ *
+ * Invalidation rules:
+ * - a changed input file (path, size or modification time) or changed
+ * settings yield a different key, and hence a different entry,
+ * - entries store their full key and a format version, and are ignored if
+ * either does not match (e.g., for hash collisions or after the file format
+ * or the BVH builder changed),
+ * - truncated or otherwise malformed entries are ignored and overwritten.
+ *
+ * Entries are written to a temporary file that is renamed once complete, so
+ * that concurrent processes never see partially written entries. Stale
+ * entries are never deleted automatically; the cache directory can be
+ * cleared at any time.
+ */
+namespace diskcache {
+
+/**
+ * @brief The directory in which entries are stored, which can be changed
+ * using the @c LW_CACHE_DIR environment variable (defaults to a subdirectory
+ * of the system's temporary directory, which is specific to the user).
+ */
+std::filesystem::path directory();
+
+/// @brief Returns a key that identifies the current version of a file, by
+/// combining its absolute path, size and modification time.
+std::string fileKey(const std::filesystem::path &path);
+
+/// @brief Returns the path of the entry for a given key.
+std::filesystem::path entryPath(const std::string &key);
+
+/**
+ * @brief Collects the sections of an entry and writes them to disk.
+ * Sections refer to the objects that were added, and store their contents at
+ * the time write() is called, so the objects must stay alive until then.
+ * Arrays that are passed as rvalue and single values are stored as they are
+ * when added instead.
+ */
+class Writer {
+    /// @brief Returns the current contents of each section.
+    std::vector<std::function<std::span<const uint8_t>()>> m_sections;
+
+public:
+    /// @brief Adds an array as next section.
+    template <typename T> void add(const std::vector<T> &data) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        m_sections.emplace_back([&data]() {
+            return std::span(reinterpret_cast<const uint8_t *>(data.data()),
+                             data.size() * sizeof(T));
+        });
+    }
+
+    /// @brief Adds a snapshot of an array as next section.
+    template <typename T> void add(std::vector<T> &&data) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        auto snapshot = std::make_shared<std::vector<T>>(std::move(data));
+        m_sections.emplace_back([snapshot]() {
+            return std::span(
+                reinterpret_cast<const uint8_t *>(snapshot->data()),
+                snapshot->size() * sizeof(T));
+        });
+    }
+
+    /// @brief Adds a single value as next section (which is always stored
+    /// as it is when added).
+    template <typename T> void add(const T &value) {
+        add(std::vector<T>{ value });
+    }
+
+    /**
+     * @brief Writes all sections as entry for the given key.
+     * @return Whether the entry was written (failures are logged, as the
+     * cache is merely an optimization).
+     */
+    bool write(const std::string &key) const {
+        return writeAt(entryPath(key), key);
+    }
+    /// @brief Writes all sections as entry for the given key to an explicit
+    /// path instead of the cache directory.
+    bool writeAt(const std::filesystem::path &path,
+                 const std::string &key) const;
+};
+
+/// @brief Maps an entry into memory and reads its sections in the order in
+/// which they were added.
+class Reader {
+    std::unique_ptr<MappedFile> m_file;
+    /// @brief The sections of the entry.
+    std::vector<std::span<const uint8_t>> m_sections;
+    /// @brief The next section to read.
+    size_t m_next = 0;
+
+    std::span<const uint8_t> next(size_t elementSize);
+
+public:
+    /**
+     * @brief Opens the entry for the given key.
+     * Check valid() afterwards, as the entry might not exist or might be
+     * invalid.
+     */
+    explicit Reader(const std::string &key) : Reader(entryPath(key), key) {}
+    /// @brief Opens the entry for the given key at an explicit path instead
+    /// of the cache directory.
+    Reader(const std::filesystem::path &path, const std::string &key);
+
+    /// @brief Whether a valid entry was found for the key.
+    bool valid() const { return m_file != nullptr; }
+
+    /// @brief Returns the next section as array, without copying it.
+    template <typename T> std::span<const T> span() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const auto bytes = next(sizeof(T));
+        return { reinterpret_cast<const T *>(bytes.data()),
+                 bytes.size() / sizeof(T) };
+    }
+
+    /// @brief Reads the next section into a vector.
+    template <typename T> void read(std::vector<T> &data) {
+        const auto elements = span<T>();
+        data.assign(elements.begin(), elements.end());
+    }
+
+    /// @brief Reads the next section as single value.
+    template <typename T> void read(T &value) {
+        const auto elements = span<T>();
+        if (elements.size() != 1)
+            lightwave_throw("malformed cache entry");
+        value = elements[0];
+    }
+};
+
+} // namespace diskcache
+
+} // namespace lightwave
@@ -64,54 +64,148 @@ inline void validateIntersection(const Intersection &its) {
 
 bool Instance::intersect(const Ray &worldRay, Intersection &its,
                          Sampler &rng) const {
+    // the closest hit found so far, which is restored if we are missed
+    const float previousT            = its.t;
+    const Instance *previousInstance = its.instance;
+    const auto previousHit           = its.hit;
+
+    Ray localRay = worldRay;
+    // distances along the local ray are scaled by the length of the
+    // transformed direction, since the world ray direction is normalized
+    float scale = 1;
+    if (m_transform) {
+        localRay = m_transform->inverse(worldRay);
+        scale    = localRay.direction.length();
+        localRay = localRay.normalized();
+        its.t *= scale;
+    }
+
+    // nested instances report themselves through its.instance, which we reset
+    // to tell their hits apart from hits of our own shape
+    its.instance  = nullptr;
+    its.hit.shape = nullptr;
+    if (!m_shape->intersect(localRay, its, rng) || !std::isfinite(its.t) ||
+        its.t < Epsilon) {
+        its.t        = previousT;
+        its.instance = previousInstance;
+        its.hit      = previousHit;
+        return false;
+    }
+
+    if (its.instance) {
+        // the surface of a nested instance needs to be computed in our local
+        // coordinates, so it cannot be deferred any further
+        its.instance->computeSurfaceInteraction(localRay, its);
+    }
+    its.instance = this;
+    validateIntersection(its);
+    its.t /= scale;
+    return true;
+}
+
+void Instance::computeSurfaceInteraction(const Ray &worldRay,
+                                         Intersection &its) const {
     if (!m_transform) {
         // fast path, if no transform is needed
-        const Ray localRay        = worldRay;
-        const bool wasIntersected = m_shape->intersect(localRay, its, rng);
-        if (wasIntersected) {
-            its.instance = this;
-            if (!std::isfinite(its.t) || its.t < Epsilon) {
-                return false;
-            }
-            validateIntersection(its);
+        if (its.hit.shape) {
+            its.hit.shape->computeSurfaceInteraction(worldRay, its);
+            its.hit.shape = nullptr;
         }
-        return wasIntersected;
+        return;
     }
 
-    const float previousT = its.t;
-    Ray localRay;
+    const Ray localRay = m_transform->inverse(worldRay);
+    if (its.hit.shape) {
+        const float worldT = its.t;
+        its.t *= localRay.direction.length();
+        its.hit.shape->computeSurfaceInteraction(localRay.normalized(), its);
+        its.hit.shape = nullptr;
+        its.t         = worldT;
+    }
+    transformFrame(its, -localRay.direction.normalized());
+}
 
-    // * transform the ray (do not forget to normalize!)
-    localRay = m_transform->inverse(worldRay).normalized();
+bool Instance::occluded(const Ray &worldRay, float tMax, Sampler &rng) const {
+    if (!m_transform) {
+        // fast path, if no transform is needed
+        return m_shape->occluded(worldRay, tMax, rng);
+    }
 
-    // hint: how does its.t need to change?
-    // currently the old intersection point is from world space, comparing it
-    // with the new intersection point in its local space will not work
-    // -> transform the old intersection point to new local space
-    if (its)
-        its.t = (localRay.origin - this->m_transform->inverse(its.position))
-                    .length();
+    // distances along the local ray scale with the length of the transformed
+    // direction, since the world ray direction is normalized
+    const Ray localRay  = m_transform->inverse(worldRay);
+    const float scale   = localRay.direction.length();
+    return m_shape->occluded(localRay.normalized(), tMax * scale, rng);
+}
 
-    // calculate hit point
-    const bool wasIntersected = m_shape->intersect(localRay, its, rng);
-    if (!wasIntersected) {
-        its.t = previousT;
-        return false;
-    }
+int Instance::intersect8(const Packet<Ray> &worldRays, int mask,
+                         Packet<Intersection> &its,
+                         const Packet<Sampler *> &rng) const {
+    // the closest hits found so far, which are restored for rays that miss
+    Packet<float> previousT;
+    Packet<const Instance *> previousInstance;
+    Packet<decltype(Intersection::hit)> previousHit;
+
+    Packet<Ray> localRays = worldRays;
+    Packet<float> scales;
+    forEachLane(mask, [&](int lane) {
+        previousT[lane]        = its[lane].t;
+        previousInstance[lane] = its[lane].instance;
+        previousHit[lane]      = its[lane].hit;
+
+        scales[lane] = 1;
+        if (m_transform) {
+            localRays[lane] = m_transform->inverse(worldRays[lane]);
+            scales[lane]    = localRays[lane].direction.length();
+            localRays[lane] = localRays[lane].normalized();
+            its[lane].t *= scales[lane];
+        }
+        its[lane].instance  = nullptr;
+        its[lane].hit.shape = nullptr;
+    });
 
-    its.instance = this;
-    if (!std::isfinite(its.t) || its.t < Epsilon) {
-        return false;
-    }
-    validateIntersection(its);
-    // -> transform the hit point to world space and get distance
-    its.position = m_transform->apply(its.position);
-    its.t        = (its.position - worldRay.origin).length();
-    its.position = m_transform->inverse(its.position);
+    const int shapeMask = m_shape->intersect8(localRays, mask, its, rng);
+
+    int hitMask = 0;
+    forEachLane(mask, [&](int lane) {
+        Intersection &laneIts = its[lane];
+        if (!(shapeMask & (1 << lane)) || !std::isfinite(laneIts.t) ||
+            laneIts.t < Epsilon) {
+            laneIts.t        = previousT[lane];
+            laneIts.instance = previousInstance[lane];
+            laneIts.hit      = previousHit[lane];
+            return;
+        }
+
+        if (laneIts.instance)
+            laneIts.instance->computeSurfaceInteraction(localRays[lane],
+                                                        laneIts);
+        laneIts.instance = this;
+        validateIntersection(laneIts);
+        laneIts.t /= scales[lane];
+        hitMask |= 1 << lane;
+    });
+    return hitMask;
+}
 
-    transformFrame(its, -localRay.direction);
+int Instance::occluded8(const Packet<Ray> &worldRays,
+                        const Packet<float> &tMax, int mask,
+                        const Packet<Sampler *> &rng) const {
+    if (!m_transform) {
+        // fast path, if no transform is needed
+        return m_shape->occluded8(worldRays, tMax, mask, rng);
+    }
 
-    return wasIntersected;
+    Packet<Ray> localRays;
+    Packet<float> localTMax;
+    localTMax.fill(Infinity);
+    forEachLane(mask, [&](int lane) {
+        const Ray localRay = m_transform->inverse(worldRays[lane]);
+        const float scale  = localRay.direction.length();
+        localRays[lane]    = localRay.normalized();
+        localTMax[lane]    = tMax[lane] * scale;
+    });
+    return m_shape->occluded8(localRays, localTMax, mask, rng);
 }
 
 Bounds Instance::getBoundingBox() const {
@@ -5,11 +5,210 @@
 #include <algorithm>
 #include <chrono>
 
+#include "diskcache.hpp"
 #include <lightwave/iterators.hpp>
 #include <lightwave/streaming.hpp>
 
 namespace lightwave {
 
+RenderOptions renderOptions;
+
+/// @brief The size of the pixel blocks whose convergence is tested when
+/// sampling adaptively.
+static constexpr int AdaptiveBlockSize = 8;
+/// @brief The luminance below which errors are no longer measured relative to
+/// the pixel value, which prevents dark pixels from being sampled forever.
+static constexpr float AdaptiveMinimumLuminance = 0.01f;
+/// @brief Increment this whenever the contents of checkpoints change.
+static constexpr int CheckpointVersion = 1;
+
+/**
+ * @brief Invokes @c f for packets of neighboring pixels of a block, along with
+ * a bit mask of the valid pixels (only the last packet can be partial).
+ */
+template <typename F>
+static void forEachPixelPacket(const Bounds2i &block, F f) {
+    Packet<Point2i> pixels;
+    int count = 0;
+    for (auto pixel : block) {
+        pixels[count++] = pixel;
+        if (count == PacketSize) {
+            f(pixels, (1 << count) - 1);
+            count = 0;
+        }
+    }
+    if (count > 0)
+        f(pixels, (1 << count) - 1);
+}
+
+/// @brief Creates one clone of the sampler per ray of a packet.
+static Packet<ref<Sampler>> cloneSamplers(const Sampler &sampler,
+                                          Packet<Sampler *> &pointers) {
+    Packet<ref<Sampler>> samplers;
+    for (int lane = 0; lane < PacketSize; lane++) {
+        samplers[lane] = sampler.clone();
+        pointers[lane] = samplers[lane].get();
+    }
+    return samplers;
+}
+
+/// @brief Running statistics of the samples of a pixel, using Welford's
+/// algorithm for the variance of the luminance.
+struct SamplingIntegrator::PixelStatistics {
+    /// @brief The sum of all samples.
+    Color sum;
+    /// @brief The mean luminance of all samples.
+    float mean = 0;
+    /// @brief The sum of squared differences from the mean luminance.
+    float m2 = 0;
+    /// @brief The number of samples taken so far.
+    int count = 0;
+
+    void add(const Color &sample) {
+        const float luminance = sample.luminance();
+        const float delta     = luminance - mean;
+        sum += sample;
+        count++;
+        mean += delta / count;
+        m2 += delta * (luminance - mean);
+    }
+
+    /// @brief The standard error of the mean, relative to the mean.
+    float relativeError() const {
+        if (count < 2)
+            return Infinity;
+        const float variance = m2 / (count - 1);
+        return sqrt(variance / count) /
+               max(abs(mean), AdaptiveMinimumLuminance);
+    }
+};
+
+float SamplingIntegrator::parseDuration(const std::string &duration) {
+    size_t end;
+    float value;
+    try {
+        value = std::stof(duration, &end);
+    } catch (const std::exception &) {
+        lightwave_throw("invalid duration \"%s\"", duration);
+    }
+
+    const std::string unit = duration.substr(end);
+    if (unit == "ms")
+        return value / 1000;
+    if (unit == "" || unit == "s")
+        return value;
+    if (unit == "m" || unit == "min")
+        return value * 60;
+    if (unit == "h")
+        return value * 3600;
+    lightwave_throw("invalid duration \"%s\", expected a unit of ms, s, m or h",
+                    duration);
+}
+
+bool SamplingIntegrator::restoreCheckpoint(
+    const std::filesystem::path &path, const std::string &key,
+    std::vector<PixelStatistics> &pixels, int &passes) {
+    diskcache::Reader checkpoint{ path, key };
+    if (!checkpoint.valid())
+        return false;
+
+    try {
+        const auto restored = checkpoint.span<PixelStatistics>();
+        if (restored.size() != pixels.size())
+            lightwave_throw("checkpoint does not match the image resolution");
+        std::copy(restored.begin(), restored.end(), pixels.begin());
+        checkpoint.read(passes);
+    } catch (const std::exception &e) {
+        logger(EWarn, "ignoring checkpoint %s: %s", path, e.what());
+        std::fill(pixels.begin(), pixels.end(), PixelStatistics());
+        passes = 0;
+        return false;
+    }
+
+    logger(EInfo, "resuming from checkpoint %s after %d passes", path, passes);
+    return true;
+}
+
+ResampledLightSample
+SamplingIntegrator::sampleLightResampled(const Intersection &its,
+                                         int candidates, Sampler &rng) const {
+    ResampledLightSample result = ResampledLightSample::invalid();
+    // the resampling weight of the selected candidate and of all candidates
+    float selectedWeight = 0;
+    float totalWeight    = 0;
+    for (int candidate = 0; candidate < candidates; candidate++) {
+        const LightSample light = m_scene->sampleLight(its.position, rng);
+        if (light.isInvalid() || !(light.probability > 0))
+            continue;
+        const DirectLightSample sample =
+            light.light->sampleDirect(its.position, rng);
+        const BsdfEval bsdf = its.evaluateBsdf(sample.wi);
+
+        // the weight is the ratio of the unshadowed contribution (the target
+        // function) and the density the candidate was drawn with
+        const Color contribution =
+            sample.weight * bsdf.value / light.probability;
+        const float weight = contribution.luminance();
+        if (!(weight > 0))
+            continue;
+
+        // candidates replace the selection with a probability proportional
+        // to their weight (no random number is needed for the first one)
+        totalWeight += weight;
+        if (totalWeight == weight || rng.next() * totalWeight < weight) {
+            result = {
+                .sample       = sample,
+                .pdf          = light.probability * sample.pdf,
+                .bsdf         = bsdf,
+                .contribution = contribution,
+            };
+            selectedWeight = weight;
+        }
+    }
+
+    if (result)
+        result.contribution *= totalWeight / (candidates * selectedWeight);
+    return result;
+}
+
+Color SamplingIntegrator::samplePixel(const Point2i &pixel, int sampleIndex,
+                                      Sampler &sampler) {
+    sampler.seed(pixel, sampleIndex);
+    auto cameraSample = m_scene->camera()->sample(pixel, sampler);
+    return cameraSample.weight * Li(cameraSample.ray, sampler);
+}
+
+void SamplingIntegrator::samplePixels(const Packet<Point2i> &pixels,
+                                      const Packet<int> &sampleIndices,
+                                      int mask,
+                                      const Packet<Sampler *> &samplers,
+                                      Packet<Color> &results) {
+    if (!tracesCameraPackets()) {
+        forEachLane(mask, [&](int lane) {
+            results[lane] =
+                samplePixel(pixels[lane], sampleIndices[lane], *samplers[lane]);
+        });
+        return;
+    }
+
+    Packet<Ray> rays;
+    Packet<Color> weights;
+    forEachLane(mask, [&](int lane) {
+        samplers[lane]->seed(pixels[lane], sampleIndices[lane]);
+        const auto cameraSample =
+            m_scene->camera()->sample(pixels[lane], *samplers[lane]);
+        rays[lane]    = cameraSample.ray;
+        weights[lane] = cameraSample.weight;
+    });
+
+    Packet<Intersection> hits;
+    m_scene->intersect8(rays, mask, hits, samplers);
+    forEachLane(mask, [&](int lane) {
+        results[lane] =
+            weights[lane] * Li(rays[lane], hits[lane], *samplers[lane]);
+    });
+}
+
 void SamplingIntegrator::execute() {
     if (!m_image) {
         lightwave_throw(
@@ -19,22 +218,34 @@ void SamplingIntegrator::execute() {
     const Vector2i resolution = m_scene->camera()->resolution();
     m_image->initialize(resolution);
 
+    if (rendersInPasses()) {
+        renderPasses();
+        m_image->save();
+        return;
+    }
+
     const float norm = 1.0f / m_sampler->samplesPerPixel();
 
     Streaming stream{ *m_image };
     ProgressReporter progress{ resolution.product() };
-    for_each_parallel(BlockSpiral(resolution, Vector2i(64)), [&](auto block) {
-        auto sampler = m_sampler->clone();
-        for (auto pixel : block) {
-            Color sum;
+    forEachBlock(resolution, [&](const Bounds2i &block) {
+        Packet<Sampler *> samplers;
+        const auto clones = cloneSamplers(*m_sampler, samplers);
+        forEachPixelPacket(block, [&](const Packet<Point2i> &pixels, int mask) {
+            Packet<Color> sums = {};
+            Packet<Color> results;
+            Packet<int> sampleIndices;
             for (int sample = 0; sample < m_sampler->samplesPerPixel();
                  sample++) {
-                sampler->seed(pixel, sample);
-                auto cameraSample = m_scene->camera()->sample(pixel, *sampler);
-                sum += cameraSample.weight * Li(cameraSample.ray, *sampler);
+                sampleIndices.fill(sample);
+                samplePixels(pixels, sampleIndices, mask, samplers, results);
+                forEachLane(mask,
+                            [&](int lane) { sums[lane] += results[lane]; });
             }
-            m_image->get(pixel) = norm * sum;
-        }
+            forEachLane(mask, [&](int lane) {
+                m_image->get(pixels[lane]) = norm * sums[lane];
+            });
+        });
 
         progress += block.diagonal().product();
         stream.updateBlock(block);
@@ -44,4 +255,266 @@ void SamplingIntegrator::execute() {
     m_image->save();
 }
 
+void SamplingIntegrator::renderPasses() {
+    const Vector2i resolution = Vector2i(m_image->resolution());
+    const int64_t pixelCount  = resolution.product();
+    const int samplesPerPixel = m_sampler->samplesPerPixel();
+    const bool isAdaptive     = m_adaptiveThreshold > 0;
+    const int passSamples =
+        isAdaptive ? min(m_adaptiveMinSamples, samplesPerPixel) : 1;
+    const int maxSamples =
+        isAdaptive ? max(m_adaptiveMaxSamples, samplesPerPixel)
+                   : samplesPerPixel;
+
+    const Vector2i blockCount =
+        (resolution + Vector2i(AdaptiveBlockSize - 1)) / AdaptiveBlockSize;
+    const auto blockIndex = [&](const Point2i &pixel) {
+        return pixel.y() / AdaptiveBlockSize * blockCount.x() +
+               pixel.x() / AdaptiveBlockSize;
+    };
+    const auto blockBounds = [&](int index) {
+        const Point2i min(index % blockCount.x() * AdaptiveBlockSize,
+                          index / blockCount.x() * AdaptiveBlockSize);
+        return Bounds2i(Point2i(0), Point2i(resolution))
+            .clip(Bounds2i(min, min + Vector2i(AdaptiveBlockSize)));
+    };
+
+    std::vector<PixelStatistics> pixels(pixelCount);
+    // the number of samples each block receives in the current pass
+    std::vector<int> blockSamples(blockCount.product(), passSamples);
+    std::vector<int> blockSampleCounts(blockCount.product(), 0);
+    std::vector<float> blockErrors(blockCount.product());
+
+    // the budget is that of uniform sampling, which converged blocks leave to
+    // the noisiest ones
+    const int64_t budget = pixelCount * samplesPerPixel;
+    int64_t spent        = pixelCount * passSamples;
+    int passes           = 0;
+
+    const bool isCheckpointing =
+        m_checkpointInterval > 0 || renderOptions.resume;
+    const auto checkpointPath =
+        m_image->basePath() / (m_image->id() + ".checkpoint");
+    // sample counts are not part of the key, so that renders can be resumed
+    // with more samples
+    const std::string checkpointKey =
+        tfm::format("checkpoint v%d|%s|%dx%d",
+                    CheckpointVersion,
+                    renderOptions.sceneKey,
+                    resolution.x(),
+                    resolution.y());
+    const auto writeCheckpoint = [&]() {
+        diskcache::Writer checkpoint;
+        checkpoint.add(pixels);
+        checkpoint.add(passes);
+        if (checkpoint.writeAt(checkpointPath, checkpointKey))
+            logger(EInfo, "wrote checkpoint %s", checkpointPath);
+    };
+
+    bool hasWork = true;
+    if (renderOptions.resume) {
+        if (restoreCheckpoint(checkpointPath, checkpointKey, pixels, passes)) {
+            // the state of the schedule follows from the sample counts, as
+            // all pixels of a block always receive the same samples
+            spent = 0;
+            for (int index = 0; index < blockCount.product(); index++) {
+                blockSamples[index] = 0;
+                blockSampleCounts[index] =
+                    pixels[blockBounds(index).min().y() * resolution.x() +
+                           blockBounds(index).min().x()]
+                        .count;
+            }
+            for (auto pixel : m_image->bounds()) {
+                const auto &statistics =
+                    pixels[pixel.y() * resolution.x() + pixel.x()];
+                spent += statistics.count;
+                if (statistics.count > 0)
+                    m_image->get(pixel) = statistics.sum / statistics.count;
+            }
+            hasWork = false;
+        } else {
+            logger(EWarn,
+                   "no checkpoint of this scene found at %s, starting over",
+                   checkpointPath);
+        }
+    }
+
+    // estimates the error of each block, and selects the noisiest blocks for
+    // the next pass as long as the budget allows
+    bool hasErrors          = false;
+    const auto selectBlocks = [&]() {
+        std::vector<int> candidates;
+        for (int index = 0; index < blockCount.product(); index++) {
+            const bool wasSampled = blockSamples[index] > 0;
+            blockSampleCounts[index] += blockSamples[index];
+            blockSamples[index] = 0;
+
+            if (blockSampleCounts[index] + passSamples > maxSamples)
+                continue;
+            if (isAdaptive) {
+                // the error only changes for blocks sampled in the last pass
+                // (all blocks need it once after resuming a checkpoint)
+                if (wasSampled || !hasErrors) {
+                    float error       = 0;
+                    const auto bounds = blockBounds(index);
+                    for (auto pixel : bounds)
+                        error +=
+                            pixels[pixel.y() * resolution.x() + pixel.x()]
+                                .relativeError();
+                    blockErrors[index] = error / bounds.diagonal().product();
+                }
+                if (blockErrors[index] <= m_adaptiveThreshold)
+                    continue;
+            }
+            candidates.push_back(index);
+        }
+        hasErrors = true;
+        std::stable_sort(candidates.begin(),
+                         candidates.end(),
+                         [&](int a, int b) {
+                             return blockErrors[a] > blockErrors[b];
+                         });
+
+        bool hasWork = false;
+        for (const int index : candidates) {
+            const int64_t cost =
+                int64_t(blockBounds(index).diagonal().product()) * passSamples;
+            if (spent + cost > budget)
+                continue;
+            spent += cost;
+            blockSamples[index] = passSamples;
+            hasWork             = true;
+        }
+        return hasWork;
+    };
+    if (!hasWork)
+        hasWork = selectBlocks();
+
+    // the image always holds the mean of the samples taken so far, which is
+    // sent to tev periodically
+    Streaming stream{ *m_image };
+    stream.startRegularUpdates();
+
+    // progress is measured in per mille of the sample or time budget,
+    // whichever is closer to being used up
+    constexpr int ProgressUnits = 1000;
+    ProgressReporter progress{ ProgressUnits };
+    int reportedProgress = 0;
+
+    const Timer timer;
+    float passStartTime  = 0;
+    float checkpointTime = 0;
+    while (hasWork) {
+        forEachBlock(resolution, [&](const Bounds2i &block) {
+            Packet<Sampler *> samplers;
+            const auto clones = cloneSamplers(*m_sampler, samplers);
+            forEachPixelPacket(block, [&](const Packet<Point2i> &packet,
+                                          int mask) {
+                Packet<PixelStatistics *> statistics;
+                Packet<int> samples;
+                forEachLane(mask, [&](int lane) {
+                    const Point2i &pixel = packet[lane];
+                    statistics[lane] =
+                        &pixels[pixel.y() * resolution.x() + pixel.x()];
+                    samples[lane] = blockSamples[blockIndex(pixel)];
+                });
+
+                // pixels of different blocks can receive different numbers
+                // of samples
+                Packet<Color> results;
+                Packet<int> sampleIndices;
+                for (int i = 0;; i++) {
+                    int active = 0;
+                    forEachLane(mask, [&](int lane) {
+                        if (i < samples[lane])
+                            active |= 1 << lane;
+                        sampleIndices[lane] = statistics[lane]->count;
+                    });
+                    if (!active)
+                        break;
+                    samplePixels(
+                        packet, sampleIndices, active, samplers, results);
+                    forEachLane(active, [&](int lane) {
+                        statistics[lane]->add(results[lane]);
+                    });
+                }
+
+                forEachLane(mask, [&](int lane) {
+                    if (samples[lane] > 0)
+                        m_image->get(packet[lane]) =
+                            statistics[lane]->sum / statistics[lane]->count;
+                });
+            });
+        });
+        passes++;
+
+        const float elapsedTime = timer.getElapsedTime();
+        const float passTime    = elapsedTime - passStartTime;
+        passStartTime           = elapsedTime;
+
+        float fraction = spent / float(budget);
+        if (m_timeBudget > 0)
+            fraction = max(fraction, elapsedTime / m_timeBudget);
+        const int currentProgress =
+            min(int(fraction * ProgressUnits), ProgressUnits);
+        progress += currentProgress - reportedProgress;
+        reportedProgress = currentProgress;
+
+        if (m_checkpointInterval > 0 &&
+            elapsedTime - checkpointTime >= m_checkpointInterval) {
+            writeCheckpoint();
+            checkpointTime = elapsedTime;
+        }
+
+        // only start passes that are expected to finish within the time
+        // budget (assuming that they take as long as the last one)
+        if (m_timeBudget > 0 && elapsedTime + passTime > m_timeBudget)
+            break;
+
+        hasWork = selectBlocks();
+    }
+    progress += ProgressUnits - reportedProgress;
+    progress.finish();
+    stream.stopRegularUpdates();
+    stream.update();
+    if (isCheckpointing) {
+        // allows resuming with more samples later on
+        writeCheckpoint();
+    }
+
+    if (isAdaptive) {
+        int converged = 0;
+        for (int index = 0; index < blockCount.product(); index++) {
+            if (blockErrors[index] <= m_adaptiveThreshold)
+                converged++;
+        }
+        logger(EInfo,
+               "adaptive sampling took %.1f samples per pixel on average "
+               "(%.0f%% of the budget) in %d passes, %d of %d blocks "
+               "converged",
+               spent / float(pixelCount),
+               100.f * spent / float(budget),
+               passes,
+               converged,
+               blockCount.product());
+    } else {
+        logger(EInfo,
+               "rendered %d passes (%d samples per pixel) in %.1f seconds",
+               passes,
+               int(spent / pixelCount),
+               timer.getElapsedTime());
+    }
+
+    if (m_saveSampleCounts) {
+        Image sampleCounts{ m_image->resolution() };
+        sampleCounts.setId(m_image->id() + "_samples");
+        sampleCounts.setBasePath(m_image->basePath());
+        for (auto pixel : m_image->bounds())
+            sampleCounts(pixel) =
+                Color(float(pixels[pixel.y() * resolution.x() + pixel.x()]
+                                .count));
+        sampleCounts.save();
+    }
+}
+
 } // namespace lightwave
@@ -0,0 +1,36 @@
+#include <lightwave/light.hpp>
+#include <lightwave/sampler.hpp>
+#include <lightwave/warp.hpp>
+
+namespace lightwave {
+
+EmissionSample Light::emitFromDisk(const DirectLightSample &sample,
+                                   const Bounds &sceneBounds, Sampler &rng) {
+    if (sample.isInvalid())
+        return EmissionSample::invalid();
+
+    // the disk is placed on the sphere around the scene, and covers the
+    // projection of that sphere along the direction
+    const float radius   = sceneBounds.diagonal().length() / 2;
+    const Point center   = sceneBounds.min() + sceneBounds.diagonal() / 2;
+    const Frame frame(-sample.wi);
+    const Point2 offset = squareToUniformDiskConcentric(rng.next2D());
+
+    EmissionSample result;
+    result.origin.position = center + radius * sample.wi +
+                             radius * offset.x() * frame.tangent +
+                             radius * offset.y() * frame.bitangent;
+    result.direction = -sample.wi;
+    result.weight    = sample.weight / diskPdf(sceneBounds);
+    // directions of lights that only emit into a single direction are
+    // certain
+    result.pdf = { .position  = diskPdf(sceneBounds),
+                   .direction = std::isinf(sample.pdf) ? 1 : sample.pdf };
+    return result;
+}
+
+float Light::diskPdf(const Bounds &sceneBounds) {
+    return 1 / (Pi * sqr(sceneBounds.diagonal().length() / 2));
+}
+
+} // namespace lightwave
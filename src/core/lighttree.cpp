@@ -0,0 +1,276 @@
+#include "lighttree.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace lightwave {
+
+/// @brief The number of bins used to find the best split of a node.
+static constexpr int LightTreeBins = 12;
+
+/// @brief Returns the bounds covering the lights of both given bounds.
+static LightBounds merge(const LightBounds &a, const LightBounds &b) {
+    LightBounds result;
+    result.bounds = a.bounds;
+    result.bounds.extend(b.bounds);
+    result.intensity        = a.intensity + b.intensity;
+    result.cosThetaEmission = min(a.cosThetaEmission, b.cosThetaEmission);
+
+    // the smallest cone containing both cones of normals
+    const float thetaA = safe_acos(a.cosThetaNormals);
+    const float thetaB = safe_acos(b.cosThetaNormals);
+    const float thetaD = safe_acos(a.axis.dot(b.axis));
+    if (min(thetaD + thetaB, Pi) <= thetaA) {
+        result.axis            = a.axis;
+        result.cosThetaNormals = a.cosThetaNormals;
+        return result;
+    }
+    if (min(thetaD + thetaA, Pi) <= thetaB) {
+        result.axis            = b.axis;
+        result.cosThetaNormals = b.cosThetaNormals;
+        return result;
+    }
+
+    const float thetaO = (thetaA + thetaD + thetaB) / 2;
+    const Vector rotationAxis = a.axis.cross(b.axis);
+    if (thetaO >= Pi || rotationAxis.lengthSquared() == 0) {
+        result.axis            = a.axis;
+        result.cosThetaNormals = -1;
+        return result;
+    }
+    // rotates the axis of a towards the axis of b
+    const float thetaR = thetaO - thetaA;
+    const Vector towardsB = rotationAxis.normalized().cross(a.axis);
+    result.axis =
+        (a.axis * cos(thetaR) + towardsB * sin(thetaR)).normalized();
+    result.cosThetaNormals = cos(thetaO);
+    return result;
+}
+
+/// @brief The cosine of the difference of two angles in [0,pi], clamped to one
+/// if the difference is negative.
+static float cosSubClamped(float sinA, float cosA, float sinB, float cosB) {
+    return cosA > cosB ? 1 : cosA * cosB + sinA * sinB;
+}
+
+/// @brief The sine of the difference of two angles in [0,pi], clamped to zero
+/// if the difference is negative.
+static float sinSubClamped(float sinA, float cosA, float sinB, float cosB) {
+    return cosA > cosB ? 0 : sinA * cosB - cosA * sinB;
+}
+
+/**
+ * @brief Estimates how much the lights within the bounds contribute to a
+ * point, by conservatively bounding the angle between the cone of normals and
+ * the direction towards the point.
+ */
+static float importance(const LightBounds &lights, const Point &origin) {
+    const Vector offset         = origin - lights.bounds.center();
+    const float distanceSquared = offset.lengthSquared();
+    const float radius          = lights.bounds.diagonal().length() / 2;
+    const Vector toOrigin =
+        distanceSquared > 0 ? offset / sqrt(distanceSquared) : Vector(0);
+
+    // the angle that the bounding sphere subtends from the point
+    float cosThetaB = -1;
+    if (distanceSquared > sqr(radius))
+        cosThetaB = safe_sqrt(1 - sqr(radius) / distanceSquared);
+    const float sinThetaB = safe_sqrt(1 - sqr(cosThetaB));
+
+    const float cosThetaW = lights.axis.dot(toOrigin);
+    const float sinThetaW = safe_sqrt(1 - sqr(cosThetaW));
+    const float sinThetaO = safe_sqrt(1 - sqr(lights.cosThetaNormals));
+
+    // the smallest angle between a normal of the cone and the direction
+    // from any point of the bounds towards the point
+    const float cosThetaX = cosSubClamped(
+        sinThetaW, cosThetaW, sinThetaO, lights.cosThetaNormals);
+    const float sinThetaX = sinSubClamped(
+        sinThetaW, cosThetaW, sinThetaO, lights.cosThetaNormals);
+    const float cosThetaP =
+        cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+    if (cosThetaP <= lights.cosThetaEmission)
+        return 0;
+
+    // points close to the center would otherwise receive an excessive
+    // importance (the clamp follows pbrt, clamping to the squared radius
+    // instead makes large nodes indistinguishable)
+    return lights.intensity * cosThetaP /
+           max(distanceSquared, max(radius, Epsilon));
+}
+
+/// @brief The cost of a node, given by its intensity, the solid angle its
+/// emission can cover, and its surface area relative to its extent along the
+/// split axis.
+static float cost(const LightBounds &lights, const Bounds &parent, int axis) {
+    const float thetaO    = safe_acos(lights.cosThetaNormals);
+    const float thetaE    = safe_acos(lights.cosThetaEmission);
+    const float thetaW    = min(thetaO + thetaE, Pi);
+    const float sinThetaO = safe_sqrt(1 - sqr(lights.cosThetaNormals));
+    const float solidAngle =
+        2 * Pi * (1 - lights.cosThetaNormals) +
+        Pi / 2 *
+            (2 * thetaW * sinThetaO - cos(thetaO - 2 * thetaW) -
+             2 * thetaO * sinThetaO + lights.cosThetaNormals);
+
+    const Vector size = lights.bounds.diagonal();
+    const float area =
+        2 * (size.x() * size.y() + size.x() * size.z() + size.y() * size.z());
+    const Vector parentSize = parent.diagonal();
+    const float aspect      = parentSize.maxComponent() / parentSize[axis];
+    return lights.intensity * solidAngle * aspect * area;
+}
+
+LightTree::LightTree(const std::vector<std::optional<LightBounds>> &lights)
+    : m_leaves(lights.size(), -1) {
+    std::vector<Entry> entries;
+    for (int light = 0; light < int(lights.size()); light++) {
+        if (lights[light] && lights[light]->intensity > 0)
+            entries.push_back({ light, *lights[light] });
+    }
+    if (!entries.empty())
+        build(entries, -1);
+}
+
+int LightTree::build(std::span<Entry> lights, int parent) {
+    const int index = int(m_nodes.size());
+    m_nodes.emplace_back();
+    m_nodes[index].parent = parent;
+
+    if (lights.size() == 1) {
+        m_nodes[index].bounds = lights[0].bounds;
+        m_nodes[index].index  = lights[0].light;
+        m_nodes[index].isLeaf = true;
+        m_leaves[lights[0].light] = index;
+        return index;
+    }
+
+    LightBounds bounds = lights[0].bounds;
+    Bounds centroids;
+    for (const auto &entry : lights) {
+        if (&entry != &lights[0])
+            bounds = merge(bounds, entry.bounds);
+        centroids.extend(entry.bounds.bounds.center());
+    }
+
+    // find the split with the lowest cost among the bins of all axes
+    float bestCost = Infinity;
+    int bestAxis = -1, bestBin = -1;
+    const auto binOf = [&](const Entry &entry, int axis) {
+        const float offset =
+            (entry.bounds.bounds.center()[axis] - centroids.min()[axis]) /
+            centroids.diagonal()[axis];
+        return min(int(offset * LightTreeBins), LightTreeBins - 1);
+    };
+    for (int axis = 0; axis < 3; axis++) {
+        if (!(centroids.diagonal()[axis] > 0))
+            continue;
+
+        std::array<std::optional<LightBounds>, LightTreeBins> bins;
+        for (const auto &entry : lights) {
+            auto &bin = bins[binOf(entry, axis)];
+            bin = bin ? merge(*bin, entry.bounds) : entry.bounds;
+        }
+
+        // bounds of all bins right of each split
+        std::array<std::optional<LightBounds>, LightTreeBins> right;
+        for (int bin = LightTreeBins - 1; bin > 0; bin--) {
+            if (bin + 1 < LightTreeBins)
+                right[bin] = right[bin + 1];
+            if (bins[bin])
+                right[bin] = right[bin] ? merge(*right[bin], *bins[bin])
+                                        : *bins[bin];
+        }
+
+        std::optional<LightBounds> left;
+        for (int bin = 0; bin < LightTreeBins - 1; bin++) {
+            if (bins[bin])
+                left = left ? merge(*left, *bins[bin]) : *bins[bin];
+            if (!left || !right[bin + 1])
+                continue;
+            const float splitCost = cost(*left, bounds.bounds, axis) +
+                                    cost(*right[bin + 1], bounds.bounds, axis);
+            if (splitCost < bestCost) {
+                bestCost = splitCost;
+                bestAxis = axis;
+                bestBin  = bin;
+            }
+        }
+    }
+
+    size_t middle = lights.size() / 2;
+    if (bestAxis >= 0) {
+        middle = std::partition(lights.begin(),
+                                lights.end(),
+                                [&](const Entry &entry) {
+                                    return binOf(entry, bestAxis) <= bestBin;
+                                }) -
+                 lights.begin();
+    }
+
+    m_nodes[index].bounds = bounds;
+    m_nodes[index].isLeaf = false;
+    build(lights.subspan(0, middle), index);
+    const int second     = build(lights.subspan(middle), index);
+    m_nodes[index].index = second;
+    return index;
+}
+
+LightTree::Sample LightTree::sample(const Point &origin, float u) const {
+    if (m_nodes.empty() || importance(m_nodes[0].bounds, origin) == 0)
+        return { .light = -1, .probability = 0 };
+
+    u                 = min(u, OneMinusEpsilon);
+    int node          = 0;
+    float probability = 1;
+    while (!m_nodes[node].isLeaf) {
+        const int first  = node + 1;
+        const int second = m_nodes[node].index;
+        const float importanceFirst =
+            importance(m_nodes[first].bounds, origin);
+        const float importanceSecond =
+            importance(m_nodes[second].bounds, origin);
+        const float total = importanceFirst + importanceSecond;
+        if (total == 0)
+            return { .light = -1, .probability = 0 };
+
+        // the random number is rescaled to be reused for the next decision
+        const float firstProbability = importanceFirst / total;
+        if (u < firstProbability) {
+            node = first;
+            u    = min(u / firstProbability, OneMinusEpsilon);
+            probability *= firstProbability;
+        } else {
+            node = second;
+            u    = min((u - firstProbability) / (1 - firstProbability),
+                    OneMinusEpsilon);
+            probability *= importanceSecond / total;
+        }
+    }
+    return { .light = m_nodes[node].index, .probability = probability };
+}
+
+float LightTree::probability(const Point &origin, int light) const {
+    int node = m_leaves[light];
+    if (node < 0 || importance(m_nodes[0].bounds, origin) == 0)
+        return 0;
+
+    // the same probabilities as during sampling, but from the leaf upwards
+    float probability = 1;
+    while (m_nodes[node].parent >= 0) {
+        const int parent = m_nodes[node].parent;
+        const float importanceFirst =
+            importance(m_nodes[parent + 1].bounds, origin);
+        const float importanceSecond =
+            importance(m_nodes[m_nodes[parent].index].bounds, origin);
+        const float own =
+            node == parent + 1 ? importanceFirst : importanceSecond;
+        if (own == 0)
+            return 0;
+        probability *= own / (importanceFirst + importanceSecond);
+        node = parent;
+    }
+    return probability;
+}
+
+} // namespace lightwave
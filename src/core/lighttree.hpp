@@ -0,0 +1,84 @@
+#pragma once
+
+#include <lightwave/light.hpp>
+
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace lightwave {
+
+/**
+ * @brief A bounding volume hierarchy over the bounds of lights, which picks
+ * lights proportional to an estimate of how much they contribute to a given
+ * point (based on distance, orientation and intensity).
+ *
+ * Picking a light descends the tree from the root, choosing each child with a
+ * probability proportional to its importance for the point. The probability
+ * of a light is the product of these probabilities along its path, which can
+ * be queried by walking from its leaf back up to the root.
+ *
+ * The tree is built top-down by binning the centroids of the lights and
+ * choosing the split with the lowest cost, which accounts for both the extent
+ * and the spread of directions of the children (the "surface area orientation
+ * heuristic" of Conty Estevez and Kulla, 2018).
+ */
+class LightTree {
+public:
+    /// @brief A light picked by the tree.
+    struct Sample {
+        /// @brief The index of the light, or -1 if no light can contribute.
+        int light;
+        /// @brief The probability of having picked the light.
+        float probability;
+    };
+
+    /**
+     * @brief Builds the tree over the bounds of lights.
+     * @param lights The bounds of each light, where lights are identified by
+     * their index in this array. Lights without bounds or without emission are
+     * not part of the tree.
+     */
+    explicit LightTree(const std::vector<std::optional<LightBounds>> &lights);
+
+    /// @brief Whether the tree contains no lights at all.
+    bool empty() const { return m_nodes.empty(); }
+
+    /// @brief Picks a light for the given point, using a single uniformly
+    /// distributed random number in [0,1).
+    Sample sample(const Point &origin, float u) const;
+    /// @brief Returns the probability of picking the given light for the given
+    /// point.
+    float probability(const Point &origin, int light) const;
+
+private:
+    struct Node {
+        /// @brief The bounds of all lights within this subtree.
+        LightBounds bounds;
+        /// @brief The index of the parent node (-1 for the root).
+        int parent;
+        /// @brief For inner nodes, the index of the second child (the first
+        /// child directly follows its parent). For leaves, the index of the
+        /// light.
+        int index;
+        bool isLeaf;
+    };
+
+    /// @brief A light that still needs to be placed in the tree.
+    struct Entry {
+        int light;
+        LightBounds bounds;
+    };
+
+    /// @brief The nodes in depth-first order, starting with the root.
+    std::vector<Node> m_nodes;
+    /// @brief The index of the leaf of each light (-1 for lights that are not
+    /// part of the tree).
+    std::vector<int> m_leaves;
+
+    /// @brief Builds the subtree for the given lights, returning the index of
+    /// its root node.
+    int build(std::span<Entry> lights, int parent);
+};
+
+} // namespace lightwave
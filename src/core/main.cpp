@@ -1,4 +1,6 @@
 #include <lightwave/core.hpp>
+#include <lightwave/hash.hpp>
+#include <lightwave/integrator.hpp>
 #include <lightwave/logger.hpp>
 #include <lightwave/registry.hpp>
 #include <catch_amalgamated.hpp>
@@ -6,6 +8,8 @@
 #include "parser.hpp"
 
 #include <fstream>
+#include <regex>
+#include <sstream>
 
 #ifdef LW_OS_WINDOWS
 #include <cstdlib>
@@ -28,6 +32,56 @@ int runUnitTests(int argc, const char *argv[]) {
     return Catch::Session().run( argc, argv );
 }
 
+/**
+ * @brief Feeds a scene description file into the scene key, except for the
+ * sample counts of samplers, so that checkpoints can be resumed with more
+ * samples. Included files are hashed in the same way, all other referenced
+ * files (meshes, textures, environment maps) by their size and modification
+ * time.
+ */
+void hashSceneFile(hash::fnv1a &hash, const std::filesystem::path &path) {
+    // missing files are reported by the parser
+    std::ifstream file{ path, std::ios::binary };
+    if (!file)
+        return;
+    std::stringstream contents;
+    contents << file.rdbuf();
+
+    static const std::regex sampleCount(
+        R"((<sampler\b[^>]*?)\s+count="[^"]*")");
+    for (const char c : std::regex_replace(contents.str(), sampleCount, "$1"))
+        hash << c;
+
+    static const std::regex filename(R"re(\bfilename="([^"]*)")re");
+    const std::string text = contents.str();
+    for (auto match = std::sregex_iterator(text.begin(), text.end(), filename);
+         match != std::sregex_iterator(); ++match) {
+        const auto asset = path.parent_path() / (*match)[1].str();
+        if (asset.extension() == ".xml") {
+            hashSceneFile(hash, asset);
+            continue;
+        }
+
+        std::error_code error;
+        const auto size     = std::filesystem::file_size(asset, error);
+        const auto modified = std::filesystem::last_write_time(asset, error);
+        if (error)
+            continue;
+        hash << uint64_t(size)
+             << int64_t(modified.time_since_epoch().count());
+    }
+}
+
+/**
+ * @brief Identifies a scene by its description and the files it references,
+ * so that checkpoints of changed scenes are not resumed from.
+ */
+std::string sceneKey(const std::filesystem::path &path) {
+    hash::fnv1a hash;
+    hashSceneFile(hash, path);
+    return tfm::format("%016x", uint64_t(hash));
+}
+
 int main(int argc, const char *argv[]) {
 #ifdef LW_DEBUG
     logger(EWarn, "lightwave was compiled in Debug mode, expect rendering to "
@@ -57,6 +111,15 @@ int main(int argc, const char *argv[]) {
         }
 
         std::filesystem::path scenePath = argv[1];
+        for (int i = 2; i < argc; i++) {
+            const std::string option = argv[i];
+            if (option == "--resume") {
+                renderOptions.resume = true;
+            } else if (option.starts_with("--")) {
+                lightwave_throw("unknown option \"%s\"", argv[i]);
+            }
+        }
+        renderOptions.sceneKey = sceneKey(scenePath);
 
         SceneParser parser{ scenePath };
         for (auto &object : parser.objects()) {
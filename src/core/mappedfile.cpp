@@ -0,0 +1,93 @@
+#include "mappedfile.hpp"
+#include <lightwave/logger.hpp>
+
+#ifdef LW_OS_WINDOWS
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace lightwave {
+
+#ifdef LW_OS_WINDOWS
+
+MappedFile::MappedFile(const std::filesystem::path &path) {
+    m_file = CreateFileW(path.c_str(),
+                         GENERIC_READ,
+                         FILE_SHARE_READ,
+                         nullptr,
+                         OPEN_EXISTING,
+                         FILE_ATTRIBUTE_NORMAL,
+                         nullptr);
+    if (m_file == INVALID_HANDLE_VALUE) {
+        m_file = nullptr;
+        lightwave_throw("could not open %s", path);
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size)) {
+        CloseHandle(m_file);
+        lightwave_throw("could not determine the size of %s", path);
+    }
+    m_size = size_t(size.QuadPart);
+    if (m_size == 0)
+        return; // empty files cannot be mapped
+
+    m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping)
+        m_data = static_cast<const uint8_t *>(
+            MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!m_data) {
+        if (m_mapping)
+            CloseHandle(m_mapping);
+        CloseHandle(m_file);
+        lightwave_throw("could not map %s", path);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    if (m_mapping)
+        CloseHandle(m_mapping);
+    if (m_file)
+        CloseHandle(m_file);
+}
+
+#else
+
+MappedFile::MappedFile(const std::filesystem::path &path) {
+    const int file = open(path.c_str(), O_RDONLY);
+    if (file < 0)
+        lightwave_throw("could not open %s", path);
+
+    struct stat info;
+    if (fstat(file, &info) != 0) {
+        close(file);
+        lightwave_throw("could not determine the size of %s", path);
+    }
+    m_size = size_t(info.st_size);
+    if (m_size == 0) {
+        close(file);
+        return; // empty files cannot be mapped
+    }
+
+    void *data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, file, 0);
+    // the mapping stays valid after the file descriptor has been closed
+    close(file);
+    if (data == MAP_FAILED)
+        lightwave_throw("could not map %s", path);
+    m_data = static_cast<const uint8_t *>(data);
+}
+
+MappedFile::~MappedFile() {
+    if (m_data)
+        munmap(const_cast<uint8_t *>(m_data), m_size);
+}
+
+#endif
+
+} // namespace lightwave
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <lightwave/core.hpp>
+
+#include <filesystem>
+
+namespace lightwave {
+
+/**
+ * @brief A read-only memory mapping of an entire file.
+ * The operating system pages the contents in on demand, so large files can
+ * be accessed without copying them into memory first.
+ */
+class MappedFile {
+    /// @brief The start of the mapping, or nullptr for empty files.
+    const uint8_t *m_data = nullptr;
+    /// @brief The size of the file in bytes.
+    size_t m_size = 0;
+#ifdef LW_OS_WINDOWS
+    /// @brief The handles of the file and of the mapping object.
+    void *m_file = nullptr, *m_mapping = nullptr;
+#endif
+
+public:
+    /// @brief Maps the given file, throwing an exception if that fails.
+    explicit MappedFile(const std::filesystem::path &path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &)            = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    /// @brief The contents of the file.
+    const uint8_t *data() const { return m_data; }
+    /// @brief The size of the file in bytes.
+    size_t size() const { return m_size; }
+};
+
+} // namespace lightwave
@@ -202,6 +202,15 @@ BsdfEval Intersection::evaluateBsdf(const Vector &wi) const {
         uv, shadingFrame().toLocal(wo), shadingFrame().toLocal(wi));
 }
 
+float Intersection::pdfBsdf(const Vector &wo, const Vector &wi) const {
+    PROFILE("Evaluate Bsdf")
+
+    if (!instance || !instance->bsdf())
+        return 0;
+    const Frame frame = shadingFrame();
+    return instance->bsdf()->pdf(uv, frame.toLocal(wo), frame.toLocal(wi));
+}
+
 Light *Intersection::light() const {
     if (!instance)
         return background;
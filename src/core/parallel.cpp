@@ -0,0 +1,184 @@
+#include <lightwave/parallel.hpp>
+
+#include <algorithm>
+#include <utility>
+
+namespace lightwave {
+
+namespace {
+/// @brief The pool that the calling thread is a worker of, if any.
+thread_local ThreadPool *t_pool = nullptr;
+/// @brief The index of the calling thread within its pool.
+thread_local int t_workerIndex = -1;
+} // namespace
+
+ThreadPool &ThreadPool::global() {
+    static ThreadPool pool(max(1, int(std::thread::hardware_concurrency())));
+    return pool;
+}
+
+ThreadPool::ThreadPool(int threadCount) : m_threadCount(threadCount) {
+    for (int i = 0; i <= threadCount; i++)
+        m_queues.push_back(std::make_unique<Queue>());
+    m_workers.reserve(threadCount);
+    for (int i = 0; i < threadCount; i++)
+        m_workers.emplace_back([this, i]() { work(i); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(m_sleepMutex);
+        m_stop = true;
+    }
+    m_wakeup.notify_all();
+    for (auto &worker : m_workers)
+        worker.join();
+}
+
+void ThreadPool::push(Task &&task) {
+    const int index = t_pool == this ? t_workerIndex : threadCount();
+    Queue &queue    = *m_queues[index];
+    {
+        std::lock_guard lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    m_queuedTasks++;
+
+    // sleeping workers register before checking for queued tasks, so either
+    // they see the new task or we see them
+    if (m_idleWorkers > 0) {
+        { std::lock_guard lock(m_sleepMutex); }
+        m_wakeup.notify_one();
+    }
+}
+
+bool ThreadPool::pop(Queue &queue, TaskGroup *group, bool fromBack,
+                     Task &task) {
+    std::lock_guard lock(queue.mutex);
+    auto &tasks = queue.tasks;
+    if (tasks.empty())
+        return false;
+
+    if (!group) {
+        if (fromBack) {
+            task = std::move(tasks.back());
+            tasks.pop_back();
+        } else {
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+    } else {
+        const auto matches = [&](const Task &task) {
+            return task.group == group;
+        };
+        auto it = tasks.end();
+        if (fromBack) {
+            const auto rit = std::find_if(tasks.rbegin(), tasks.rend(), matches);
+            if (rit != tasks.rend())
+                it = std::prev(rit.base());
+        } else {
+            it = std::find_if(tasks.begin(), tasks.end(), matches);
+        }
+        if (it == tasks.end())
+            return false;
+        task = std::move(*it);
+        tasks.erase(it);
+    }
+
+    m_queuedTasks--;
+    task.group->m_queued--;
+    return true;
+}
+
+bool ThreadPool::runOne(TaskGroup *group) {
+    const int own   = t_pool == this ? t_workerIndex : -1;
+    const int count = int(m_queues.size());
+
+    Task task;
+    // own tasks are taken depth first, the shared queue is processed in order
+    bool found = own >= 0 && pop(*m_queues[own], group, true, task);
+    if (!found)
+        found = pop(*m_queues[threadCount()], group, false, task);
+    // steal from the other workers, starting with the next one
+    for (int i = 1; !found && i < count; i++) {
+        const int victim = (max(own, 0) + i) % threadCount();
+        if (victim != own)
+            found = pop(*m_queues[victim], group, false, task);
+    }
+    if (!found)
+        return false;
+
+    task.group->execute(task);
+    return true;
+}
+
+void ThreadPool::work(int index) {
+    t_pool        = this;
+    t_workerIndex = index;
+    while (true) {
+        if (runOne(nullptr))
+            continue;
+
+        std::unique_lock lock(m_sleepMutex);
+        m_idleWorkers++;
+        m_wakeup.wait(lock, [&]() { return m_stop || m_queuedTasks > 0; });
+        m_idleWorkers--;
+        if (m_stop)
+            break;
+    }
+}
+
+TaskGroup::~TaskGroup() {
+    try {
+        wait();
+    } catch (...) {
+        // exceptions can only be reported by explicit calls to wait()
+    }
+}
+
+void TaskGroup::run(std::function<void()> f) {
+    m_pending++;
+    m_queued++;
+    m_pool.push({ std::move(f), this });
+    // wake up threads waiting for the group, so that they can help
+    std::lock_guard lock(m_mutex);
+    m_changed.notify_all();
+}
+
+void TaskGroup::execute(ThreadPool::Task &task) {
+    if (!m_cancelled) {
+        try {
+            task.function();
+        } catch (...) {
+            std::lock_guard lock(m_mutex);
+            if (!m_exception)
+                m_exception = std::current_exception();
+        }
+    }
+    // captured state might refer to objects that only live until wait()
+    // returns, so it must be released first
+    task.function = nullptr;
+
+    // the group may be destroyed as soon as the lock is released
+    std::lock_guard lock(m_mutex);
+    m_pending--;
+    m_changed.notify_all();
+}
+
+void TaskGroup::wait() {
+    while (m_pending > 0) {
+        if (m_pool.runOne(this))
+            continue;
+
+        // the remaining tasks are being executed by other threads, or are
+        // about to be queued
+        std::unique_lock lock(m_mutex);
+        m_changed.wait(lock, [&]() { return m_pending == 0 || m_queued > 0; });
+    }
+
+    std::lock_guard lock(m_mutex);
+    if (m_exception)
+        std::rethrow_exception(std::exchange(m_exception, nullptr));
+}
+
+} // namespace lightwave
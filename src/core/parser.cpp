@@ -1,4 +1,4 @@
-#include <ctpl_stl.h>
+#include <lightwave/parallel.hpp>
 #include <lightwave/properties.hpp>
 #include <lightwave/registry.hpp>
 #include <lightwave/transform.hpp>
@@ -11,8 +11,6 @@
 
 #include "parser.hpp"
 
-ctpl::thread_pool pool(2 * std::thread::hardware_concurrency());
-
 namespace lightwave {
 
 struct SceneParser::Node
@@ -71,6 +69,8 @@ struct SceneParser::RootNode : public SceneParser::Node {
     }
 
     void close() override {
+        // help constructing the objects instead of idling
+        sceneParser.m_tasks.wait();
         for (const auto &object : objectFutures) {
             sceneParser.m_objects.push_back(object.get());
         }
@@ -123,7 +123,7 @@ struct SceneParser::ObjectNode : public SceneParser::Node {
 
         auto self = shared_from_this();
         std::shared_future<ref<Object>> object =
-            pool.push([this, self, &progress](int) {
+            getRoot().sceneParser.m_tasks.submit([this, self, &progress]() {
                 // wait for all child objects to be constructed and add them to
                 // properties
                 for (const auto &child : childFutures) {
@@ -421,8 +421,8 @@ void SceneParser::close() {
 }
 
 void SceneParser::stop() {
-    pool.clear_queue();
-    pool.stop(true);
+    m_tasks.cancel();
+    m_tasks.wait();
 }
 
 SceneParser::SceneParser(const std::filesystem::path &path)
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <lightwave/core.hpp>
+#include <lightwave/parallel.hpp>
 
 #include "xml.hpp"
 
@@ -24,6 +25,10 @@ protected:
     std::stack<ref<Node>> m_stack;
     std::vector<ref<Object>> m_objects;
     ProgressReporter m_progress;
+    /// @brief Constructs objects as soon as their children are available
+    /// (declared last, so that pending tasks finish before other members are
+    /// destroyed).
+    TaskGroup m_tasks;
 
     std::string resolveVariables(const std::string &value);
 
@@ -1,7 +1,13 @@
 #include "plyparser.hpp"
+#include "mappedfile.hpp"
+#include <lightwave/iterators.hpp>
 #include <lightwave/logger.hpp>
+#include <lightwave/parallel.hpp>
 
+#include <atomic>
+#include <bit>
 #include <climits>
+#include <cstring>
 #include <fstream>
 
 namespace lightwave {
@@ -39,6 +45,9 @@ struct Header {
     int MatElem           = -1;
     bool SwitchEndianness = false;
     bool IsAscii          = false;
+    /// @brief Whether faces consist of nothing but a 'list uchar int' of
+    /// vertex indices, i.e., have a fixed size if all faces are triangles.
+    bool HasCompactFaces = false;
 
     [[nodiscard]] inline bool hasVertices() const {
         return XElem >= 0 && YElem >= 0 && ZElem >= 0;
@@ -53,6 +62,27 @@ struct Header {
     [[nodiscard]] inline bool hasMaterials() const { return MatElem >= 0; }
 };
 
+/// @brief Computes texture coordinates by projecting the vertices onto the xy
+/// plane of their bounding box, for meshes without texture coordinates.
+static void generateUVs(std::vector<Vertex> &vertices) {
+    Bounds bbox;
+    for (const Vertex &v : vertices)
+        bbox.extend(v.position);
+
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        auto &v        = vertices.at(i);
+        const Vector d = bbox.diagonal();
+        const Vector t = v.position - bbox.min();
+
+        Vector2 p = Vector2(0);
+        if (d.x() > Epsilon)
+            p.x() = t.x() / d.x();
+        if (d.y() > Epsilon)
+            p.y() = t.y() / d.y();
+        v.uv = p; // Drop the z coordinate
+    }
+}
+
 static void readPlyContent(std::istream &stream, const Header &header,
                            std::vector<Vector3i> &indices,
                            std::vector<Vertex> &vertices) {
@@ -183,24 +213,120 @@ static void readPlyContent(std::istream &stream, const Header &header,
                         indicesIndex,
                         indices.size());
 
-    if (!header.hasUVs()) {
-        Bounds bbox;
-        for (const Vertex &v : vertices)
-            bbox.extend(v.position);
-
-        for (size_t i = 0; i < vertices.size(); ++i) {
-            auto &v        = vertices.at(i);
-            const Vector d = bbox.diagonal();
-            const Vector t = v.position - bbox.min();
-
-            Vector2 p = Vector2(0);
-            if (d.x() > Epsilon)
-                p.x() = t.x() / d.x();
-            if (d.y() > Epsilon)
-                p.y() = t.y() / d.y();
-            v.uv = p; // Drop the z coordinate
-        }
+    if (!header.hasUVs())
+        generateUVs(vertices);
+}
+
+/// @brief The vertex layout of most binary PLY files, which can be decoded
+/// without looking at individual properties.
+struct PackedPlyVertex {
+    float x, y, z;
+    float nx, ny, nz;
+    float u, v;
+};
+
+/// @brief The number of vertices or faces that are decoded per task when
+/// reading memory mapped files.
+static constexpr int MappedChunkSize = 1 << 16;
+
+/**
+ * @brief Decodes binary little endian content directly from a memory mapping
+ * of the file, in parallel chunks.
+ * @param contentOffset The offset of the first vertex in the file.
+ * @return Whether the content could be decoded, which is not the case for
+ * layouts other than little endian binary with compact faces (see
+ * Header::HasCompactFaces ), which are handled by @ref readPlyContent .
+ */
+static bool readPlyMapped(const std::filesystem::path &path,
+                          size_t contentOffset, const Header &header,
+                          std::vector<Vector3i> &indices,
+                          std::vector<Vertex> &vertices) {
+    if (header.IsAscii || header.SwitchEndianness ||
+        std::endian::native != std::endian::little || !header.HasCompactFaces)
+        return false;
+    if (!header.hasNormals())
+        lightwave_throw("no normals found");
+
+    // every face consists of its vertex count and three 32 bit indices
+    const size_t faceStride   = 1 + 3 * sizeof(uint32_t);
+    const size_t vertexStride = header.VertexPropCount * sizeof(float);
+    const size_t vertexBytes  = header.VertexCount * vertexStride;
+
+    const MappedFile file(path);
+    if (file.size() < contentOffset + vertexBytes +
+                          size_t(header.FaceCount) * faceStride)
+        lightwave_throw("file is truncated");
+    const uint8_t *vertexData = file.data() + contentOffset;
+    const uint8_t *faceData   = vertexData + vertexBytes;
+
+    vertices.resize(header.VertexCount);
+    const bool isPacked = header.VertexPropCount == 8 && header.XElem == 0 &&
+                          header.YElem == 1 && header.ZElem == 2 &&
+                          header.NXElem == 3 && header.NYElem == 4 &&
+                          header.NZElem == 5 && header.UElem == 6 &&
+                          header.VElem == 7;
+    if (isPacked) {
+        for_each_parallel(
+            ChunkedRange(header.VertexCount, MappedChunkSize),
+            [&](Range chunk) {
+                for (int i : chunk) {
+                    PackedPlyVertex in;
+                    std::memcpy(&in, vertexData + i * vertexStride, sizeof(in));
+                    Vertex &vertex  = vertices[i];
+                    vertex.position = { in.x, in.y, in.z };
+                    vertex.normal = Vector(in.nx, in.ny, in.nz).normalized();
+                    vertex.uv     = Vector2(in.u, in.v);
+                }
+            });
+    } else {
+        for_each_parallel(
+            ChunkedRange(header.VertexCount, MappedChunkSize),
+            [&](Range chunk) {
+                for (int i : chunk) {
+                    const uint8_t *in     = vertexData + i * vertexStride;
+                    const auto property = [&](int elem) {
+                        float value = 0;
+                        if (elem >= 0)
+                            std::memcpy(&value,
+                                        in + elem * sizeof(float),
+                                        sizeof(float));
+                        return value;
+                    };
+                    Vertex &vertex  = vertices[i];
+                    vertex.position = { property(header.XElem),
+                                        property(header.YElem),
+                                        property(header.ZElem) };
+                    vertex.normal   = Vector(property(header.NXElem),
+                                           property(header.NYElem),
+                                           property(header.NZElem))
+                                        .normalized();
+                    vertex.uv       = Vector2(property(header.UElem),
+                                        property(header.VElem));
+                }
+            });
     }
+
+    indices.resize(header.FaceCount);
+    std::atomic<bool> onlyTriangles = true;
+    for_each_parallel(
+        ChunkedRange(header.FaceCount, MappedChunkSize), [&](Range chunk) {
+            for (int i : chunk) {
+                const uint8_t *in = faceData + i * faceStride;
+                if (in[0] != 3) {
+                    onlyTriangles = false;
+                    return;
+                }
+                int32_t face[3];
+                std::memcpy(face, in + 1, sizeof(face));
+                indices[i] = Vector3i(face[0], face[1], face[2]);
+            }
+        });
+    if (!onlyTriangles)
+        lightwave_throw("only triangles supported");
+
+    if (!header.hasUVs())
+        generateUVs(vertices);
+    return true;
 }
 
 static inline bool isAllowedVertIndType(const std::string &str) {
@@ -283,6 +409,9 @@ void readPLY(const std::filesystem::path &path, std::vector<Vector3i> &indices,
 
                     if (name == "vertex_indices" || name == "vertex_index")
                         header.IndElem = facePropCounter - 1;
+                    header.HasCompactFaces =
+                        (countType == "uchar" || countType == "uint8_t") &&
+                        (indType == "int" || indType == "uint");
                 } else {
                     lightwave_throw("only float or list properties allowed");
                 }
@@ -297,6 +426,12 @@ void readPLY(const std::filesystem::path &path, std::vector<Vector3i> &indices,
 
         header.SwitchEndianness = (method == "binary_big_endian");
         header.IsAscii          = (method == "ascii");
+        header.HasCompactFaces &= facePropCounter == 1;
+
+        const auto contentOffset = stream.tellg();
+        if (contentOffset >= 0 &&
+            readPlyMapped(path, size_t(contentOffset), header, indices, vertices))
+            return;
         readPlyContent(stream, header, indices, vertices);
     } catch (...) {
         lightwave_throw_nested("while parsing %s", path);
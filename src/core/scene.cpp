@@ -1,94 +1,307 @@
 #include <lightwave/camera.hpp>
 #include <lightwave/core.hpp>
+#include <lightwave/hash.hpp>
 #include <lightwave/integrator.hpp>
 #include <lightwave/light.hpp>
+#include <lightwave/logger.hpp>
 #include <lightwave/registry.hpp>
+#include <lightwave/sampler.hpp>
 #include <lightwave/shape.hpp>
 #include <lightwave/instance.hpp>
 #include <lightwave/profiler.hpp>
 
-#include <unordered_map>
+#include <algorithm>
+#include <optional>
+
+#include "lighttree.hpp"
 
 namespace lightwave {
 
+/**
+ * @brief Deterministic random numbers for estimating the power of lights, so
+ * that the light distribution does not depend on the sampler of the
+ * integrator (uses the SplitMix64 generator).
+ */
+class PowerEstimationSampler final : public Sampler {
+    uint64_t m_state = 0;
+
+public:
+    float next() override {
+        uint64_t z = (m_state += 0x9E3779B97F4A7C15);
+        z          = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+        z          = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+        z ^= z >> 31;
+        return float(z >> 40) * 0x1p-24f;
+    }
+
+    void seed(int index) override { m_state = hash::fnv1a(index); }
+    void seed(const Point2i &pixel, int sampleIndex) override {
+        m_state = hash::fnv1a(pixel.x(), pixel.y(), sampleIndex);
+    }
+
+    ref<Sampler> clone() const override {
+        return std::make_shared<PowerEstimationSampler>(*this);
+    }
+
+    std::string toString() const override { return "PowerEstimationSampler[]"; }
+};
+
 class Scene::LightSampling {
-    struct DistributionElement {
+    /// @brief An entry of the alias table, see Vose's alias method.
+    struct AliasEntry {
+        /// @brief The light that is picked if the random number falls below
+        /// the threshold within this entry.
         const Light *light;
-        float probability;
-        float cdf;
+        /// @brief The light that is picked otherwise.
+        const Light *alias;
+        /// @brief The fraction of this entry that belongs to @c light .
+        float threshold;
     };
+    using AliasTable = std::vector<AliasEntry>;
 
     /// @brief References to all lights, to maintain memory ownership.
     std::vector<ref<Light>> m_lights;
-    /// @brief A fast lookup table to query how likely a light is to be sampled.
-    std::unordered_map<const Light *, float> m_probabilities;
-    /// @brief The distribution used for sampling.
-    std::vector<DistributionElement> m_distribution;
+    /// @brief The alias table used for picking lights independently of a
+    /// point, with one entry per light that can be sampled.
+    AliasTable m_table;
 
-public:
-    LightSampling(const std::vector<ref<Light>> &lights)
-    : m_lights(lights) {
-        float cummulativeWeight = 0;
+    /// @brief The hierarchy of all lights with bounds, if lights are picked
+    /// based on the point they illuminate.
+    std::optional<LightTree> m_tree;
+    /// @brief The alias table for lights without bounds, which are picked
+    /// independently of the point when a tree is used.
+    AliasTable m_infiniteTable;
+    /// @brief The probability of picking a light without bounds rather than
+    /// descending the tree.
+    float m_infiniteProbability = 0;
+    /// @brief For each light, the probability of being picked from the alias
+    /// table of lights without bounds.
+    std::vector<float> m_infiniteProbabilities;
 
-        for (const auto &light : lights) {
-            const float weight = light->samplingWeight();
-            if (weight == 0) {
-                // this light does not want to be sampled, so do not add
-                // it to the distribution and set its probability to 0
-                m_probabilities.insert(std::make_pair(light.get(), 0));
+    /**
+     * @brief Builds an alias table that picks lights proportional to their
+     * weights, using Vose's alias method: entries that are underfull (i.e.,
+     * with a scaled probability below one) are filled up by overfull ones.
+     * @return The probability of each light.
+     */
+    static std::vector<float> buildAliasTable(
+        const std::vector<Light *> &lights, const std::vector<float> &weights,
+        AliasTable &table) {
+        float totalWeight = 0;
+        for (const float weight : weights)
+            totalWeight += weight;
+        if (totalWeight <= 0)
+            return std::vector<float>(lights.size(), 0);
+
+        const int count = int(lights.size());
+        std::vector<float> probabilities(count);
+        std::vector<float> scaled(count);
+        std::vector<int> small, large;
+        for (int i = 0; i < count; i++) {
+            probabilities[i] = weights[i] / totalWeight;
+            scaled[i]        = probabilities[i] * count;
+            (scaled[i] < 1 ? small : large).push_back(i);
+        }
+
+        table.resize(count);
+        while (!small.empty() && !large.empty()) {
+            const int less = small.back();
+            const int more = large.back();
+            small.pop_back();
+            table[less] = { lights[less], lights[more], scaled[less] };
+            scaled[more] -= 1 - scaled[less];
+            if (scaled[more] < 1) {
+                large.pop_back();
+                small.push_back(more);
+            }
+        }
+        // the remaining entries are full up to rounding errors
+        for (const int i : small)
+            table[i] = { lights[i], lights[i], 1 };
+        for (const int i : large)
+            table[i] = { lights[i], lights[i], 1 };
+        return probabilities;
+    }
+
+    /// @brief Picks an entry of an alias table with a single random number,
+    /// whose fractional part selects one of the two lights of the entry.
+    static const Light *sampleAliasTable(const AliasTable &table, float u) {
+        const float scaled = u * table.size();
+        const int index    = min(int(scaled), int(table.size()) - 1);
+        const auto &entry  = table[index];
+        return scaled - index < entry.threshold ? entry.light : entry.alias;
+    }
+
+    /**
+     * @brief Weighs lights by their sampling weight, and additionally by their
+     * estimated power unless lights are picked uniformly.
+     * Lights with a weight of zero do not want to be sampled, so they are not
+     * part of the result and keep a probability of 0.
+     */
+    static void weighLights(const std::vector<Light *> &candidates,
+                            Strategy strategy, const Bounds &sceneBounds,
+                            std::vector<Light *> &lights,
+                            std::vector<float> &weights) {
+        PowerEstimationSampler rng;
+        for (Light *light : candidates) {
+            float weight = light->samplingWeight();
+            if (weight == 0)
                 continue;
+            if (strategy != Strategy::Uniform) {
+                rng.seed(light->samplingIndex());
+                weight *= light->estimatePower(sceneBounds, rng);
             }
+            lights.push_back(light);
+            weights.push_back(weight);
+        }
+
+        if (!std::all_of(weights.begin(), weights.end(), [](float weight) {
+                return std::isfinite(weight);
+            })) {
+            // the power of distant lights is unknown for unbounded scenes
+            logger(EWarn,
+                   "cannot estimate the power of all lights, picking lights "
+                   "proportional to their weight instead");
+            for (size_t i = 0; i < lights.size(); i++)
+                weights[i] = lights[i]->samplingWeight();
+        }
+    }
+
+public:
+    LightSampling(const std::vector<ref<Light>> &lights, Strategy strategy,
+                  const Bounds &sceneBounds)
+    : m_lights(lights) {
+        std::vector<Light *> candidates;
+        for (const auto &light : lights) {
+            light->setSamplingIndex(int(candidates.size()));
+            candidates.push_back(light.get());
+        }
+
+        std::vector<Light *> sampled;
+        std::vector<float> weights;
+        weighLights(candidates, strategy, sceneBounds, sampled, weights);
+        const auto probabilities = buildAliasTable(sampled, weights, m_table);
+        for (size_t i = 0; i < sampled.size(); i++)
+            sampled[i]->setSamplingProbability(probabilities[i]);
 
-            cummulativeWeight += weight;
-            m_distribution.emplace_back(DistributionElement {
-                light.get(),
-                weight,
-                cummulativeWeight
-            });
+        if (strategy != Strategy::Tree)
+            return;
+
+        // lights with bounds go into the tree, the others are picked by power
+        PowerEstimationSampler rng;
+        std::vector<std::optional<LightBounds>> bounds(candidates.size());
+        std::vector<Light *> infinite;
+        for (Light *light : candidates) {
+            rng.seed(light->samplingIndex());
+            auto &lightBounds = bounds[light->samplingIndex()];
+            lightBounds       = light->lightBounds(rng);
+            if (lightBounds)
+                lightBounds->intensity *= light->samplingWeight();
+            else
+                infinite.push_back(light);
         }
+        m_tree.emplace(bounds);
+
+        sampled.clear();
+        weights.clear();
+        weighLights(infinite, strategy, sceneBounds, sampled, weights);
+        const auto infiniteProbabilities =
+            buildAliasTable(sampled, weights, m_infiniteTable);
+        m_infiniteProbabilities.resize(candidates.size());
+        for (size_t i = 0; i < sampled.size(); i++)
+            m_infiniteProbabilities[sampled[i]->samplingIndex()] =
+                infiniteProbabilities[i];
 
-        // normalize the distribution so that probability and cdf are in the range [0,1]
-        for (auto &element : m_distribution) {
-            element.probability /= cummulativeWeight;
-            element.cdf /= cummulativeWeight;
+        // the tree and the lights without bounds share the samples according
+        // to their estimated power
+        if (!m_infiniteTable.empty()) {
+            float treePower     = 0;
+            float infinitePower = 0;
+            for (Light *light : candidates) {
+                if (light->samplingWeight() == 0)
+                    continue;
+                rng.seed(light->samplingIndex());
+                const float power = light->samplingWeight() *
+                                    light->estimatePower(sceneBounds, rng);
+                (bounds[light->samplingIndex()] ? treePower : infinitePower) +=
+                    power;
+            }
 
-            // add light to lookup table so that the probability can be queried efficiently
-            m_probabilities[element.light] = element.probability;
+            if (m_tree->empty()) {
+                m_infiniteProbability = 1;
+            } else if (std::isfinite(infinitePower) && infinitePower > 0 &&
+                       std::isfinite(treePower)) {
+                m_infiniteProbability =
+                    infinitePower / (infinitePower + treePower);
+            } else {
+                // without a usable estimate, the tree counts as one more
+                // light next to all lights without bounds
+                m_infiniteProbability =
+                    m_infiniteTable.size() / (m_infiniteTable.size() + 1.f);
+            }
         }
     }
 
     bool hasLights() const { return !m_lights.empty(); }
 
     LightSample sample(Sampler &rng) const {
-        if (m_distribution.empty()) return LightSample::invalid();
-        const auto cdf = rng.next();
-        const auto element = std::upper_bound(
-            m_distribution.begin(),
-            m_distribution.end(),
-            cdf,
-            [](float value, const DistributionElement &element) {
-                return value < element.cdf;
-            }
-        );
+        if (m_table.empty())
+            return LightSample::invalid();
+        const Light *light = sampleAliasTable(m_table, rng.next());
+        return {
+            .light       = light,
+            .probability = light->samplingProbability(),
+        };
+    }
+
+    LightSample sample(const Point &origin, Sampler &rng) const {
+        if (!m_tree)
+            return sample(rng);
+
+        // a single random number is rescaled for all decisions
+        float u = rng.next();
+        if (u < m_infiniteProbability) {
+            const Light *light = sampleAliasTable(
+                m_infiniteTable, u / m_infiniteProbability);
+            return {
+                .light       = light,
+                .probability = probability(origin, light),
+            };
+        }
+
+        u = (u - m_infiniteProbability) / (1 - m_infiniteProbability);
+        const auto sample = m_tree->sample(origin, u);
+        if (sample.light < 0)
+            return LightSample::invalid();
         return {
-            .light = element->light,
-            .probability = element->probability,
+            .light       = m_lights[sample.light].get(),
+            .probability = (1 - m_infiniteProbability) * sample.probability,
         };
     }
 
-    float probability(const Light *light) const {
-        if (light == nullptr) return 0;
+    float probability(const Point &origin, const Light *light) const {
+        if (!light)
+            return 0;
+        if (!m_tree)
+            return light->samplingProbability();
 
-        const auto it = m_probabilities.find(light);
-        if (it == m_probabilities.end()) return 0;
-        return it->second;
+        const int index = light->samplingIndex();
+        if (m_infiniteProbabilities[index] > 0)
+            return m_infiniteProbability * m_infiniteProbabilities[index];
+        return (1 - m_infiniteProbability) * m_tree->probability(origin, index);
     }
 };
 
 Scene::Scene(const Properties &properties) {
     m_camera     = properties.getChild<Camera>();
     m_background = properties.getOptionalChild<BackgroundLight>();
-    m_lightSampling = std::make_shared<LightSampling>(properties.getChildren<Light>());
+    // clang-format off
+    const Strategy strategy = properties.getEnum<Strategy>("lightSampling", Strategy::Power, {
+        { "tree",    Strategy::Tree    },
+        { "power",   Strategy::Power   },
+        { "uniform", Strategy::Uniform },
+    });
+    // clang-format on
 
     const std::vector<ref<Shape>> entities = properties.getChildren<Shape>();
     if (entities.size() == 1) {
@@ -99,6 +312,10 @@ Scene::Scene(const Properties &properties) {
     }
 
     m_shape->markAsVisible();
+
+    // the power of distant lights depends on the extent of the scene
+    m_lightSampling = std::make_shared<LightSampling>(
+        properties.getChildren<Light>(), strategy, getBoundingBox());
 }
 
 std::string Scene::toString() const {
@@ -114,18 +331,53 @@ Intersection Scene::intersect(const Ray &ray, Sampler &rng) const {
 
     Intersection its(-ray.direction);
     m_shape->intersect(ray, its, rng);
-    if (!its) {
+    if (its) {
+        // surface attributes are only computed for the closest hit
+        its.instance->computeSurfaceInteraction(ray, its);
+    } else {
         its.background = m_background.get();
     }
-    its.lightProbability = m_lightSampling->probability(its.light());
+    its.lightProbability =
+        m_lightSampling->probability(ray.origin, its.light());
     return its;
 }
 
 bool Scene::intersect(const Ray &ray, float tMax, Sampler &rng) const {
     PROFILE("Shadow ray")
 
-    Intersection its(-ray.direction, tMax * (1 - Epsilon));
-    return m_shape->intersect(ray, its, rng);
+    return m_shape->occluded(ray, tMax * (1 - Epsilon), rng);
+}
+
+void Scene::intersect8(const Packet<Ray> &rays, int mask,
+                       Packet<Intersection> &its,
+                       const Packet<Sampler *> &rng) const {
+    PROFILE("Intersect")
+
+    forEachLane(mask, [&](int lane) {
+        its[lane] = Intersection(-rays[lane].direction);
+    });
+    m_shape->intersect8(rays, mask, its, rng);
+    forEachLane(mask, [&](int lane) {
+        Intersection &laneIts = its[lane];
+        if (laneIts) {
+            laneIts.instance->computeSurfaceInteraction(rays[lane], laneIts);
+        } else {
+            laneIts.background = m_background.get();
+        }
+        laneIts.lightProbability =
+            m_lightSampling->probability(rays[lane].origin, laneIts.light());
+    });
+}
+
+int Scene::intersect8(const Packet<Ray> &rays, const Packet<float> &tMax,
+                      int mask, const Packet<Sampler *> &rng) const {
+    PROFILE("Shadow ray")
+
+    Packet<float> limits;
+    limits.fill(Infinity);
+    forEachLane(mask,
+                [&](int lane) { limits[lane] = tMax[lane] * (1 - Epsilon); });
+    return m_shape->occluded8(rays, limits, mask, rng);
 }
 
 LightSample Scene::sampleLight(Sampler &rng) const {
@@ -134,6 +386,16 @@ LightSample Scene::sampleLight(Sampler &rng) const {
     return m_lightSampling->sample(rng);
 }
 
+LightSample Scene::sampleLight(const Point &origin, Sampler &rng) const {
+    PROFILE("Pick light")
+
+    return m_lightSampling->sample(origin, rng);
+}
+
+float Scene::lightProbability(const Point &origin, const Light *light) const {
+    return m_lightSampling->probability(origin, light);
+}
+
 bool Scene::hasLights() const {
     return m_lightSampling->hasLights();
 }
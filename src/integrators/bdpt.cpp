@@ -0,0 +1,595 @@
+#include <lightwave.hpp>
+
+#include <vector>
+
+namespace lightwave {
+
+/**
+ * @brief A bidirectional path tracer (Veach, 1997), which traces one path from
+ * the camera and one from a light source per sample, and connects every
+ * prefix of the one to every prefix of the other.
+ *
+ * Each combination of @c s vertices of the light subpath and @c t vertices of
+ * the camera subpath is a separate sampling strategy, and all strategies that
+ * produce paths of up to @c depth bounces are combined with multiple
+ * importance sampling (power heuristic). Strategies with a single light vertex
+ * sample the light anew (next event estimation), while strategies with a
+ * single camera vertex connect the light subpath to the camera (light
+ * tracing) and are splatted into the pixel they are seen in. The latter
+ * requires a camera that supports @ref Camera::connect ; for other cameras,
+ * light tracing is skipped.
+ *
+ * Light subpaths start at lights picked proportional to their power. Paths
+ * are traced in both directions with the same BSDFs, so refraction scales
+ * light subpaths by the squared ratio of the indices of refraction, which
+ * cancels out for paths that leave the refracting object again.
+ *
+ * The image is always rendered tile by tile, as light tracing contributes to
+ * pixels outside the tile that is being rendered.
+ */
+class BidirectionalPathtracerIntegrator : public SamplingIntegrator {
+    /// @brief A vertex of a camera or light subpath.
+    struct PathVertex {
+        enum class Type {
+            /// @brief The first vertex of a camera subpath.
+            Camera,
+            /// @brief The first vertex of a light subpath, or the end of a
+            /// camera subpath that has escaped to the background.
+            Light,
+            /// @brief A vertex on the surface of an object.
+            Surface,
+        };
+
+        Type type;
+        /// @brief The surface point of the vertex. For light and camera
+        /// vertices that are not on a surface, only the position is set.
+        Intersection its;
+        /// @brief The light source of light vertices.
+        const Light *light = nullptr;
+        /// @brief The product of all weights of the subpath up to this vertex.
+        Color weight;
+        /// @brief For vertices at infinity, the direction light travels in,
+        /// pointing into the scene.
+        Vector direction;
+        /// @brief Whether the vertex lies on a surface, which makes densities
+        /// with respect to area depend on the orientation of the surface.
+        bool isOnSurface = false;
+        /// @brief Whether the vertex is infinitely far away.
+        bool isInfinite = false;
+        /// @brief Whether the vertex scatters light into a single direction,
+        /// so that it cannot be connected to.
+        bool isDelta = false;
+        /// @brief The density (with respect to area, or solid angle for
+        /// vertices at infinity) of sampling the vertex from the subpath it
+        /// belongs to.
+        float pdfForward = 0;
+        /// @brief The density of sampling the vertex if the path was traced
+        /// in reverse direction.
+        float pdfReverse = 0;
+
+        /// @brief The light source the vertex lies on, if any.
+        const Light *emitter() const {
+            if (type == Type::Light)
+                return light;
+            if (type == Type::Surface)
+                return its.light();
+            return nullptr;
+        }
+    };
+
+    /// @brief The relative difference in distance up to which a hit of a light
+    /// is considered to be the point that has been sampled on it.
+    static constexpr float LightHitTolerance = 1e-3f;
+
+    int m_depth;
+    /// @brief The bounding box of the scene geometry, which lights that are
+    /// infinitely far away aim their rays at.
+    Bounds m_sceneBounds;
+
+    /// @brief Returns the direction from one vertex towards another, along
+    /// with their squared distance (one if either is at infinity).
+    static Vector towards(const PathVertex &from, const PathVertex &to,
+                          float &distanceSquared) {
+        distanceSquared = 1;
+        if (to.isInfinite)
+            return -to.direction;
+        if (from.isInfinite)
+            return from.direction;
+        const Vector w  = to.its.position - from.its.position;
+        distanceSquared = w.lengthSquared();
+        return distanceSquared > 0 ? w / std::sqrt(distanceSquared) : w;
+    }
+
+    /// @brief Converts a density with respect to solid angle at one vertex
+    /// into a density with respect to area at the next vertex.
+    static float convertDensity(float pdf, const PathVertex &from,
+                                const PathVertex &next) {
+        if (next.isInfinite)
+            return pdf;
+        float distanceSquared;
+        const Vector w = towards(from, next, distanceSquared);
+        if (distanceSquared == 0)
+            return 0;
+        if (next.isOnSurface)
+            pdf *= abs(next.its.shadingNormal.dot(w));
+        return pdf / distanceSquared;
+    }
+
+    /// @brief Returns the density of a light vertex emitting towards the next
+    /// vertex, with respect to area at that vertex.
+    float pdfLight(const PathVertex &vertex, const PathVertex &next) const {
+        const Light *light = vertex.emitter();
+        if (!light)
+            return 0;
+
+        float distanceSquared;
+        const Vector w = towards(vertex, next, distanceSquared);
+        float pdf;
+        if (vertex.isInfinite) {
+            // rays of lights at infinity leave from a disk covering the scene
+            pdf = light->pdfEmission(vertex.its, w, m_sceneBounds).position;
+        } else {
+            pdf = light->pdfEmission(vertex.its, w, m_sceneBounds).direction /
+                  distanceSquared;
+        }
+        if (next.isOnSurface)
+            pdf *= abs(next.its.shadingNormal.dot(w));
+        return pdf;
+    }
+
+    /// @brief Returns the density of picking a light vertex as origin of a
+    /// light subpath that continues towards the next vertex (with respect to
+    /// area, or solid angle for lights at infinity).
+    float pdfLightOrigin(const PathVertex &vertex,
+                         const PathVertex &next) const {
+        const Light *light = vertex.emitter();
+        if (!light)
+            return 0;
+
+        float distanceSquared;
+        const Vector w = towards(vertex, next, distanceSquared);
+        const EmissionPdf pdf =
+            light->pdfEmission(vertex.its, w, m_sceneBounds);
+        return light->samplingProbability() *
+               (vertex.isInfinite ? pdf.direction : pdf.position);
+    }
+
+    /**
+     * @brief Returns the density of a vertex sampling the next vertex, with
+     * respect to area at the next vertex.
+     * @param prev The vertex the path arrived from (unused for camera and
+     * light vertices).
+     */
+    float pdf(const PathVertex &vertex, const PathVertex *prev,
+              const PathVertex &next) const {
+        if (vertex.type == PathVertex::Type::Light)
+            return pdfLight(vertex, next);
+
+        float distanceSquared;
+        const Vector wn = towards(vertex, next, distanceSquared);
+        float pdf;
+        if (vertex.type == PathVertex::Type::Camera) {
+            pdf = m_scene->camera()->pdfDirection(wn);
+        } else {
+            const Vector wp = towards(vertex, *prev, distanceSquared);
+            pdf             = vertex.its.pdfBsdf(wp, wn);
+        }
+        return convertDensity(pdf, vertex, next);
+    }
+
+    /**
+     * @brief Extends a subpath by sampling BSDFs until it has the given
+     * number of vertices or has been terminated.
+     * @param pdf The density of the direction of @c ray with respect to solid
+     * angle.
+     * @param isCameraPath Whether the subpath starts at the camera, in which
+     * case escaping rays end at the background.
+     */
+    void randomWalk(Ray ray, Color weight, float pdf, int maxVertices,
+                    bool isCameraPath, std::vector<PathVertex> &path,
+                    Sampler &rng) const {
+        while (int(path.size()) < maxVertices) {
+            const Intersection its = m_scene->intersect(ray, rng);
+
+            PathVertex vertex;
+            vertex.its    = its;
+            vertex.weight = weight;
+            if (!its) {
+                if (!isCameraPath || !its.background)
+                    break;
+                vertex.type       = PathVertex::Type::Light;
+                vertex.light      = its.background;
+                vertex.direction  = -ray.direction;
+                vertex.isInfinite = true;
+            } else {
+                vertex.type        = PathVertex::Type::Surface;
+                vertex.isOnSurface = true;
+            }
+            vertex.pdfForward = convertDensity(pdf, path.back(), vertex);
+            path.push_back(vertex);
+            if (!its || int(path.size()) >= maxVertices)
+                break;
+
+            const BsdfSample sample = its.sampleBsdf(rng);
+            if (sample.isInvalid())
+                break;
+            weight *= sample.weight;
+
+            // specular vertices cannot be sampled by any other strategy,
+            // which is expressed by zero densities
+            float pdfReverse = 0;
+            pdf              = 0;
+            if (std::isinf(sample.pdf)) {
+                path.back().isDelta = true;
+            } else {
+                pdf        = sample.pdf;
+                pdfReverse = its.pdfBsdf(sample.wi, its.wo);
+            }
+            const int current = int(path.size()) - 1;
+            path[current - 1].pdfReverse =
+                convertDensity(pdfReverse, path[current], path[current - 1]);
+
+            ray = Ray(its.position, sample.wi);
+        }
+    }
+
+    /// @brief Traces a subpath starting at the camera, whose first vertex is
+    /// the camera itself.
+    void traceCameraPath(const CameraSample &cameraSample,
+                         std::vector<PathVertex> &path, Sampler &rng) const {
+        const Camera *camera = m_scene->camera();
+
+        PathVertex vertex;
+        vertex.type         = PathVertex::Type::Camera;
+        vertex.its.position = cameraSample.ray.origin;
+        vertex.weight       = cameraSample.weight;
+        // cameras that cannot be connected to exclude light tracing
+        vertex.isDelta = !camera->canBeConnected();
+        path.push_back(vertex);
+
+        randomWalk(cameraSample.ray,
+                   cameraSample.weight,
+                   camera->pdfDirection(cameraSample.ray.direction),
+                   m_depth + 2,
+                   true,
+                   path,
+                   rng);
+    }
+
+    /// @brief Traces a subpath starting at a light picked proportional to its
+    /// power, whose first vertex lies on the light.
+    void traceLightPath(std::vector<PathVertex> &path, Sampler &rng) const {
+        if (!m_scene->hasLights())
+            return;
+        const LightSample choice = m_scene->sampleLight(rng);
+        if (choice.isInvalid() || choice.probability == 0)
+            return;
+        const EmissionSample emission =
+            choice.light->sampleEmission(m_sceneBounds, rng);
+        if (emission.isInvalid())
+            return;
+
+        PathVertex vertex;
+        static_cast<SurfaceEvent &>(vertex.its) = emission.origin;
+        vertex.type        = PathVertex::Type::Light;
+        vertex.light       = choice.light;
+        vertex.weight      = emission.weight / choice.probability;
+        vertex.direction   = emission.direction;
+        vertex.isInfinite  = choice.light->isInfinite();
+        vertex.isOnSurface = !vertex.isInfinite && !choice.light->isDelta();
+        vertex.pdfForward =
+            choice.probability * (vertex.isInfinite ? emission.pdf.direction
+                                                    : emission.pdf.position);
+        path.push_back(vertex);
+
+        randomWalk(emission.ray(),
+                   vertex.weight,
+                   emission.pdf.direction,
+                   m_depth + 1,
+                   false,
+                   path,
+                   rng);
+
+        // the second vertex of paths from lights at infinity is found through
+        // the disk their rays leave from
+        if (vertex.isInfinite && path.size() > 1) {
+            path[1].pdfForward =
+                emission.pdf.position *
+                abs(path[1].its.shadingNormal.dot(emission.direction));
+        }
+    }
+
+    /**
+     * @brief Computes the weight of a strategy by the power heuristic, given
+     * the densities stored along both subpaths.
+     * @param sampled The endpoint that has been sampled anew for strategies
+     * with a single light or camera vertex.
+     */
+    float misWeight(std::vector<PathVertex> &cameraPath,
+                    std::vector<PathVertex> &lightPath, int s, int t,
+                    PathVertex &sampled) const {
+        if (s + t == 2)
+            return 1;
+
+        PathVertex &pt = cameraPath[t - 1];
+        // emitters that lights are never picked from can only be found by
+        // the camera subpath
+        if (s == 0 && pdfLightOrigin(pt, cameraPath[t - 2]) == 0)
+            return 1;
+
+        // temporarily turn the subpaths into the path of this strategy
+        if (s == 1)
+            std::swap(lightPath[0], sampled);
+        else if (t == 1)
+            std::swap(cameraPath[0], sampled);
+        PathVertex *qs     = s > 0 ? &lightPath[s - 1] : nullptr;
+        PathVertex *qsPrev = s > 1 ? &lightPath[s - 2] : nullptr;
+        PathVertex *ptPrev = t > 1 ? &cameraPath[t - 2] : nullptr;
+
+        const bool ptDelta    = pt.isDelta;
+        const float ptReverse = pt.pdfReverse;
+        pt.isDelta            = false;
+        pt.pdfReverse =
+            qs ? pdf(*qs, qsPrev, pt) : pdfLightOrigin(pt, *ptPrev);
+
+        float ptPrevReverse = 0;
+        if (ptPrev) {
+            ptPrevReverse = ptPrev->pdfReverse;
+            ptPrev->pdfReverse =
+                qs ? pdf(pt, qs, *ptPrev) : pdfLight(pt, *ptPrev);
+        }
+        bool qsDelta    = false;
+        float qsReverse = 0, qsPrevReverse = 0;
+        if (qs) {
+            qsDelta        = qs->isDelta;
+            qsReverse      = qs->pdfReverse;
+            qs->isDelta    = false;
+            qs->pdfReverse = pdf(pt, ptPrev, *qs);
+        }
+        if (qsPrev) {
+            qsPrevReverse      = qsPrev->pdfReverse;
+            qsPrev->pdfReverse = pdf(*qs, &pt, *qsPrev);
+        }
+
+        // sums up the densities of all other strategies relative to this
+        // one, where zero densities of delta vertices cancel out
+        const auto remap = [](float pdf) { return pdf != 0 ? pdf : 1; };
+        float sum        = 0;
+        float ratio      = 1;
+        for (int i = t - 1; i > 0; i--) {
+            ratio *= remap(cameraPath[i].pdfReverse) /
+                     remap(cameraPath[i].pdfForward);
+            if (!cameraPath[i].isDelta && !cameraPath[i - 1].isDelta)
+                sum += sqr(ratio);
+        }
+        ratio = 1;
+        for (int i = s - 1; i >= 0; i--) {
+            ratio *= remap(lightPath[i].pdfReverse) /
+                     remap(lightPath[i].pdfForward);
+            const bool isDeltaLight = i > 0 ? lightPath[i - 1].isDelta
+                                            : lightPath[0].light->isDelta();
+            if (!lightPath[i].isDelta && !isDeltaLight)
+                sum += sqr(ratio);
+        }
+
+        pt.isDelta    = ptDelta;
+        pt.pdfReverse = ptReverse;
+        if (ptPrev)
+            ptPrev->pdfReverse = ptPrevReverse;
+        if (qs) {
+            qs->isDelta    = qsDelta;
+            qs->pdfReverse = qsReverse;
+        }
+        if (qsPrev)
+            qsPrev->pdfReverse = qsPrevReverse;
+        if (s == 1)
+            std::swap(lightPath[0], sampled);
+        else if (t == 1)
+            std::swap(cameraPath[0], sampled);
+
+        return std::isfinite(sum) ? 1 / (1 + sum) : 0;
+    }
+
+    /**
+     * @brief Evaluates the strategy with @c s light and @c t camera vertices,
+     * weighted by multiple importance sampling.
+     * @param pixel For light tracing (t = 1), receives the pixel the
+     * contribution belongs to.
+     */
+    Color connect(std::vector<PathVertex> &cameraPath,
+                  std::vector<PathVertex> &lightPath, int s, int t,
+                  Point2i &pixel, Sampler &rng) const {
+        const PathVertex &pt = cameraPath[t - 1];
+        // paths that escaped to the background cannot be connected
+        if (t > 1 && s != 0 && pt.type == PathVertex::Type::Light)
+            return Color(0);
+
+        Color result(0);
+        PathVertex sampled;
+        if (s == 0) {
+            // the camera subpath has found an emitter by chance
+            result = pt.weight * pt.its.evaluateEmission().value;
+        } else if (t == 1) {
+            // the light subpath is connected to the camera
+            const PathVertex &qs = lightPath[s - 1];
+            const CameraConnection connection =
+                m_scene->camera()->connect(qs.its.position);
+            if (connection.isInvalid())
+                return Color(0);
+
+            sampled.type         = PathVertex::Type::Camera;
+            sampled.its.position = qs.its.position +
+                                   connection.distance * connection.wi;
+            sampled.weight = connection.weight;
+            pixel          = connection.pixel;
+
+            result = qs.weight * qs.its.evaluateBsdf(connection.wi).value *
+                     sampled.weight;
+            if (result == Color(0) ||
+                m_scene->intersect(Ray(qs.its.position, connection.wi),
+                                   connection.distance,
+                                   rng))
+                return Color(0);
+        } else if (s == 1) {
+            // the light is sampled anew (next event estimation)
+            const LightSample choice = m_scene->sampleLight(rng);
+            if (choice.isInvalid() || choice.probability == 0)
+                return Color(0);
+            const Light *light             = choice.light;
+            const DirectLightSample sample =
+                light->sampleDirect(pt.its.position, rng);
+            if (sample.isInvalid())
+                return Color(0);
+            result = pt.weight * pt.its.evaluateBsdf(sample.wi).value *
+                     sample.weight / choice.probability;
+            if (result == Color(0))
+                return Color(0);
+
+            sampled.type  = PathVertex::Type::Light;
+            sampled.light = light;
+            const Ray ray(pt.its.position, sample.wi);
+            if (light->isInfinite()) {
+                sampled.direction  = -sample.wi;
+                sampled.isInfinite = true;
+                if (m_scene->intersect(ray, sample.distance, rng))
+                    return Color(0);
+            } else if (light->isDelta()) {
+                sampled.its.position = ray(sample.distance);
+                if (m_scene->intersect(ray, sample.distance, rng))
+                    return Color(0);
+            } else {
+                // the surface of the light is found by tracing the ray, which
+                // also tests whether the sampled point is visible
+                const Intersection its = m_scene->intersect(ray, rng);
+                if (!its || its.light() != light ||
+                    abs(its.t - sample.distance) >
+                        LightHitTolerance * sample.distance)
+                    return Color(0);
+                sampled.its         = its;
+                sampled.isOnSurface = true;
+            }
+            sampled.pdfForward = pdfLightOrigin(sampled, pt);
+        } else {
+            // both subpaths are joined by a connecting edge
+            const PathVertex &qs = lightPath[s - 1];
+            float distanceSquared;
+            const Vector w = towards(pt, qs, distanceSquared);
+            result = qs.weight * qs.its.evaluateBsdf(-w).value *
+                     pt.its.evaluateBsdf(w).value * pt.weight /
+                     distanceSquared;
+            if (result == Color(0) ||
+                m_scene->intersect(Ray(pt.its.position, w),
+                                   std::sqrt(distanceSquared),
+                                   rng))
+                return Color(0);
+        }
+
+        if (result == Color(0))
+            return Color(0);
+        return result * misWeight(cameraPath, lightPath, s, t, sampled);
+    }
+
+public:
+    BidirectionalPathtracerIntegrator(const Properties &properties)
+        : SamplingIntegrator(properties) {
+        m_depth = properties.get<int>("depth", 2);
+    }
+
+    void execute() override {
+        if (!m_image) {
+            lightwave_throw(
+                "<integrator /> needs an <image /> child to render into!");
+        }
+        if (rendersInPasses()) {
+            logger(EWarn,
+                   "bdpt renders tile by tile, ignoring progressive and "
+                   "adaptive sampling");
+        }
+
+        const Camera *camera      = m_scene->camera();
+        const Vector2i resolution = camera->resolution();
+        m_image->initialize(resolution);
+        m_sceneBounds = m_scene->getBoundingBox();
+
+        // light tracing contributes to arbitrary pixels, which are gathered
+        // separately and added once all tiles are done
+        Image splats(resolution);
+
+        const int samplesPerPixel = m_sampler->samplesPerPixel();
+        const float norm          = 1.0f / samplesPerPixel;
+
+        Streaming stream{ *m_image };
+        ProgressReporter progress{ resolution.product() };
+        forEachBlock(resolution, [&](const Bounds2i &block) {
+            const ref<Sampler> rng = m_sampler->clone();
+            std::vector<PathVertex> cameraPath, lightPath;
+            cameraPath.reserve(m_depth + 2);
+            lightPath.reserve(m_depth + 1);
+
+            for (auto pixel : block) {
+                Color sum(0);
+                for (int sample = 0; sample < samplesPerPixel; sample++) {
+                    rng->seed(pixel, sample);
+                    cameraPath.clear();
+                    lightPath.clear();
+                    traceCameraPath(camera->sample(pixel, *rng), cameraPath,
+                                    *rng);
+                    traceLightPath(lightPath, *rng);
+
+                    for (int t = 1; t <= int(cameraPath.size()); t++) {
+                        for (int s = 0; s <= int(lightPath.size()); s++) {
+                            const int depth = s + t - 2;
+                            if ((s == 1 && t == 1) || depth < 0 ||
+                                depth > m_depth)
+                                continue;
+                            if (t == 1 && !camera->canBeConnected())
+                                continue;
+
+                            Point2i target = pixel;
+                            const Color contribution = connect(
+                                cameraPath, lightPath, s, t, target, *rng);
+                            if (t == 1)
+                                atomicAdd(splats(target), contribution);
+                            else
+                                sum += contribution;
+                        }
+                    }
+                }
+                m_image->get(pixel) = norm * sum;
+            }
+
+            progress += block.diagonal().product();
+            stream.updateBlock(block);
+        });
+
+        for (auto pixel : Bounds2i(Point2i(0), Point2i(resolution)))
+            m_image->get(pixel) += norm * splats(pixel);
+        stream.update();
+        progress.finish();
+
+        m_image->save();
+    }
+
+    Color Li(const Ray &ray, Sampler &rng) override {
+        // light tracing needs to know the pixels of all samples, hence the
+        // integrator takes care of sampling pixels itself
+        lightwave_throw("bdpt does not support estimating radiance of "
+                        "individual rays");
+    }
+
+    std::string toString() const override {
+        return tfm::format(
+            "BidirectionalPathtracerIntegrator[\n"
+            "  depth = %d,\n"
+            "  sampler = %s,\n"
+            "  image = %s,\n"
+            "]",
+            m_depth,
+            indent(m_sampler),
+            indent(m_image));
+    }
+};
+
+} // namespace lightwave
+
+REGISTER_INTEGRATOR(BidirectionalPathtracerIntegrator, "bdpt")
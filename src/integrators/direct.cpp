@@ -2,33 +2,39 @@
 
 namespace lightwave {
 class DirectIntegrator : public SamplingIntegrator {
+    /// @brief The number of candidates light samples are selected from (see
+    /// @ref SamplingIntegrator::sampleLightResampled ).
+    int m_lightCandidates;
+
     Color LiLightSample(const Intersection &its, Sampler &rng) {
-        LightSample light = m_scene->sampleLight(rng);
+        const ResampledLightSample light =
+            sampleLightResampled(its, m_lightCandidates, rng);
 
-        if (light.isInvalid() || light.probability < Epsilon) {
+        if (light.isInvalid()) {
             return Color(0);
         }
-        DirectLightSample sample = light.light->sampleDirect(its.position, rng);
-        Ray reverse_light_ray(its.position, sample.wi);
+        Ray reverse_light_ray(its.position, light.sample.wi);
 
         // If light is occluded: return black
         // light is occluded if there is an intersection from the
         // surface to the light source
-        Intersection light_its = m_scene->intersect(reverse_light_ray, rng);
-        if (light_its && light_its.t < sample.distance)
+        if (m_scene->intersect(reverse_light_ray, light.sample.distance, rng))
             return Color(0);
 
-        return sample.weight * its.evaluateBsdf(sample.wi).value /
-               light.probability;
+        return light.contribution;
     }
 
 public:
     DirectIntegrator(const Properties &properties)
-        : SamplingIntegrator(properties) {}
+        : SamplingIntegrator(properties) {
+        m_lightCandidates = max(properties.get<int>("lightCandidates", 1), 1);
+    }
 
     Color Li(const Ray &ray, Sampler &rng) override {
-        Intersection its = m_scene->intersect(ray, rng);
+        return Li(ray, m_scene->intersect(ray, rng), rng);
+    }
 
+    Color Li(const Ray &ray, const Intersection &its, Sampler &rng) override {
         // Start with the emission of the hit object/background
         Color li = its.evaluateEmission().value;
         // If no intersection was found: we add contribution of background
@@ -50,6 +56,8 @@ public:
         return li + bsdf_its.evaluateEmission().value * bsdf_sample.weight;
     }
 
+    bool tracesCameraPackets() const override { return true; }
+
     std::string toString() const override { return "DirectIntegrator[]"; }
 };
 } // namespace lightwave
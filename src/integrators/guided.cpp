@@ -0,0 +1,608 @@
+#include <lightwave.hpp>
+
+#include <array>
+#include <vector>
+
+namespace lightwave {
+
+/**
+ * @brief A distribution over the sphere of directions, given by a quadtree
+ * over the unit square that is mapped to the sphere by the area preserving
+ * cylindrical mapping of @ref squareToUniformSphere .
+ * Every node stores the energy that arrived from each of its four quadrants,
+ * and directions are sampled proportional to the energy of the leaf
+ * quadrants.
+ */
+class DirectionalTree {
+    /// @brief The share of the total energy above which a quadrant is
+    /// subdivided when the tree is refined.
+    static constexpr float SubdivisionThreshold = 0.01f;
+    /// @brief The maximum depth of the quadtree.
+    static constexpr int MaximumDepth = 20;
+
+    struct Node {
+        /// @brief The energy of each quadrant, where the quadrant with index
+        /// x + 2 y covers the x-th half horizontally and the y-th half
+        /// vertically.
+        std::array<float, 4> energies{};
+        /// @brief The node subdividing each quadrant, or 0 for quadrants that
+        /// are leaves (the root cannot be a child).
+        std::array<int, 4> children{};
+    };
+
+    /// @brief The nodes of the tree, starting with the root.
+    std::vector<Node> m_nodes{ Node() };
+    /// @brief The total energy of all quadrants, which is only known after
+    /// @ref build has been called.
+    float m_total = 0;
+    /// @brief The number of samples recorded in the tree.
+    int64_t m_samples = 0;
+
+    /// @brief Maps a direction to the unit square.
+    static Point2 toSquare(const Vector &direction) {
+        float phi = std::atan2(direction.y(), direction.x()) * Inv2Pi;
+        if (phi < 0)
+            phi += 1;
+        return { clamp(phi, 0.f, OneMinusEpsilon),
+                 clamp((1 - direction.z()) / 2, 0.f, OneMinusEpsilon) };
+    }
+
+    /// @brief Returns the quadrant containing a point of the unit square, and
+    /// maps the point to the unit square of that quadrant.
+    static int quadrant(Point2 &point) {
+        const int x = point.x() >= 0.5f;
+        const int y = point.y() >= 0.5f;
+        point       = { 2 * point.x() - x, 2 * point.y() - y };
+        return x + 2 * y;
+    }
+
+    /// @brief Sums up the energies of the quadrants below a node, returning
+    /// the energy of the node.
+    float sumUp(int node) {
+        float total = 0;
+        for (int quadrant = 0; quadrant < 4; quadrant++) {
+            if (const int child = m_nodes[node].children[quadrant])
+                m_nodes[node].energies[quadrant] = sumUp(child);
+            total += m_nodes[node].energies[quadrant];
+        }
+        return total;
+    }
+
+    /**
+     * @brief Creates children for the quadrants of a node whose energy
+     * exceeds the subdivision threshold.
+     * @param source The tree whose total energy the threshold refers to.
+     * @param sourceNode The node of @c source that covers the same region, or
+     * -1 if @c source does not subdivide the region this far (in which case
+     * its energy is split evenly among the quadrants).
+     */
+    void subdivide(int node, const DirectionalTree &source, int sourceNode,
+                   const std::array<float, 4> &energies, int depth) {
+        if (depth >= MaximumDepth)
+            return;
+        for (int quadrant = 0; quadrant < 4; quadrant++) {
+            if (!(energies[quadrant] > SubdivisionThreshold * source.m_total))
+                continue;
+
+            const int child = int(m_nodes.size());
+            m_nodes.emplace_back();
+            m_nodes[node].children[quadrant] = child;
+
+            const int sourceChild =
+                sourceNode >= 0 ? source.m_nodes[sourceNode].children[quadrant]
+                                : 0;
+            if (sourceChild) {
+                subdivide(child,
+                          source,
+                          sourceChild,
+                          source.m_nodes[sourceChild].energies,
+                          depth + 1);
+            } else {
+                const float share = energies[quadrant] / 4;
+                subdivide(child,
+                          source,
+                          -1,
+                          { share, share, share, share },
+                          depth + 1);
+            }
+        }
+    }
+
+public:
+    /// @brief The number of samples recorded in the tree.
+    int64_t samples() const { return m_samples; }
+    /// @brief Whether the tree has received energy, which is required for
+    /// sampling it to be useful.
+    bool hasEnergy() const { return m_total > 0; }
+    /// @brief Scales the number of recorded samples, e.g., when the region
+    /// of the tree is split.
+    void scaleSamples(float factor) { m_samples = int64_t(m_samples * factor); }
+
+    /// @brief Adds energy arriving from a direction to the leaf quadrant
+    /// containing it (thread-safe).
+    void record(const Vector &direction, float energy) {
+        Point2 point = toSquare(direction);
+        int node     = 0;
+        while (true) {
+            const int index = quadrant(point);
+            const int child = m_nodes[node].children[index];
+            if (!child) {
+                atomicAdd(m_nodes[node].energies[index], energy);
+                break;
+            }
+            node = child;
+        }
+        atomicAdd(m_samples, int64_t(1));
+    }
+
+    /// @brief Propagates the recorded energies to the inner nodes, which is
+    /// required before the tree can be sampled.
+    void build() { m_total = sumUp(0); }
+
+    /**
+     * @brief Returns an empty tree whose structure adapts to the energy of
+     * this tree: quadrants with a large share of the energy are subdivided,
+     * while the children of quadrants with little energy are merged.
+     */
+    DirectionalTree refined() const {
+        DirectionalTree result;
+        result.subdivide(0, *this, 0, m_nodes[0].energies, 1);
+        return result;
+    }
+
+    /// @brief Samples a direction proportional to the energy of the leaf
+    /// quadrants, returning its density with respect to solid angle in @c pdf
+    /// .
+    Vector sample(Point2 u, float &pdf) const {
+        if (!hasEnergy()) {
+            pdf = Inv4Pi;
+            return squareToUniformSphere(u);
+        }
+
+        Point2 origin(0);
+        float size    = 1;
+        float density = Inv4Pi;
+        int node      = 0;
+        while (true) {
+            const auto &energies = m_nodes[node].energies;
+            const float total =
+                energies[0] + energies[1] + energies[2] + energies[3];
+
+            // the row is picked by the vertical and the quadrant within the
+            // row by the horizontal random number
+            const float lower = (energies[0] + energies[1]) / total;
+            int y             = 0;
+            if (u.y() < lower) {
+                u.y() = u.y() / lower;
+            } else {
+                y     = 1;
+                u.y() = (u.y() - lower) / (1 - lower);
+            }
+            const float left =
+                energies[2 * y] / (energies[2 * y] + energies[2 * y + 1]);
+            int x = 0;
+            if (u.x() < left) {
+                u.x() = u.x() / left;
+            } else {
+                x     = 1;
+                u.x() = (u.x() - left) / (1 - left);
+            }
+            u = { min(u.x(), OneMinusEpsilon), min(u.y(), OneMinusEpsilon) };
+
+            const int index = x + 2 * y;
+            density *= 4 * energies[index] / total;
+            size /= 2;
+            origin = { origin.x() + x * size, origin.y() + y * size };
+            if (!m_nodes[node].children[index])
+                break;
+            node = m_nodes[node].children[index];
+        }
+
+        pdf = density;
+        return squareToUniformSphere(
+            { origin.x() + size * u.x(), origin.y() + size * u.y() });
+    }
+
+    /// @brief Returns the density of sampling a direction with respect to
+    /// solid angle.
+    float pdf(const Vector &direction) const {
+        if (!hasEnergy())
+            return Inv4Pi;
+
+        Point2 point  = toSquare(direction);
+        float density = Inv4Pi;
+        int node      = 0;
+        while (true) {
+            const auto &energies = m_nodes[node].energies;
+            const int index      = quadrant(point);
+            if (!(energies[index] > 0))
+                return 0;
+            density *= 4 * energies[index] /
+                       (energies[0] + energies[1] + energies[2] + energies[3]);
+            if (!m_nodes[node].children[index])
+                return density;
+            node = m_nodes[node].children[index];
+        }
+    }
+};
+
+/**
+ * @brief A spatial binary tree over the scene whose leaves hold directional
+ * trees, learning the incident radiance at every point of the scene (the
+ * "SD-tree" of Müller et al., 2017, "Practical Path Guiding for Efficient
+ * Light-Transport Simulation").
+ * Each leaf holds one directional tree that is sampled and one that records
+ * samples, which take each other's place after every training pass.
+ */
+class GuidingTree {
+    struct Node {
+        /// @brief The axis along which the node is split in half.
+        int axis;
+        /// @brief The index of the first of the two children, or 0 for leaf
+        /// nodes (the root cannot be a child).
+        int children;
+        /// @brief The index of the leaf data of leaf nodes.
+        int leaf;
+    };
+
+public:
+    struct Leaf {
+        /// @brief The distribution that directions are sampled from.
+        DirectionalTree sampling;
+        /// @brief The distribution that samples are recorded in.
+        DirectionalTree building;
+    };
+
+private:
+    /// @brief The cube covering the scene.
+    Bounds m_bounds;
+    /// @brief The nodes of the tree, starting with the root.
+    std::vector<Node> m_nodes;
+    /// @brief The data of all leaf nodes.
+    std::vector<Leaf> m_leaves;
+
+    /// @brief Splits a leaf node in half as long as its samples exceed the
+    /// threshold.
+    void split(int node, int64_t threshold) {
+        if (m_nodes[node].children) {
+            split(m_nodes[node].children, threshold);
+            split(m_nodes[node].children + 1, threshold);
+            return;
+        }
+        const int leaf = m_nodes[node].leaf;
+        if (m_leaves[leaf].building.samples() <= threshold)
+            return;
+
+        // both halves start from the distribution of the whole leaf, and
+        // are assumed to have received half of its samples
+        m_leaves[leaf].building.scaleSamples(0.5f);
+        m_leaves.push_back(m_leaves[leaf]);
+
+        const int axis     = (m_nodes[node].axis + 1) % 3;
+        const int children = int(m_nodes.size());
+        m_nodes.push_back({ .axis = axis, .children = 0, .leaf = leaf });
+        m_nodes.push_back(
+            { .axis = axis, .children = 0, .leaf = int(m_leaves.size()) - 1 });
+        m_nodes[node].children = children;
+        split(children, threshold);
+        split(children + 1, threshold);
+    }
+
+public:
+    GuidingTree() = default;
+
+    /// @brief Creates a tree with a single leaf that covers the given scene
+    /// bounds.
+    explicit GuidingTree(const Bounds &bounds) {
+        Point center(0);
+        float extent = 1;
+        if (!bounds.isEmpty() && !bounds.isUnbounded()) {
+            center = bounds.center();
+            extent = max(bounds.diagonal().maxComponent(), Epsilon);
+        }
+        // a cube, so that repeated splits produce cells of equal extents
+        m_bounds = Bounds(center - Vector(extent / 2), center + Vector(extent / 2));
+        m_nodes.push_back({ .axis = 0, .children = 0, .leaf = 0 });
+        m_leaves.emplace_back();
+    }
+
+    /// @brief The number of leaves of the tree.
+    int leafCount() const { return int(m_leaves.size()); }
+
+    /// @brief Returns the leaf containing a point.
+    Leaf &lookup(const Point &position) {
+        Point point;
+        for (int dim = 0; dim < 3; dim++)
+            point[dim] = clamp((position[dim] - m_bounds.min()[dim]) /
+                                   m_bounds.diagonal()[dim],
+                               0.f,
+                               1.f);
+
+        int node = 0;
+        while (m_nodes[node].children) {
+            const int axis   = m_nodes[node].axis;
+            const int second = point[axis] >= 0.5f;
+            point[axis]      = 2 * point[axis] - second;
+            node             = m_nodes[node].children + second;
+        }
+        return m_leaves[m_nodes[node].leaf];
+    }
+
+    /**
+     * @brief Prepares the tree for the next training pass: leaves with more
+     * recorded samples than the threshold are split, the recorded
+     * distributions are used for sampling, and empty distributions that adapt
+     * to them start recording.
+     */
+    void update(int64_t threshold) {
+        for (auto &leaf : m_leaves)
+            leaf.building.build();
+        split(0, threshold);
+        for (auto &leaf : m_leaves) {
+            leaf.sampling = leaf.building;
+            leaf.building = leaf.sampling.refined();
+        }
+    }
+};
+
+/**
+ * @brief A path tracer that learns the incident radiance in the scene and
+ * samples directions proportional to it (path guiding).
+ *
+ * Before rendering, the image is rendered in training passes of 1, 2, 4, ...
+ * samples per pixel (as long as they fit within @c trainingSamples samples
+ * per pixel in total). Every pass records the radiance its paths find in a
+ * @ref GuidingTree , and samples directions from the distribution recorded by
+ * the previous pass. The image is then rendered using the last recorded
+ * distribution, with @c bsdfSamplingFraction of all directions still sampled
+ * from the BSDF, and both strategies combined with multiple importance
+ * sampling. Specular BSDFs are always sampled directly.
+ */
+class GuidedPathtracerIntegrator : public SamplingIntegrator {
+    /// @brief A vertex of a training path, whose incident radiance is
+    /// recorded once the path has ended.
+    struct Vertex {
+        /// @brief The leaf of the guiding tree containing the vertex.
+        GuidingTree::Leaf *leaf;
+        /// @brief The direction the path was continued in.
+        Vector direction;
+        /// @brief The density of sampling @c direction .
+        float pdf;
+        /// @brief The product of the BSDF weights of all later vertices.
+        Color weight;
+        /// @brief The radiance arriving at the vertex from @c direction .
+        Color radiance;
+    };
+
+    int depth;
+    /// @brief The number of samples per pixel spent on training in total.
+    int m_trainingSamples;
+    /// @brief The number of recorded samples above which leaves of the
+    /// guiding tree are split after the first training pass (grows with the
+    /// square root of the number of samples per pass).
+    float m_spatialThreshold;
+    /// @brief The probability of sampling directions from the BSDF instead of
+    /// the guiding tree.
+    float m_bsdfSamplingFraction;
+
+    /// @brief The learned distributions of incident radiance.
+    GuidingTree m_guiding;
+    /// @brief Whether paths record their radiance in the guiding tree.
+    bool m_isTraining = false;
+
+    /// @brief Renders the training passes.
+    void train() {
+        m_guiding = GuidingTree(m_scene->getBoundingBox());
+
+        const Vector2i resolution = m_scene->camera()->resolution();
+        int spent = 0, passes = 0;
+        m_isTraining = true;
+        for (int samples = 1; spent + samples <= m_trainingSamples;
+             samples *= 2) {
+            logger(EInfo,
+                   "training pass %d with %d samples per pixel",
+                   passes + 1,
+                   samples);
+            forEachBlock(resolution, [&](const Bounds2i &block) {
+                const ref<Sampler> rng = m_sampler->clone();
+                for (auto pixel : block) {
+                    for (int sample = 0; sample < samples; sample++) {
+                        // training samples use negative indices, so that
+                        // they are independent of those of the final image
+                        rng->seed(pixel, -1 - spent - sample);
+                        const auto cameraSample =
+                            m_scene->camera()->sample(pixel, *rng);
+                        Li(cameraSample.ray, *rng);
+                    }
+                }
+            });
+            spent += samples;
+            passes++;
+            m_guiding.update(
+                int64_t(m_spatialThreshold * std::sqrt(float(samples))));
+        }
+        m_isTraining = false;
+
+        logger(EInfo,
+               "trained guiding in %d passes, using %d spatial leaves",
+               passes,
+               m_guiding.leafCount());
+    }
+
+public:
+    GuidedPathtracerIntegrator(const Properties &properties)
+        : SamplingIntegrator(properties) {
+        depth             = properties.get<int>("depth", 2);
+        m_trainingSamples = properties.get<int>(
+            "trainingSamples", max(m_sampler->samplesPerPixel() / 2, 1));
+        m_spatialThreshold =
+            properties.get<float>("spatialThreshold", 12000);
+        m_bsdfSamplingFraction =
+            properties.get<float>("bsdfSamplingFraction", 0.5f);
+    }
+
+    void execute() override {
+        if (m_image)
+            train();
+        SamplingIntegrator::execute();
+    }
+
+    Color Li(const Ray &ray, Sampler &rng) override {
+        return Li(ray, m_scene->intersect(ray, rng), rng);
+    }
+
+    Color Li(const Ray &ray, const Intersection &cameraIts,
+             Sampler &rng) override {
+        Color li(0);
+
+        Ray cur_ray       = ray;
+        Color path_weight = Color(1);
+        // the density of the direction of cur_ray (camera rays cannot be
+        // found by light sampling)
+        float bsdf_pdf = Infinity;
+
+        // the vertices whose radiance is recorded (only while training)
+        std::vector<Vertex> vertices;
+        // whether the direction of cur_ray was recorded as last vertex
+        bool isRecorded = false;
+        // adds radiance that reaches the camera through all recorded
+        // vertices
+        const auto splat = [&](const Color &radiance) {
+            for (auto &vertex : vertices)
+                vertex.radiance += vertex.weight * radiance;
+        };
+
+        for (int cur_depth = 0; cur_depth < depth; cur_depth++) {
+            // the camera ray has already been intersected
+            Intersection its = cur_depth == 0
+                                   ? cameraIts
+                                   : m_scene->intersect(cur_ray, rng);
+
+            // emission is weighted against light sampling as in the
+            // pathtracer, but the last vertex records the full emission
+            // arriving from its direction
+            const Color emission = its.evaluateEmission().value;
+            float mis            = 1;
+            if (its.lightProbability > 0) {
+                const float light_pdf =
+                    its.lightProbability *
+                    its.light()->pdfDirect(cur_ray.origin, its);
+                mis = powerHeuristic(bsdf_pdf, light_pdf);
+            }
+            li += emission * path_weight * mis;
+            if (!vertices.empty()) {
+                const Color weighted = emission * mis;
+                splat(weighted);
+                if (isRecorded)
+                    vertices.back().radiance += emission - weighted;
+            }
+
+            if (!its) {
+                break;
+            }
+
+            GuidingTree::Leaf &leaf = m_guiding.lookup(its.position);
+            const bool isGuided     = leaf.sampling.hasEnergy();
+            // the density of the combined strategies, given that of the BSDF
+            const auto combinedPdf = [&](const Vector &wi, float pdf) {
+                if (!isGuided || std::isinf(pdf))
+                    return pdf;
+                return m_bsdfSamplingFraction * pdf +
+                       (1 - m_bsdfSamplingFraction) * leaf.sampling.pdf(wi);
+            };
+
+            if (m_scene->hasLights()) {
+                LightSample light = m_scene->sampleLight(its.position, rng);
+
+                if (!light.isInvalid() && light.probability > 0) {
+                    DirectLightSample sample =
+                        light.light->sampleDirect(its.position, rng);
+                    Ray reverse_light_ray(its.position, sample.wi);
+
+                    if (!m_scene->intersect(
+                            reverse_light_ray, sample.distance, rng)) {
+                        const BsdfEval bsdf = its.evaluateBsdf(sample.wi);
+                        const float mis =
+                            cur_depth + 1 < depth
+                                ? powerHeuristic(
+                                      light.probability * sample.pdf,
+                                      combinedPdf(sample.wi, bsdf.pdf))
+                                : 1;
+                        const Color radiance = sample.weight * bsdf.value /
+                                               light.probability * mis;
+                        li += radiance * path_weight;
+                        splat(radiance);
+                    }
+                }
+            }
+
+            // the BSDF is always sampled, which reveals whether it is
+            // specular (and hence cannot be guided)
+            BsdfSample bsdf_sample = its.sampleBsdf(rng);
+            Vector wi              = bsdf_sample.wi;
+            Color weight           = bsdf_sample.weight;
+            float pdf              = bsdf_sample.pdf;
+            if (isGuided && !std::isinf(pdf)) {
+                if (rng.next() >= m_bsdfSamplingFraction) {
+                    float guidePdf;
+                    wi = leaf.sampling.sample(rng.next2D(), guidePdf);
+                    const BsdfEval bsdf = its.evaluateBsdf(wi);
+                    pdf    = m_bsdfSamplingFraction * bsdf.pdf +
+                          (1 - m_bsdfSamplingFraction) * guidePdf;
+                    weight = pdf > 0 ? bsdf.value / pdf : Color(0);
+                } else if (!bsdf_sample.isInvalid()) {
+                    const Color value = bsdf_sample.weight * bsdf_sample.pdf;
+                    pdf               = combinedPdf(wi, bsdf_sample.pdf);
+                    weight            = value / pdf;
+                }
+            }
+            if (weight == Color(0)) {
+                break;
+            }
+
+            if (m_isTraining) {
+                for (auto &vertex : vertices)
+                    vertex.weight *= weight;
+                isRecorded = !std::isinf(pdf);
+                if (isRecorded)
+                    vertices.push_back({ .leaf      = &leaf,
+                                         .direction = wi.normalized(),
+                                         .pdf       = pdf,
+                                         .weight    = Color(1),
+                                         .radiance  = Color(0) });
+            }
+
+            cur_ray = Ray(its.position, wi.normalized());
+            path_weight *= weight;
+            bsdf_pdf = pdf;
+        }
+
+        // the energy of a direction is estimated by the radiance arriving
+        // from it, divided by the density of sampling it
+        for (const auto &vertex : vertices) {
+            const float energy = vertex.radiance.mean() / vertex.pdf;
+            if (std::isfinite(energy) && energy >= 0)
+                vertex.leaf->building.record(vertex.direction, energy);
+        }
+
+        return li;
+    }
+
+    bool tracesCameraPackets() const override { return true; }
+
+    std::string toString() const override {
+        return tfm::format(
+            "GuidedPathtracerIntegrator[\n"
+            "  depth = %d,\n"
+            "  trainingSamples = %d,\n"
+            "  bsdfSamplingFraction = %f\n"
+            "]",
+            depth,
+            m_trainingSamples,
+            m_bsdfSamplingFraction);
+    }
+};
+
+} // namespace lightwave
+
+REGISTER_INTEGRATOR(GuidedPathtracerIntegrator, "guided_pathtracer")
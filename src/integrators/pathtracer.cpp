@@ -1,102 +1,433 @@
 #include <lightwave.hpp>
 
+#include <vector>
+
 namespace lightwave {
+
+/**
+ * @brief Averages the luminance of the radiance reflected by surfaces within
+ * the cells of a uniform grid over the scene. Cells are stored in a hash
+ * table, and cells that collide share their average.
+ */
+class RadianceCache {
+    /// @brief The number of cells along the largest extent of the scene.
+    static constexpr int Resolution = 64;
+    /// @brief The number of entries of the hash table.
+    static constexpr int TableSize = 1 << 18;
+
+    struct Entry {
+        /// @brief The sum of all recorded luminances.
+        float sum = 0;
+        /// @brief The number of recorded luminances.
+        float count = 0;
+    };
+
+    /// @brief The hash table of all cells.
+    std::vector<Entry> m_entries;
+    /// @brief The corner of the grid.
+    Point m_origin;
+    /// @brief The number of cells per unit length.
+    float m_inverseCellSize = 0;
+
+    /// @brief Returns the index of the entry of the cell containing a point.
+    size_t index(const Point &position) const {
+        const Vector cell = (position - m_origin) * m_inverseCellSize;
+        return uint64_t(hash::fnv1a(int(std::floor(cell.x())),
+                                    int(std::floor(cell.y())),
+                                    int(std::floor(cell.z())))) %
+               TableSize;
+    }
+
+public:
+    RadianceCache() = default;
+
+    /// @brief Creates an empty cache for a scene with the given bounds.
+    explicit RadianceCache(const Bounds &bounds)
+        : m_entries(TableSize), m_origin(0), m_inverseCellSize(Resolution) {
+        if (!bounds.isEmpty() && !bounds.isUnbounded()) {
+            m_origin          = bounds.min();
+            m_inverseCellSize = Resolution /
+                                max(bounds.diagonal().maxComponent(), Epsilon);
+        }
+    }
+
+    /// @brief Records the luminance of radiance reflected at a point
+    /// (thread-safe).
+    void record(const Point &position, float luminance) {
+        Entry &entry = m_entries[index(position)];
+        atomicAdd(entry.sum, luminance);
+        atomicAdd(entry.count, 1.f);
+    }
+
+    /// @brief Returns the average luminance reflected around a point, or 0 if
+    /// nothing has been recorded there.
+    float lookup(const Point &position) const {
+        if (m_entries.empty())
+            return 0;
+        const Entry &entry = m_entries[index(position)];
+        return entry.count > 0 ? entry.sum / entry.count : 0;
+    }
+};
+
+/**
+ * @brief A unidirectional path tracer with next event estimation.
+ *
+ * Paths are traced until they reach @c depth unless @c roulette is enabled, in
+ * which case paths can be terminated early (Russian roulette) from vertex
+ * @c rouletteDepth on, with their throughput divided by the probability of
+ * surviving to keep the image unbiased:
+ * - @c throughput continues paths with a probability given by the largest
+ * component of their throughput,
+ * - @c adjoint estimates the expected contribution of a path by scaling its
+ * throughput by the radiance reflected at the vertex, relative to the radiance
+ * reflected at the first vertex of the path (which approximates the value of
+ * the pixel). Both are taken from a radiance cache that is learned in a
+ * pre-pass of @c cacheSamples samples per pixel. Paths whose expected
+ * contribution falls below a window around one are terminated with Russian
+ * roulette, while paths above the window are split into up to @c splitting
+ * paths (a simplified version of adjoint-driven Russian roulette and
+ * splitting, Vorba and Křivánek, 2016).
+ *
+ * Light samples are selected among @c lightCandidates candidates by their
+ * unshadowed contribution (see @ref SamplingIntegrator::sampleLightResampled
+ * ).
+ */
 class PathtracerIntegrator : public SamplingIntegrator {
+    /// @brief How the expected contribution of paths is estimated.
+    enum class Roulette {
+        /// @brief Paths are neither terminated early nor split.
+        None,
+        /// @brief By the throughput of the path.
+        Throughput,
+        /// @brief By the throughput, scaled by the reflected radiance
+        /// relative to the pixel.
+        Adjoint,
+    };
+
+    /// @brief The ratio of the upper and lower bound of the window of
+    /// expected contributions within which paths are neither terminated nor
+    /// split by adjoint roulette (the window is centered around one).
+    static constexpr float WindowRatio = 5;
+
+    /// @brief A path that has been split off, which is traced once the
+    /// current path ends.
+    struct Branch {
+        /// @brief The ray the path continues with.
+        Ray ray;
+        /// @brief The throughput of the path.
+        Color weight;
+        /// @brief The density of the direction of @c ray .
+        float pdf;
+        /// @brief The depth of the vertex the ray leads to.
+        int depth;
+    };
+
+    /// @brief A vertex of a path traced to learn the radiance cache.
+    struct CacheVertex {
+        /// @brief The position of the vertex.
+        Point position;
+        /// @brief The product of the BSDF weights of all later vertices.
+        Color weight;
+        /// @brief The radiance reflected at the vertex.
+        Color radiance;
+    };
+
+    /// @brief The number of decisions of Russian roulette and splitting.
+    struct Statistics {
+        /// @brief The number of vertices at which the expected contribution
+        /// was estimated.
+        int64_t vertices = 0;
+        /// @brief The number of paths that were terminated.
+        int64_t terminated = 0;
+        /// @brief The number of paths that were split.
+        int64_t split = 0;
+        /// @brief The number of paths that split paths were split into.
+        int64_t branches = 0;
+    };
+
     int depth;
+    /// @brief How the expected contribution of paths is estimated.
+    Roulette m_roulette;
+    /// @brief The depth from which on paths can be terminated or split.
+    int m_rouletteDepth;
+    /// @brief The maximum number of paths a path is split into.
+    int m_splitting;
+    /// @brief The number of samples per pixel used to learn the radiance
+    /// cache.
+    int m_cacheSamples;
+    /// @brief The number of candidates light samples are selected from.
+    int m_lightCandidates;
+
+    /// @brief The radiance reflected by surfaces (only for adjoint roulette).
+    RadianceCache m_cache;
+    /// @brief Whether paths record their radiance in the radiance cache.
+    bool m_isCaching = false;
+    /// @brief The decisions of Russian roulette and splitting in the current
+    /// render.
+    Statistics m_statistics;
+
+    /// @brief Renders the pre-pass that learns the radiance cache.
+    void learnCache() {
+        m_cache = RadianceCache(m_scene->getBoundingBox());
+
+        m_isCaching = true;
+        forEachBlock(m_scene->camera()->resolution(),
+                     [&](const Bounds2i &block) {
+                         const ref<Sampler> rng = m_sampler->clone();
+                         for (auto pixel : block) {
+                             for (int sample = 0; sample < m_cacheSamples;
+                                  sample++) {
+                                 // negative indices keep the pre-pass
+                                 // independent of the final image
+                                 rng->seed(pixel, -1 - sample);
+                                 const auto cameraSample =
+                                     m_scene->camera()->sample(pixel, *rng);
+                                 Li(cameraSample.ray, *rng);
+                             }
+                         }
+                     });
+        m_isCaching = false;
+    }
+
+    /**
+     * @brief Decides how many paths continue from a vertex (0 if the path is
+     * terminated), and scales the throughput of each of them accordingly.
+     * @param pixel The radiance reflected at the first vertex of the path (0
+     * if unknown).
+     */
+    int continuations(Color &path_weight, const Point &position, float pixel,
+                      Sampler &rng) const {
+        float expected =
+            max(path_weight.r(), max(path_weight.g(), path_weight.b()));
+        if (m_roulette == Roulette::Throughput) {
+            if (expected >= 1)
+                return 1;
+            if (!(rng.next() < expected))
+                return 0;
+            path_weight /= expected;
+            return 1;
+        }
+
+        // vertices without cached radiance fall back to the throughput
+        if (pixel > 0) {
+            if (const float reflected = m_cache.lookup(position))
+                expected *= reflected / pixel;
+        }
+        const float lower = 2 / (1 + WindowRatio);
+        if (expected < lower) {
+            if (!(rng.next() < expected))
+                return 0;
+            path_weight /= expected;
+            return 1;
+        }
+        if (expected > WindowRatio * lower) {
+            const int copies = min(int(expected), m_splitting);
+            path_weight /= float(copies);
+            return copies;
+        }
+        return 1;
+    }
 
 public:
     PathtracerIntegrator(const Properties &properties)
         : SamplingIntegrator(properties) {
         depth = properties.get<int>("depth", 2);
+        // clang-format off
+        m_roulette = properties.getEnum<Roulette>("roulette", Roulette::None, {
+            { "none",       Roulette::None       },
+            { "throughput", Roulette::Throughput },
+            { "adjoint",    Roulette::Adjoint    },
+        });
+        // clang-format on
+        m_rouletteDepth = properties.get<int>("rouletteDepth", 2);
+        m_splitting     = max(properties.get<int>("splitting", 4), 1);
+        m_cacheSamples  = properties.get<int>("cacheSamples", 4);
+        m_lightCandidates =
+            max(properties.get<int>("lightCandidates", 1), 1);
+    }
+
+    void execute() override {
+        if (m_image && m_roulette == Roulette::Adjoint)
+            learnCache();
+
+        m_statistics = {};
+        SamplingIntegrator::execute();
+
+        if (m_roulette != Roulette::None) {
+            logger(EInfo,
+                   "roulette at %s vertices terminated %s paths and split %s "
+                   "paths into %s",
+                   thousands(m_statistics.vertices),
+                   thousands(m_statistics.terminated),
+                   thousands(m_statistics.split),
+                   thousands(m_statistics.branches));
+        }
     }
 
     Color Li(const Ray &ray, Sampler &rng) override {
+        return Li(ray, m_scene->intersect(ray, rng), rng);
+    }
+
+    Color Li(const Ray &ray, const Intersection &cameraIts,
+             Sampler &rng) override {
         // Start with the emission of the hit object/background
         Color li(0);
 
         Ray cur_ray       = ray;
         Color path_weight = Color(1);
+        // the density of the direction of cur_ray (camera rays cannot be
+        // found by light sampling)
+        float bsdf_pdf  = Infinity;
+        int start_depth = 0;
 
-        float p_bsdf = 1.0f;
+        // paths that have been split off and still need to be traced
+        std::vector<Branch> branches;
+        // the radiance reflected at the first vertex
+        float pixel_estimate = 0;
+        Statistics statistics;
 
-        for (int cur_depth = 0; cur_depth < depth; cur_depth++) {
-            Intersection its = m_scene->intersect(cur_ray, rng);
+        // the vertices whose reflected radiance is recorded (only while
+        // learning the radiance cache)
+        std::vector<CacheVertex> vertices;
+        const auto splat = [&](const Color &radiance) {
+            for (auto &vertex : vertices)
+                vertex.radiance += vertex.weight * radiance;
+        };
 
-            // If no intersection was found: we add contribution of background
-            if (!its) {
-                li += its.evaluateEmission().value * path_weight;
-                break;
-            }
+        while (true) {
+            for (int cur_depth = start_depth; cur_depth < depth; cur_depth++) {
+                // the camera ray has already been intersected
+                Intersection its = cur_depth == 0
+                                       ? cameraIts
+                                       : m_scene->intersect(cur_ray, rng);
+
+                // Emission of lights that can also be found by next event
+                // estimation is weighted against it (multiple importance
+                // sampling), so that every light counts exactly once
+                Color emission = its.evaluateEmission().value;
+                if (its.lightProbability > 0) {
+                    const float light_pdf =
+                        its.lightProbability *
+                        its.light()->pdfDirect(cur_ray.origin, its);
+                    emission *= powerHeuristic(bsdf_pdf, light_pdf);
+                }
+                li += emission * path_weight;
+                splat(emission);
+
+                // If no intersection was found: the path ends in the
+                // background
+                if (!its) {
+                    break;
+                }
+
+                if (m_isCaching)
+                    vertices.push_back({ .position = its.position,
+                                         .weight   = Color(1),
+                                         .radiance = Color(0) });
+                if (cur_depth == 0 && m_roulette == Roulette::Adjoint)
+                    pixel_estimate = m_cache.lookup(its.position);
+
+                // Compute direct illumination
+                if (m_scene->hasLights()) {
+                    const ResampledLightSample light =
+                        sampleLightResampled(its, m_lightCandidates, rng);
+
+                    if (light) {
+                        Ray reverse_light_ray(its.position, light.sample.wi);
 
-            // Compute direct illumination
-            Color light_contribution(0);
-            float p_ne = 0.0f;
-
-            if (m_scene->hasLights()) {
-                LightSample light = m_scene->sampleLight(rng);
-
-                if (!light.isInvalid() && light.probability >= Epsilon) {
-                    DirectLightSample sample =
-                        light.light->sampleDirect(its.position, rng);
-                    Ray reverse_light_ray(its.position, sample.wi);
-
-                    // If light is occluded: return black
-                    // light is occluded if there is an intersection from the
-                    // surface to the light source
-                    Intersection light_its =
-                        m_scene->intersect(reverse_light_ray, rng);
-                    if (!light_its && light_its.t >= sample.distance) {
-                        light_contribution = sample.weight *
-                                             its.evaluateBsdf(sample.wi).value /
-                                             light.probability;
-                        p_ne = sample.pdf;
+                        // light is occluded if there is an intersection from
+                        // the surface to the light source
+                        if (!m_scene->intersect(reverse_light_ray,
+                                                light.sample.distance,
+                                                rng)) {
+                            // the last light sample is not weighted, as the
+                            // path is not continued to find the light by BSDF
+                            // sampling
+                            const float mis =
+                                cur_depth + 1 < depth
+                                    ? powerHeuristic(light.pdf, light.bsdf.pdf)
+                                    : 1;
+                            const Color radiance = light.contribution * mis;
+                            li += radiance * path_weight;
+                            splat(radiance);
+                        }
                     }
                 }
-            }
 
-            // Compute bsdf contribution
-            Color bsdf_contribution = its.evaluateEmission().value;
-
-            // Compute balance heuristics
-            float weight_bsdf;
-            float weight_ne;
-
-            float pdf_sum = p_ne + p_bsdf;
-            if (pdf_sum > 0 && p_ne < Infinity && p_bsdf < Infinity) {
-                weight_bsdf = p_bsdf / pdf_sum;
-                weight_ne   = p_ne / pdf_sum;
-            } else if (p_ne == Infinity) {
-                weight_bsdf = 0.0f;
-                weight_ne   = 1.0f;
-            } else {
-                weight_bsdf = 1.0f;
-                weight_ne   = 0.0f;
-            }
+                //-----------------------------------
 
-            Color contribution = bsdf_contribution * weight_bsdf +
-                                 light_contribution * weight_ne;
+                // Terminate or split paths based on their expected
+                // contribution
+                int copies = 1;
+                if (m_roulette != Roulette::None && !m_isCaching &&
+                    cur_depth >= m_rouletteDepth && cur_depth + 1 < depth) {
+                    copies = continuations(
+                        path_weight, its.position, pixel_estimate, rng);
+                    statistics.vertices++;
+                    if (copies == 0) {
+                        statistics.terminated++;
+                        break;
+                    }
+                }
+                if (copies > 1) {
+                    // every copy continues in its own direction, and is
+                    // traced after the current path
+                    statistics.split++;
+                    statistics.branches += copies;
+                    for (int copy = 0; copy < copies; copy++) {
+                        BsdfSample bsdf_sample = its.sampleBsdf(rng);
+                        if (bsdf_sample.isInvalid())
+                            continue;
+                        branches.push_back({
+                            .ray    = Ray(its.position,
+                                       bsdf_sample.wi.normalized()),
+                            .weight = path_weight * bsdf_sample.weight,
+                            .pdf    = bsdf_sample.pdf,
+                            .depth  = cur_depth + 1,
+                        });
+                    }
+                    break;
+                }
 
-            li += contribution * path_weight;
+                // Sample direction w_i to continue the path
+                BsdfSample bsdf_sample = its.sampleBsdf(rng);
+                if (bsdf_sample.isInvalid()) {
+                    break;
+                }
+                // Trace ray to find next point
+                Ray bsdf_ray(its.position, bsdf_sample.wi.normalized());
+                cur_ray = bsdf_ray;
 
-            //-----------------------------------
+                path_weight *= bsdf_sample.weight;
+                bsdf_pdf = bsdf_sample.pdf;
+                for (auto &vertex : vertices)
+                    vertex.weight *= bsdf_sample.weight;
+            }
 
-            // Sample direction w_i to continue the path
-            BsdfSample bsdf_sample = its.sampleBsdf(rng);
-            if (bsdf_sample.isInvalid()) {
+            if (branches.empty())
                 break;
-            }
-            // Trace ray to find next point
-            Ray bsdf_ray(its.position, bsdf_sample.wi.normalized());
-            cur_ray = bsdf_ray;
+            const Branch branch = branches.back();
+            branches.pop_back();
+            cur_ray     = branch.ray;
+            path_weight = branch.weight;
+            bsdf_pdf    = branch.pdf;
+            start_depth = branch.depth;
+        }
 
-            // Compute bsdf contribution
-            p_bsdf = bsdf_sample.pdf;
-            path_weight *= bsdf_sample.weight;
+        for (const auto &vertex : vertices)
+            m_cache.record(vertex.position, vertex.radiance.luminance());
+        if (statistics.vertices > 0) {
+            atomicAdd(m_statistics.vertices, statistics.vertices);
+            atomicAdd(m_statistics.terminated, statistics.terminated);
+            atomicAdd(m_statistics.split, statistics.split);
+            atomicAdd(m_statistics.branches, statistics.branches);
         }
 
         return li;
     }
 
+    bool tracesCameraPackets() const override { return true; }
+
     std::string toString() const override { return "PathtracerIntegrator[]"; }
 };
 } // namespace lightwave
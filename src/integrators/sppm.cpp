@@ -0,0 +1,452 @@
+#include <lightwave.hpp>
+
+#include <algorithm>
+#include <mutex>
+#include <numeric>
+#include <vector>
+
+namespace lightwave {
+
+/**
+ * @brief A spatial hash grid over the visible points of all pixels, which is
+ * rebuilt once per iteration.
+ *
+ * The grid is stored in compressed form: all points overlapping a cell are
+ * stored consecutively, and each entry of the hash table holds the offset of
+ * its first point. Both arrays are sized once and reused, so that the memory
+ * stays bounded no matter how many iterations are rendered.
+ */
+class VisiblePointGrid {
+    /// @brief The number of visible points processed per task.
+    static constexpr int ChunkSize = 1024;
+
+    /// @brief The offset of the first point of each entry of the hash table,
+    /// followed by the total number of stored points.
+    std::vector<int64_t> m_offsets;
+    /// @brief The indices of the points overlapping each entry, ordered by
+    /// entry.
+    std::vector<int> m_points;
+    /// @brief The number of cells per unit length.
+    float m_inverseCellSize = 0;
+
+    /// @brief Returns the cell containing a point.
+    Vector3i cell(const Point &position) const {
+        const Vector scaled = (position - Point(0)) * m_inverseCellSize;
+        return Vector3i(int(std::floor(scaled.x())),
+                       int(std::floor(scaled.y())),
+                       int(std::floor(scaled.z())));
+    }
+
+    /// @brief Returns the index of the entry of a cell.
+    size_t index(const Vector3i &cell) const {
+        return uint64_t(hash::fnv1a(cell.x(), cell.y(), cell.z())) %
+               (m_offsets.size() - 1);
+    }
+
+    /// @brief Invokes @c f once for the index of each entry that the sphere
+    /// around a point overlaps.
+    template <typename F>
+    void forEachEntry(const Point &position, float radius, F f) const {
+        const Vector3i min = cell(position - Vector(radius));
+        const Vector3i max = cell(position + Vector(radius));
+
+        // cells are as large as the diameter, so spheres usually overlap at
+        // most two of them along each axis, some of which may share an entry
+        size_t visited[27];
+        int count = 0;
+        for (int z = min.z(); z <= max.z(); z++) {
+            for (int y = min.y(); y <= max.y(); y++) {
+                for (int x = min.x(); x <= max.x(); x++) {
+                    const size_t entry = index(Vector3i(x, y, z));
+                    if (std::find(visited, visited + count, entry) !=
+                        visited + count)
+                        continue;
+                    visited[count++] = entry;
+                    f(entry);
+                }
+            }
+        }
+    }
+
+public:
+    /// @brief Creates an empty grid whose hash table has the given number of
+    /// entries.
+    explicit VisiblePointGrid(int tableSize) : m_offsets(tableSize + 1, 0) {}
+
+    /**
+     * @brief Rebuilds the grid in parallel.
+     * @param count The number of visible points.
+     * @param position Returns the position of a point.
+     * @param radius Returns the radius of a point, or zero for points that
+     * should not be stored.
+     */
+    template <typename P, typename R>
+    void build(int count, P position, R radius) {
+        // the largest radius determines the size of the cells
+        float maxRadius = 0;
+        std::mutex mutex;
+        for_each_parallel(ChunkedRange(count, ChunkSize), [&](Range chunk) {
+            float chunkMax = 0;
+            for (int i : chunk)
+                chunkMax = max(chunkMax, radius(i));
+            std::lock_guard lock(mutex);
+            maxRadius = max(maxRadius, chunkMax);
+        });
+        std::fill(m_offsets.begin(), m_offsets.end(), 0);
+        if (maxRadius == 0) {
+            m_points.clear();
+            return;
+        }
+        m_inverseCellSize = 1 / (2 * maxRadius);
+
+        // count the points per entry, and turn the counts into offsets
+        for_each_parallel(ChunkedRange(count, ChunkSize), [&](Range chunk) {
+            for (int i : chunk) {
+                if (radius(i) > 0)
+                    forEachEntry(position(i), radius(i), [&](size_t entry) {
+                        atomicAdd(m_offsets[entry], 1);
+                    });
+            }
+        });
+        std::exclusive_scan(
+            m_offsets.begin(), m_offsets.end(), m_offsets.begin(), int64_t(0));
+        m_points.resize(m_offsets.back());
+
+        // the offsets serve as cursors while filling in the points, and end up
+        // at the start of the next entry
+        for_each_parallel(ChunkedRange(count, ChunkSize), [&](Range chunk) {
+            for (int i : chunk) {
+                if (radius(i) > 0)
+                    forEachEntry(position(i), radius(i), [&](size_t entry) {
+                        m_points[atomicAdd(m_offsets[entry], 1) - 1] = i;
+                    });
+            }
+        });
+        std::copy_backward(
+            m_offsets.begin(), m_offsets.end() - 1, m_offsets.end());
+        m_offsets.front() = 0;
+    }
+
+    /// @brief Invokes @c f for the index of every point that may lie within
+    /// its radius of a position (points of other cells sharing the same
+    /// entry need to be rejected by the caller).
+    template <typename F> void lookup(const Point &position, F f) const {
+        if (m_points.empty())
+            return;
+        const size_t entry = index(cell(position));
+        for (int64_t i = m_offsets[entry]; i < m_offsets[entry + 1]; i++)
+            f(m_points[i]);
+    }
+};
+
+/**
+ * @brief A stochastic progressive photon mapper (Hachisuka and Jensen, 2009),
+ * which renders caustics and other specular-diffuse-specular paths that the
+ * path tracer cannot find.
+ *
+ * Each iteration traces one path per pixel from the camera through specular
+ * surfaces up to the first non-specular surface (the visible point), where
+ * direct light is estimated by next event estimation. The visible points are
+ * then stored in a spatial hash grid, and @c photonsPerIteration photons are
+ * emitted from the lights (picked proportional to their power). Whenever a
+ * photon hits a surface after its first bounce, it deposits its flux at all
+ * visible points within their radius. Afterwards, the radius of each pixel
+ * shrinks depending on how many photons it has gathered (controlled by
+ * @c alpha ), so that the estimate converges to the correct result.
+ *
+ * Paths have at most @c depth bounces, as for the path tracer. Only lights
+ * emit photons, while emissive objects that are not registered as lights are
+ * only seen through specular surfaces. Camera paths, the grid construction and
+ * photons are all distributed across the thread pool, and photons are never
+ * stored, so memory only depends on the resolution.
+ */
+class StochasticProgressivePhotonMapper : public SamplingIntegrator {
+    /// @brief The number of pixels or photons processed per task.
+    static constexpr int ChunkSize = 256;
+
+    /// @brief The state of a pixel, which is carried across iterations.
+    struct PixelState {
+        /// @brief The radius within which photons are gathered.
+        float radius;
+        /// @brief The sum of the direct light (and emission seen through
+        /// specular surfaces) over all iterations.
+        Color direct = Color(0);
+        /// @brief The visible point of the current iteration.
+        Intersection its;
+        /// @brief The throughput of the camera path up to the visible point,
+        /// which is zero if the path has not found one.
+        Color weight = Color(0);
+        /// @brief The number of bounces of the camera path, including the
+        /// visible point.
+        int depth = 0;
+        /// @brief The flux gathered in the current iteration.
+        Color flux = Color(0);
+        /// @brief The number of photons gathered in the current iteration.
+        int64_t photons = 0;
+        /// @brief The accumulated number of photons after radius reduction.
+        float count = 0;
+        /// @brief The accumulated flux, scaled to the current radius.
+        Color tau = Color(0);
+    };
+
+    int m_depth;
+    int m_iterations;
+    int m_photonsPerIteration;
+    float m_initialRadius;
+    float m_alpha;
+    /// @brief The bounding box of the scene geometry, which lights that are
+    /// infinitely far away aim their photons at.
+    Bounds m_sceneBounds;
+
+    /// @brief Traces a camera path through specular surfaces, and records
+    /// its visible point and direct light.
+    void traceCameraPath(const Point2i &pixel, PixelState &state,
+                         Sampler &rng) const {
+        const CameraSample cameraSample =
+            m_scene->camera()->sample(pixel, rng);
+        Ray ray      = cameraSample.ray;
+        Color weight = cameraSample.weight;
+
+        for (int depth = 1; depth <= m_depth; depth++) {
+            const Intersection its = m_scene->intersect(ray, rng);
+            // the path only continues through specular bounces, which next
+            // event estimation cannot find lights through
+            state.direct += weight * its.evaluateEmission().value;
+            if (!its)
+                return;
+
+            const BsdfSample sample = its.sampleBsdf(rng);
+            if (!std::isinf(sample.pdf)) {
+                if (m_scene->hasLights()) {
+                    const ResampledLightSample light =
+                        sampleLightResampled(its, 1, rng);
+                    if (light && !m_scene->intersect(
+                                     Ray(its.position, light.sample.wi),
+                                     light.sample.distance,
+                                     rng))
+                        state.direct += weight * light.contribution;
+                }
+                state.its    = its;
+                state.weight = weight;
+                state.depth  = depth;
+                return;
+            }
+            if (sample.isInvalid())
+                return;
+
+            weight *= sample.weight;
+            ray = Ray(its.position, sample.wi);
+        }
+    }
+
+    /// @brief Traces a photon from a light picked proportional to its power,
+    /// and deposits its flux at the visible points it hits.
+    void tracePhoton(std::vector<PixelState> &pixels,
+                     const VisiblePointGrid &grid, Sampler &rng) const {
+        const LightSample choice = m_scene->sampleLight(rng);
+        if (choice.isInvalid() || choice.probability == 0)
+            return;
+        const EmissionSample emission =
+            choice.light->sampleEmission(m_sceneBounds, rng);
+        if (emission.isInvalid())
+            return;
+
+        Ray ray      = emission.ray();
+        Color weight = emission.weight / choice.probability;
+        for (int depth = 1; depth <= m_depth; depth++) {
+            const Intersection its = m_scene->intersect(ray, rng);
+            if (!its)
+                return;
+
+            // light arriving without a bounce is covered by next event
+            // estimation at the visible points
+            if (depth > 1) {
+                grid.lookup(its.position, [&](int index) {
+                    PixelState &state = pixels[index];
+                    if (state.depth + depth - 1 > m_depth ||
+                        (state.its.position - its.position).lengthSquared() >
+                            sqr(state.radius))
+                        return;
+                    // the density of photons already accounts for the
+                    // foreshortening that the BSDF evaluation includes
+                    const float cosine =
+                        abs(state.its.shadingNormal.dot(its.wo));
+                    const BsdfEval bsdf = state.its.evaluateBsdf(its.wo);
+                    if (cosine == 0 || bsdf.isInvalid())
+                        return;
+                    atomicAdd(state.flux, weight * bsdf.value / cosine);
+                    atomicAdd(state.photons, 1);
+                });
+            }
+            if (depth == m_depth)
+                return;
+
+            const BsdfSample sample = its.sampleBsdf(rng);
+            if (sample.isInvalid())
+                return;
+
+            // Russian roulette keeps the flux of photons roughly constant
+            const Color next          = weight * sample.weight;
+            const float survival      = weight.luminance() > 0
+                                            ? min(next.luminance() /
+                                                      weight.luminance(),
+                                                  1.f)
+                                            : 0;
+            if (survival == 0 || rng.next() >= survival)
+                return;
+            weight = next / survival;
+            ray    = Ray(its.position, sample.wi);
+        }
+    }
+
+public:
+    StochasticProgressivePhotonMapper(const Properties &properties)
+        : SamplingIntegrator(properties) {
+        m_depth      = properties.get<int>("depth", 2);
+        m_iterations = properties.get<int>("iterations",
+                                           m_sampler->samplesPerPixel());
+        m_photonsPerIteration = properties.get<int>("photonsPerIteration", 0);
+        m_initialRadius       = properties.get<float>("initialRadius", 0);
+        m_alpha               = properties.get<float>("alpha", 2.f / 3);
+    }
+
+    void execute() override {
+        if (!m_image) {
+            lightwave_throw(
+                "<integrator /> needs an <image /> child to render into!");
+        }
+        if (rendersInPasses()) {
+            logger(EWarn,
+                   "sppm renders in iterations of its own, ignoring "
+                   "progressive and adaptive sampling");
+        }
+
+        const Vector2i resolution = m_scene->camera()->resolution();
+        const int pixelCount      = resolution.product();
+        m_image->initialize(resolution);
+        m_sceneBounds = m_scene->getBoundingBox();
+
+        const int photonsPerIteration =
+            m_photonsPerIteration > 0 ? m_photonsPerIteration : pixelCount;
+        float initialRadius = m_initialRadius;
+        if (initialRadius <= 0) {
+            // a small fraction of the scene, which shrinks over time anyway
+            initialRadius = m_sceneBounds.isEmpty() ||
+                                    m_sceneBounds.isUnbounded()
+                                ? 1
+                                : 0.01f * m_sceneBounds.diagonal().length();
+        }
+
+        std::vector<PixelState> pixels(pixelCount);
+        for (auto &state : pixels)
+            state.radius = initialRadius;
+        VisiblePointGrid grid(pixelCount);
+
+        const auto pixelAt = [&](int index) {
+            return Point2i(index % resolution.x(), index / resolution.x());
+        };
+
+        Streaming stream{ *m_image };
+        ProgressReporter progress{ m_iterations };
+        for (int iteration = 0; iteration < m_iterations; iteration++) {
+            for_each_parallel(ChunkedRange(pixelCount, ChunkSize),
+                              [&](Range chunk) {
+                                  const ref<Sampler> rng = m_sampler->clone();
+                                  for (int i : chunk) {
+                                      rng->seed(pixelAt(i), iteration);
+                                      traceCameraPath(pixelAt(i),
+                                                      pixels[i],
+                                                      *rng);
+                                  }
+                              });
+
+            grid.build(
+                pixelCount,
+                [&](int i) { return pixels[i].its.position; },
+                [&](int i) {
+                    return pixels[i].weight == Color(0) ? 0
+                                                        : pixels[i].radius;
+                });
+
+            if (m_scene->hasLights()) {
+                for_each_parallel(
+                    ChunkedRange(photonsPerIteration, ChunkSize),
+                    [&](Range chunk) {
+                        const ref<Sampler> rng = m_sampler->clone();
+                        for (int photon : chunk) {
+                            // photons use a negative sample index so that
+                            // they are independent of the camera paths
+                            rng->seed(Point2i(photon, iteration), -1);
+                            tracePhoton(pixels, grid, *rng);
+                        }
+                    });
+            }
+
+            // shrink the radii, and update the image with the estimate so far
+            const float iterations = iteration + 1;
+            for_each_parallel(
+                ChunkedRange(pixelCount, ChunkSize), [&](Range chunk) {
+                    for (int i : chunk) {
+                        PixelState &state = pixels[i];
+                        if (state.photons > 0) {
+                            const float count =
+                                state.count + m_alpha * state.photons;
+                            const float radius =
+                                state.radius *
+                                std::sqrt(count /
+                                          (state.count + state.photons));
+                            state.tau = (state.tau + state.weight * state.flux) *
+                                        sqr(radius / state.radius);
+                            state.count  = count;
+                            state.radius = radius;
+                        }
+                        state.flux    = Color(0);
+                        state.photons = 0;
+                        state.weight  = Color(0);
+
+                        m_image->get(pixelAt(i)) =
+                            state.direct / iterations +
+                            state.tau / (iterations * photonsPerIteration *
+                                         Pi * sqr(state.radius));
+                    }
+                });
+
+            progress += 1;
+            stream.update();
+        }
+        progress.finish();
+
+        m_image->save();
+    }
+
+    Color Li(const Ray &ray, Sampler &rng) override {
+        // photons are shared by all pixels, hence the integrator takes care
+        // of sampling pixels itself
+        lightwave_throw("sppm does not support estimating radiance of "
+                        "individual rays");
+    }
+
+    std::string toString() const override {
+        return tfm::format(
+            "StochasticProgressivePhotonMapper[\n"
+            "  depth = %d,\n"
+            "  iterations = %d,\n"
+            "  photonsPerIteration = %d,\n"
+            "  initialRadius = %f,\n"
+            "  alpha = %f,\n"
+            "  sampler = %s,\n"
+            "  image = %s,\n"
+            "]",
+            m_depth,
+            m_iterations,
+            m_photonsPerIteration,
+            m_initialRadius,
+            m_alpha,
+            indent(m_sampler),
+            indent(m_image));
+    }
+};
+
+} // namespace lightwave
+
+REGISTER_INTEGRATOR(StochasticProgressivePhotonMapper, "sppm")
@@ -0,0 +1,346 @@
+#include <lightwave.hpp>
+
+#include <algorithm>
+#include <array>
+
+namespace lightwave {
+
+/**
+ * @brief A path tracer that advances all paths of a tile in lockstep.
+ *
+ * Instead of tracing one path after the other, the state of all paths of a
+ * tile is kept in queues (one array per attribute), and every stage of a
+ * bounce (intersection, emission, light sampling, shadow rays and BSDF
+ * sampling) processes the whole queue before the next stage starts. Between
+ * stages, the queue can be sorted by ray direction or by material, so that
+ * consecutive rays traverse similar parts of the scene or evaluate the same
+ * BSDF.
+ *
+ * Every path draws its random numbers from its own sampler in the same order
+ * as the @c pathtracer , so both integrators produce the same images (up to
+ * floating point rounding). Outside of tile rendering (e.g., when rendering
+ * progressively), paths are traced one at a time.
+ */
+class WavefrontIntegrator : public SamplingIntegrator {
+    /// @brief The order in which paths are processed by each stage.
+    enum class SortMode {
+        /// @brief Paths stay in pixel order.
+        None,
+        /// @brief Rays are grouped by octant and dominant axis of their
+        /// direction before they are intersected.
+        Direction,
+        /// @brief Hits are grouped by the BSDF of the intersected instance
+        /// before they are shaded.
+        Material,
+    };
+
+    /// @brief The state of all paths of a tile, stored as one array per
+    /// attribute.
+    struct Paths {
+        /// @brief The sampler of each path.
+        std::vector<Sampler *> samplers;
+        /// @brief The ray that is traced next by each path.
+        std::vector<Ray> rays;
+        /// @brief The closest hit of the last ray of each path.
+        std::vector<Intersection> hits;
+        /// @brief The product of the BSDF weights along each path.
+        std::vector<Color> throughputs;
+        /// @brief The density of the direction of the ray of each path (used
+        /// to weigh emission against light sampling).
+        std::vector<float> pdfs;
+        /// @brief The radiance gathered by each path so far.
+        std::vector<Color> radiances;
+        /// @brief The indices of the paths that have not terminated yet.
+        std::vector<int> active;
+        /// @brief Scratch space for reordering the active paths.
+        std::vector<int> sorted;
+
+        /// @brief Queue of shadow rays generated by light sampling.
+        struct {
+            /// @brief The path each shadow ray belongs to.
+            std::vector<int> paths;
+            /// @brief The shadow rays, pointing towards the light.
+            std::vector<Ray> rays;
+            /// @brief The distance to the light along each shadow ray.
+            std::vector<float> distances;
+            /// @brief The radiance each path receives if the light is
+            /// visible.
+            std::vector<Color> contributions;
+
+            void clear() {
+                paths.clear();
+                rays.clear();
+                distances.clear();
+                contributions.clear();
+            }
+        } shadow;
+
+        void resize(int count) {
+            samplers.resize(count);
+            rays.resize(count);
+            hits.resize(count);
+            throughputs.resize(count);
+            pdfs.resize(count);
+            radiances.resize(count);
+            active.reserve(count);
+        }
+
+        /// @brief Starts a new path from the given ray.
+        void start(int path, const Ray &ray) {
+            rays[path]        = ray;
+            throughputs[path] = Color(1);
+            pdfs[path]        = Infinity;
+            radiances[path]   = Color(0);
+            active.push_back(path);
+        }
+    };
+
+    int m_depth;
+    SortMode m_sort;
+
+    /// @brief The number of distinct results of directionClass().
+    static constexpr int DirectionClasses = 24;
+
+    /// @brief Maps a direction to one of 24 classes (octant and dominant
+    /// axis), which roughly corresponds to the traversal order of BVHs.
+    static int directionClass(const Vector &d) {
+        const float x = abs(d.x()), y = abs(d.y()), z = abs(d.z());
+        const int axis = x >= y ? (x >= z ? 0 : 2) : (y >= z ? 1 : 2);
+        return 3 * ((d.x() < 0) | (d.y() < 0) << 1 | (d.z() < 0) << 2) + axis;
+    }
+
+    /// @brief Invokes @c f for consecutive packets of a queue, given the
+    /// position of their first element and a bit mask of their valid
+    /// elements.
+    template <typename F> static void forEachPacket(size_t size, F f) {
+        for (size_t first = 0; first < size; first += PacketSize) {
+            const int count = int(std::min(size - first, size_t(PacketSize)));
+            f(int(first), (1 << count) - 1);
+        }
+    }
+
+    /// @brief Advances all active paths until they have terminated.
+    void trace(Paths &paths) {
+        auto &active = paths.active;
+        auto &shadow = paths.shadow;
+
+        for (int depth = 0; depth < m_depth && !active.empty(); depth++) {
+            if (m_sort == SortMode::Direction) {
+                // counting sort, which keeps paths of a class in pixel order
+                std::array<int, DirectionClasses + 1> offsets{};
+                paths.sorted.resize(active.size());
+                for (const int path : active)
+                    offsets[directionClass(paths.rays[path].direction) + 1]++;
+                for (int i = 0; i < DirectionClasses; i++)
+                    offsets[i + 1] += offsets[i];
+                for (const int path : active)
+                    paths.sorted[offsets[directionClass(
+                        paths.rays[path].direction)]++] = path;
+                std::swap(active, paths.sorted);
+            }
+
+            // intersect, in packets of consecutive paths
+            forEachPacket(active.size(), [&](int first, int mask) {
+                Packet<Ray> rays;
+                Packet<Sampler *> rng;
+                Packet<Intersection> hits;
+                forEachLane(mask, [&](int lane) {
+                    const int path = active[first + lane];
+                    rays[lane]     = paths.rays[path];
+                    rng[lane]      = paths.samplers[path];
+                });
+                m_scene->intersect8(rays, mask, hits, rng);
+                forEachLane(mask, [&](int lane) {
+                    paths.hits[active[first + lane]] = hits[lane];
+                });
+            });
+
+            if (m_sort == SortMode::Material) {
+                const auto material = [&](int path) {
+                    const auto &its = paths.hits[path];
+                    return its ? its.instance->bsdf() : nullptr;
+                };
+                std::stable_sort(
+                    active.begin(), active.end(), [&](int a, int b) {
+                        return std::less<>()(material(a), material(b));
+                    });
+            }
+
+            // emission of lights that can be sampled is weighted against next
+            // event estimation, paths that miss end in the background
+            std::erase_if(active, [&](int path) {
+                const auto &its = paths.hits[path];
+                float weight    = 1;
+                if (its.lightProbability > 0) {
+                    const float lightPdf =
+                        its.lightProbability *
+                        its.light()->pdfDirect(paths.rays[path].origin, its);
+                    weight = powerHeuristic(paths.pdfs[path], lightPdf);
+                }
+                paths.radiances[path] += its.evaluateEmission().value *
+                                         paths.throughputs[path] * weight;
+                return !its;
+            });
+
+            // sample lights
+            shadow.clear();
+            if (m_scene->hasLights()) {
+                for (const int path : active) {
+                    Sampler &rng    = *paths.samplers[path];
+                    const auto &its = paths.hits[path];
+
+                    const LightSample light =
+                        m_scene->sampleLight(its.position, rng);
+                    if (light.isInvalid() || !(light.probability > 0))
+                        continue;
+                    const DirectLightSample sample =
+                        light.light->sampleDirect(its.position, rng);
+
+                    shadow.paths.push_back(path);
+                    shadow.rays.emplace_back(its.position, sample.wi);
+                    shadow.distances.push_back(sample.distance);
+                    // the last light sample is not weighted, as the path is
+                    // not continued to find the light by BSDF sampling
+                    const BsdfEval bsdf = its.evaluateBsdf(sample.wi);
+                    const float mis =
+                        depth + 1 < m_depth
+                            ? powerHeuristic(light.probability * sample.pdf,
+                                             bsdf.pdf)
+                            : 1;
+                    shadow.contributions.push_back(
+                        sample.weight * bsdf.value / light.probability *
+                        paths.throughputs[path] * mis);
+                }
+            }
+
+            // trace shadow rays in packets, the light is occluded if there
+            // is an intersection from the surface to the light source
+            forEachPacket(shadow.paths.size(), [&](int first, int mask) {
+                Packet<Ray> rays;
+                Packet<float> distances;
+                Packet<Sampler *> rng;
+                forEachLane(mask, [&](int lane) {
+                    rays[lane]      = shadow.rays[first + lane];
+                    distances[lane] = shadow.distances[first + lane];
+                    rng[lane] = paths.samplers[shadow.paths[first + lane]];
+                });
+                const int occluded =
+                    m_scene->intersect8(rays, distances, mask, rng);
+                forEachLane(mask & ~occluded, [&](int lane) {
+                    paths.radiances[shadow.paths[first + lane]] +=
+                        shadow.contributions[first + lane];
+                });
+            });
+
+            // sample directions to continue the paths
+            std::erase_if(active, [&](int path) {
+                const BsdfSample sample =
+                    paths.hits[path].sampleBsdf(*paths.samplers[path]);
+                if (sample.isInvalid())
+                    return true;
+                paths.rays[path] =
+                    Ray(paths.hits[path].position, sample.wi.normalized());
+                paths.throughputs[path] *= sample.weight;
+                paths.pdfs[path] = sample.pdf;
+                return false;
+            });
+        }
+        active.clear();
+    }
+
+public:
+    WavefrontIntegrator(const Properties &properties)
+        : SamplingIntegrator(properties) {
+        m_depth = properties.get<int>("depth", 2);
+        // clang-format off
+        m_sort = properties.getEnum<SortMode>("sort", SortMode::None, {
+            { "none",      SortMode::None      },
+            { "direction", SortMode::Direction },
+            { "material",  SortMode::Material  },
+        });
+        // clang-format on
+    }
+
+    void execute() override {
+        // rendering in passes only relies on Li()
+        if (!m_image || rendersInPasses()) {
+            SamplingIntegrator::execute();
+            return;
+        }
+
+        const Vector2i resolution = m_scene->camera()->resolution();
+        m_image->initialize(resolution);
+
+        const int samplesPerPixel = m_sampler->samplesPerPixel();
+        const float norm          = 1.0f / samplesPerPixel;
+
+        Streaming stream{ *m_image };
+        ProgressReporter progress{ resolution.product() };
+        forEachBlock(resolution, [&](const Bounds2i &block) {
+            const int count = block.diagonal().product();
+
+            std::vector<ref<Sampler>> samplers(count);
+            std::vector<Color> cameraWeights(count);
+            std::vector<Color> sums(count);
+            Paths paths;
+            paths.resize(count);
+            for (int path = 0; path < count; path++) {
+                samplers[path]       = m_sampler->clone();
+                paths.samplers[path] = samplers[path].get();
+            }
+
+            // one sample of every pixel of the block is traced at a time
+            for (int sample = 0; sample < samplesPerPixel; sample++) {
+                int path = 0;
+                for (auto pixel : block) {
+                    Sampler &rng = *samplers[path];
+                    rng.seed(pixel, sample);
+                    const auto cameraSample =
+                        m_scene->camera()->sample(pixel, rng);
+                    cameraWeights[path] = cameraSample.weight;
+                    paths.start(path++, cameraSample.ray);
+                }
+
+                trace(paths);
+
+                for (path = 0; path < count; path++)
+                    sums[path] += cameraWeights[path] * paths.radiances[path];
+            }
+
+            int path = 0;
+            for (auto pixel : block)
+                m_image->get(pixel) = norm * sums[path++];
+
+            progress += count;
+            stream.updateBlock(block);
+        });
+        progress.finish();
+
+        m_image->save();
+    }
+
+    Color Li(const Ray &ray, Sampler &rng) override {
+        Paths paths;
+        paths.resize(1);
+        paths.samplers[0] = &rng;
+        paths.start(0, ray);
+        trace(paths);
+        return paths.radiances[0];
+    }
+
+    std::string toString() const override {
+        return tfm::format(
+            "WavefrontIntegrator[\n"
+            "  depth = %d,\n"
+            "  sampler = %s,\n"
+            "  image = %s,\n"
+            "]",
+            m_depth,
+            indent(m_sampler),
+            indent(m_image));
+    }
+};
+
+} // namespace lightwave
+
+REGISTER_INTEGRATOR(WavefrontIntegrator, "wavefront")
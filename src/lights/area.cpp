@@ -5,9 +5,65 @@ namespace lightwave {
 class AreaLight final : public Light {
     ref<Instance> m_shape;
 
+    /// @brief The number of points on the shape used to estimate its power.
+    static constexpr int PowerSamples = 1024;
+    /// @brief Shapes whose sampled normals deviate by less than this cosine
+    /// from each other are considered planar.
+    static constexpr float PlanarThreshold = 0.9999f;
+
+    /// @brief Integrates the emission towards the normal over the area of the
+    /// shape.
+    float integrateEmission(Sampler &rng) const {
+        if (!m_shape->emission())
+            return 0;
+
+        float emission = 0;
+        for (int i = 0; i < PowerSamples; i++) {
+            const AreaSample sample = m_shape->sampleArea(rng);
+            if (sample.pdf == 0)
+                continue;
+            emission += m_shape->emission()
+                            ->evaluate(sample.uv, Vector(0, 0, 1))
+                            .value.luminance() /
+                        sample.pdf;
+        }
+        return emission / PowerSamples;
+    }
+
 public:
     AreaLight(const Properties &properties) : Light(properties) {
         m_shape = properties.getChild<Instance>("shape");
+        // allows hits of the shape to report how likely this light is sampled
+        m_shape->setLight(this);
+    }
+
+    float estimatePower(const Bounds &sceneBounds,
+                        Sampler &rng) const override {
+        // the cosine-weighted hemisphere contributes a factor of pi
+        return Pi * integrateEmission(rng);
+    }
+
+    std::optional<LightBounds> lightBounds(Sampler &rng) const override {
+        // planar shapes emit around their normal, for all other shapes the
+        // normals are conservatively bounded by the entire sphere
+        const Vector axis     = m_shape->sampleArea(rng).shadingFrame().normal;
+        float cosThetaNormals = 1;
+        for (int i = 1; i < PowerSamples; i++) {
+            cosThetaNormals = min(
+                cosThetaNormals,
+                axis.dot(m_shape->sampleArea(rng).shadingFrame().normal));
+        }
+        if (cosThetaNormals < PlanarThreshold)
+            cosThetaNormals = -1;
+
+        // a diffuse emitter is brightest along its normal
+        return LightBounds{
+            .bounds           = m_shape->getBoundingBox(),
+            .axis             = axis,
+            .cosThetaNormals  = cosThetaNormals,
+            .cosThetaEmission = 0,
+            .intensity        = integrateEmission(rng),
+        };
     }
 
     DirectLightSample sampleDirect(const Point &origin,
@@ -22,20 +78,62 @@ public:
         Vector sampleLocal = sample.shadingFrame().toLocal(-dir).normalized();
         EmissionEval emission =
             m_shape->emission()->evaluate(sample.uv, sampleLocal);
-        float cosine  = Frame::cosTheta(sampleLocal);
-        float falloff = 1 / (distance * distance);
-        float areaPdf = cosine / sample.pdf;
-        float pdf     = falloff / sample.pdf *
-                    abs(sample.shadingFrame().normal.dot(dir.normalized()));
+        float cosine = Frame::absCosTheta(sampleLocal);
+        if (cosine == 0 || sample.pdf == 0)
+            return DirectLightSample::invalid();
+        // converts the density from area to solid angle
+        float pdf = sample.pdf * distance * distance / cosine;
 
         return DirectLightSample{ .wi       = dir.normalized(),
-                                  .weight   = emission.value * areaPdf * falloff,
+                                  .weight   = emission.value / pdf,
                                   .distance = distance,
-                                  .pdf      = areaPdf };
+                                  .pdf      = pdf };
+    }
+
+    float pdfDirect(const Point &origin,
+                    const Intersection &its) const override {
+        const float cosine =
+            Frame::absCosTheta(its.shadingFrame().toLocal(its.wo));
+        if (cosine == 0)
+            return 0;
+        return its.pdf * (its.position - origin).lengthSquared() / cosine;
     }
 
     bool canBeIntersected() const override { return true; }
 
+    EmissionSample sampleEmission(const Bounds &sceneBounds,
+                                  Sampler &rng) const override {
+        // diffuse emitters are sampled proportional to the cosine of their
+        // front side
+        const AreaSample sample = m_shape->sampleArea(rng);
+        if (sample.pdf == 0)
+            return EmissionSample::invalid();
+        const Vector local = squareToCosineHemisphere(rng.next2D());
+        const float pdf    = cosineHemispherePdf(local);
+        if (pdf == 0)
+            return EmissionSample::invalid();
+
+        const EmissionEval emission =
+            m_shape->emission()->evaluate(sample.uv, local);
+        return EmissionSample{
+            .origin    = sample,
+            .direction = sample.shadingFrame().toWorld(local).normalized(),
+            .weight    = emission.value * Frame::cosTheta(local) /
+                         (sample.pdf * pdf),
+            .pdf       = { .position = sample.pdf, .direction = pdf },
+        };
+    }
+
+    EmissionPdf pdfEmission(const SurfaceEvent &origin,
+                            const Vector &direction,
+                            const Bounds &sceneBounds) const override {
+        return {
+            .position  = origin.pdf,
+            .direction = cosineHemispherePdf(
+                origin.shadingFrame().toLocal(direction).normalized()),
+        };
+    }
+
     std::string toString() const override {
         return tfm::format(
             "AreaLight[\n"
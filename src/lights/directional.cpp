@@ -20,8 +20,31 @@ public:
                                   .pdf      = Infinity };
     }
 
+    float estimatePower(const Bounds &sceneBounds,
+                        Sampler &rng) const override {
+        // the light falls onto the disk that the scene covers
+        const float radius = sceneBounds.diagonal().length() / 2;
+        return intensity.luminance() * Pi * sqr(radius);
+    }
+
     bool canBeIntersected() const override { return false; }
 
+    EmissionSample sampleEmission(const Bounds &sceneBounds,
+                                  Sampler &rng) const override {
+        return emitFromDisk(sampleDirect(Point(), rng), sceneBounds, rng);
+    }
+
+    EmissionPdf pdfEmission(const SurfaceEvent &origin,
+                            const Vector &direction,
+                            const Bounds &sceneBounds) const override {
+        // no other direction can be sampled by chance
+        return { .position = diskPdf(sceneBounds), .direction = 0 };
+    }
+
+    bool isDelta() const override { return true; }
+
+    bool isInfinite() const override { return true; }
+
     std::string toString() const override {
         return tfm::format(
             "DirectionalLight[\n"
@@ -1,35 +1,336 @@
 #include <lightwave.hpp>
 
+#include <optional>
 #include <vector>
 
 namespace lightwave {
 
+/**
+ * @brief A background light given by a texture in equirectangular projection.
+ *
+ * Directions are importance sampled proportional to the brightness of the
+ * texture. Optionally (@c extractSun ), the brightest region of the texture is
+ * detected at load time and replaced by a cone of constant radiance with the
+ * same power. The rest of the texture (the residual) shows the surrounding sky
+ * in place of the region. Sampling the cone almost deterministically connects
+ * to the sun, instead of relying on a few bright texels being found.
+ */
 class EnvironmentMap final : public BackgroundLight {
+    /// @brief A cone of constant radiance replacing the brightest region of
+    /// the texture.
+    struct Sun {
+        /// @brief The central direction of the cone, in local coordinates.
+        Vector direction;
+        /// @brief The cosine of the opening angle of the cone.
+        float cosThetaMax;
+        /// @brief The radiance emitted from within the cone.
+        Color radiance;
+        /// @brief The power (as luminance) arriving from the cone.
+        float power;
+        /// @brief The probability of sampling the cone instead of the
+        /// residual texture.
+        float probability;
+    };
+
     /// @brief The texture to use as background
     ref<Texture> m_texture;
     /// @brief An optional transform from local-to-world space
     ref<Transform> m_transform;
+    /// @brief The resolution of the grid the texture is tabulated on.
+    Point2i m_resolution;
+    /// @brief The distribution of texture coordinates used for sampling,
+    /// proportional to the luminance of the residual texture times the sine
+    /// of the polar angle (which accounts for the area the rows cover on the
+    /// sphere).
+    Distribution2D m_distribution;
 
-public:
-    EnvironmentMap(const Properties &properties) : BackgroundLight(properties) {
-        m_texture   = properties.getChild<Texture>();
-        m_transform = properties.getOptionalChild<Transform>();
-    }
+    /// @brief The sun extracted from the texture, if any.
+    std::optional<Sun> m_sun;
+    /// @brief Marks the cells of the grid that the sun has been extracted
+    /// from.
+    std::vector<bool> m_sunCells;
+    /// @brief The radiance shown in place of the sun, given by the average of
+    /// the cells surrounding it.
+    Color m_sunFill;
+    /// @brief How many times brighter than the average radiance a cell needs
+    /// to be to be considered part of the sun.
+    float m_sunThreshold;
 
-    EmissionEval evaluate(const Vector &direction) const override {
+    /// @brief The number of directions used to estimate the average radiance.
+    static constexpr int PowerSamples = 4096;
+    /// @brief The smallest resolution of the sampling distribution, which
+    /// keeps the variation of the polar angle within each row small even for
+    /// constant textures.
+    static constexpr int MinimumColumns = 64, MinimumRows = 32;
+    /// @brief The number of points per axis used to integrate the texture
+    /// over each cell of the sun, which is exact for bilinearly filtered
+    /// images (whose cells are the pixels).
+    static constexpr int SunSubsamples = 4;
+    /// @brief The largest angular radius of a sun (in radians), as larger
+    /// regions are not approximated well by a cone.
+    static constexpr float MaximumSunRadius = 10 * Pi / 180;
 
-        Vector dir = direction;
-        if (m_transform) {
-            dir = m_transform->inverse(direction).normalized();
-        }
+    /// @brief Maps texture coordinates to a direction in local coordinates
+    /// (the inverse of @ref warp ).
+    static Vector direction(const Point2 &warped) {
+        const float phi      = -(warped.x() * 2 * Pi - Pi);
+        const float theta    = warped.y() * Pi;
+        const float sinTheta = std::sin(theta);
+        return {
+            sinTheta * std::cos(phi),
+            std::cos(theta),
+            sinTheta * std::sin(phi),
+        };
+    }
 
+    /// @brief Maps a direction in local coordinates to texture coordinates.
+    static Point2 warp(const Vector &dir) {
         // first: map 3D light direction to spherical coordinates
         float theta = safe_acos(dir.y());
         float phi   = -std::atan2(dir.z(), dir.x());
 
         // second: remap to texture coordinates
-        Point2 warped = Point2((phi + Pi) * Inv2Pi, theta * InvPi);
+        return Point2((phi + Pi) * Inv2Pi, theta * InvPi);
+    }
+
+    /// @brief Transforms a direction from world to local coordinates.
+    Vector toLocal(const Vector &direction) const {
+        if (m_transform) {
+            return m_transform->inverse(direction).normalized();
+        }
+        return direction;
+    }
 
+    /// @brief The index of the cell of the grid containing the given texture
+    /// coordinates.
+    int cell(const Point2 &warped) const {
+        const int x = clamp(
+            int(warped.x() * m_resolution.x()), 0, m_resolution.x() - 1);
+        const int y = clamp(
+            int(warped.y() * m_resolution.y()), 0, m_resolution.y() - 1);
+        return y * m_resolution.x() + x;
+    }
+
+    /// @brief The radiance of the texture without the sun.
+    Color residual(const Point2 &warped) const {
+        if (m_sun && m_sunCells[cell(warped)])
+            return m_sunFill;
+        return m_texture->evaluate(warped);
+    }
+
+    /// @brief The radiance arriving from a direction in local coordinates.
+    Color evaluateLocal(const Vector &local, const Point2 &warped) const {
+        Color radiance = residual(warped);
+        if (m_sun && local.dot(m_sun->direction) >= m_sun->cosThetaMax)
+            radiance += m_sun->radiance;
+        return radiance;
+    }
+
+    /// @brief The density of @ref sampleDirect producing a direction in local
+    /// coordinates, with respect to solid angle.
+    float pdfLocal(const Vector &local, const Point2 &warped) const {
+        // the texture coordinates cover an area of 2 pi^2 sin(theta) on the
+        // sphere (the transform is assumed to preserve angles)
+        const float sinTheta = std::sin(warped.y() * Pi);
+        float pdf            = 0;
+        if (sinTheta > 0)
+            pdf = m_distribution.pdf(warped) / (2 * Pi * Pi * sinTheta);
+        if (!m_sun)
+            return pdf;
+
+        pdf *= 1 - m_sun->probability;
+        if (local.dot(m_sun->direction) >= m_sun->cosThetaMax)
+            pdf += m_sun->probability * uniformConePdf(m_sun->cosThetaMax);
+        return pdf;
+    }
+
+    /**
+     * @brief Detects the sun as the cells connected to the brightest cell
+     * that exceed the threshold, and replaces them by a cone covering the
+     * same solid angle that emits the radiance in excess of the surrounding
+     * sky.
+     */
+    void extractSun() {
+        const int width  = m_resolution.x();
+        const int height = m_resolution.y();
+        std::vector<Color> radiance(width * height);
+        float weightedLuminance = 0, weights = 0;
+        int peak = 0;
+        for (int y = 0; y < height; y++) {
+            const float sinTheta = std::sin((y + 0.5f) / height * Pi);
+            for (int x = 0; x < width; x++) {
+                const int index = y * width + x;
+                radiance[index] = m_texture->evaluate(
+                    { (x + 0.5f) / width, (y + 0.5f) / height });
+                weightedLuminance += radiance[index].luminance() * sinTheta;
+                weights += sinTheta;
+                if (radiance[index].luminance() > radiance[peak].luminance())
+                    peak = index;
+            }
+        }
+        const float threshold = m_sunThreshold * weightedLuminance / weights;
+        if (!(radiance[peak].luminance() > threshold))
+            return;
+
+        // flood fill, where the grid wraps around horizontally
+        const auto forEachNeighbor = [&](int index, auto f) {
+            const int x = index % width, y = index / width;
+            for (int dy = -1; dy <= 1; dy++) {
+                if (y + dy < 0 || y + dy >= height)
+                    continue;
+                for (int dx = -1; dx <= 1; dx++) {
+                    if (dx != 0 || dy != 0)
+                        f((y + dy) * width + (x + dx + width) % width);
+                }
+            }
+        };
+        m_sunCells.assign(width * height, false);
+        m_sunCells[peak] = true;
+        std::vector<int> region{ peak };
+        for (size_t i = 0; i < region.size(); i++) {
+            forEachNeighbor(region[i], [&](int neighbor) {
+                if (m_sunCells[neighbor] ||
+                    !(radiance[neighbor].luminance() > threshold))
+                    return;
+                m_sunCells[neighbor] = true;
+                region.push_back(neighbor);
+            });
+        }
+        // the sun covers the solid angle of the bright cells
+        float solidAngle = 0;
+        for (const int index : region)
+            solidAngle += 2 * Pi * Pi *
+                          std::sin((index / width + 0.5f) / height * Pi) /
+                          (width * height);
+        if (1 - solidAngle * Inv2Pi < std::cos(MaximumSunRadius)) {
+            logger(EWarn,
+                   "the brightest region of the environment map is too large "
+                   "to be extracted as sun, consider raising sunThreshold");
+            m_sunCells.clear();
+            return;
+        }
+
+        // filtering spreads the sun into adjacent cells, which are replaced
+        // as well so that the residual contains no trace of the sun
+        std::vector<int> replaced = region;
+        for (const int index : region) {
+            forEachNeighbor(index, [&](int neighbor) {
+                if (!m_sunCells[neighbor]) {
+                    m_sunCells[neighbor] = true;
+                    replaced.push_back(neighbor);
+                }
+            });
+        }
+
+        int fillCount = 0;
+        m_sunFill     = Color(0);
+        for (const int index : replaced) {
+            forEachNeighbor(index, [&](int neighbor) {
+                if (!m_sunCells[neighbor]) {
+                    m_sunFill += radiance[neighbor];
+                    fillCount++;
+                }
+            });
+        }
+        if (fillCount > 0)
+            m_sunFill /= float(fillCount);
+
+        // the radiance in excess of the fill, integrated over solid angle
+        // (the residual only differs from the texture within the replaced
+        // cells)
+        Color irradiance(0);
+        Vector direction(0);
+        for (const int index : replaced) {
+            const int x = index % width, y = index / width;
+            const Point2 center{ (x + 0.5f) / width, (y + 0.5f) / height };
+            const float cellSolidAngle =
+                2 * Pi * Pi * std::sin(center.y() * Pi) / (width * height);
+
+            Color average(0);
+            for (int sy = 0; sy < SunSubsamples; sy++) {
+                for (int sx = 0; sx < SunSubsamples; sx++) {
+                    average += m_texture->evaluate(
+                        { (x + (sx + 0.5f) / SunSubsamples) / width,
+                          (y + (sy + 0.5f) / SunSubsamples) / height });
+                }
+            }
+            average /= sqr(SunSubsamples);
+
+            Color excess = average - m_sunFill;
+            for (int channel = 0; channel < Color::NumComponents; channel++)
+                excess[channel] = max(excess[channel], 0.f);
+
+            irradiance += excess * cellSolidAngle;
+            direction += excess.luminance() * cellSolidAngle *
+                         EnvironmentMap::direction(center);
+        }
+        if (!(irradiance.luminance() > 0) || direction.lengthSquared() == 0) {
+            m_sunCells.clear();
+            return;
+        }
+
+        m_sun = Sun{
+            .direction   = direction.normalized(),
+            .cosThetaMax = 1 - solidAngle * Inv2Pi,
+            .radiance    = irradiance / solidAngle,
+            .power       = irradiance.luminance(),
+            .probability = 0,
+        };
+    }
+
+    /// @brief Tabulates the brightness of the residual texture, averaging the
+    /// center and the corners of each cell so that no cell that is partially
+    /// bright (e.g., due to filtering) has a density of zero.
+    void buildDistribution() {
+        std::vector<float> function(m_resolution.x() * m_resolution.y());
+        for (int y = 0; y < m_resolution.y(); y++) {
+            const float sinTheta = std::sin((y + 0.5f) / m_resolution.y() * Pi);
+            for (int x = 0; x < m_resolution.x(); x++) {
+                const auto luminance = [&](float dx, float dy) {
+                    return residual({ (x + dx) / m_resolution.x(),
+                                      (y + dy) / m_resolution.y() })
+                        .luminance();
+                };
+                const float average =
+                    (luminance(0.5f, 0.5f) + luminance(0, 0) +
+                     luminance(1, 0) + luminance(0, 1) + luminance(1, 1)) /
+                    5;
+                function[y * m_resolution.x() + x] =
+                    max(average, 0.f) * sinTheta;
+            }
+        }
+        m_distribution = Distribution2D(function, m_resolution);
+    }
+
+public:
+    EnvironmentMap(const Properties &properties) : BackgroundLight(properties) {
+        m_texture      = properties.getChild<Texture>();
+        m_transform    = properties.getOptionalChild<Transform>();
+        m_sunThreshold = properties.get<float>("sunThreshold", 100);
+        m_resolution   = {
+            max(m_texture->resolution().x(), MinimumColumns),
+            max(m_texture->resolution().y(), MinimumRows),
+        };
+
+        if (properties.get<bool>("extractSun", false))
+            extractSun();
+        buildDistribution();
+        if (m_sun) {
+            // the sun and the residual are sampled proportional to their
+            // power
+            const float residualPower =
+                2 * Pi * Pi * m_distribution.integral();
+            m_sun->probability =
+                m_sun->power / (m_sun->power + residualPower);
+            logger(EInfo,
+                   "extracted sun with a radius of %.2f degrees, carrying "
+                   "%.1f%% of the power of the environment map",
+                   safe_acos(m_sun->cosThetaMax) * 180 * InvPi,
+                   100 * m_sun->probability);
+        }
+    }
+
+    EmissionEval evaluate(const Vector &direction) const override {
         // hints:
         // * if (m_transform) { transform direction vector from world to local
         // coordinates }
@@ -38,37 +339,74 @@ public:
         // * make use of std::atan2 instead of tangent function.
         // * check out the safe versions of sine and cosine, e.g. safe_acos
         // in math.hpp to avoid problematic edge cases
+        const Vector local = toLocal(direction);
         return {
-            .value = m_texture->evaluate(warped),
+            .value = evaluateLocal(local, warp(local)),
         };
     }
 
+    float estimatePower(const Bounds &sceneBounds,
+                        Sampler &rng) const override {
+        // uniform directions are not affected by the transform
+        float radiance = 0;
+        for (int i = 0; i < PowerSamples; i++)
+            radiance += residual(warp(squareToUniformSphere(rng.next2D())))
+                            .luminance();
+        radiance /= PowerSamples;
+
+        // the average radiance arrives from all directions onto the disk that
+        // the scene covers
+        const float radius = sceneBounds.diagonal().length() / 2;
+        const float sunPower = m_sun ? m_sun->power : 0;
+        return (radiance * 4 * Pi + sunPower) * Pi * sqr(radius);
+    }
+
     DirectLightSample sampleDirect(const Point &origin,
                                    Sampler &rng) const override {
-        Point2 warped    = rng.next2D();
-        Vector direction = squareToUniformSphere(warped);
-        auto E           = evaluate(direction);
-
-        // implement better importance sampling here, if you ever need it
-        // (useful for environment maps with bright tiny light sources, like the
-        // sun for example)
+        Vector local;
+        Point2 warped;
+        if (m_sun && rng.next() < m_sun->probability) {
+            local  = Frame(m_sun->direction)
+                        .toWorld(squareToUniformCone(rng.next2D(),
+                                                     m_sun->cosThetaMax));
+            warped = warp(local);
+        } else {
+            float pdf;
+            warped = m_distribution.sample(rng.next2D(), pdf);
+            local  = direction(warped);
+        }
 
+        const float pdf = pdfLocal(local, warped);
+        if (pdf == 0)
+            return DirectLightSample::invalid();
         return DirectLightSample{
-            .wi       = direction,
-            .weight   = E.value * Inv4Pi,
+            .wi       = m_transform ? m_transform->apply(local).normalized()
+                                    : local,
+            .weight   = evaluateLocal(local, warped) / pdf,
             .distance = Infinity,
-            .pdf      = 1.0f, // TODO
+            .pdf      = pdf,
         };
     }
 
+    float pdfDirect(const Point &origin,
+                    const Intersection &its) const override {
+        const Vector local = toLocal(-its.wo);
+        return pdfLocal(local, warp(local));
+    }
+
     std::string toString() const override {
         return tfm::format(
             "EnvironmentMap[\n"
             "  texture = %s,\n"
-            "  transform = %s\n"
+            "  transform = %s,\n"
+            "  sun = %s\n"
             "]",
             indent(m_texture),
-            indent(m_transform));
+            indent(m_transform),
+            m_sun ? tfm::format("%s (radiance %s)",
+                                m_sun->direction,
+                                m_sun->radiance)
+                  : "none");
     }
 };
 
@@ -25,8 +25,40 @@ public:
                                   .pdf      = Infinity };
     }
 
+    float estimatePower(const Bounds &sceneBounds,
+                        Sampler &rng) const override {
+        return power.luminance();
+    }
+
+    std::optional<LightBounds> lightBounds(Sampler &rng) const override {
+        // emits into all directions
+        return LightBounds{ .bounds           = Bounds(position, position),
+                            .axis             = Vector(0, 0, 1),
+                            .cosThetaNormals  = -1,
+                            .cosThetaEmission = 0,
+                            .intensity        = intensity.luminance() };
+    }
+
     bool canBeIntersected() const override { return false; }
 
+    EmissionSample sampleEmission(const Bounds &sceneBounds,
+                                  Sampler &rng) const override {
+        EmissionSample result;
+        result.origin.position = position;
+        result.direction       = squareToUniformSphere(rng.next2D());
+        result.weight          = power;
+        result.pdf             = { .position = 1, .direction = Inv4Pi };
+        return result;
+    }
+
+    EmissionPdf pdfEmission(const SurfaceEvent &origin,
+                            const Vector &direction,
+                            const Bounds &sceneBounds) const override {
+        return { .position = 1, .direction = Inv4Pi };
+    }
+
+    bool isDelta() const override { return true; }
+
     std::string toString() const override {
         return tfm::format(
             "PointLight[\n"
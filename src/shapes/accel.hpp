@@ -1,9 +1,15 @@
 #pragma once
 
+#include "../core/diskcache.hpp"
 #include <lightwave/core.hpp>
+#include <lightwave/iterators.hpp>
 #include <lightwave/math.hpp>
+#include <lightwave/parallel.hpp>
 #include <lightwave/shape.hpp>
+#include <lightwave/simd.hpp>
 
+#include <atomic>
+#include <bit>
 #include <numeric>
 
 namespace lightwave {
@@ -23,6 +29,18 @@ namespace lightwave {
  * - getCentroid(primitiveIndex)    -- return the centroid of a single child
  * (used for building the BVH)
  *
+ * Optionally, subclasses can store their children in the order of the BVH
+ * leaves (see reorderPrimitives()) and intersect whole leaves at once (see
+ * intersectLeaf() and occludedLeaf()).
+ *
+ * The binary tree is built using binned SAH object splits. With @c builder
+ * set to "sbvh", spatial splits are considered as well, which duplicate
+ * references to children that straddle the split plane (see splitBounds()).
+ *
+ * The BVH is always built as binary tree, which can optionally be collapsed
+ * into a 4-wide or 8-wide tree (selected by the @c bvh property) whose child
+ * bounding boxes are tested against the ray using SIMD instructions.
+ *
  * @example For a simple example of how to use this class, look at @ref
  * shapes/group.cpp
  * @see Group
@@ -33,6 +51,20 @@ class AccelerationStructure : public Shape {
     /// remapping.
     typedef int32_t NodeIndex;
 
+    /// @brief The node layouts that can be used for traversal.
+    enum class Layout {
+        Binary, ///< the binary tree produced by the builder
+        Wide4,  ///< a 4-wide tree, collapsed from the binary tree
+        Wide8,  ///< an 8-wide tree, collapsed from the binary tree
+    };
+
+    /// @brief The algorithms that can be used to build the binary tree.
+    enum class Builder {
+        Binned,  ///< binned SAH object splits on the centroids of children
+        Spatial, ///< additionally considers spatial splits, which duplicate
+                 ///< references to children that straddle the split plane
+    };
+
     /// @brief A node in our binary BVH tree.
     struct Node {
         /// @brief The axis aligned bounding box of this node.
@@ -48,12 +80,21 @@ class AccelerationStructure : public Shape {
          * node are always contigous in m_primitiveIndices.
          */
         NodeIndex leftFirst;
-        /// @brief The number of primitives in a leaf node, or 0 to indicate
-        /// that this node is not a leaf node.
+        /**
+         * @brief The number of primitives in a leaf node. Internal nodes
+         * instead store their split axis as @code -(axis + 1) @endcode , which
+         * lets traversal decide which child lies closer to the ray origin.
+         */
         NodeIndex primitiveCount;
 
         /// @brief Whether this BVH node is a leaf node.
-        bool isLeaf() const { return primitiveCount != 0; }
+        bool isLeaf() const { return primitiveCount > 0; }
+
+        /// @brief For internal nodes: The axis along which the primitives of
+        /// this node were split between its children.
+        int splitAxis() const { return -primitiveCount - 1; }
+        /// @brief Marks this node as internal node with the given split axis.
+        void setSplitAxis(int axis) { primitiveCount = -(axis + 1); }
 
         /// @brief For internal nodes: The index of the left child node in
         /// m_nodes.
@@ -81,8 +122,16 @@ class AccelerationStructure : public Shape {
      * list of indices (which starts of as @code 0, 1, 2, ..., primitiveCount -
      * 1 @endcode ), which allows us to translate from re-ordered (contiguous)
      * indices to the indices the user of this class expects.
+     * @note Released once subclasses store their children in leaf order (see
+     * @ref reorderPrimitives ), as the mapping is the identity from then on.
      */
     std::vector<int> m_primitiveIndices;
+    /// @brief The number of positions in the leaf order, which exceeds the
+    /// number of children if spatial splits have duplicated references.
+    size_t m_referenceCount = 0;
+    /// @brief Whether subclasses store their children in leaf order, i.e.,
+    /// positions in the leaf order are primitive indices.
+    bool m_isLeafOrder = false;
 
     /// @brief Returns the root BVH node.
     const Node &rootNode() const {
@@ -90,69 +139,117 @@ class AccelerationStructure : public Shape {
         return m_nodes.front();
     }
 
+    /// @brief The maximum depth of the BVH, which bounds the size of the
+    /// traversal stack.
+    static constexpr int MaxDepth = 64;
+
+    /// @brief A ray prepared for traversal, with all per-ray quantities of the
+    /// slab test computed once instead of once per node.
+    struct TraversalRay {
+        /// @brief The origin of the ray.
+        Point origin;
+        /// @brief The reciprocal of the ray direction, which turns the
+        /// divisions of the slab test into multiplications.
+        Vector invDirection;
+        /// @brief For each axis, whether the ray travels towards negative
+        /// coordinates (i.e., enters boxes through their maximum).
+        bool isNegative[3];
+
+        explicit TraversalRay(const Ray &ray) : origin(ray.origin) {
+            for (int axis = 0; axis < 3; axis++) {
+                invDirection[axis] = 1 / ray.direction[axis];
+                // derived from the reciprocal so that -0 counts as negative
+                isNegative[axis] = invDirection[axis] < 0;
+            }
+        }
+    };
+
+    /// @brief An entry of the traversal stack: a node that still needs to be
+    /// visited, and the distance at which the ray enters its bounding box.
+    struct StackEntry {
+        NodeIndex nodeIndex;
+        float tNear;
+    };
+
     /**
-     * @brief Intersects a BVH node, recursing into children (for internal
-     * nodes), or intersecting all primitives (for leaf nodes).
+     * @brief Traverses the BVH with an explicit stack, calling @c visitLeaf
+     * for all leaf nodes whose bounding box is hit before @c tMax .
+     * For internal nodes, the child that lies closer to the ray origin along
+     * the split axis is visited first, and the other child is pushed onto the
+     * stack if its bounding box is hit as well.
+     * @param tMax The maximum distance of interest, which is re-read after
+     * every leaf (so that closest-hit queries can shrink it).
+     * @param nodeCounter Incremented for every node that is visited.
+     * @param visitLeaf Called with the first index in m_primitiveIndices and
+     * the number of primitives of a leaf, returns @c true to stop traversal.
+     * @return Whether traversal was stopped by @c visitLeaf .
      */
-    bool intersectNode(const Node &node, const Ray &ray, Intersection &its,
-                       Sampler &rng) const {
-        // update the statistic tracking how many BVH nodes have been tested for
-        // intersection
-        its.stats.bvhCounter++;
+    template <typename LeafFunction>
+    bool traverseNodes(const TraversalRay &ray, const float &tMax,
+                       int &nodeCounter, LeafFunction &&visitLeaf) const {
+        StackEntry stack[MaxDepth];
+        int stackSize = 0;
 
-        bool wasIntersected = false;
-        if (node.isLeaf()) {
-            for (NodeIndex i = 0; i < node.primitiveCount; i++) {
-                // update the statistic tracking how many children have been
-                // tested for intersection
-                its.stats.primCounter++;
-                // test the child for intersection
-                wasIntersected |= intersect(
-                    m_primitiveIndices[node.leftFirst + i], ray, its, rng);
-            }
-        } else { // internal node
-            // test which bounding box is intersected first by the ray.
-            // this allows us to traverse the children in the order they are
-            // intersected in, which can help prune a lot of unnecessary
-            // intersection tests.
-            const auto leftT =
-                intersectAABB(m_nodes[node.leftChildIndex()].aabb, ray);
-            const auto rightT =
-                intersectAABB(m_nodes[node.rightChildIndex()].aabb, ray);
-            if (leftT < rightT) { // left child is hit first; test left child
-                                  // first, then right child
-                if (leftT < its.t)
-                    wasIntersected |= intersectNode(
-                        m_nodes[node.leftChildIndex()], ray, its, rng);
-                if (rightT < its.t)
-                    wasIntersected |= intersectNode(
-                        m_nodes[node.rightChildIndex()], ray, its, rng);
-            } else { // right child is hit first; test right child first, then
-                     // left child
-                if (rightT < its.t)
-                    wasIntersected |= intersectNode(
-                        m_nodes[node.rightChildIndex()], ray, its, rng);
-                if (leftT < its.t)
-                    wasIntersected |= intersectNode(
-                        m_nodes[node.leftChildIndex()], ray, its, rng);
+        const Node *node = &rootNode();
+        while (true) {
+            nodeCounter++;
+
+            if (node->isLeaf()) {
+                if (visitLeaf(node->firstPrimitiveIndex(),
+                              node->primitiveCount))
+                    return true;
+            } else { // internal node
+                // the left child holds the primitives with smaller centroids
+                // along the split axis, so it is the near child unless the ray
+                // travels towards negative coordinates along that axis.
+                const bool swapChildren = ray.isNegative[node->splitAxis()];
+                const NodeIndex nearIndex =
+                    node->leftChildIndex() + (swapChildren ? 1 : 0);
+                const NodeIndex farIndex =
+                    node->leftChildIndex() + (swapChildren ? 0 : 1);
+
+                const float nearT = intersectAABB(m_nodes[nearIndex].aabb, ray);
+                const float farT  = intersectAABB(m_nodes[farIndex].aabb, ray);
+                if (nearT < tMax) {
+                    if (farT < tMax)
+                        stack[stackSize++] = { farIndex, farT };
+                    node = &m_nodes[nearIndex];
+                    continue;
+                }
+                if (farT < tMax) {
+                    node = &m_nodes[farIndex];
+                    continue;
+                }
             }
+
+            // continue with the next node on the stack, skipping nodes that
+            // lie behind the closest intersection found in the meantime
+            do {
+                if (stackSize == 0)
+                    return false;
+                stackSize--;
+            } while (stack[stackSize].tNear >= tMax);
+            node = &m_nodes[stack[stackSize].nodeIndex];
         }
-        return wasIntersected;
     }
 
     /// @brief Performs a slab test to intersect a bounding box with a ray,
     /// returning Infinity in case the ray misses.
-    float intersectAABB(const Bounds &bounds, const Ray &ray) const {
-        const auto t1 = (bounds.min() - ray.origin) / ray.direction;
-        // intersect all axes at once with the maximum slabs of the bounding box
-        const auto t2 = (bounds.max() - ray.origin) / ray.direction;
-
-        // the elementwiseMin picks the near slab for each axis, of which we
-        // then take the maximum
-        const auto tNear = elementwiseMin(t1, t2).maxComponent();
-        // the elementwiseMax picks the far slab for each axis, of which we then
-        // take the minimum
-        const auto tFar = elementwiseMax(t1, t2).minComponent();
+    float intersectAABB(const Bounds &bounds, const TraversalRay &ray) const {
+        float tNear = -Infinity;
+        float tFar  = Infinity;
+        for (int axis = 0; axis < 3; axis++) {
+            // the sign of the direction tells us which slab is entered first,
+            // so no min/max is needed to sort the two slab distances
+            const float nearSlab = ray.isNegative[axis] ? bounds.max()[axis]
+                                                        : bounds.min()[axis];
+            const float farSlab  = ray.isNegative[axis] ? bounds.min()[axis]
+                                                        : bounds.max()[axis];
+            tNear = max(tNear,
+                        (nearSlab - ray.origin[axis]) * ray.invDirection[axis]);
+            tFar  = min(tFar,
+                       (farSlab - ray.origin[axis]) * ray.invDirection[axis]);
+        }
 
         if (tFar < tNear)
             return Infinity; // the ray does not intersect the bounding box
@@ -163,6 +260,593 @@ class AccelerationStructure : public Shape {
                       // (may also be negative!)
     }
 
+    /**
+     * @brief A node of a wide BVH, which stores up to @c Width children.
+     * The bounding boxes of the children are stored as structure of arrays,
+     * so that a single SIMD slab test can intersect all children at once.
+     * Unused child slots have empty bounding boxes, which are never hit.
+     */
+    template <int Width> struct alignas(32) WideNode {
+        /// @brief The bounding boxes of the children, indexed by [0 for
+        /// minimum / 1 for maximum][axis][child].
+        float bounds[2][3][Width];
+        /**
+         * @brief Either the index of the child node in the list of wide nodes
+         * (for internal children), or the first primitive in
+         * m_primitiveIndices (for leaf children).
+         */
+        NodeIndex childFirst[Width];
+        /// @brief The number of primitives of leaf children, or 0 for
+        /// internal children.
+        NodeIndex childCount[Width];
+    };
+
+    /// @brief The layout used for traversal, selected by the @c bvh property.
+    Layout m_layout = Layout::Binary;
+    /// @brief The nodes of the 4-wide BVH (if selected as layout).
+    std::vector<WideNode<4>> m_wideNodes4;
+    /// @brief The nodes of the 8-wide BVH (if selected as layout).
+    std::vector<WideNode<8>> m_wideNodes8;
+    /// @brief The bounding box of all primitives.
+    Bounds m_bounds;
+    /// @brief The builder used for the binary tree, selected by the @c
+    /// builder property.
+    Builder m_builder = Builder::Binned;
+    /// @brief The maximum number of duplicate references that spatial splits
+    /// may create, relative to the number of primitives.
+    float m_spatialSplitBudget = 0.3f;
+    /**
+     * @brief The original index of the child at each position of the leaf
+     * order, only populated if spatial splits duplicated some references.
+     * Used to skip children that have already been tested (see Mailbox).
+     */
+    std::vector<int> m_referenceIds;
+
+    /**
+     * @brief Remembers the last few children that a ray has been tested
+     * against, so that children referenced by several leaves (see spatial
+     * splits) are not tested repeatedly.
+     */
+    struct Mailbox {
+        static constexpr int Size = 8;
+        int ids[Size] = { -1, -1, -1, -1, -1, -1, -1, -1 };
+        int next      = 0;
+
+        /// @brief Records the given child, returning false if it has already
+        /// been recorded.
+        bool insert(int id) {
+            for (int i = 0; i < Size; i++) {
+                if (ids[i] == id)
+                    return false;
+            }
+            ids[next] = id;
+            next      = (next + 1) % Size;
+            return true;
+        }
+    };
+
+    template <int Width> std::vector<WideNode<Width>> &wideNodes() {
+        if constexpr (Width == 4)
+            return m_wideNodes4;
+        else
+            return m_wideNodes8;
+    }
+    template <int Width>
+    const std::vector<WideNode<Width>> &wideNodes() const {
+        if constexpr (Width == 4)
+            return m_wideNodes4;
+        else
+            return m_wideNodes8;
+    }
+
+    /**
+     * @brief Performs slab tests of the ray against all children of a wide
+     * node, storing the entry distances in @c tNear .
+     * @return A bit mask of the children that are hit before @c tMax .
+     */
+    template <int Width>
+    static int intersectChildren(const WideNode<Width> &node,
+                                 const TraversalRay &ray, float tMax,
+                                 float (&tNear)[Width]) {
+#ifdef LW_SIMD_AVX2
+        if constexpr (Width == 8) {
+            __m256 nearT = _mm256_set1_ps(-Infinity);
+            __m256 farT  = _mm256_set1_ps(Infinity);
+            for (int axis = 0; axis < 3; axis++) {
+                // the sign of the direction selects which of the two rows of
+                // the node holds the near slabs
+                const float *nearSlab = node.bounds[ray.isNegative[axis]][axis];
+                const float *farSlab =
+                    node.bounds[1 - ray.isNegative[axis]][axis];
+                const __m256 origin = _mm256_set1_ps(ray.origin[axis]);
+                const __m256 invDir = _mm256_set1_ps(ray.invDirection[axis]);
+                // max and min return their second operand for NaNs, which
+                // ignores slabs that the ray is parallel to and starts on
+                nearT = _mm256_max_ps(
+                    _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(nearSlab), origin),
+                                  invDir),
+                    nearT);
+                farT = _mm256_min_ps(
+                    _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(farSlab), origin),
+                                  invDir),
+                    farT);
+            }
+            _mm256_storeu_ps(tNear, nearT);
+            const __m256 hit = _mm256_and_ps(
+                _mm256_and_ps(_mm256_cmp_ps(nearT, farT, _CMP_LE_OQ),
+                              _mm256_cmp_ps(farT,
+                                            _mm256_set1_ps(Epsilon),
+                                            _CMP_GE_OQ)),
+                _mm256_cmp_ps(nearT, _mm256_set1_ps(tMax), _CMP_LT_OQ));
+            return _mm256_movemask_ps(hit);
+        }
+#endif
+#ifdef LW_SIMD_SSE
+        // wider nodes are processed in groups of 4 children
+        int mask = 0;
+        for (int group = 0; group < Width; group += 4) {
+            __m128 nearT = _mm_set1_ps(-Infinity);
+            __m128 farT  = _mm_set1_ps(Infinity);
+            for (int axis = 0; axis < 3; axis++) {
+                const float *nearSlab =
+                    node.bounds[ray.isNegative[axis]][axis] + group;
+                const float *farSlab =
+                    node.bounds[1 - ray.isNegative[axis]][axis] + group;
+                const __m128 origin = _mm_set1_ps(ray.origin[axis]);
+                const __m128 invDir = _mm_set1_ps(ray.invDirection[axis]);
+                // NaNs are dropped by the operand order, see above
+                nearT = _mm_max_ps(
+                    _mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearSlab), origin),
+                               invDir),
+                    nearT);
+                farT = _mm_min_ps(
+                    _mm_mul_ps(_mm_sub_ps(_mm_load_ps(farSlab), origin),
+                               invDir),
+                    farT);
+            }
+            _mm_storeu_ps(tNear + group, nearT);
+            const __m128 hit = _mm_and_ps(
+                _mm_and_ps(_mm_cmple_ps(nearT, farT),
+                           _mm_cmpge_ps(farT, _mm_set1_ps(Epsilon))),
+                _mm_cmplt_ps(nearT, _mm_set1_ps(tMax)));
+            mask |= _mm_movemask_ps(hit) << group;
+        }
+        return mask;
+#else
+        int mask = 0;
+        for (int child = 0; child < Width; child++) {
+            float nearT = -Infinity;
+            float farT  = Infinity;
+            for (int axis = 0; axis < 3; axis++) {
+                const float nearSlab =
+                    node.bounds[ray.isNegative[axis]][axis][child];
+                const float farSlab =
+                    node.bounds[1 - ray.isNegative[axis]][axis][child];
+                const float entry =
+                    (nearSlab - ray.origin[axis]) * ray.invDirection[axis];
+                const float exit =
+                    (farSlab - ray.origin[axis]) * ray.invDirection[axis];
+                // comparisons with NaNs fail, which ignores slabs that the
+                // ray runs parallel to and starts on (like the SIMD paths)
+                if (entry > nearT)
+                    nearT = entry;
+                if (exit < farT)
+                    farT = exit;
+            }
+            tNear[child] = nearT;
+            if (nearT <= farT && farT >= Epsilon && nearT < tMax)
+                mask |= 1 << child;
+        }
+        return mask;
+#endif
+    }
+
+    /**
+     * @brief Traverses a wide BVH with an explicit stack, with the same
+     * interface as @ref traverseNodes .
+     * All children of a node that are hit are pushed onto the stack sorted by
+     * their entry distance, so that the closest child is visited next.
+     */
+    template <int Width, typename LeafFunction>
+    bool traverseWideNodes(const std::vector<WideNode<Width>> &nodes,
+                           const TraversalRay &ray, const float &tMax,
+                           int &nodeCounter, LeafFunction &&visitLeaf) const {
+        /// @brief A pending wide node or leaf (if the primitive count is
+        /// positive).
+        struct WideStackEntry {
+            NodeIndex first;
+            NodeIndex primitiveCount;
+            float tNear;
+        };
+        // every level of the tree leaves at most Width - 1 entries behind
+        WideStackEntry stack[MaxDepth * (Width - 1) + 1];
+        int stackSize = 0;
+
+        WideStackEntry current = { 0, 0, -Infinity };
+        while (true) {
+            nodeCounter++;
+
+            if (current.primitiveCount > 0) {
+                if (visitLeaf(current.first, current.primitiveCount))
+                    return true;
+            } else {
+                const WideNode<Width> &node = nodes[current.first];
+                alignas(32) float tNear[Width];
+                int hitMask = intersectChildren(node, ray, tMax, tNear);
+
+                if (hitMask && !(hitMask & (hitMask - 1))) {
+                    // a single child is hit, which we can visit directly
+                    const int child = std::countr_zero(unsigned(hitMask));
+                    current         = { node.childFirst[child],
+                                        node.childCount[child],
+                                        tNear[child] };
+                    continue;
+                }
+
+                // push the children that are hit, keeping the pushed entries
+                // sorted by descending distance (insertion sort)
+                const int firstPushed = stackSize;
+                while (hitMask) {
+                    const int child = std::countr_zero(unsigned(hitMask));
+                    hitMask &= hitMask - 1;
+
+                    const WideStackEntry entry = { node.childFirst[child],
+                                                   node.childCount[child],
+                                                   tNear[child] };
+                    int position = stackSize++;
+                    while (position > firstPushed &&
+                           stack[position - 1].tNear < entry.tNear) {
+                        stack[position] = stack[position - 1];
+                        position--;
+                    }
+                    stack[position] = entry;
+                }
+            }
+
+            // continue with the closest pending node, skipping nodes that lie
+            // behind the closest intersection found in the meantime
+            do {
+                if (stackSize == 0)
+                    return false;
+                current = stack[--stackSize];
+            } while (current.tNear >= tMax);
+        }
+    }
+
+    /// @brief Traverses the BVH in the selected layout, see @ref
+    /// traverseNodes .
+    template <typename LeafFunction>
+    bool traverse(const TraversalRay &ray, const float &tMax, int &nodeCounter,
+                  LeafFunction &&visitLeaf) const {
+        switch (m_layout) {
+        case Layout::Wide4:
+            return traverseWideNodes(
+                m_wideNodes4, ray, tMax, nodeCounter, visitLeaf);
+        case Layout::Wide8:
+            return traverseWideNodes(
+                m_wideNodes8, ray, tMax, nodeCounter, visitLeaf);
+        default:
+            return traverseNodes(ray, tMax, nodeCounter, visitLeaf);
+        }
+    }
+
+    /// @brief The rays of a packet prepared for traversal, stored as structure
+    /// of arrays so that a bounding box can be tested against all rays at
+    /// once.
+    struct alignas(32) TraversalPacket {
+        /// @brief The origins of the rays, indexed by [axis][ray].
+        float origin[3][PacketSize];
+        /// @brief The reciprocal directions of the rays, indexed by
+        /// [axis][ray].
+        float invDirection[3][PacketSize];
+
+        TraversalPacket(const Packet<Ray> &rays, int mask) {
+            for (int lane = 0; lane < PacketSize; lane++) {
+                // invalid rays are never reported as hit, but should not
+                // produce floating point exceptions either
+                const bool valid = mask & (1 << lane);
+                for (int axis = 0; axis < 3; axis++) {
+                    origin[axis][lane] = valid ? rays[lane].origin[axis] : 0;
+                    invDirection[axis][lane] =
+                        valid ? 1 / rays[lane].direction[axis] : 1;
+                }
+            }
+        }
+    };
+
+    /**
+     * @brief Performs slab tests of all rays of a packet against a bounding
+     * box given by its corners.
+     * @param tNear Set to the smallest entry distance of the rays that hit.
+     * @return A bit mask of the rays in @c mask that hit the box before
+     * their @c tMax .
+     */
+    static int intersectPacketAABB(const float (&lower)[3],
+                                   const float (&upper)[3],
+                                   const TraversalPacket &packet,
+                                   const Packet<float> &tMax, int mask,
+                                   float &tNear) {
+        alignas(32) float nearT[PacketSize];
+        int hitMask = 0;
+#ifdef LW_SIMD_AVX2
+        __m256 vNear = _mm256_set1_ps(-Infinity);
+        __m256 vFar  = _mm256_set1_ps(Infinity);
+        for (int axis = 0; axis < 3; axis++) {
+            const __m256 origin = _mm256_load_ps(packet.origin[axis]);
+            const __m256 invDir = _mm256_load_ps(packet.invDirection[axis]);
+            const __m256 min    = _mm256_set1_ps(lower[axis]);
+            const __m256 max    = _mm256_set1_ps(upper[axis]);
+            // the rays of a packet can travel in different directions, so
+            // the sign of each reciprocal direction selects its near slab
+            const __m256 nearSlab = _mm256_blendv_ps(min, max, invDir);
+            const __m256 farSlab  = _mm256_blendv_ps(max, min, invDir);
+            // max and min return their second operand for NaNs, which
+            // ignores slabs that rays are parallel to and start on
+            vNear = _mm256_max_ps(
+                _mm256_mul_ps(_mm256_sub_ps(nearSlab, origin), invDir), vNear);
+            vFar = _mm256_min_ps(
+                _mm256_mul_ps(_mm256_sub_ps(farSlab, origin), invDir), vFar);
+        }
+        _mm256_store_ps(nearT, vNear);
+        const __m256 hit = _mm256_and_ps(
+            _mm256_and_ps(_mm256_cmp_ps(vNear, vFar, _CMP_LE_OQ),
+                          _mm256_cmp_ps(vFar, _mm256_set1_ps(Epsilon),
+                                        _CMP_GE_OQ)),
+            _mm256_cmp_ps(vNear, _mm256_loadu_ps(tMax.data()), _CMP_LT_OQ));
+        hitMask = _mm256_movemask_ps(hit) & mask;
+#elif defined(LW_SIMD_SSE)
+        // packets are processed in groups of 4 rays
+        for (int group = 0; group < PacketSize; group += 4) {
+            __m128 vNear = _mm_set1_ps(-Infinity);
+            __m128 vFar  = _mm_set1_ps(Infinity);
+            for (int axis = 0; axis < 3; axis++) {
+                const __m128 origin = _mm_load_ps(packet.origin[axis] + group);
+                const __m128 invDir =
+                    _mm_load_ps(packet.invDirection[axis] + group);
+                const __m128 min = _mm_set1_ps(lower[axis]);
+                const __m128 max = _mm_set1_ps(upper[axis]);
+                // SSE2 has no blend, so the sign bit is spread into a mask
+                const __m128 negative = _mm_castsi128_ps(
+                    _mm_srai_epi32(_mm_castps_si128(invDir), 31));
+                const __m128 nearSlab = _mm_or_ps(_mm_and_ps(negative, max),
+                                                  _mm_andnot_ps(negative, min));
+                const __m128 farSlab  = _mm_or_ps(_mm_and_ps(negative, min),
+                                                 _mm_andnot_ps(negative, max));
+                vNear                 = _mm_max_ps(
+                    _mm_mul_ps(_mm_sub_ps(nearSlab, origin), invDir), vNear);
+                vFar = _mm_min_ps(
+                    _mm_mul_ps(_mm_sub_ps(farSlab, origin), invDir), vFar);
+            }
+            _mm_store_ps(nearT + group, vNear);
+            const __m128 hit = _mm_and_ps(
+                _mm_and_ps(_mm_cmple_ps(vNear, vFar),
+                           _mm_cmpge_ps(vFar, _mm_set1_ps(Epsilon))),
+                _mm_cmplt_ps(vNear, _mm_loadu_ps(tMax.data() + group)));
+            hitMask |= _mm_movemask_ps(hit) << group;
+        }
+        hitMask &= mask;
+#else
+        for (int lane = 0; lane < PacketSize; lane++) {
+            float laneNear = -Infinity;
+            float laneFar  = Infinity;
+            for (int axis = 0; axis < 3; axis++) {
+                const float invDir   = packet.invDirection[axis][lane];
+                const bool negative  = std::signbit(invDir);
+                const float nearSlab = negative ? upper[axis] : lower[axis];
+                const float farSlab  = negative ? lower[axis] : upper[axis];
+                laneNear             = max(laneNear,
+                               (nearSlab - packet.origin[axis][lane]) * invDir);
+                laneFar              = min(laneFar,
+                              (farSlab - packet.origin[axis][lane]) * invDir);
+            }
+            nearT[lane] = laneNear;
+            if (laneNear <= laneFar && laneFar >= Epsilon &&
+                laneNear < tMax[lane])
+                hitMask |= 1 << lane;
+        }
+        hitMask &= mask;
+#endif
+        tNear = Infinity;
+        forEachLane(hitMask,
+                    [&](int lane) { tNear = min(tNear, nearT[lane]); });
+        return hitMask;
+    }
+
+    /// @brief Performs slab tests of all rays of a packet against a bounding
+    /// box, see above.
+    static int intersectPacketAABB(const Bounds &bounds,
+                                   const TraversalPacket &packet,
+                                   const Packet<float> &tMax, int mask,
+                                   float &tNear) {
+        const float lower[3] = { bounds.min().x(),
+                                 bounds.min().y(),
+                                 bounds.min().z() };
+        const float upper[3] = { bounds.max().x(),
+                                 bounds.max().y(),
+                                 bounds.max().z() };
+        return intersectPacketAABB(lower, upper, packet, tMax, mask, tNear);
+    }
+
+    /**
+     * @brief Traverses the BVH once for a packet of rays, calling
+     * @c visitLeaf for all leaf nodes whose bounding box is hit by any of
+     * the rays before their @c tMax .
+     * Every node is tested against all rays that are still active, and
+     * children are visited in order of the smallest entry distance of their
+     * rays. Width 2 selects the binary tree, otherwise wide nodes are used.
+     * @param tMax The maximum distances of interest, which are re-read after
+     * every leaf.
+     * @param nodeCounters Incremented for every node a ray visits.
+     * @param visitLeaf Called with the first index in m_primitiveIndices and
+     * the number of primitives of a leaf, as well as the mask of rays that
+     * hit it. Returns the mask of rays that need no further traversal.
+     */
+    template <int Width, typename LeafFunction>
+    void traversePacketNodes(const TraversalPacket &packet, int mask,
+                             const Packet<float> &tMax,
+                             Packet<int> &nodeCounters,
+                             LeafFunction &&visitLeaf) const {
+        /// @brief A pending node (or leaf, if the primitive count is
+        /// positive) and the rays that hit its bounding box.
+        struct PacketStackEntry {
+            NodeIndex first;
+            NodeIndex primitiveCount;
+            int mask;
+            float tNear;
+        };
+        // every level of the tree leaves at most Width - 1 entries behind
+        PacketStackEntry stack[MaxDepth * (Width - 1) + 1];
+        int stackSize = 0;
+
+        if constexpr (Width == 2) {
+            const Node &root = rootNode();
+            stack[stackSize++] = { root.isLeaf() ? root.firstPrimitiveIndex()
+                                                 : 0,
+                                   max(root.primitiveCount, 0),
+                                   mask,
+                                   -Infinity };
+        } else {
+            stack[stackSize++] = { 0, 0, mask, -Infinity };
+        }
+
+        int active = mask;
+        while (stackSize > 0) {
+            const PacketStackEntry entry = stack[--stackSize];
+            // skip rays that have finished, or whose closest intersection
+            // found in the meantime lies in front of the node
+            int entryMask = entry.mask & active;
+            forEachLane(entryMask, [&](int lane) {
+                if (entry.tNear >= tMax[lane])
+                    entryMask &= ~(1 << lane);
+            });
+            if (!entryMask)
+                continue;
+            forEachLane(entryMask, [&](int lane) { nodeCounters[lane]++; });
+
+            if (entry.primitiveCount > 0) {
+                active &= ~visitLeaf(
+                    entry.first, entry.primitiveCount, entryMask);
+                if (!active)
+                    return;
+                continue;
+            }
+
+            // push the children that are hit, keeping the pushed entries
+            // sorted by descending distance (insertion sort)
+            const int firstPushed = stackSize;
+            const auto push       = [&](const PacketStackEntry &child) {
+                int position = stackSize++;
+                while (position > firstPushed &&
+                       stack[position - 1].tNear < child.tNear) {
+                    stack[position] = stack[position - 1];
+                    position--;
+                }
+                stack[position] = child;
+            };
+
+            if constexpr (Width == 2) {
+                const Node &node = m_nodes[entry.first];
+                for (int i = 0; i < 2; i++) {
+                    const NodeIndex childIndex = node.leftChildIndex() + i;
+                    const Node &child          = m_nodes[childIndex];
+                    float tNear;
+                    const int childMask = intersectPacketAABB(
+                        child.aabb, packet, tMax, entryMask, tNear);
+                    if (!childMask)
+                        continue;
+                    if (child.isLeaf())
+                        push({ child.firstPrimitiveIndex(),
+                               child.primitiveCount,
+                               childMask,
+                               tNear });
+                    else
+                        push({ childIndex, 0, childMask, tNear });
+                }
+            } else {
+                const WideNode<Width> &node =
+                    wideNodes<Width>()[entry.first];
+                for (int i = 0; i < Width; i++) {
+                    const float lower[3] = { node.bounds[0][0][i],
+                                             node.bounds[0][1][i],
+                                             node.bounds[0][2][i] };
+                    const float upper[3] = { node.bounds[1][0][i],
+                                             node.bounds[1][1][i],
+                                             node.bounds[1][2][i] };
+                    float tNear;
+                    const int childMask = intersectPacketAABB(
+                        lower, upper, packet, tMax, entryMask, tNear);
+                    if (childMask)
+                        push({ node.childFirst[i],
+                               node.childCount[i],
+                               childMask,
+                               tNear });
+                }
+            }
+        }
+    }
+
+    /// @brief Traverses the BVH in the selected layout for a packet of rays,
+    /// see @ref traversePacketNodes .
+    template <typename LeafFunction>
+    void traversePacket(const TraversalPacket &packet, int mask,
+                        const Packet<float> &tMax, Packet<int> &nodeCounters,
+                        LeafFunction &&visitLeaf) const {
+        switch (m_layout) {
+        case Layout::Wide4:
+            return traversePacketNodes<4>(
+                packet, mask, tMax, nodeCounters, visitLeaf);
+        case Layout::Wide8:
+            return traversePacketNodes<8>(
+                packet, mask, tMax, nodeCounters, visitLeaf);
+        default:
+            return traversePacketNodes<2>(
+                packet, mask, tMax, nodeCounters, visitLeaf);
+        }
+    }
+
+    /**
+     * @brief Derives the data used for traversal from the binary tree, i.e.,
+     * collapses it into a wide tree if requested.
+     * @return The number of nodes in the selected layout.
+     */
+    size_t prepareTraversal() {
+        m_bounds = rootNode().aabb;
+        m_wideNodes4.clear();
+        m_wideNodes8.clear();
+        if (m_layout == Layout::Binary || m_referenceCount == 0)
+            return m_nodes.size();
+
+        size_t nodeCount;
+        if (m_layout == Layout::Wide4) {
+            collapse<4>(0);
+            nodeCount = m_wideNodes4.size();
+        } else {
+            collapse<8>(0);
+            nodeCount = m_wideNodes8.size();
+        }
+        // the binary nodes are no longer needed for traversal
+        m_nodes.clear();
+        m_nodes.shrink_to_fit();
+        return nodeCount;
+    }
+
+    /// @brief A human readable name of the selected layout, for logging.
+    const char *layoutName() const {
+        return m_layout == Layout::Wide8   ? "8-wide"
+               : m_layout == Layout::Wide4 ? "4-wide"
+                                           : "binary";
+    }
+
+    /**
+     * @brief Whether leaves are intersected child by child with a mailbox,
+     * which is the case if references have been duplicated and children are
+     * not tested in batches (where skipping single children would not pay
+     * off).
+     */
+    bool usesMailbox() const {
+        return !m_referenceIds.empty() && m_leafBatchSize == 1;
+    }
+
     /// @brief Computes the axis aligned bounding box for a leaf BVH node
     void computeAABB(Node &node) {
         node.aabb = Bounds::empty();
@@ -180,6 +864,67 @@ class AccelerationStructure : public Shape {
                     size.y() * size.z());
     }
 
+    /// @brief Nodes with at least this many primitives hand their children to
+    /// separate tasks when building in parallel.
+    static constexpr NodeIndex ParallelSubtreeThreshold = 4096;
+    /// @brief Nodes with at least this many primitives distribute binning
+    /// across all cores when building in parallel.
+    static constexpr NodeIndex ParallelBinningThreshold = 65536;
+    /// @brief The number of bins to use for the SAH heuristic.
+    static constexpr int BINS = 16;
+
+    /// @brief Whether the BVH is built using multiple threads.
+    bool m_parallelBuild = true;
+    /// @brief The number of children that intersectLeaf() tests at once,
+    /// queried from leafBatchSize() when the build starts.
+    int m_leafBatchSize = 1;
+    /// @brief Whether the build also measures itself against a serial build
+    /// and logs the resulting speedup, and compares spatial split BVHs with
+    /// the binned SAH tree. Both cost additional builds.
+    bool m_buildStatistics = false;
+
+    /// @brief The SAH intersection cost of a leaf with the given number of
+    /// children, which are tested in batches of m_leafBatchSize.
+    float leafCost(int primitiveCount) const {
+        return float((primitiveCount + m_leafBatchSize - 1) / m_leafBatchSize);
+    }
+
+    /// @brief Bins used to evaluate the SAH cost of split planes.
+    struct Bin {
+        Bounds bounds;
+        int primitiveCount = 0;
+    };
+
+    /**
+     * @brief Sorts a range of primitives of a node into bins along all three
+     * axes.
+     * @param node The BVH node whose bounding box determines the bins.
+     * @param first The first index in m_primitiveIndices to bin.
+     * @param last The index after the last index in m_primitiveIndices to bin.
+     * @param bins The bins for each axis, which will be extended by the range.
+     */
+    void populateBins(const Node &node, NodeIndex first, NodeIndex last,
+                      Bin (&bins)[3][BINS]) const {
+        Vector binScale;
+        for (int axis = 0; axis < 3; axis++) {
+            const float extent = node.aabb.max()[axis] - node.aabb.min()[axis];
+            binScale[axis]     = extent > 0 ? BINS / extent : 0;
+        }
+
+        for (NodeIndex i = first; i < last; i++) {
+            const int priIdx     = m_primitiveIndices[i];
+            const Point centroid = getCentroid(priIdx);
+            const Bounds priAABB = getBoundingBox(priIdx);
+            for (int axis = 0; axis < 3; axis++) {
+                const int axisBinIdx =
+                    (centroid[axis] - node.aabb.min()[axis]) * binScale[axis];
+                const int binIdx = min(BINS - 1, axisBinIdx);
+                bins[axis][binIdx].primitiveCount++;
+                bins[axis][binIdx].bounds.extend(priAABB);
+            }
+        }
+    }
+
     /**
      * For a given node, computes split axis and split position that minimize
      * the surface area heuristic.
@@ -193,16 +938,43 @@ class AccelerationStructure : public Shape {
      */
     void binning(const Node &node, int &bestSplitAxis,
                  float &bestSplitPosition) {
-        // strucutre to only visit each interval once
-        struct Bin {
-            Bounds bounds;
-            int primitiveCount = 0;
-        };
+        // populate the bins of all axes in a single pass over the primitives
+        Bin bins[3][BINS];
+        if (m_parallelBuild &&
+            node.primitiveCount >= ParallelBinningThreshold) {
+            // each chunk is binned independently, and the bins are merged
+            // afterwards (the result does not depend on the order of merging,
+            // as bins only track counts and bounds)
+            std::mutex mergeLock;
+            const NodeIndex chunkSize = ParallelBinningThreshold / 4;
+            for_each_parallel(
+                ChunkedRange(node.firstPrimitiveIndex(),
+                             node.firstPrimitiveIndex() + node.primitiveCount,
+                             chunkSize),
+                [&](Range chunk) {
+                    Bin chunkBins[3][BINS];
+                    populateBins(node, *chunk.begin(), *chunk.end(), chunkBins);
+
+                    std::unique_lock lock{ mergeLock };
+                    for (int axis = 0; axis < 3; axis++) {
+                        for (int i = 0; i < BINS; i++) {
+                            bins[axis][i].primitiveCount +=
+                                chunkBins[axis][i].primitiveCount;
+                            bins[axis][i].bounds.extend(
+                                chunkBins[axis][i].bounds);
+                        }
+                    }
+                });
+        } else {
+            populateBins(node,
+                         node.firstPrimitiveIndex(),
+                         node.firstPrimitiveIndex() + node.primitiveCount,
+                         bins);
+        }
 
-        // number of bins to use for the SAH heuristic
-        const int BINS = 16;
         // parent cost as best cost
-        float bestCost = node.primitiveCount * surfaceArea(node.aabb);
+        float bestCost =
+            leafCost(node.primitiveCount) * surfaceArea(node.aabb);
 
         bestSplitAxis = -1;
 
@@ -214,18 +986,7 @@ class AccelerationStructure : public Shape {
             if (boundsMin == boundsMax)
                 continue;
 
-            // populate bins
-            Bin bin[BINS];
-            float binScale = BINS / (boundsMax - boundsMin);
-            for (int i = 0; i < node.primitiveCount; i++) {
-                int priIdx     = m_primitiveIndices[node.leftFirst + i];
-                Point centroid = getCentroid(priIdx);
-
-                int axisBinIdx = (centroid[axis] - boundsMin) * binScale;
-                int binIdx     = min(BINS - 1, axisBinIdx);
-                bin[binIdx].primitiveCount++;
-                bin[binIdx].bounds.extend(getBoundingBox(priIdx));
-            }
+            const Bin *bin = bins[axis];
 
             // gather data for the planes in between the bins
             float leftArea[BINS - 1], rightArea[BINS - 1];
@@ -250,8 +1011,8 @@ class AccelerationStructure : public Shape {
             // calculate SAH cost for all planes
             float scale = (boundsMax - boundsMin) / BINS;
             for (int i = 0; i < BINS - 1; i++) {
-                float planeCost =
-                    leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+                float planeCost = leafCost(leftCount[i]) * leftArea[i] +
+                                  leafCost(rightCount[i]) * rightArea[i];
                 if (planeCost < bestCost) {
                     bestCost          = planeCost;
                     bestSplitPosition = boundsMin + scale * (i + 1);
@@ -261,11 +1022,19 @@ class AccelerationStructure : public Shape {
         }
     }
 
-    /// @brief Attempts to subdivide a given BVH node.
-    void subdivide(Node &parent) {
+    /**
+     * @brief Attempts to split a given BVH node into two children.
+     * @param parent The node to split. Its primitives will be re-ordered so
+     * that the primitives of the left child precede those of the right child.
+     * @param out left The left child, populated if splitting succeeds.
+     * @param out right The right child, populated if splitting succeeds.
+     * @param out axis The axis along which the primitives were split.
+     * @return Whether a useful split was found.
+     */
+    bool split(const Node &parent, Node &left, Node &right, int &axis) {
         // only subdivide if enough children are available.
         if (parent.primitiveCount <= 2) {
-            return;
+            return false;
         }
 
         // set to true when implementing binning
@@ -284,7 +1053,7 @@ class AccelerationStructure : public Shape {
 
         if (splitAxis == -1) {
             // a split axis of -1 indicates that no useful split exists
-            return;
+            return false;
         }
 
         // the point at which to split (note that primitives must be re-ordered
@@ -311,29 +1080,591 @@ class AccelerationStructure : public Shape {
 
         if (leftCount == 0 || rightCount == 0) {
             // if either child gets no primitives, we abort subdividing
-            return;
+            return false;
         }
 
-        // the two children will always be contiguous in our m_nodes list
-        const NodeIndex leftChildIndex  = (NodeIndex) (m_nodes.size() + 0);
-        const NodeIndex rightChildIndex = (NodeIndex) (m_nodes.size() + 1);
-        parent.primitiveCount = 0; // mark the parent node as internal node
-        parent.leftFirst      = leftChildIndex;
+        left.leftFirst       = firstLeftIndex;
+        left.primitiveCount  = leftCount;
+        right.leftFirst      = firstRightIndex;
+        right.primitiveCount = rightCount;
+        computeAABB(left);
+        computeAABB(right);
+        axis = splitAxis;
+        return true;
+    }
+
+    /**
+     * @brief Recursively subdivides a given BVH node on the current thread.
+     * @param depth The depth of the node, which is kept below @ref MaxDepth so
+     * that the traversal stack cannot overflow.
+     */
+    void subdivide(std::vector<Node> &nodes, NodeIndex parentIndex,
+                   int depth) {
+        if (depth + 1 >= MaxDepth)
+            return;
 
-        m_nodes.emplace_back();
-        m_nodes[leftChildIndex].leftFirst      = firstLeftIndex;
-        m_nodes[leftChildIndex].primitiveCount = leftCount;
+        Node left, right;
+        int axis;
+        if (!split(nodes[parentIndex], left, right, axis))
+            return;
+
+        // the two children will always be contiguous in our node list
+        const NodeIndex leftChildIndex  = (NodeIndex) (nodes.size() + 0);
+        const NodeIndex rightChildIndex = (NodeIndex) (nodes.size() + 1);
+        nodes[parentIndex].setSplitAxis(axis); // mark the parent node as
+                                               // internal node
+        nodes[parentIndex].leftFirst = leftChildIndex;
 
-        m_nodes.emplace_back();
-        m_nodes[rightChildIndex].leftFirst      = firstRightIndex;
-        m_nodes[rightChildIndex].primitiveCount = rightCount;
+        nodes.push_back(left);
+        nodes.push_back(right);
 
         // first, process the left child node (and all of its children)
-        computeAABB(m_nodes[leftChildIndex]);
-        subdivide(m_nodes[leftChildIndex]);
+        subdivide(nodes, leftChildIndex, depth + 1);
         // then, process the right child node (and all of its children)
-        computeAABB(m_nodes[rightChildIndex]);
-        subdivide(m_nodes[rightChildIndex]);
+        subdivide(nodes, rightChildIndex, depth + 1);
+    }
+
+    /**
+     * @brief Builds the BVH subtree for a given node, with the root of the
+     * subtree at index 0 of the returned node list.
+     * Large subtrees build their left child as separate task while the right
+     * child is built on the current thread. Since the two node lists are
+     * spliced together in the order the serial build would have produced
+     * them, the result is identical to @ref subdivide .
+     * @param depth The depth of the node, used to limit the number of tasks.
+     */
+    std::vector<Node> buildSubtree(const Node &root, int depth) {
+        std::vector<Node> nodes = { root };
+        if (root.primitiveCount < ParallelSubtreeThreshold ||
+            depth >= maxParallelBuildDepth()) {
+            subdivide(nodes, 0, depth);
+            return nodes;
+        }
+
+        Node left, right;
+        int axis;
+        if (!split(root, left, right, axis))
+            return nodes;
+
+        std::vector<Node> leftNodes;
+        TaskGroup leftTask;
+        leftTask.run([&]() { leftNodes = buildSubtree(left, depth + 1); });
+        const std::vector<Node> rightNodes = buildSubtree(right, depth + 1);
+        leftTask.wait();
+
+        // layout: [root, left root, right root, left descendants..., right
+        // descendants...], which matches the order of the serial build
+        // (a child at local index i > 0 ends up at index i + offset)
+        const NodeIndex leftOffset  = 2;
+        const NodeIndex rightOffset = NodeIndex(leftNodes.size()) + 1;
+        nodes.reserve(leftNodes.size() + rightNodes.size() + 1);
+        nodes[0].setSplitAxis(axis);
+        nodes[0].leftFirst = 1;
+
+        const auto append = [&](const Node &node, NodeIndex offset) {
+            Node &copy = nodes.emplace_back(node);
+            if (!copy.isLeaf())
+                copy.leftFirst += offset;
+        };
+        append(leftNodes[0], leftOffset);
+        append(rightNodes[0], rightOffset);
+        for (size_t i = 1; i < leftNodes.size(); i++)
+            append(leftNodes[i], leftOffset);
+        for (size_t i = 1; i < rightNodes.size(); i++)
+            append(rightNodes[i], rightOffset);
+        return nodes;
+    }
+
+    /// @brief A reference to a child during the spatial split build, whose
+    /// bounds may have been clipped to the part of the child within a node.
+    struct Reference {
+        Bounds bounds;
+        int primitiveIndex;
+    };
+
+    /// @brief The number of bins used to evaluate spatial splits.
+    static constexpr int SpatialBins = 32;
+    /**
+     * @brief Spatial splits are only considered if the children of the best
+     * object split overlap by more than this fraction of the surface area of
+     * the root, as proposed by Stich et al. 2009, "Spatial Splits in Bounding
+     * Volume Hierarchies".
+     */
+    static constexpr float SpatialSplitAlpha = 1e-5f;
+
+    /// @brief The state of a spatial split build.
+    struct SpatialBuild {
+        /// @brief The binary tree built so far.
+        std::vector<Node> nodes;
+        /// @brief The children referenced by the leaves, in leaf order.
+        std::vector<int> primitiveIndices;
+        /// @brief The surface area of the root node.
+        float rootArea;
+        /// @brief The number of references that may still be duplicated.
+        int64_t remainingDuplicates;
+    };
+
+    /// @brief A candidate split of a node during the spatial split build.
+    struct SplitCandidate {
+        /// @brief The SAH cost of the split.
+        float cost = Infinity;
+        /// @brief The split axis, or -1 if no split was found.
+        int axis = -1;
+        /// @brief The last bin that belongs to the left child.
+        int bin;
+        /// @brief The position of the first bin along the split axis.
+        float binMin;
+        /// @brief The number of bins per unit length along the split axis.
+        float binScale;
+        /// @brief The bounds of the two children.
+        Bounds left, right;
+        /// @brief The number of references in the two children.
+        int leftCount, rightCount;
+    };
+
+    /// @brief Whether the given bounds contain at least a single point.
+    static bool isValid(const Bounds &bounds) {
+        for (int axis = 0; axis < 3; axis++) {
+            if (bounds.min()[axis] > bounds.max()[axis])
+                return false;
+        }
+        return true;
+    }
+
+    /// @brief Calls splitBounds(), replacing parts that do not exist by empty
+    /// bounds.
+    void splitReference(const Reference &ref, int axis, float position,
+                        Bounds &left, Bounds &right) const {
+        splitBounds(
+            ref.primitiveIndex, ref.bounds, axis, position, left, right);
+        if (!isValid(left))
+            left = Bounds::empty();
+        if (!isValid(right))
+            right = Bounds::empty();
+    }
+
+    /// @brief Finds the best object split of a list of references, using
+    /// binned SAH on the centers of their bounds.
+    SplitCandidate findObjectSplit(const std::vector<Reference> &refs) const {
+        Bounds centroidBounds;
+        for (const Reference &ref : refs)
+            centroidBounds.extend(ref.bounds.center());
+
+        SplitCandidate best;
+        for (int axis = 0; axis < 3; axis++) {
+            const float binMin = centroidBounds.min()[axis];
+            const float extent = centroidBounds.max()[axis] - binMin;
+            if (extent <= 0)
+                continue;
+
+            const float binScale = BINS / extent;
+            Bin bins[BINS];
+            for (const Reference &ref : refs) {
+                const int binIdx =
+                    min(BINS - 1, int((ref.bounds.center()[axis] - binMin) *
+                                      binScale));
+                bins[binIdx].primitiveCount++;
+                bins[binIdx].bounds.extend(ref.bounds);
+            }
+
+            Bounds rightBoxes[BINS];
+            int rightCounts[BINS];
+            Bounds rightBox;
+            int rightCount = 0;
+            for (int i = BINS - 1; i > 0; i--) {
+                rightBox.extend(bins[i].bounds);
+                rightCount += bins[i].primitiveCount;
+                rightBoxes[i]  = rightBox;
+                rightCounts[i] = rightCount;
+            }
+
+            Bounds leftBox;
+            int leftCount = 0;
+            for (int i = 0; i < BINS - 1; i++) {
+                leftBox.extend(bins[i].bounds);
+                leftCount += bins[i].primitiveCount;
+                if (leftCount == 0 || rightCounts[i + 1] == 0)
+                    continue;
+
+                const float cost = leafCost(leftCount) * surfaceArea(leftBox) +
+                                   leafCost(rightCounts[i + 1]) *
+                                       surfaceArea(rightBoxes[i + 1]);
+                if (cost < best.cost) {
+                    best.cost       = cost;
+                    best.axis       = axis;
+                    best.bin        = i;
+                    best.binMin     = binMin;
+                    best.binScale   = binScale;
+                    best.left       = leftBox;
+                    best.right      = rightBoxes[i + 1];
+                    best.leftCount  = leftCount;
+                    best.rightCount = rightCounts[i + 1];
+                }
+            }
+        }
+        return best;
+    }
+
+    /// @brief Finds the best spatial split of a node, clipping the references
+    /// to the bins they overlap.
+    SplitCandidate findSpatialSplit(const Bounds &nodeBounds,
+                                    const std::vector<Reference> &refs) const {
+        struct SpatialBin {
+            Bounds bounds;
+            /// @brief The number of references that start in this bin.
+            int entries = 0;
+            /// @brief The number of references that end in this bin.
+            int exits = 0;
+        };
+
+        SplitCandidate best;
+        for (int axis = 0; axis < 3; axis++) {
+            const float binMin = nodeBounds.min()[axis];
+            const float extent = nodeBounds.max()[axis] - binMin;
+            if (extent <= 0)
+                continue;
+
+            const float binScale = SpatialBins / extent;
+            const auto binOf     = [&](float position) {
+                return clamp(
+                    int((position - binMin) * binScale), 0, SpatialBins - 1);
+            };
+
+            SpatialBin bins[SpatialBins];
+            for (const Reference &ref : refs) {
+                const int firstBin = binOf(ref.bounds.min()[axis]);
+                const int lastBin =
+                    max(firstBin, binOf(ref.bounds.max()[axis]));
+
+                // chop the reference into the parts that overlap each bin
+                Reference remainder = ref;
+                for (int i = firstBin; i < lastBin; i++) {
+                    Bounds left, right;
+                    splitReference(remainder,
+                                   axis,
+                                   binMin + (i + 1) / binScale,
+                                   left,
+                                   right);
+                    bins[i].bounds.extend(left);
+                    remainder.bounds = right;
+                }
+                bins[lastBin].bounds.extend(remainder.bounds);
+                bins[firstBin].entries++;
+                bins[lastBin].exits++;
+            }
+
+            Bounds rightBoxes[SpatialBins];
+            int rightCounts[SpatialBins];
+            Bounds rightBox;
+            int rightCount = 0;
+            for (int i = SpatialBins - 1; i > 0; i--) {
+                rightBox.extend(bins[i].bounds);
+                rightCount += bins[i].exits;
+                rightBoxes[i]  = rightBox;
+                rightCounts[i] = rightCount;
+            }
+
+            Bounds leftBox;
+            int leftCount = 0;
+            for (int i = 0; i < SpatialBins - 1; i++) {
+                leftBox.extend(bins[i].bounds);
+                leftCount += bins[i].entries;
+                if (leftCount == 0 || rightCounts[i + 1] == 0)
+                    continue;
+
+                const float cost = leafCost(leftCount) * surfaceArea(leftBox) +
+                                   leafCost(rightCounts[i + 1]) *
+                                       surfaceArea(rightBoxes[i + 1]);
+                if (cost < best.cost) {
+                    best.cost       = cost;
+                    best.axis       = axis;
+                    best.bin        = i;
+                    best.binMin     = binMin;
+                    best.binScale   = binScale;
+                    best.left       = leftBox;
+                    best.right      = rightBoxes[i + 1];
+                    best.leftCount  = leftCount;
+                    best.rightCount = rightCounts[i + 1];
+                }
+            }
+        }
+        return best;
+    }
+
+    /**
+     * @brief Distributes references among the two sides of a spatial split.
+     * References that straddle the split plane are either duplicated (with
+     * their bounds clipped to either side), or moved entirely to one side if
+     * that is cheaper ("reference unsplitting").
+     */
+    void partitionSpatial(const SplitCandidate &split,
+                          const std::vector<Reference> &refs,
+                          std::vector<Reference> &left,
+                          std::vector<Reference> &right) const {
+        const int axis       = split.axis;
+        const float position = split.binMin + (split.bin + 1) / split.binScale;
+        Bounds leftBox = split.left, rightBox = split.right;
+        int leftCount = split.leftCount, rightCount = split.rightCount;
+
+        for (const Reference &ref : refs) {
+            if (ref.bounds.max()[axis] <= position) {
+                left.push_back(ref);
+                continue;
+            }
+            if (ref.bounds.min()[axis] >= position) {
+                right.push_back(ref);
+                continue;
+            }
+
+            Bounds unsplitLeft = leftBox, unsplitRight = rightBox;
+            unsplitLeft.extend(ref.bounds);
+            unsplitRight.extend(ref.bounds);
+            const float splitCost =
+                leafCost(leftCount) * surfaceArea(leftBox) +
+                leafCost(rightCount) * surfaceArea(rightBox);
+            const float leftCost =
+                leafCost(leftCount) * surfaceArea(unsplitLeft) +
+                leafCost(rightCount - 1) * surfaceArea(rightBox);
+            const float rightCost =
+                leafCost(leftCount - 1) * surfaceArea(leftBox) +
+                leafCost(rightCount) * surfaceArea(unsplitRight);
+
+            if (leftCost < splitCost && leftCost <= rightCost) {
+                left.push_back(ref);
+                leftBox = unsplitLeft;
+                rightCount--;
+            } else if (rightCost < splitCost) {
+                right.push_back(ref);
+                rightBox = unsplitRight;
+                leftCount--;
+            } else {
+                Bounds leftPart, rightPart;
+                splitReference(ref, axis, position, leftPart, rightPart);
+                if (isValid(leftPart))
+                    left.push_back({ leftPart, ref.primitiveIndex });
+                if (isValid(rightPart))
+                    right.push_back({ rightPart, ref.primitiveIndex });
+                if (!isValid(leftPart) && !isValid(rightPart)) {
+                    // rounding can leave nothing of either half, but the
+                    // primitive must not disappear from the hierarchy
+                    if (ref.bounds.center()[axis] < position)
+                        left.push_back(ref);
+                    else
+                        right.push_back(ref);
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Recursively builds the subtree of a node from its references,
+     * choosing between object splits, spatial splits and creating a leaf
+     * based on their SAH cost.
+     * @param refs The references of the node, which are consumed.
+     */
+    void buildSpatialNode(SpatialBuild &build, NodeIndex nodeIndex,
+                          std::vector<Reference> &refs, int depth) const {
+        const Bounds bounds  = build.nodes[nodeIndex].aabb;
+        const NodeIndex count = NodeIndex(refs.size());
+
+        SplitCandidate best;
+        bool isSpatial = false;
+        if (count > 2 && depth + 1 < MaxDepth) {
+            best = findObjectSplit(refs);
+
+            // spatial splits only pay off if the children of the object split
+            // overlap considerably
+            Bounds overlap = best.left;
+            overlap.min()  = elementwiseMax(best.left.min(), best.right.min());
+            overlap.max()  = elementwiseMin(best.left.max(), best.right.max());
+            const float overlapArea =
+                best.axis != -1 && isValid(overlap) ? surfaceArea(overlap) : 0;
+            if (build.remainingDuplicates > 0 &&
+                (best.axis == -1 ||
+                 overlapArea > SpatialSplitAlpha * build.rootArea)) {
+                const SplitCandidate spatial = findSpatialSplit(bounds, refs);
+                if (spatial.cost < best.cost &&
+                    spatial.leftCount + spatial.rightCount - count <=
+                        build.remainingDuplicates) {
+                    best      = spatial;
+                    isSpatial = true;
+                }
+            }
+        }
+
+        std::vector<Reference> left, right;
+        const float noSplitCost = leafCost(count) * surfaceArea(bounds);
+        if (best.axis != -1 && best.cost < noSplitCost) {
+            if (isSpatial) {
+                partitionSpatial(best, refs, left, right);
+            } else {
+                for (const Reference &ref : refs) {
+                    const int binIdx = min(
+                        BINS - 1,
+                        int((ref.bounds.center()[best.axis] - best.binMin) *
+                            best.binScale));
+                    (binIdx <= best.bin ? left : right).push_back(ref);
+                }
+            }
+        }
+
+        if (left.empty() || right.empty()) {
+            // no useful split exists, so we create a leaf
+            Node &leaf          = build.nodes[nodeIndex];
+            leaf.leftFirst      = NodeIndex(build.primitiveIndices.size());
+            leaf.primitiveCount = count;
+            for (const Reference &ref : refs)
+                build.primitiveIndices.push_back(ref.primitiveIndex);
+            return;
+        }
+
+        build.remainingDuplicates -=
+            int64_t(left.size() + right.size()) - count;
+        refs.clear();
+        refs.shrink_to_fit();
+
+        Node leftNode, rightNode;
+        for (const Reference &ref : left)
+            leftNode.aabb.extend(ref.bounds);
+        for (const Reference &ref : right)
+            rightNode.aabb.extend(ref.bounds);
+
+        const NodeIndex leftChildIndex = NodeIndex(build.nodes.size());
+        build.nodes[nodeIndex].setSplitAxis(best.axis);
+        build.nodes[nodeIndex].leftFirst = leftChildIndex;
+        build.nodes.push_back(leftNode);
+        build.nodes.push_back(rightNode);
+
+        buildSpatialNode(build, leftChildIndex, left, depth + 1);
+        buildSpatialNode(build, leftChildIndex + 1, right, depth + 1);
+    }
+
+    /**
+     * @brief Replaces the binary tree with a tree that also uses spatial
+     * splits. If build statistics are enabled, the binary tree has been
+     * built by binned SAH and the change of the SAH cost is logged.
+     */
+    void buildSpatialSplitBVH() {
+        const float binnedCost = m_buildStatistics ? treeCost(m_nodes) : 0;
+
+        SpatialBuild build;
+        build.rootArea            = surfaceArea(rootNode().aabb);
+        build.remainingDuplicates = int64_t(
+            m_spatialSplitBudget * float(m_primitiveIndices.size()));
+
+        std::vector<Reference> refs(m_primitiveIndices.size());
+        for (size_t i = 0; i < refs.size(); i++)
+            refs[i] = { getBoundingBox(int(i)), int(i) };
+
+        Node root;
+        root.aabb = rootNode().aabb;
+        build.nodes.push_back(root);
+        buildSpatialNode(build, 0, refs, 0);
+
+        m_nodes            = std::move(build.nodes);
+        m_primitiveIndices = std::move(build.primitiveIndices);
+
+        if (!m_buildStatistics) {
+            logger(EInfo,
+                   "spatial splits used %ld references for %d primitives",
+                   m_primitiveIndices.size(),
+                   numberOfPrimitives());
+            return;
+        }
+
+        const float spatialCost = treeCost(m_nodes);
+        logger(EInfo,
+               "spatial splits changed the SAH cost from %.2f to %.2f "
+               "(%+.1f%%), using %ld references for %d primitives",
+               binnedCost,
+               spatialCost,
+               100 * (spatialCost / binnedCost - 1),
+               m_primitiveIndices.size(),
+               numberOfPrimitives());
+    }
+
+    /// @brief Computes the SAH cost of a binary tree relative to the surface
+    /// area of its root, charging one unit per node and per leaf batch.
+    float treeCost(const std::vector<Node> &nodes) const {
+        float cost = 0;
+        for (const Node &node : nodes) {
+            cost += surfaceArea(node.aabb) *
+                    (node.isLeaf() ? 1 + leafCost(node.primitiveCount) : 1);
+        }
+        return cost / surfaceArea(nodes.front().aabb);
+    }
+
+    /**
+     * @brief Collapses the binary BVH below a given node into a wide node
+     * (and recursively, its descendants).
+     * The children of the wide node are found by repeatedly replacing the
+     * internal child with the largest surface area by its two children, until
+     * either @c Width children are found or all children are leaves.
+     * @return The index of the created wide node.
+     */
+    template <int Width> NodeIndex collapse(NodeIndex binaryIndex) {
+        NodeIndex children[Width];
+        int childCount = 0;
+        if (m_nodes[binaryIndex].isLeaf()) {
+            // can only happen for the root, which then is the only child
+            children[childCount++] = binaryIndex;
+        } else {
+            children[childCount++] = m_nodes[binaryIndex].leftChildIndex();
+            children[childCount++] = m_nodes[binaryIndex].rightChildIndex();
+        }
+
+        while (childCount < Width) {
+            int largestChild  = -1;
+            float largestArea = -1;
+            for (int i = 0; i < childCount; i++) {
+                const Node &child = m_nodes[children[i]];
+                if (!child.isLeaf() && surfaceArea(child.aabb) > largestArea) {
+                    largestChild = i;
+                    largestArea  = surfaceArea(child.aabb);
+                }
+            }
+            if (largestChild == -1)
+                break; // all children are leaves
+
+            const Node &opened     = m_nodes[children[largestChild]];
+            children[largestChild] = opened.leftChildIndex();
+            children[childCount++] = opened.rightChildIndex();
+        }
+
+        // note that the node list may grow while collapsing the children, so
+        // the new node can only be referenced by index
+        auto &nodes                = wideNodes<Width>();
+        const NodeIndex wideIndex  = NodeIndex(nodes.size());
+        nodes.emplace_back();
+        for (int i = 0; i < Width; i++) {
+            const Bounds box =
+                i < childCount ? m_nodes[children[i]].aabb : Bounds::empty();
+            for (int axis = 0; axis < 3; axis++) {
+                nodes[wideIndex].bounds[0][axis][i] = box.min()[axis];
+                nodes[wideIndex].bounds[1][axis][i] = box.max()[axis];
+            }
+
+            NodeIndex first = 0, count = 0;
+            if (i < childCount) {
+                const Node &child = m_nodes[children[i]];
+                if (child.isLeaf()) {
+                    first = child.firstPrimitiveIndex();
+                    count = child.primitiveCount;
+                } else {
+                    first = collapse<Width>(children[i]);
+                }
+            }
+            nodes[wideIndex].childFirst[i] = first;
+            nodes[wideIndex].childCount[i] = count;
+        }
+        return wideIndex;
+    }
+
+    /// @brief The depth up to which subtrees are handed out as separate
+    /// tasks, chosen so that all cores have work to do.
+    static int maxParallelBuildDepth() {
+        const int numThreads = ThreadPool::global().threadCount();
+        return int(std::ceil(std::log2(numThreads))) + 2;
     }
 
 protected:
@@ -344,48 +1675,437 @@ protected:
     /// ray.
     virtual bool intersect(int primitiveIndex, const Ray &ray,
                            Intersection &its, Sampler &rng) const = 0;
+    /**
+     * @brief Reports whether a single child (identified by the index) is hit
+     * by the given ray closer than @c tMax .
+     * @note Override this to skip the computation of surface attributes that
+     * the closest-hit @ref intersect performs.
+     */
+    virtual bool occluded(int primitiveIndex, const Ray &ray, float tMax,
+                          Sampler &rng) const {
+        Intersection its(-ray.direction, tMax);
+        return intersect(primitiveIndex, ray, its, rng);
+    }
     /// @brief Returns the axis aligned bounding box of the given child.
     virtual Bounds getBoundingBox(int primitiveIndex) const = 0;
     /// @brief Returns the centroid of the given child.
     virtual Point getCentroid(int primitiveIndex) const = 0;
 
-    /// @brief Builds the acceleration structure.
-    void buildAccelerationStructure() {
+    /**
+     * @brief Intersects all children of a BVH leaf with the given ray.
+     * @param first The position of the first child of the leaf in the leaf
+     * order of the BVH.
+     * @param count The number of children of the leaf.
+     * @note The default implementation calls @ref intersect for every child.
+     * Subclasses that store their children in leaf order (see @ref
+     * reorderPrimitives ) can override this to stream through them directly.
+     */
+    virtual bool intersectLeaf(int first, int count, const Ray &ray,
+                               Intersection &its, Sampler &rng) const {
+        bool wasIntersected = false;
+        for (int i = first; i < first + count; i++)
+            wasIntersected |= intersect(primitiveAt(i), ray, its, rng);
+        return wasIntersected;
+    }
+    /// @brief Reports whether any child of a BVH leaf is hit by the given ray
+    /// closer than @c tMax (see @ref intersectLeaf ).
+    virtual bool occludedLeaf(int first, int count, const Ray &ray, float tMax,
+                              Sampler &rng) const {
+        for (int i = first; i < first + count; i++) {
+            if (occluded(primitiveAt(i), ray, tMax, rng))
+                return true;
+        }
+        return false;
+    }
+    /**
+     * @brief Intersects all children of a BVH leaf with the rays of a packet
+     * whose bit is set in @c mask (see @ref intersectLeaf ).
+     * @return A bit mask of the rays for which an intersection was found.
+     * @note The default implementation calls @ref intersectLeaf for every
+     * ray. Subclasses whose children are shapes themselves can override this
+     * to pass the packet on to them.
+     */
+    virtual int intersectLeaf8(int first, int count, const Packet<Ray> &rays,
+                               int mask, Packet<Intersection> &its,
+                               const Packet<Sampler *> &rng) const {
+        int hitMask = 0;
+        forEachLane(mask, [&](int lane) {
+            if (intersectLeaf(first, count, rays[lane], its[lane], *rng[lane]))
+                hitMask |= 1 << lane;
+        });
+        return hitMask;
+    }
+    /// @brief Tests the rays of a packet for occlusion by any child of a BVH
+    /// leaf, returning a bit mask of the occluded rays (see @ref
+    /// intersectLeaf8 ).
+    virtual int occludedLeaf8(int first, int count, const Packet<Ray> &rays,
+                              const Packet<float> &tMax, int mask,
+                              const Packet<Sampler *> &rng) const {
+        int occludedMask = 0;
+        forEachLane(mask, [&](int lane) {
+            if (occludedLeaf(first, count, rays[lane], tMax[lane], *rng[lane]))
+                occludedMask |= 1 << lane;
+        });
+        return occludedMask;
+    }
+    /// @brief Returns the index of the child at the given position of the
+    /// leaf order, as used by @ref intersectLeaf .
+    int primitiveAt(int position) const {
+        return m_isLeafOrder ? position : m_primitiveIndices[position];
+    }
+    /**
+     * @brief Called once the BVH has been built, allowing subclasses to store
+     * their children in the order of the BVH leaves, which makes the children
+     * of each leaf contiguous in memory.
+     * @param order The original index of the child at each position of the
+     * leaf order.
+     * @return Whether the children have been re-ordered, in which case all
+     * primitive indices refer to positions in the leaf order from then on.
+     */
+    virtual bool reorderPrimitives(const std::vector<int> &order) {
+        return false;
+    }
+    /**
+     * @brief The number of children that intersectLeaf() tests at once, e.g.,
+     * using SIMD instructions.
+     * The SAH accounts for this by charging leaves per started batch, which
+     * lets leaves grow up to the batch size.
+     */
+    virtual int leafBatchSize() const { return 1; }
+    /**
+     * @brief Splits the part of a child that lies within @c bounds at an axis
+     * aligned plane, as needed for spatial splits.
+     * @param out left The bounds of the part below the plane, or empty bounds
+     * if there is no such part.
+     * @param out right The bounds of the part above the plane, or empty
+     * bounds if there is no such part.
+     * @note The default implementation splits @c bounds itself. Subclasses can
+     * provide tighter bounds by clipping the actual geometry of the child.
+     */
+    virtual void splitBounds(int primitiveIndex, const Bounds &bounds, int axis,
+                             float position, Bounds &left,
+                             Bounds &right) const {
+        left = right      = bounds;
+        left.max()[axis]  = min(bounds.max()[axis], position);
+        right.min()[axis] = max(bounds.min()[axis], position);
+    }
+
+    /**
+     * @brief Calls @c visit with the first position and the number of
+     * children of every BVH leaf.
+     * @note Only available while the binary tree exists, i.e., from within
+     * @ref reorderPrimitives .
+     */
+    template <typename Visitor> void forEachLeaf(Visitor &&visit) const {
+        for (const Node &node : m_nodes) {
+            if (node.isLeaf())
+                visit(node.firstPrimitiveIndex(), node.primitiveCount);
+        }
+    }
+
+    /**
+     * @brief Builds the acceleration structure.
+     * @param cache If given, the BVH is added to this cache entry, from which
+     * it can be restored using restoreAccelerationStructure().
+     */
+    void buildAccelerationStructure(diskcache::Writer *cache = nullptr) {
         Timer buildTimer;
+        m_leafBatchSize          = leafBatchSize();
+        const int primitiveCount = numberOfPrimitives();
 
         // fill primitive indices with 0 to primitiveCount - 1
         m_primitiveIndices.resize(numberOfPrimitives());
         std::iota(m_primitiveIndices.begin(), m_primitiveIndices.end(), 0);
 
         // create root node
-        auto &root          = m_nodes.emplace_back();
+        Node root;
         root.leftFirst      = 0;
         root.primitiveCount = numberOfPrimitives();
         computeAABB(root);
-        subdivide(root);
 
+        float serialTime = 0;
+        if (m_buildStatistics && m_parallelBuild) {
+            // the serial build produces the same tree, which is only timed
+            Timer serialTimer;
+            std::vector<Node> serialNodes = { root };
+            m_parallelBuild = false;
+            subdivide(serialNodes, 0, 0);
+            m_parallelBuild = true;
+            serialTime      = serialTimer.getElapsedTime();
+            std::iota(m_primitiveIndices.begin(), m_primitiveIndices.end(), 0);
+        }
+
+        Timer binaryTimer;
+        m_nodes.clear();
+        if (m_builder == Builder::Spatial && !m_buildStatistics) {
+            // the spatial split build only needs the bounds of the root
+            m_nodes.push_back(root);
+        } else if (m_parallelBuild) {
+            m_nodes = buildSubtree(root, 0);
+        } else {
+            m_nodes.push_back(root);
+            subdivide(m_nodes, 0, 0);
+        }
+        const float binaryTime = binaryTimer.getElapsedTime();
+
+        if (m_builder == Builder::Spatial && primitiveCount > 0)
+            buildSpatialSplitBVH();
+        m_referenceIds.clear();
+        if (m_primitiveIndices.size() > size_t(primitiveCount)) {
+            // spatial splits have duplicated references
+            m_referenceIds = m_primitiveIndices;
+        }
+
+        m_referenceCount = m_primitiveIndices.size();
+        m_isLeafOrder    = reorderPrimitives(m_primitiveIndices);
+        if (m_isLeafOrder) {
+            // primitive indices now coincide with positions in the leaf order
+            std::iota(m_primitiveIndices.begin(), m_primitiveIndices.end(), 0);
+        }
+
+        if (cache) {
+            // the binary nodes might be discarded after collapsing them
+            cache->add(primitiveCount);
+            cache->add(std::vector<Node>(m_nodes));
+            cache->add(m_primitiveIndices);
+            cache->add(m_referenceIds);
+        }
+        releaseLeafOrderIndices();
+
+        const size_t nodeCount = prepareTraversal();
         logger(EInfo,
-               "built BVH with %ld nodes for %ld primitives in %.1f ms",
-               m_nodes.size(),
-               numberOfPrimitives(),
-               buildTimer.getElapsedTime() * 1000);
+               "built %s BVH with %ld nodes for %ld primitives in %.1f ms",
+               layoutName(),
+               nodeCount,
+               primitiveCount,
+               (buildTimer.getElapsedTime() - serialTime) * 1000);
+        if (serialTime > 0) {
+            logger(EInfo,
+                   "binary tree took %.1f ms to build in parallel and %.1f ms "
+                   "serially (%.1fx speedup)",
+                   binaryTime * 1000,
+                   serialTime * 1000,
+                   serialTime / max(binaryTime, 1e-6f));
+        }
+    }
+
+    /// @brief Frees the primitive indices if the children are stored in leaf
+    /// order, where they would only map each position to itself.
+    void releaseLeafOrderIndices() {
+        if (!m_isLeafOrder)
+            return;
+        m_primitiveIndices.clear();
+        m_primitiveIndices.shrink_to_fit();
+    }
+
+    /// @brief Describes all settings that affect the binary tree, to be used
+    /// as part of the key of cache entries.
+    std::string accelerationStructureKey() const {
+        return tfm::format("builder=%d budget=%g batch=%d",
+                           int(m_builder),
+                           m_spatialSplitBudget,
+                           leafBatchSize());
+    }
+
+    /**
+     * @brief Restores a BVH that was added to a cache entry by
+     * buildAccelerationStructure(), instead of building it.
+     * @note Subclasses that re-order their children must restore them in leaf
+     * order first. reorderPrimitives() is then called with the identity
+     * order, which allows subclasses to rebuild derived data.
+     */
+    void restoreAccelerationStructure(diskcache::Reader &cache) {
+        Timer restoreTimer;
+        m_leafBatchSize = leafBatchSize();
+        int primitiveCount;
+        cache.read(primitiveCount);
+        cache.read(m_nodes);
+        cache.read(m_primitiveIndices);
+        cache.read(m_referenceIds);
+        if (m_nodes.empty())
+            lightwave_throw("malformed cache entry");
+
+        m_referenceCount = m_primitiveIndices.size();
+        m_isLeafOrder    = reorderPrimitives(m_primitiveIndices);
+        releaseLeafOrderIndices();
+
+        const size_t nodeCount = prepareTraversal();
+        logger(EInfo,
+               "restored %s BVH with %ld nodes for %ld primitives in %.1f ms",
+               layoutName(),
+               nodeCount,
+               primitiveCount,
+               restoreTimer.getElapsedTime() * 1000);
     }
 
 public:
+    AccelerationStructure(const Properties &properties) {
+        m_parallelBuild   = properties.get<bool>("parallelBuild", true);
+        m_buildStatistics = properties.get<bool>("buildStatistics", false);
+        // clang-format off
+        m_layout = properties.getEnum<Layout>("bvh", Layout::Binary, {
+            { "binary", Layout::Binary },
+            { "wide4", Layout::Wide4 },
+            { "wide8", Layout::Wide8 },
+        });
+        m_builder = properties.getEnum<Builder>("builder", Builder::Binned, {
+            { "binned", Builder::Binned },
+            { "sbvh", Builder::Spatial },
+        });
+        // clang-format on
+        m_spatialSplitBudget =
+            properties.get<float>("spatialSplitBudget", m_spatialSplitBudget);
+    }
+
     bool intersect(const Ray &ray, Intersection &its,
                    Sampler &rng) const override {
-        if (m_primitiveIndices.empty())
+        if (m_referenceCount == 0)
             return false; // exit early if no children exist
-        if (intersectAABB(rootNode().aabb, ray) < its.t) // test root bounding
-                                                         // box for potential
-                                                         // hit
-            return intersectNode(rootNode(), ray, its, rng);
-        return false;
+
+        const TraversalRay traversalRay { ray };
+        if (intersectAABB(m_bounds, traversalRay) >=
+            its.t) // test root bounding box for potential hit
+            return false;
+
+        bool wasIntersected = false;
+        if (usesMailbox()) {
+            Mailbox mailbox;
+            traverse(traversalRay,
+                     its.t,
+                     its.stats.bvhCounter,
+                     [&](NodeIndex first, NodeIndex count) {
+                         its.stats.primCounter += count;
+                         for (NodeIndex i = first; i < first + count; i++) {
+                             if (mailbox.insert(m_referenceIds[i]))
+                                 wasIntersected |= intersect(
+                                     primitiveAt(i), ray, its, rng);
+                         }
+                         return false;
+                     });
+            return wasIntersected;
+        }
+
+        traverse(traversalRay,
+                 its.t,
+                 its.stats.bvhCounter,
+                 [&](NodeIndex first, NodeIndex count) {
+                     // update the statistic tracking how many children have
+                     // been tested for intersection
+                     its.stats.primCounter += count;
+                     // test the children for intersection
+                     wasIntersected |= intersectLeaf(first, count, ray, its, rng);
+                     return false; // the closest hit needs all leaves
+                 });
+        return wasIntersected;
+    }
+
+    bool occluded(const Ray &ray, float tMax, Sampler &rng) const override {
+        if (m_referenceCount == 0)
+            return false;
+
+        const TraversalRay traversalRay { ray };
+        if (intersectAABB(m_bounds, traversalRay) >= tMax)
+            return false;
+
+        int nodeCounter = 0;
+        if (usesMailbox()) {
+            Mailbox mailbox;
+            return traverse(
+                traversalRay,
+                tMax,
+                nodeCounter,
+                [&](NodeIndex first, NodeIndex count) {
+                    for (NodeIndex i = first; i < first + count; i++) {
+                        if (mailbox.insert(m_referenceIds[i]) &&
+                            occluded(primitiveAt(i), ray, tMax, rng))
+                            return true;
+                    }
+                    return false;
+                });
+        }
+
+        return traverse(traversalRay,
+                        tMax,
+                        nodeCounter,
+                        [&](NodeIndex first, NodeIndex count) {
+                            // any hit suffices, so we stop at the first one
+                            return occludedLeaf(first, count, ray, tMax, rng);
+                        });
+    }
+
+    int intersect8(const Packet<Ray> &rays, int mask, Packet<Intersection> &its,
+                   const Packet<Sampler *> &rng) const override {
+        if (m_referenceCount == 0)
+            return 0;
+        if (usesMailbox() || std::has_single_bit(unsigned(mask))) {
+            // duplicated references are skipped per ray, and single rays are
+            // traversed faster on their own
+            return Shape::intersect8(rays, mask, its, rng);
+        }
+
+        // inactive lanes are read by the packet box tests, but never hit
+        Packet<float> tMax;
+        tMax.fill(Infinity);
+        forEachLane(mask, [&](int lane) { tMax[lane] = its[lane].t; });
+        const TraversalPacket packet { rays, mask };
+        float tNear;
+        mask = intersectPacketAABB(m_bounds, packet, tMax, mask, tNear);
+        if (!mask)
+            return 0;
+
+        int hitMask              = 0;
+        Packet<int> nodeCounters = {};
+        traversePacket(packet,
+                       mask,
+                       tMax,
+                       nodeCounters,
+                       [&](NodeIndex first, NodeIndex count, int leafMask) {
+                           hitMask |= intersectLeaf8(
+                               first, count, rays, leafMask, its, rng);
+                           forEachLane(leafMask, [&](int lane) {
+                               its[lane].stats.primCounter += count;
+                               tMax[lane] = its[lane].t;
+                           });
+                           return 0; // the closest hits need all leaves
+                       });
+        forEachLane(mask, [&](int lane) {
+            its[lane].stats.bvhCounter += nodeCounters[lane];
+        });
+        return hitMask;
+    }
+
+    int occluded8(const Packet<Ray> &rays, const Packet<float> &tMax, int mask,
+                  const Packet<Sampler *> &rng) const override {
+        if (m_referenceCount == 0)
+            return 0;
+        if (usesMailbox() || std::has_single_bit(unsigned(mask)))
+            return Shape::occluded8(rays, tMax, mask, rng);
+
+        const TraversalPacket packet { rays, mask };
+        float tNear;
+        mask = intersectPacketAABB(m_bounds, packet, tMax, mask, tNear);
+        if (!mask)
+            return 0;
+
+        int occludedMask         = 0;
+        Packet<int> nodeCounters = {};
+        traversePacket(packet,
+                       mask,
+                       tMax,
+                       nodeCounters,
+                       [&](NodeIndex first, NodeIndex count, int leafMask) {
+                           // any hit suffices, so occluded rays are done
+                           const int leafOccluded = occludedLeaf8(
+                               first, count, rays, tMax, leafMask, rng);
+                           occludedMask |= leafOccluded;
+                           return leafOccluded;
+                       });
+        return occludedMask;
     }
 
-    Bounds getBoundingBox() const override { return rootNode().aabb; }
+    Bounds getBoundingBox() const override { return m_bounds; }
 
-    Point getCentroid() const override { return rootNode().aabb.center(); }
+    Point getCentroid() const override { return m_bounds.center(); }
 };
 
 } // namespace lightwave
@@ -22,6 +22,33 @@ protected:
         return m_children[primitiveIndex]->intersect(ray, its, rng);
     }
 
+    bool occluded(int primitiveIndex, const Ray &ray, float tMax,
+                  Sampler &rng) const override {
+        return m_children[primitiveIndex]->occluded(ray, tMax, rng);
+    }
+
+    int intersectLeaf8(int first, int count, const Packet<Ray> &rays, int mask,
+                       Packet<Intersection> &its,
+                       const Packet<Sampler *> &rng) const override {
+        // children can be acceleration structures themselves, which then
+        // traverse their nodes for the whole packet as well
+        int hitMask = 0;
+        for (int i = first; i < first + count; i++)
+            hitMask |=
+                m_children[primitiveAt(i)]->intersect8(rays, mask, its, rng);
+        return hitMask;
+    }
+
+    int occludedLeaf8(int first, int count, const Packet<Ray> &rays,
+                      const Packet<float> &tMax, int mask,
+                      const Packet<Sampler *> &rng) const override {
+        int occludedMask = 0;
+        for (int i = first; i < first + count && occludedMask != mask; i++)
+            occludedMask |= m_children[primitiveAt(i)]->occluded8(
+                rays, tMax, mask & ~occludedMask, rng);
+        return occludedMask;
+    }
+
     Bounds getBoundingBox(int primitiveIndex) const override {
         return m_children[primitiveIndex]->getBoundingBox();
     }
@@ -31,11 +58,20 @@ protected:
     }
 
 public:
-    Group(const Properties &properties) {
+    Group(const Properties &properties) : AccelerationStructure(properties) {
         m_children = properties.getChildren<Shape>();
         buildAccelerationStructure();
     }
 
+    bool intersect(const Ray &ray, Intersection &its,
+                   Sampler &rng) const override {
+        return AccelerationStructure::intersect(ray, its, rng);
+    }
+
+    bool occluded(const Ray &ray, float tMax, Sampler &rng) const override {
+        return AccelerationStructure::occluded(ray, tMax, rng);
+    }
+
     void markAsVisible() override {
         for (auto &child : m_children)
             child->markAsVisible();
@@ -1,7 +1,9 @@
 #include <lightwave.hpp>
 
 #include "../core/plyparser.hpp"
+#include "../core/diskcache.hpp"
 #include "accel.hpp"
+#include "trianglepack.hpp"
 
 namespace lightwave {
 
@@ -11,7 +13,7 @@ namespace lightwave {
  * needed (and would pose an excessive amount of overhead), collections of
  * triangles are combined in a single shape.
  */
-class TriangleMesh : public AccelerationStructure {
+class TriangleMesh final : public AccelerationStructure {
     /**
      * @brief The index buffer of the triangles.
      * The n-th element corresponds to the n-th triangle, and each component of
@@ -26,6 +28,38 @@ class TriangleMesh : public AccelerationStructure {
      * fewer than @code 3 * numTriangles @endcode vertices.
      */
     std::vector<Vertex> m_vertices;
+    /// @brief The data of a triangle that is needed to test it for
+    /// intersection.
+    struct TrianglePositions {
+        /// @brief The position of the first vertex.
+        Point v0;
+        /// @brief The edge from the first to the second vertex.
+        Vector edge1;
+        /// @brief The edge from the first to the third vertex.
+        Vector edge2;
+    };
+    /**
+     * @brief The positions of all triangles, stored in the order of the BVH
+     * leaves (as is m_triangles once the BVH has been built).
+     * Intersection tests only touch this compact list, while the remaining
+     * vertex attributes are only loaded for the closest hit.
+     */
+    std::vector<TrianglePositions> m_positions;
+    /**
+     * @brief The number of triangles that are intersected at once using SIMD
+     * instructions (1, 4 or 8), selected by the @c packing property.
+     * With packing enabled, the triangles of each BVH leaf are additionally
+     * stored in m_packs4 or m_packs8 , and the BVH builder favors leaves that
+     * fill whole packs.
+     */
+    int m_packSize;
+    /// @brief The triangles of all leaves in packs of four.
+    std::vector<TrianglePack<4>> m_packs4;
+    /// @brief The triangles of all leaves in packs of eight.
+    std::vector<TrianglePack<8>> m_packs8;
+    /// @brief The index of the first pack of each leaf, indexed by the
+    /// position of the first triangle of the leaf.
+    std::vector<int> m_leafPacks;
     /// @brief The file this mesh was loaded from, for logging and debugging
     /// purposes.
     std::filesystem::path m_originalPath;
@@ -37,19 +71,24 @@ class TriangleMesh : public AccelerationStructure {
 protected:
     int numberOfPrimitives() const override { return int(m_triangles.size()); }
 
-    bool intersect(int primitiveIndex, const Ray &ray, Intersection &its,
-                   Sampler &rng) const override {
+    /**
+     * @brief Intersects a single triangle with a ray, without computing any
+     * surface attributes.
+     * @param out t The distance to the intersection, if one was found.
+     * @param out barycentrics The barycentric coordinates of the intersection
+     * with respect to the second and third vertex.
+     * @return Whether the triangle is hit between Epsilon and @c tMax .
+     */
+    bool intersectTriangle(int primitiveIndex, const Ray &ray, float tMax,
+                           float &t, Vector2 &barycentrics) const {
         Point orig = ray.origin;
         Vector dir = ray.direction;
 
-        Vector3i indices = m_triangles[primitiveIndex];
+        const TrianglePositions &triangle = m_positions[primitiveIndex];
+        const Point &p0                   = triangle.v0;
+        const Vector &v0v1                = triangle.edge1;
+        const Vector &v0v2                = triangle.edge2;
 
-        Vertex v0 = m_vertices[indices[0]];
-        Vertex v1 = m_vertices[indices[1]];
-        Vertex v2 = m_vertices[indices[2]];
-
-        Vector v0v1 = v1.position - v0.position;
-        Vector v0v2 = v2.position - v0.position;
         Vector pvec = dir.cross(v0v2);
         float det   = v0v1.dot(pvec);
 
@@ -58,7 +97,7 @@ protected:
 
         float invDet = 1 / det;
 
-        Vector tvec = orig - v0.position;
+        Vector tvec = orig - p0;
         float u     = tvec.dot(pvec) * invDet;
         if (u < 0 || u > 1)
             return false;
@@ -68,38 +107,152 @@ protected:
         if (v < 0 || u + v > 1)
             return false;
 
-        float t = v0v2.dot(qvec) * invDet;
+        t = v0v2.dot(qvec) * invDet;
 
-        if (t < Epsilon || t > its.t)
+        if (t < Epsilon || t > tMax)
             return false;
 
-        its.t               = t;
-        its.position        = ray(t);
-        Vertex interpolated = Vertex::interpolate(Vector2(u, v), v0, v1, v2);
-        its.uv              = interpolated.uv;
+        barycentrics = Vector2(u, v);
+        return true;
+    }
 
-        its.geometryNormal = v0v1.cross(v0v2).normalized();
-        if (m_smoothNormals) {
-            its.shadingNormal = interpolated.normal.normalized();
-        } else {
-            its.shadingNormal = its.geometryNormal;
-        }
-        Vector bitangent;
-        buildOrthonormalBasis(its.shadingNormal, its.tangent, bitangent);
-        its.pdf = 0;
+    bool intersect(int primitiveIndex, const Ray &ray, Intersection &its,
+                   Sampler &rng) const override {
+        float t;
+        Vector2 barycentrics;
+        if (!intersectTriangle(primitiveIndex, ray, its.t, t, barycentrics))
+            return false;
 
+        // the surface attributes are only computed once the closest hit is
+        // known, see computeSurfaceInteraction
+        its.t                  = t;
+        its.hit.shape          = this;
+        its.hit.primitiveIndex = primitiveIndex;
+        its.hit.barycentrics   = barycentrics;
         return true;
+    }
 
-        // hints:
-        // * use m_triangles[primitiveIndex] to get the vertex indices of the
-        // triangle that should be intersected
-        // * if m_smoothNormals is true, interpolate the vertex normals from
-        // m_vertices
-        //   * make sure that your shading frame stays orthonormal!
-        // * if m_smoothNormals is false, use the geometrical normal (can be
-        // computed from the vertex positions)
+    bool occluded(int primitiveIndex, const Ray &ray, float tMax,
+                  Sampler &rng) const override {
+        float t;
+        Vector2 barycentrics;
+        return intersectTriangle(primitiveIndex, ray, tMax, t, barycentrics);
+    }
+
+    /// @brief Intersects the packs of a leaf, see intersectLeaf().
+    template <int Width>
+    bool intersectPacks(const std::vector<TrianglePack<Width>> &packs,
+                        int first, int count, const Ray &ray,
+                        Intersection &its) const {
+        bool wasIntersected            = false;
+        const TrianglePack<Width> *pack = &packs[m_leafPacks[first]];
+        for (int offset = 0; offset < count; offset += Width, pack++) {
+            float t;
+            Vector2 barycentrics;
+            const int lane =
+                pack->intersect(ray, count - offset, its.t, t, barycentrics);
+            if (lane < 0)
+                continue;
+
+            its.t                  = t;
+            its.hit.shape          = this;
+            its.hit.primitiveIndex = first + offset + lane;
+            its.hit.barycentrics   = barycentrics;
+            wasIntersected         = true;
+        }
+        return wasIntersected;
+    }
+
+    /// @brief Tests the packs of a leaf for occlusion, see occludedLeaf().
+    template <int Width>
+    bool occludedPacks(const std::vector<TrianglePack<Width>> &packs,
+                       int first, int count, const Ray &ray,
+                       float tMax) const {
+        const TrianglePack<Width> *pack = &packs[m_leafPacks[first]];
+        for (int offset = 0; offset < count; offset += Width, pack++) {
+            if (pack->occluded(ray, count - offset, tMax))
+                return true;
+        }
+        return false;
     }
 
+    /// @brief Stores the triangles of every BVH leaf in consecutive packs.
+    template <int Width>
+    void buildPacks(std::vector<TrianglePack<Width>> &packs) {
+        packs.clear();
+        m_leafPacks.assign(m_positions.size(), 0);
+        forEachLeaf([&](int first, int count) {
+            m_leafPacks[first] = int(packs.size());
+            for (int offset = 0; offset < count; offset += Width) {
+                TrianglePack<Width> &pack = packs.emplace_back();
+                for (int lane = 0; lane < Width; lane++) {
+                    // unused lanes hold degenerate triangles and are masked
+                    // out during intersection
+                    if (offset + lane >= count) {
+                        pack.set(lane, Point(0), Vector(0), Vector(0));
+                        continue;
+                    }
+                    const TrianglePositions &triangle =
+                        m_positions[first + offset + lane];
+                    pack.set(lane, triangle.v0, triangle.edge1, triangle.edge2);
+                }
+            }
+        });
+    }
+
+    bool intersectLeaf(int first, int count, const Ray &ray, Intersection &its,
+                       Sampler &rng) const override {
+        if (m_packSize == 4)
+            return intersectPacks(m_packs4, first, count, ray, its);
+        if (m_packSize == 8)
+            return intersectPacks(m_packs8, first, count, ray, its);
+
+        // triangles are stored in leaf order, so we can stream through them
+        // without any indirection
+        bool wasIntersected = false;
+        for (int i = first; i < first + count; i++)
+            wasIntersected |= intersect(i, ray, its, rng);
+        return wasIntersected;
+    }
+
+    bool occludedLeaf(int first, int count, const Ray &ray, float tMax,
+                      Sampler &rng) const override {
+        if (m_packSize == 4)
+            return occludedPacks(m_packs4, first, count, ray, tMax);
+        if (m_packSize == 8)
+            return occludedPacks(m_packs8, first, count, ray, tMax);
+
+        float t;
+        Vector2 barycentrics;
+        for (int i = first; i < first + count; i++) {
+            if (intersectTriangle(i, ray, tMax, t, barycentrics))
+                return true;
+        }
+        return false;
+    }
+
+    bool reorderPrimitives(const std::vector<int> &order) override {
+        std::vector<Vector3i> triangles(order.size());
+        m_positions.resize(order.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            triangles[i] = m_triangles[order[i]];
+
+            const Point &p0 = m_vertices[triangles[i][0]].position;
+            const Point &p1 = m_vertices[triangles[i][1]].position;
+            const Point &p2 = m_vertices[triangles[i][2]].position;
+            m_positions[i]  = { p0, p1 - p0, p2 - p0 };
+        }
+        m_triangles = std::move(triangles);
+
+        if (m_packSize == 4)
+            buildPacks(m_packs4);
+        if (m_packSize == 8)
+            buildPacks(m_packs8);
+        return true;
+    }
+
+    int leafBatchSize() const override { return m_packSize; }
+
     Bounds getBoundingBox(int primitiveIndex) const override {
         Vector3i indices = m_triangles[primitiveIndex];
 
@@ -124,6 +277,41 @@ protected:
         return Bounds(Point{ minX, minY, minZ }, Point{ maxX, maxY, maxZ });
     }
 
+    void splitBounds(int primitiveIndex, const Bounds &bounds, int axis,
+                     float position, Bounds &left,
+                     Bounds &right) const override {
+        // clip the triangle itself, which yields much tighter bounds than
+        // splitting its bounding box (Stich et al. 2009)
+        const Vector3i indices = m_triangles[primitiveIndex];
+        left = right = Bounds::empty();
+        for (int i = 0; i < 3; i++) {
+            const Point &v0 = m_vertices[indices[i]].position;
+            const Point &v1 = m_vertices[indices[(i + 1) % 3]].position;
+            if (v0[axis] <= position)
+                left.extend(v0);
+            if (v0[axis] >= position)
+                right.extend(v0);
+
+            // add the point where the edge crosses the split plane
+            if ((v0[axis] < position && v1[axis] > position) ||
+                (v0[axis] > position && v1[axis] < position)) {
+                const float t = (position - v0[axis]) / (v1[axis] - v0[axis]);
+                Point crossing = v0 + t * (v1 - v0);
+                crossing[axis] = position;
+                left.extend(crossing);
+                right.extend(crossing);
+            }
+        }
+
+        // the reference might already have been clipped by earlier splits
+        left.min()  = elementwiseMax(left.min(), bounds.min());
+        left.max()  = elementwiseMin(left.max(), bounds.max());
+        right.min() = elementwiseMax(right.min(), bounds.min());
+        right.max() = elementwiseMin(right.max(), bounds.max());
+        left.max()[axis]  = min(left.max()[axis], position);
+        right.min()[axis] = max(right.min()[axis], position);
+    }
+
     Point getCentroid(int primitiveIndex) const override {
         Vector3i indices = m_triangles[primitiveIndex];
 
@@ -135,16 +323,64 @@ protected:
         return centroid;
     }
 
+    /// @brief The version of the data that meshes store in the disk cache,
+    /// which needs to be incremented whenever the data or the way it is
+    /// computed changes.
+    static constexpr int CacheVersion = 1;
+
+    /**
+     * @brief Restores the mesh and its BVH from the disk cache.
+     * @return Whether a valid entry was found.
+     */
+    bool restore(const std::string &cacheKey) {
+        diskcache::Reader cache(cacheKey);
+        if (!cache.valid())
+            return false;
+
+        try {
+            cache.read(m_vertices);
+            cache.read(area);
+            cache.read(m_triangles);
+            restoreAccelerationStructure(cache);
+        } catch (const std::exception &e) {
+            logger(EWarn, "ignoring mesh cache entry: %s", e.what());
+            m_vertices.clear();
+            m_triangles.clear();
+            return false;
+        }
+
+        logger(EInfo, "mesh cache hit for %s", m_originalPath);
+        return true;
+    }
+
 public:
-    TriangleMesh(const Properties &properties) {
+    TriangleMesh(const Properties &properties)
+        : AccelerationStructure(properties) {
         m_originalPath  = properties.get<std::filesystem::path>("filename");
         m_smoothNormals = properties.get<bool>("smooth", true);
+        // clang-format off
+        m_packSize = properties.getEnum<int>("packing", 1, {
+            { "none", 1 },
+            { "4", 4 },
+            { "8", 8 },
+        });
+        // clang-format on
+
+        std::string cacheKey;
+        if (properties.get<bool>("cache", true)) {
+            cacheKey = tfm::format("%s|mesh v%d|%s",
+                                   diskcache::fileKey(m_originalPath),
+                                   CacheVersion,
+                                   accelerationStructureKey());
+            if (restore(cacheKey))
+                return;
+        }
+
         readPLY(m_originalPath, m_triangles, m_vertices);
         logger(EInfo,
                "loaded ply with %d triangles, %d vertices",
                m_triangles.size(),
                m_vertices.size());
-        buildAccelerationStructure();
         area = 0;
         for (int i = 0; i < m_triangles.size(); i++) {
             Vector3i indices = m_triangles[i];
@@ -158,6 +394,54 @@ public:
 
             area += 0.5 * v0v1.cross(v0v2).length();
         }
+        if (cacheKey.empty()) {
+            // note that the BVH may duplicate triangles (see spatial splits),
+            // so the area must be computed beforehand
+            buildAccelerationStructure();
+            return;
+        }
+
+        // note that the triangles are stored in leaf order, as the cache is
+        // only written once the BVH has been built
+        diskcache::Writer cache;
+        cache.add(m_vertices);
+        cache.add(area);
+        cache.add(m_triangles);
+        buildAccelerationStructure(&cache);
+        if (cache.write(cacheKey)) {
+            logger(EInfo,
+                   "mesh cache miss for %s, stored as %s",
+                   m_originalPath,
+                   diskcache::entryPath(cacheKey));
+        }
+    }
+
+    void computeSurfaceInteraction(const Ray &ray,
+                                   Intersection &its) const override {
+        Vector3i indices = m_triangles[its.hit.primitiveIndex];
+
+        Vertex v0 = m_vertices[indices[0]];
+        Vertex v1 = m_vertices[indices[1]];
+        Vertex v2 = m_vertices[indices[2]];
+
+        Vector v0v1 = v1.position - v0.position;
+        Vector v0v2 = v2.position - v0.position;
+
+        its.position = ray(its.t);
+        Vertex interpolated =
+            Vertex::interpolate(its.hit.barycentrics, v0, v1, v2);
+        its.uv = interpolated.uv;
+
+        its.geometryNormal = v0v1.cross(v0v2).normalized();
+        if (m_smoothNormals) {
+            its.shadingNormal = interpolated.normal.normalized();
+        } else {
+            its.shadingNormal = its.geometryNormal;
+        }
+        Vector bitangent;
+        buildOrthonormalBasis(its.shadingNormal, its.tangent, bitangent);
+        // matches the density of sampleArea
+        its.pdf = 1.0f / area;
     }
 
     bool intersect(const Ray &ray, Intersection &its,
@@ -166,6 +450,11 @@ public:
         return AccelerationStructure::intersect(ray, its, rng);
     }
 
+    bool occluded(const Ray &ray, float tMax, Sampler &rng) const override {
+        PROFILE("Triangle mesh")
+        return AccelerationStructure::occluded(ray, tMax, rng);
+    }
+
     AreaSample sampleArea(Sampler &rng) const override {
         // only implement this if you need triangle mesh area light sampling for
         // your rendering competition
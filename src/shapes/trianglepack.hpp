@@ -0,0 +1,238 @@
+#pragma once
+
+#include <lightwave/core.hpp>
+#include <lightwave/math.hpp>
+#include <lightwave/simd.hpp>
+
+#include <bit>
+
+namespace lightwave {
+
+/**
+ * @brief A group of up to @c Width triangles stored as structure of arrays,
+ * so that a ray can be tested against all of them at once using SIMD
+ * instructions (see @ref TriangleMesh ).
+ *
+ * The intersection test is the same Möller–Trumbore test that is used for
+ * individual triangles, evaluated for all lanes in parallel. Lanes beyond the
+ * number of triangles in the pack are masked out.
+ */
+template <int Width> struct alignas(32) TrianglePack {
+    /// @brief The position of the first vertex of each triangle, indexed by
+    /// [axis][lane].
+    float v0[3][Width];
+    /// @brief The edge from the first to the second vertex of each triangle.
+    float edge1[3][Width];
+    /// @brief The edge from the first to the third vertex of each triangle.
+    float edge2[3][Width];
+
+    /// @brief Stores a triangle in the given lane.
+    void set(int lane, const Point &p0, const Vector &e1, const Vector &e2) {
+        for (int axis = 0; axis < 3; axis++) {
+            v0[axis][lane]    = p0[axis];
+            edge1[axis][lane] = e1[axis];
+            edge2[axis][lane] = e2[axis];
+        }
+    }
+
+    /**
+     * @brief Intersects the first @c count triangles of the pack with a ray.
+     * @param tMax Only intersections up to this distance are reported.
+     * @param out t The distance of the closest intersection, if one was found.
+     * @param out barycentrics The barycentric coordinates of the closest
+     * intersection.
+     * @return The lane of the closest triangle that was hit, or -1.
+     */
+    int intersect(const Ray &ray, int count, float tMax, float &t,
+                  Vector2 &barycentrics) const {
+        alignas(32) float tHit[Width], uHit[Width], vHit[Width];
+        int mask = hitMask(ray, count, tMax, tHit, uHit, vHit);
+        if (!mask)
+            return -1;
+
+        // find the closest of the triangles that were hit
+        int closest = std::countr_zero(unsigned(mask));
+        for (mask &= mask - 1; mask; mask &= mask - 1) {
+            const int lane = std::countr_zero(unsigned(mask));
+            if (tHit[lane] < tHit[closest])
+                closest = lane;
+        }
+        t            = tHit[closest];
+        barycentrics = Vector2(uHit[closest], vHit[closest]);
+        return closest;
+    }
+
+    /// @brief Reports whether any of the first @c count triangles is hit
+    /// closer than @c tMax .
+    bool occluded(const Ray &ray, int count, float tMax) const {
+        alignas(32) float tHit[Width], uHit[Width], vHit[Width];
+        return hitMask(ray, count, tMax, tHit, uHit, vHit) != 0;
+    }
+
+private:
+    /**
+     * @brief Tests all lanes for intersection, storing distance and
+     * barycentric coordinates of every lane.
+     * @return A bit mask of the lanes that are hit between Epsilon and @c
+     * tMax .
+     */
+    int hitMask(const Ray &ray, int count, float tMax, float (&tHit)[Width],
+                float (&uHit)[Width], float (&vHit)[Width]) const {
+        const int validLanes = count >= Width ? (1 << Width) - 1
+                                              : (1 << count) - 1;
+#ifdef LW_SIMD_AVX2
+        if constexpr (Width == 8) {
+            return hitMask8(ray, tMax, tHit, uHit, vHit) & validLanes;
+        }
+#endif
+#ifdef LW_SIMD_SSE
+        int mask = 0;
+        for (int group = 0; group < Width; group += 4)
+            mask |= hitMask4(ray, group, tMax, tHit, uHit, vHit) << group;
+        return mask & validLanes;
+#else
+        int mask = 0;
+        for (int lane = 0; lane < Width; lane++) {
+            const Vector e1 { edge1[0][lane], edge1[1][lane], edge1[2][lane] };
+            const Vector e2 { edge2[0][lane], edge2[1][lane], edge2[2][lane] };
+            const Vector pvec = ray.direction.cross(e2);
+            const float invDet = 1 / e1.dot(pvec);
+            const Vector tvec =
+                ray.origin - Point{ v0[0][lane], v0[1][lane], v0[2][lane] };
+            const Vector qvec = tvec.cross(e1);
+            uHit[lane]        = tvec.dot(pvec) * invDet;
+            vHit[lane]        = ray.direction.dot(qvec) * invDet;
+            tHit[lane]        = e2.dot(qvec) * invDet;
+            if (uHit[lane] >= 0 && uHit[lane] <= 1 && vHit[lane] >= 0 &&
+                uHit[lane] + vHit[lane] <= 1 && tHit[lane] >= Epsilon &&
+                tHit[lane] <= tMax)
+                mask |= 1 << lane;
+        }
+        return mask & validLanes;
+#endif
+    }
+
+#ifdef LW_SIMD_SSE
+    /// @brief Tests lanes @c group to @c group + 3 using SSE.
+    int hitMask4(const Ray &ray, int group, float tMax, float (&tHit)[Width],
+                 float (&uHit)[Width], float (&vHit)[Width]) const {
+        const auto load = [&](const float(&row)[Width]) {
+            return _mm_load_ps(row + group);
+        };
+        const auto cross = [](__m128 ax, __m128 ay, __m128 az, __m128 bx,
+                              __m128 by, __m128 bz, __m128 &cx, __m128 &cy,
+                              __m128 &cz) {
+            cx = _mm_sub_ps(_mm_mul_ps(ay, bz), _mm_mul_ps(az, by));
+            cy = _mm_sub_ps(_mm_mul_ps(az, bx), _mm_mul_ps(ax, bz));
+            cz = _mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(ay, bx));
+        };
+        const auto dot = [](__m128 ax, __m128 ay, __m128 az, __m128 bx,
+                            __m128 by, __m128 bz) {
+            return _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)),
+                _mm_mul_ps(az, bz));
+        };
+
+        const __m128 dx = _mm_set1_ps(ray.direction.x());
+        const __m128 dy = _mm_set1_ps(ray.direction.y());
+        const __m128 dz = _mm_set1_ps(ray.direction.z());
+        const __m128 e1x = load(edge1[0]), e1y = load(edge1[1]),
+                     e1z = load(edge1[2]);
+        const __m128 e2x = load(edge2[0]), e2y = load(edge2[1]),
+                     e2z = load(edge2[2]);
+
+        __m128 px, py, pz;
+        cross(dx, dy, dz, e2x, e2y, e2z, px, py, pz);
+        const __m128 invDet =
+            _mm_div_ps(_mm_set1_ps(1), dot(e1x, e1y, e1z, px, py, pz));
+
+        const __m128 tx = _mm_sub_ps(_mm_set1_ps(ray.origin.x()), load(v0[0]));
+        const __m128 ty = _mm_sub_ps(_mm_set1_ps(ray.origin.y()), load(v0[1]));
+        const __m128 tz = _mm_sub_ps(_mm_set1_ps(ray.origin.z()), load(v0[2]));
+        __m128 qx, qy, qz;
+        cross(tx, ty, tz, e1x, e1y, e1z, qx, qy, qz);
+
+        const __m128 u = _mm_mul_ps(dot(tx, ty, tz, px, py, pz), invDet);
+        const __m128 v = _mm_mul_ps(dot(dx, dy, dz, qx, qy, qz), invDet);
+        const __m128 t = _mm_mul_ps(dot(e2x, e2y, e2z, qx, qy, qz), invDet);
+        _mm_store_ps(uHit + group, u);
+        _mm_store_ps(vHit + group, v);
+        _mm_store_ps(tHit + group, t);
+
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one  = _mm_set1_ps(1);
+        __m128 hit        = _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one));
+        hit = _mm_and_ps(hit, _mm_cmpge_ps(v, zero));
+        hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), one));
+        hit = _mm_and_ps(hit, _mm_cmpge_ps(t, _mm_set1_ps(Epsilon)));
+        hit = _mm_and_ps(hit, _mm_cmple_ps(t, _mm_set1_ps(tMax)));
+        return _mm_movemask_ps(hit);
+    }
+#endif
+
+#ifdef LW_SIMD_AVX2
+    /// @brief Tests all 8 lanes using AVX2.
+    int hitMask8(const Ray &ray, float tMax, float (&tHit)[Width],
+                 float (&uHit)[Width], float (&vHit)[Width]) const {
+        const auto cross = [](__m256 ax, __m256 ay, __m256 az, __m256 bx,
+                              __m256 by, __m256 bz, __m256 &cx, __m256 &cy,
+                              __m256 &cz) {
+            cx = _mm256_sub_ps(_mm256_mul_ps(ay, bz), _mm256_mul_ps(az, by));
+            cy = _mm256_sub_ps(_mm256_mul_ps(az, bx), _mm256_mul_ps(ax, bz));
+            cz = _mm256_sub_ps(_mm256_mul_ps(ax, by), _mm256_mul_ps(ay, bx));
+        };
+        const auto dot = [](__m256 ax, __m256 ay, __m256 az, __m256 bx,
+                            __m256 by, __m256 bz) {
+            return _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(ax, bx), _mm256_mul_ps(ay, by)),
+                _mm256_mul_ps(az, bz));
+        };
+
+        const __m256 dx  = _mm256_set1_ps(ray.direction.x());
+        const __m256 dy  = _mm256_set1_ps(ray.direction.y());
+        const __m256 dz  = _mm256_set1_ps(ray.direction.z());
+        const __m256 e1x = _mm256_load_ps(edge1[0]);
+        const __m256 e1y = _mm256_load_ps(edge1[1]);
+        const __m256 e1z = _mm256_load_ps(edge1[2]);
+        const __m256 e2x = _mm256_load_ps(edge2[0]);
+        const __m256 e2y = _mm256_load_ps(edge2[1]);
+        const __m256 e2z = _mm256_load_ps(edge2[2]);
+
+        __m256 px, py, pz;
+        cross(dx, dy, dz, e2x, e2y, e2z, px, py, pz);
+        const __m256 invDet =
+            _mm256_div_ps(_mm256_set1_ps(1), dot(e1x, e1y, e1z, px, py, pz));
+
+        const __m256 tx =
+            _mm256_sub_ps(_mm256_set1_ps(ray.origin.x()), _mm256_load_ps(v0[0]));
+        const __m256 ty =
+            _mm256_sub_ps(_mm256_set1_ps(ray.origin.y()), _mm256_load_ps(v0[1]));
+        const __m256 tz =
+            _mm256_sub_ps(_mm256_set1_ps(ray.origin.z()), _mm256_load_ps(v0[2]));
+        __m256 qx, qy, qz;
+        cross(tx, ty, tz, e1x, e1y, e1z, qx, qy, qz);
+
+        const __m256 u = _mm256_mul_ps(dot(tx, ty, tz, px, py, pz), invDet);
+        const __m256 v = _mm256_mul_ps(dot(dx, dy, dz, qx, qy, qz), invDet);
+        const __m256 t = _mm256_mul_ps(dot(e2x, e2y, e2z, qx, qy, qz), invDet);
+        _mm256_store_ps(uHit, u);
+        _mm256_store_ps(vHit, v);
+        _mm256_store_ps(tHit, t);
+
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one  = _mm256_set1_ps(1);
+        __m256 hit = _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ),
+                                   _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+        hit = _mm256_and_ps(
+            hit, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+        hit = _mm256_and_ps(
+            hit, _mm256_cmp_ps(t, _mm256_set1_ps(Epsilon), _CMP_GE_OQ));
+        hit = _mm256_and_ps(
+            hit, _mm256_cmp_ps(t, _mm256_set1_ps(tMax), _CMP_LE_OQ));
+        return _mm256_movemask_ps(hit);
+    }
+#endif
+};
+
+} // namespace lightwave
@@ -24,6 +24,10 @@ public:
         }
     }
 
+    Point2i resolution() const override {
+        return { int(ceil(abs(scale.x()))), int(ceil(abs(scale.y()))) };
+    }
+
     std::string toString() const override {
         return tfm::format(
             "CheckerboardTexture[\n"
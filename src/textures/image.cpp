@@ -119,6 +119,8 @@ public:
         return Color(0);
     }
 
+    Point2i resolution() const override { return m_image->resolution(); }
+
     std::string toString() const override {
         return tfm::format(
             "ImageTexture[\n"
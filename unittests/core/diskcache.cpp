@@ -0,0 +1,54 @@
+#include <catch_amalgamated.hpp>
+#include <core/diskcache.hpp>
+#include <lightwave/math.hpp>
+
+#include <filesystem>
+#include <random>
+
+using namespace lightwave;
+
+// clang-format off
+
+TEST_CASE( "Disk cache tests", "[diskcache]" ) {
+    // entries are written to a private directory, so that the cache of the
+    // user is neither read nor modified
+    const auto directory = std::filesystem::temp_directory_path() /
+        tfm::format("lightwave-unittest-%08x", std::random_device()());
+    const auto path = directory / "entry.lwcache";
+
+    const std::string key = "unittest|diskcache";
+    const std::vector<Vector> vectors { { 1, 2, 3 }, { 4, 5, 6 } };
+    const std::vector<int> empty;
+    const float value = 42;
+
+    diskcache::Writer writer;
+    writer.add(vectors);
+    writer.add(empty);
+    writer.add(value);
+    REQUIRE( writer.writeAt(path, key) );
+
+    SECTION( "Sections are restored in order" ) {
+        diskcache::Reader reader { path, key };
+        REQUIRE( reader.valid() );
+
+        std::vector<Vector> readVectors;
+        std::vector<int> readEmpty { 1 };
+        float readValue;
+        reader.read(readVectors);
+        reader.read(readEmpty);
+        reader.read(readValue);
+        REQUIRE( readVectors == vectors );
+        REQUIRE( readEmpty.empty() );
+        REQUIRE( readValue == value );
+        REQUIRE_THROWS( reader.read(readValue) );
+    }
+
+    SECTION( "Other keys and truncated entries are ignored" ) {
+        REQUIRE( !diskcache::Reader { path, key + "|other" }.valid() );
+
+        std::filesystem::resize_file(path, std::filesystem::file_size(path) - 8);
+        REQUIRE( !diskcache::Reader { path, key }.valid() );
+    }
+
+    std::filesystem::remove_all(directory);
+}
@@ -0,0 +1,255 @@
+#include <catch_amalgamated.hpp>
+#include <lightwave.hpp>
+
+#include "../testing.hpp"
+
+#include <filesystem>
+#include <random>
+
+using namespace lightwave;
+using namespace lightwave::testing;
+
+// clang-format off
+
+namespace {
+
+/// @brief A unit sphere lit by a point light, viewed by a small camera.
+ref<Scene> createSphereScene(float power) {
+    const auto cameraTransform = create<Transform>("transform", "default", {});
+    cameraTransform->translate(Vector(0, 0, -4));
+
+    Properties sphereProperties;
+    sphereProperties.addChild(create<Shape>("shape", "sphere", {}));
+    Properties bsdfProperties;
+    bsdfProperties.set("albedo", constant(0.8f));
+    sphereProperties.addChild(create<Bsdf>("bsdf", "diffuse", bsdfProperties));
+
+    Properties lightProperties;
+    lightProperties.set("position", std::string("1,-2,-2"));
+    lightProperties.set("power", Color(power));
+
+    return createScene(createCamera(16, 16, 40, cameraTransform), {
+        create<Instance>("instance", "default", sphereProperties),
+        create<Light>("light", "point", lightProperties),
+    });
+}
+
+/// @brief A large rectangle at the given depth, whose front side faces the
+/// negative z axis if flipped and the positive z axis otherwise.
+ref<Transform> wall(float z, bool flipped) {
+    const auto transform = create<Transform>("transform", "default", {});
+    transform->scale(Vector(10, 10, flipped ? -1 : 1));
+    transform->translate(Vector(0, 0, z));
+    return transform;
+}
+
+/// @brief A mirror in front of the origin that reflects an area light
+/// behind it, so that the light can only be found by BSDF sampling.
+ref<Scene> createMirrorScene() {
+    Properties mirrorProperties;
+    mirrorProperties.addChild(create<Shape>("shape", "rectangle", {}));
+    Properties bsdfProperties;
+    bsdfProperties.set("reflectance", constant(0.5f));
+    mirrorProperties.addChild(create<Bsdf>("bsdf", "conductor", bsdfProperties));
+    mirrorProperties.addChild(wall(1, true));
+
+    Properties lampProperties;
+    lampProperties.addChild(create<Shape>("shape", "rectangle", {}));
+    Properties emissionProperties;
+    emissionProperties.set("emission", constant(1));
+    lampProperties.addChild(create<Emission>("emission", "lambertian", emissionProperties));
+    lampProperties.addChild(wall(-1, false));
+    const auto lamp = create<Instance>("instance", "default", lampProperties);
+
+    Properties lightProperties;
+    lightProperties.addChild(lamp);
+
+    return createScene(createCamera(4, 4, 40), {
+        create<Instance>("instance", "default", mirrorProperties),
+        lamp,
+        create<Light>("light", "area", lightProperties),
+    });
+}
+
+/// @brief A wall on the right half of the view that is lit by an area light
+/// outside of the view, next to an empty left half.
+ref<Scene> createHalfLitScene() {
+    Properties wallProperties;
+    wallProperties.addChild(create<Shape>("shape", "rectangle", {}));
+    Properties bsdfProperties;
+    bsdfProperties.set("albedo", constant(0.8f));
+    wallProperties.addChild(create<Bsdf>("bsdf", "diffuse", bsdfProperties));
+    const auto wallTransform = create<Transform>("transform", "default", {});
+    wallTransform->scale(Vector(10, 10, -1));
+    wallTransform->translate(Vector(10, 0, 2));
+    wallProperties.addChild(wallTransform);
+
+    Properties lampProperties;
+    lampProperties.addChild(create<Shape>("shape", "rectangle", {}));
+    Properties emissionProperties;
+    emissionProperties.set("emission", constant(10));
+    lampProperties.addChild(create<Emission>("emission", "lambertian", emissionProperties));
+    const auto lampTransform = create<Transform>("transform", "default", {});
+    lampTransform->scale(Vector(0.5f, 0.5f, 1));
+    lampTransform->translate(Vector(5, 0, 1));
+    lampProperties.addChild(lampTransform);
+    const auto lamp = create<Instance>("instance", "default", lampProperties);
+
+    Properties lightProperties;
+    lightProperties.addChild(lamp);
+
+    return createScene(createCamera(16, 8, 90), {
+        create<Instance>("instance", "default", wallProperties),
+        lamp,
+        create<Light>("light", "area", lightProperties),
+    });
+}
+
+/// @brief Renders the scene in passes of one sample, writing a checkpoint
+/// into the given directory once done. The key identifies the scene like
+/// the key of the scene file does on the command line.
+ref<Image> render(const ref<Scene> &scene, const std::filesystem::path &directory, int samples, bool resume, const std::string &key = "unittest|sphere") {
+    renderOptions.resume   = resume;
+    renderOptions.sceneKey = key;
+
+    Properties samplerProperties;
+    samplerProperties.set("count", samples);
+    const auto image = create<Image>("image", "default", Properties(directory));
+    image->setId("render");
+
+    Properties properties;
+    properties.set("depth", 3);
+    properties.set("checkpointInterval", std::string("1h"));
+    properties.addChild(scene);
+    properties.addChild(create<Sampler>("sampler", "independent", samplerProperties));
+    properties.addChild(image);
+    create<SamplingIntegrator>("integrator", "pathtracer", properties)->execute();
+
+    renderOptions = RenderOptions();
+    return image;
+}
+
+} // namespace
+
+TEST_CASE( "Duration parsing tests", "[integrator]" ) {
+    SECTION( "Units are converted to seconds" ) {
+        REQUIRE( SamplingIntegrator::parseDuration("250ms") == Catch::Approx(0.25f) );
+        REQUIRE( SamplingIntegrator::parseDuration("90s") == 90 );
+        REQUIRE( SamplingIntegrator::parseDuration("90") == 90 );
+        REQUIRE( SamplingIntegrator::parseDuration("5m") == 300 );
+        REQUIRE( SamplingIntegrator::parseDuration("2min") == 120 );
+        REQUIRE( SamplingIntegrator::parseDuration("1.5h") == 5400 );
+    }
+
+    SECTION( "Malformed durations are rejected" ) {
+        REQUIRE_THROWS( SamplingIntegrator::parseDuration("") );
+        REQUIRE_THROWS( SamplingIntegrator::parseDuration("abc") );
+        REQUIRE_THROWS( SamplingIntegrator::parseDuration("m5") );
+        REQUIRE_THROWS( SamplingIntegrator::parseDuration("5x") );
+        REQUIRE_THROWS( SamplingIntegrator::parseDuration("10 s") );
+        REQUIRE_THROWS( SamplingIntegrator::parseDuration("1hour") );
+    }
+}
+
+TEST_CASE( "Checkpoint tests", "[integrator]" ) {
+    // checkpoints and images are written to a private directory
+    const auto directory = std::filesystem::temp_directory_path() /
+        tfm::format("lightwave-unittest-%08x", std::random_device()());
+    std::filesystem::create_directories(directory);
+    const auto scene = createSphereScene(100);
+
+    SECTION( "Resumed renders match uninterrupted ones" ) {
+        // a render that is interrupted after four passes and resumed up to
+        // eight
+        render(scene, directory, 4, false);
+        REQUIRE( std::filesystem::exists(directory / "render.checkpoint") );
+        const auto resumed = render(scene, directory, 8, true);
+
+        std::filesystem::remove(directory / "render.checkpoint");
+        const auto uninterrupted = render(scene, directory, 8, false);
+
+        int mismatches = 0, lit = 0;
+        for (auto pixel : uninterrupted->bounds()) {
+            mismatches += resumed->get(pixel) != uninterrupted->get(pixel);
+            lit += uninterrupted->get(pixel) != Color(0);
+        }
+        REQUIRE( mismatches == 0 );
+        REQUIRE( lit > 0 );
+    }
+
+    SECTION( "Checkpoints of other scenes are not resumed from" ) {
+        // the unlit scene must be rendered anew instead of restoring the
+        // samples of the lit one
+        render(scene, directory, 4, false);
+        REQUIRE( std::filesystem::exists(directory / "render.checkpoint") );
+        const auto unlit = render(createSphereScene(0), directory, 4, true, "unittest|unlit");
+
+        int lit = 0;
+        for (auto pixel : unlit->bounds())
+            lit += unlit->get(pixel) != Color(0);
+        REQUIRE( lit == 0 );
+    }
+
+    std::filesystem::remove_all(directory);
+}
+
+TEST_CASE( "Adaptive sampling tests", "[integrator]" ) {
+    const auto directory = std::filesystem::temp_directory_path() /
+        tfm::format("lightwave-unittest-%08x", std::random_device()());
+    std::filesystem::create_directories(directory);
+
+    SECTION( "Noisy blocks receive the samples of converged ones" ) {
+        const int samplesPerPixel = 16;
+        const int minSamples      = 4;
+
+        Properties samplerProperties;
+        samplerProperties.set("count", samplesPerPixel);
+        const auto image = create<Image>("image", "default", Properties(directory));
+        image->setId("adaptive");
+
+        Properties properties;
+        properties.set("depth", 2);
+        properties.set("adaptiveThreshold", 0.01f);
+        properties.set("adaptiveMinSamples", minSamples);
+        properties.set("saveSampleCounts", true);
+        properties.addChild(createHalfLitScene());
+        properties.addChild(create<Sampler>("sampler", "independent", samplerProperties));
+        properties.addChild(image);
+        create<SamplingIntegrator>("integrator", "pathtracer", properties)->execute();
+
+        // the empty half converges after its first pass, and the lit half
+        // takes over its share of the uniform budget
+        const Image samples { directory / "adaptive_samples.exr", true };
+        float total = 0;
+        for (auto pixel : samples.bounds()) {
+            const float count = samples(pixel).r();
+            total += count;
+            if (pixel.x() < 8)
+                REQUIRE( count == minSamples );
+            else
+                REQUIRE( count > samplesPerPixel );
+        }
+        REQUIRE( total <= Vector2i(samples.resolution()).product() * samplesPerPixel );
+    }
+
+    std::filesystem::remove_all(directory);
+}
+
+TEST_CASE( "Emission tests", "[integrator]" ) {
+    SECTION( "Area lights are found after specular bounces" ) {
+        // next event estimation cannot sample the mirror, so the light must
+        // count in full when the reflected ray hits it
+        Properties samplerProperties;
+        const auto rng = create<Sampler>("sampler", "independent", samplerProperties);
+        rng->seed(0);
+
+        Properties properties;
+        properties.set("depth", 2);
+        properties.addChild(createMirrorScene());
+        properties.addChild(rng);
+        const auto integrator = create<SamplingIntegrator>("integrator", "pathtracer", properties);
+
+        const Ray ray(Point(0), Vector(0, 0, 1));
+        REQUIRE( integrator->Li(ray, *rng).luminance() == Catch::Approx(0.5f) );
+    }
+}
@@ -0,0 +1,207 @@
+#include <catch_amalgamated.hpp>
+#include <lightwave.hpp>
+
+#include "../testing.hpp"
+
+using namespace lightwave;
+using namespace lightwave::testing;
+
+// clang-format off
+
+namespace {
+
+ref<Light> pointLight(float power, const std::string &position = "0,0,2") {
+    Properties properties;
+    properties.set("position", position);
+    properties.set("power", Color(power));
+    return create<Light>("light", "point", properties);
+}
+
+/// @brief A scene with a unit sphere that is viewed by a camera, and the given
+/// lights.
+ref<Scene> createSphereScene(std::vector<ref<Object>> lights, const ref<Instance> &sphere, const std::string &strategy = "tree") {
+    lights.insert(lights.begin(), sphere);
+    return createScene(createCamera(8, 8, 40), lights, strategy);
+}
+
+ref<Instance> sphere() {
+    Properties properties;
+    properties.addChild(create<Shape>("shape", "sphere", {}));
+    return create<Instance>("instance", "default", properties);
+}
+
+} // namespace
+
+TEST_CASE( "Light sampling tests", "[lights]" ) {
+    SECTION( "Lights are picked proportional to their power" ) {
+        const auto dim = pointLight(1), bright = pointLight(3);
+        const auto scene = createSphereScene({ dim, bright }, sphere());
+        REQUIRE( dim->samplingProbability() == Catch::Approx(0.25f) );
+        REQUIRE( bright->samplingProbability() == Catch::Approx(0.75f) );
+
+        Properties samplerProperties;
+        auto rng = create<Sampler>("sampler", "independent", samplerProperties);
+        rng->seed(0);
+        int brightCount = 0, mismatches = 0;
+        constexpr int Count = 100000;
+        for (int i = 0; i < Count; i++) {
+            const LightSample sample = scene->sampleLight(*rng);
+            mismatches += sample.probability != sample.light->samplingProbability();
+            brightCount += sample.light == bright.get();
+        }
+        REQUIRE( mismatches == 0 );
+        REQUIRE( brightCount / float(Count) == Catch::Approx(0.75f).margin(0.01f) );
+    }
+
+    SECTION( "Weights scale the power and can exclude lights" ) {
+        Properties properties;
+        properties.set("position", std::string("0,0,2"));
+        properties.set("power", Color(100));
+        properties.set("weight", 0.f);
+        const auto excluded = create<Light>("light", "point", properties);
+        const auto a = pointLight(1), b = pointLight(3);
+        const auto scene = createSphereScene({ a, b, excluded }, sphere(), "uniform");
+        REQUIRE( a->samplingProbability() == Catch::Approx(0.5f) );
+        REQUIRE( b->samplingProbability() == Catch::Approx(0.5f) );
+        REQUIRE( excluded->samplingProbability() == 0 );
+    }
+
+    SECTION( "Area lights report their probability on hits" ) {
+        Properties emissionProperties;
+        Properties textureProperties;
+        textureProperties.set("value", Color(1));
+        emissionProperties.set("emission", create<Texture>("texture", "constant", textureProperties));
+
+        Properties instanceProperties;
+        instanceProperties.addChild(create<Shape>("shape", "sphere", {}));
+        instanceProperties.addChild(create<Emission>("emission", "lambertian", emissionProperties));
+        instanceProperties.addChild(create<Transform>("transform", "default", {}));
+        const auto emitter = create<Instance>("instance", "default", instanceProperties);
+
+        Properties lightProperties;
+        lightProperties.addChild(emitter);
+        const auto area = create<Light>("light", "area", lightProperties);
+        const auto point = pointLight(4);
+        const auto scene = createSphereScene({ area, point }, emitter);
+
+        // a unit sphere emitting a radiance of one has a power of 4 pi^2
+        const float power = 4 * Pi * Pi;
+        REQUIRE( area->samplingProbability() == Catch::Approx(power / (power + 4)).epsilon(0.01f) );
+
+        Properties samplerProperties;
+        auto rng = create<Sampler>("sampler", "independent", samplerProperties);
+        const Intersection its = scene->intersect(Ray(Point(0, 0, 5), Vector(0, 0, -1)), *rng);
+        REQUIRE( its.light() == area.get() );
+        REQUIRE( its.lightProbability == scene->lightProbability(Point(0, 0, 5), area.get()) );
+    }
+
+    SECTION( "Light trees prefer close lights and report consistent probabilities" ) {
+        std::vector<ref<Object>> lights;
+        for (int x = 0; x < 16; x++)
+            for (int y = 0; y < 16; y++)
+                lights.push_back(pointLight(1, tfm::format("%d,%d,3", 4 * x, 4 * y)));
+        Properties directionalProperties;
+        directionalProperties.set("direction", Vector(0, 0, 1));
+        directionalProperties.set("intensity", Color(1));
+        lights.push_back(create<Light>("light", "directional", directionalProperties));
+        const auto scene = createSphereScene(lights, sphere());
+
+        const Point origin(20, 20, 0);
+        float total = 0;
+        for (const auto &light : lights)
+            total += scene->lightProbability(origin, static_cast<Light *>(light.get()));
+        REQUIRE( total == Catch::Approx(1).epsilon(1e-4f) );
+
+        Properties samplerProperties;
+        auto rng = create<Sampler>("sampler", "independent", samplerProperties);
+        rng->seed(0);
+        int mismatches = 0, closeCount = 0;
+        constexpr int Count = 10000;
+        for (int i = 0; i < Count; i++) {
+            const LightSample sample = scene->sampleLight(origin, *rng);
+            mismatches += sample.probability != Catch::Approx(scene->lightProbability(origin, sample.light));
+            closeCount += sample.light == lights[5 * 16 + 5].get();
+        }
+        REQUIRE( mismatches == 0 );
+        // the closest light is picked far more often than with uniform selection
+        REQUIRE( closeCount > 10 * Count / 257 );
+    }
+
+    SECTION( "Environment maps sample bright directions with consistent densities" ) {
+        Properties textureProperties;
+        textureProperties.set("color0", Color(0.01f));
+        textureProperties.set("color1", Color(10));
+        textureProperties.set("scale", std::string("8,4"));
+        const auto transform = create<Transform>("transform", "default", {});
+        transform->rotate(Vector(1, 1, 0).normalized(), 0.7f);
+
+        Properties envmapProperties;
+        envmapProperties.addChild(create<Texture>("texture", "checkerboard", textureProperties));
+        envmapProperties.addChild(transform);
+        const auto envmap = create<BackgroundLight>("light", "envmap", envmapProperties);
+
+        Properties samplerProperties;
+        auto rng = create<Sampler>("sampler", "independent", samplerProperties);
+        rng->seed(0);
+        int mismatches = 0, brightCount = 0;
+        constexpr int Count = 10000;
+        for (int i = 0; i < Count; i++) {
+            const DirectLightSample sample = envmap->sampleDirect(Point(0), *rng);
+            const Color radiance = envmap->evaluate(sample.wi).value;
+            mismatches += (sample.weight * sample.pdf).luminance() != Catch::Approx(radiance.luminance()).epsilon(1e-3f);
+            mismatches += envmap->pdfDirect(Point(0), Intersection(-sample.wi)) != Catch::Approx(sample.pdf).epsilon(1e-3f);
+            brightCount += radiance.luminance() > 1;
+        }
+        // directions close to the boundaries of cells may be attributed to neighboring cells
+        REQUIRE( mismatches < Count / 100 );
+        // uniform sampling would pick bright directions half of the time
+        REQUIRE( brightCount > 0.8f * Count );
+
+        // the density integrates to one over the sphere
+        float integral = 0;
+        for (int i = 0; i < Count; i++)
+            integral += envmap->pdfDirect(Point(0), Intersection(-squareToUniformSphere(rng->next2D())));
+        REQUIRE( integral * 4 * Pi / Count == Catch::Approx(1).epsilon(0.05f) );
+    }
+
+    SECTION( "Suns extracted from environment maps preserve their power" ) {
+        // a uniform sky with a small and very bright sun
+        const auto image = std::make_shared<Image>(Point2i(128, 64));
+        for (auto pixel : image->bounds())
+            image->get(pixel) = Color(0.5f);
+        for (int y = 20; y < 22; y++)
+            for (int x = 40; x < 42; x++)
+                image->get(Point2i(x, y)) = Color(20000);
+
+        Properties textureProperties;
+        textureProperties.addChild(image);
+        const auto texture = create<Texture>("texture", "image", textureProperties);
+        const auto envmap = [&](bool extractSun) {
+            Properties properties;
+            properties.set("extractSun", extractSun);
+            properties.addChild(texture);
+            return create<BackgroundLight>("light", "envmap", properties);
+        };
+
+        Properties samplerProperties;
+        auto rng = create<Sampler>("sampler", "independent", samplerProperties);
+        rng->seed(0);
+        // the radiance integrated over the sphere, estimated by light sampling
+        const auto integrate = [&](const ref<BackgroundLight> &light, int &mismatches) {
+            constexpr int Count = 20000;
+            float integral = 0;
+            for (int i = 0; i < Count; i++) {
+                const DirectLightSample sample = light->sampleDirect(Point(0), *rng);
+                integral += sample.weight.luminance();
+                mismatches += light->pdfDirect(Point(0), Intersection(-sample.wi)) != Catch::Approx(sample.pdf).epsilon(1e-3f);
+            }
+            return integral / Count;
+        };
+
+        int mismatches = 0;
+        const float original = integrate(envmap(false), mismatches);
+        const float extracted = integrate(envmap(true), mismatches);
+        REQUIRE( mismatches < 400 );
+        REQUIRE( extracted == Catch::Approx(original).epsilon(0.02f) );
+    }
+}
@@ -0,0 +1,68 @@
+#include <catch_amalgamated.hpp>
+#include <lightwave/parallel.hpp>
+#include <lightwave/iterators.hpp>
+
+#include <algorithm>
+
+using namespace lightwave;
+
+// clang-format off
+
+/// @brief Sums [first, last) by recursively splitting the range in halves.
+static int64_t parallelSum(ThreadPool &pool, int first, int last) {
+    if (last - first <= 64) {
+        int64_t sum = 0;
+        for (int i = first; i < last; i++)
+            sum += i;
+        return sum;
+    }
+    const int middle = (first + last) / 2;
+    int64_t left;
+    TaskGroup tasks { pool };
+    tasks.run([&]() { left = parallelSum(pool, first, middle); });
+    const int64_t right = parallelSum(pool, middle, last);
+    tasks.wait();
+    return left + right;
+}
+
+TEST_CASE( "Thread pool tests", "[parallel]" ) {
+    ThreadPool pool { 4 };
+
+    SECTION( "Nested task groups complete" ) {
+        REQUIRE( parallelSum(pool, 0, 100000) == int64_t(100000) * 99999 / 2 );
+    }
+
+    SECTION( "Exceptions are rethrown by wait" ) {
+        TaskGroup tasks { pool };
+        std::atomic<int> count = 0;
+        for (int i = 0; i < 100; i++)
+            tasks.run([&, i]() {
+                count++;
+                if (i == 42)
+                    throw std::runtime_error("task failed");
+            });
+        REQUIRE_THROWS_AS( tasks.wait(), std::runtime_error );
+        REQUIRE( count == 100 );
+        REQUIRE_NOTHROW( tasks.wait() );
+    }
+
+    SECTION( "Submitted tasks can depend on earlier tasks" ) {
+        TaskGroup tasks { pool };
+        std::vector<std::shared_future<int>> futures;
+        futures.push_back(tasks.submit([]() { return 1; }));
+        for (int i = 1; i < 50; i++)
+            futures.push_back(tasks.submit(
+                [previous = futures.back()]() { return previous.get() + 1; }));
+        tasks.wait();
+        REQUIRE( futures.back().get() == 50 );
+    }
+
+    SECTION( "Parallel loops visit every element once" ) {
+        std::vector<int> visits(10000);
+        for_each_parallel(ChunkedRange(int(visits.size()), 100), [&](Range chunk) {
+            for (int i : chunk)
+                visits[i]++;
+        });
+        REQUIRE( std::all_of(visits.begin(), visits.end(), [](int v) { return v == 1; }) );
+    }
+}
@@ -0,0 +1,27 @@
+#include <catch_amalgamated.hpp>
+#include <lightwave.hpp>
+
+#include "../testing.hpp"
+
+using namespace lightwave;
+using namespace lightwave::testing;
+
+// clang-format off
+
+TEST_CASE( "Bidirectional path tracer tests", "[integrators]" ) {
+    const auto directory = createTemporaryDirectory();
+    const auto scene     = createCornerScene();
+
+    SECTION( "Bidirectional path tracing matches the path tracer in the mean" ) {
+        // direct light only, and with indirect light, which checks that both
+        // integrators count path lengths alike
+        for (const int depth : { 2, 4 }) {
+            Properties properties;
+            properties.set("depth", depth);
+            const float reference = renderMean("pathtracer", properties, scene, 256, directory);
+            REQUIRE( renderMean("bdpt", properties, scene, 64, directory) == Catch::Approx(reference).epsilon(0.02f) );
+        }
+    }
+
+    std::filesystem::remove_all(directory);
+}
@@ -0,0 +1,29 @@
+#include <catch_amalgamated.hpp>
+#include <lightwave.hpp>
+
+#include "../testing.hpp"
+
+using namespace lightwave;
+using namespace lightwave::testing;
+
+// clang-format off
+
+TEST_CASE( "Guided path tracer tests", "[integrators]" ) {
+    const auto directory = createTemporaryDirectory();
+    const auto scene     = createCornerScene();
+    Properties pathtracerProperties;
+    pathtracerProperties.set("depth", 4);
+    const float reference = renderMean("pathtracer", pathtracerProperties, scene, 256, directory);
+
+    SECTION( "Guiding matches the path tracer in the mean" ) {
+        // mostly guided, mixed, and pure BSDF sampling after training
+        for (const float fraction : { 0.1f, 0.5f, 1.f }) {
+            Properties properties;
+            properties.set("depth", 4);
+            properties.set("bsdfSamplingFraction", fraction);
+            REQUIRE( renderMean("guided_pathtracer", properties, scene, 64, directory) == Catch::Approx(reference).epsilon(0.02f) );
+        }
+    }
+
+    std::filesystem::remove_all(directory);
+}
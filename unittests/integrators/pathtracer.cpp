@@ -0,0 +1,41 @@
+#include <catch_amalgamated.hpp>
+#include <lightwave.hpp>
+
+#include "../testing.hpp"
+
+using namespace lightwave;
+using namespace lightwave::testing;
+
+// clang-format off
+
+TEST_CASE( "Path tracer tests", "[integrators]" ) {
+    const auto directory = createTemporaryDirectory();
+    const auto scene     = createCornerScene();
+    Properties referenceProperties;
+    referenceProperties.set("depth", 6);
+    const float reference = renderMean("pathtracer", referenceProperties, scene, 256, directory);
+
+    SECTION( "Roulette and splitting keep the mean" ) {
+        // roulette starts after the first bounce, so that it acts on most of
+        // the indirect light
+        for (const std::string roulette : { "throughput", "adjoint" }) {
+            Properties properties;
+            properties.set("depth", 6);
+            properties.set("roulette", roulette);
+            properties.set("rouletteDepth", 1);
+            REQUIRE( renderMean("pathtracer", properties, scene, 64, directory) == Catch::Approx(reference).epsilon(0.02f) );
+        }
+    }
+
+    SECTION( "Resampled light candidates keep the mean" ) {
+        // the candidates are drawn with each light selection strategy
+        for (const std::string lightSampling : { "uniform", "power", "tree" }) {
+            Properties properties;
+            properties.set("depth", 6);
+            properties.set("lightCandidates", 8);
+            REQUIRE( renderMean("pathtracer", properties, createCornerScene(lightSampling), 64, directory) == Catch::Approx(reference).epsilon(0.02f) );
+        }
+    }
+
+    std::filesystem::remove_all(directory);
+}
@@ -0,0 +1,31 @@
+#include <catch_amalgamated.hpp>
+#include <lightwave.hpp>
+
+#include "../testing.hpp"
+
+using namespace lightwave;
+using namespace lightwave::testing;
+
+// clang-format off
+
+TEST_CASE( "Photon mapping tests", "[integrators]" ) {
+    const auto directory = createTemporaryDirectory();
+    const auto scene     = createCornerScene();
+
+    SECTION( "Photon mapping matches the path tracer in the mean" ) {
+        // density estimation is only consistent, so the tolerance leaves room
+        // for the bias that remains after the radii shrank for 64 iterations
+        for (const int depth : { 2, 4 }) {
+            Properties pathtracerProperties;
+            pathtracerProperties.set("depth", depth);
+            const float reference = renderMean("pathtracer", pathtracerProperties, scene, 256, directory);
+
+            Properties properties;
+            properties.set("depth", depth);
+            properties.set("photonsPerIteration", 4096);
+            REQUIRE( renderMean("sppm", properties, scene, 64, directory) == Catch::Approx(reference).epsilon(0.03f) );
+        }
+    }
+
+    std::filesystem::remove_all(directory);
+}
@@ -0,0 +1,29 @@
+#include <catch_amalgamated.hpp>
+#include <lightwave.hpp>
+
+#include "../testing.hpp"
+
+using namespace lightwave;
+using namespace lightwave::testing;
+
+// clang-format off
+
+TEST_CASE( "Wavefront tests", "[integrators]" ) {
+    const auto directory = createTemporaryDirectory();
+    const auto scene     = createCornerScene();
+    Properties pathtracerProperties;
+    pathtracerProperties.set("depth", 4);
+    const float reference = renderMean("pathtracer", pathtracerProperties, scene, 256, directory);
+
+    SECTION( "Wavefront matches the path tracer in the mean" ) {
+        // sorting only changes the order in which paths are traced
+        for (const std::string sort : { "none", "direction", "material" }) {
+            Properties properties;
+            properties.set("depth", 4);
+            properties.set("sort", sort);
+            REQUIRE( renderMean("wavefront", properties, scene, 64, directory) == Catch::Approx(reference).epsilon(0.02f) );
+        }
+    }
+
+    std::filesystem::remove_all(directory);
+}
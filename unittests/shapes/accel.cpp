@@ -0,0 +1,249 @@
+#include <catch_amalgamated.hpp>
+#include <samplers/independent.cpp>
+#include <shapes/accel.hpp>
+
+#include <random>
+
+using namespace lightwave;
+
+namespace {
+
+/// @brief A soup of random axis aligned boxes, used to compare the BVH against
+/// brute force intersection.
+class RandomBoxes : public AccelerationStructure {
+    std::vector<Bounds> m_boxes;
+
+    static float intersectBox(const Bounds &box, const Ray &ray) {
+        float tNear = -Infinity, tFar = Infinity;
+        for (int axis = 0; axis < 3; axis++) {
+            // rays parallel to a slab hit it only if they start within it,
+            // including its faces
+            if (ray.direction[axis] == 0) {
+                if (ray.origin[axis] < box.min()[axis] || ray.origin[axis] > box.max()[axis])
+                    return Infinity;
+                continue;
+            }
+            const float t1 = (box.min()[axis] - ray.origin[axis]) / ray.direction[axis];
+            const float t2 = (box.max()[axis] - ray.origin[axis]) / ray.direction[axis];
+            tNear = max(tNear, min(t1, t2));
+            tFar  = min(tFar, max(t1, t2));
+        }
+        if (tFar < tNear)
+            return Infinity;
+        if (tNear >= Epsilon)
+            return tNear;
+        if (tFar >= Epsilon)
+            return tFar;
+        return Infinity;
+    }
+
+protected:
+    int numberOfPrimitives() const override { return int(m_boxes.size()); }
+
+    bool intersect(int primitiveIndex, const Ray &ray, Intersection &its,
+                   Sampler &rng) const override {
+        const float t = intersectBox(m_boxes[primitiveIndex], ray);
+        if (t >= its.t)
+            return false;
+        its.t = t;
+        return true;
+    }
+
+    Bounds getBoundingBox(int primitiveIndex) const override {
+        return m_boxes[primitiveIndex];
+    }
+
+    Point getCentroid(int primitiveIndex) const override {
+        return m_boxes[primitiveIndex].center();
+    }
+
+public:
+    RandomBoxes(const Properties &properties, int count)
+        : AccelerationStructure(properties) {
+        std::mt19937 gen(1234);
+        std::uniform_real_distribution<float> position(-10, 10);
+        std::uniform_real_distribution<float> extent(0.001f, 0.2f);
+        for (int i = 0; i < count; i++) {
+            const Point min { position(gen), position(gen), position(gen) };
+            const Vector size { extent(gen), extent(gen), extent(gen) };
+            m_boxes.emplace_back(min, min + size);
+        }
+        buildAccelerationStructure();
+    }
+
+    bool intersect(const Ray &ray, Intersection &its,
+                   Sampler &rng) const override {
+        return AccelerationStructure::intersect(ray, its, rng);
+    }
+
+    const std::vector<Bounds> &boxes() const { return m_boxes; }
+
+    float bruteForce(const Ray &ray) const {
+        float t = Infinity;
+        for (const Bounds &box : m_boxes)
+            t = min(t, intersectBox(box, ray));
+        return t;
+    }
+
+    std::string toString() const override { return "RandomBoxes[]"; }
+};
+
+std::vector<Ray> randomRays(int count) {
+    std::mt19937 gen(5678);
+    std::uniform_real_distribution<float> position(-12, 12);
+    std::vector<Ray> rays;
+    for (int i = 0; i < count; i++) {
+        const Point origin { position(gen), position(gen), position(gen) };
+        const Point target { position(gen), position(gen), position(gen) };
+        rays.emplace_back(origin, (target - origin).normalized());
+    }
+    return rays;
+}
+
+/// @brief Rays that start on a face of each box and run parallel to it, so
+/// that slab tests of boxes sharing that face compute 0 * inf.
+std::vector<Ray> faceRays(const std::vector<Bounds> &boxes, int count) {
+    std::vector<Ray> rays;
+    for (int i = 0; i < count; i++) {
+        const Bounds &box = boxes[i];
+        const int axis    = i % 3;
+        const int across  = (axis + 1) % 3;
+        const int along   = (axis + 2) % 3;
+        Point origin;
+        origin[axis]   = i % 2 ? box.max()[axis] : box.min()[axis];
+        origin[across] = box.center()[across];
+        origin[along]  = box.min()[along] - 1;
+        Vector direction(0);
+        direction[along] = 1;
+        rays.emplace_back(origin, direction);
+    }
+    return rays;
+}
+
+} // namespace
+
+// clang-format off
+
+TEST_CASE( "BVH tests", "[bvh]" ) {
+    Properties serialProps;
+    serialProps.set<bool>("parallelBuild", false);
+    Properties parallelProps;
+    parallelProps.set<bool>("parallelBuild", true);
+
+    const int boxCount = 200000;
+    const RandomBoxes serial { serialProps, boxCount };
+    const RandomBoxes parallel { parallelProps, boxCount };
+    Independent sampler { Properties() };
+
+    SECTION( "Parallel build matches serial build" ) {
+        for (const Ray &ray : randomRays(1000)) {
+            Intersection serialIts, parallelIts;
+            serial.intersect(ray, serialIts, sampler);
+            parallel.intersect(ray, parallelIts, sampler);
+            REQUIRE( parallelIts.t == serialIts.t );
+            REQUIRE( parallelIts.stats.bvhCounter == serialIts.stats.bvhCounter );
+            REQUIRE( parallelIts.stats.primCounter == serialIts.stats.primCounter );
+        }
+    }
+
+    SECTION( "Build statistics do not change the tree" ) {
+        // the parallel build runs after the serial build that is timed
+        Properties statisticsProps;
+        statisticsProps.set<bool>("buildStatistics", true);
+        const RandomBoxes measured { statisticsProps, boxCount };
+        for (const Ray &ray : randomRays(1000)) {
+            Intersection serialIts, measuredIts;
+            serial.intersect(ray, serialIts, sampler);
+            measured.intersect(ray, measuredIts, sampler);
+            REQUIRE( measuredIts.t == serialIts.t );
+            REQUIRE( measuredIts.stats.bvhCounter == serialIts.stats.bvhCounter );
+        }
+    }
+
+    SECTION( "Wide BVHs match binary BVH" ) {
+        for (const std::string layout : { "wide4", "wide8" }) {
+            Properties wideProps;
+            wideProps.set<std::string>("bvh", layout);
+            const RandomBoxes wide { wideProps, boxCount };
+            for (const Ray &ray : randomRays(1000)) {
+                Intersection binaryIts, wideIts;
+                serial.intersect(ray, binaryIts, sampler);
+                wide.intersect(ray, wideIts, sampler);
+                REQUIRE( wideIts.t == binaryIts.t );
+            }
+        }
+    }
+
+    SECTION( "Wide BVHs match binary BVH for rays along faces" ) {
+        const auto rays = faceRays(serial.boxes(), 1000);
+        for (const std::string layout : { "wide4", "wide8" }) {
+            Properties wideProps;
+            wideProps.set<std::string>("bvh", layout);
+            const RandomBoxes wide { wideProps, boxCount };
+            for (const Ray &ray : rays) {
+                Intersection binaryIts, wideIts;
+                serial.intersect(ray, binaryIts, sampler);
+                wide.intersect(ray, wideIts, sampler);
+                REQUIRE( binaryIts.t == Catch::Approx(serial.bruteForce(ray)) );
+                REQUIRE( wideIts.t == binaryIts.t );
+            }
+        }
+    }
+
+    SECTION( "Spatial split BVH reports closest intersection" ) {
+        // with statistics, the spatial split build replaces a binned tree
+        for (const bool statistics : { false, true }) {
+            Properties sbvhProps;
+            sbvhProps.set<std::string>("builder", "sbvh");
+            sbvhProps.set<bool>("buildStatistics", statistics);
+            const RandomBoxes sbvh { sbvhProps, 20000 };
+            for (const Ray &ray : randomRays(200)) {
+                Intersection its;
+                sbvh.intersect(ray, its, sampler);
+                REQUIRE( its.t == Catch::Approx(sbvh.bruteForce(ray)) );
+            }
+        }
+    }
+
+    SECTION( "Packet traversal matches single rays" ) {
+        for (const std::string layout : { "binary", "wide4", "wide8" }) {
+            Properties layoutProps;
+            layoutProps.set<std::string>("bvh", layout);
+            const RandomBoxes bvh { layoutProps, 20000 };
+            const auto rays = randomRays(800);
+            for (size_t first = 0; first < rays.size(); first += PacketSize) {
+                // leave out some rays, which must remain untouched
+                const int mask = first % (2 * PacketSize) ? 0b10110101 : 0xff;
+                Packet<Ray> packet;
+                Packet<Intersection> its;
+                Packet<float> tMax;
+                Packet<Sampler *> rng;
+                for (int lane = 0; lane < PacketSize; lane++) {
+                    packet[lane] = rays[first + lane];
+                    tMax[lane]   = 5.f * lane;
+                    rng[lane]    = &sampler;
+                }
+
+                const int hitMask      = bvh.intersect8(packet, mask, its, rng);
+                const int occludedMask = bvh.occluded8(packet, tMax, mask, rng);
+                for (int lane = 0; lane < PacketSize; lane++) {
+                    const bool valid = mask & (1 << lane);
+                    Intersection single;
+                    const bool hit = bvh.intersect(packet[lane], single, sampler);
+                    REQUIRE( bool(hitMask & (1 << lane)) == (valid && hit) );
+                    REQUIRE( its[lane].t == (valid ? single.t : Infinity) );
+                    REQUIRE( bool(occludedMask & (1 << lane)) ==
+                             (valid && bvh.occluded(packet[lane], tMax[lane], sampler)) );
+                }
+            }
+        }
+    }
+
+    SECTION( "BVH reports closest intersection" ) {
+        for (const Ray &ray : randomRays(200)) {
+            Intersection its;
+            parallel.intersect(ray, its, sampler);
+            REQUIRE( its.t == Catch::Approx(parallel.bruteForce(ray)) );
+        }
+    }
+}
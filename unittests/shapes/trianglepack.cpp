@@ -0,0 +1,82 @@
+#include <catch_amalgamated.hpp>
+#include <shapes/trianglepack.hpp>
+
+#include <random>
+
+using namespace lightwave;
+
+namespace {
+
+struct Triangle {
+    Point v0;
+    Vector edge1, edge2;
+};
+
+/// @brief Reference Möller–Trumbore test for a single triangle.
+float intersectTriangle(const Triangle &triangle, const Ray &ray) {
+    const Vector pvec  = ray.direction.cross(triangle.edge2);
+    const float invDet = 1 / triangle.edge1.dot(pvec);
+    const Vector tvec  = ray.origin - triangle.v0;
+    const float u      = tvec.dot(pvec) * invDet;
+    if (u < 0 || u > 1)
+        return Infinity;
+    const Vector qvec = tvec.cross(triangle.edge1);
+    const float v     = ray.direction.dot(qvec) * invDet;
+    if (v < 0 || u + v > 1)
+        return Infinity;
+    const float t = triangle.edge2.dot(qvec) * invDet;
+    return t < Epsilon ? Infinity : t;
+}
+
+/// @brief Compares a pack of random triangles against the reference test.
+template <int Width> void comparePacks(int count) {
+    std::mt19937 gen(4321);
+    std::uniform_real_distribution<float> position(-1, 1);
+    const auto randomPoint = [&]() {
+        return Point{ position(gen), position(gen), position(gen) };
+    };
+
+    for (int trial = 0; trial < 200; trial++) {
+        Triangle triangles[Width];
+        TrianglePack<Width> pack;
+        for (int lane = 0; lane < Width; lane++) {
+            const Point p0 = randomPoint();
+            triangles[lane] = { p0, randomPoint() - p0, randomPoint() - p0 };
+            pack.set(lane, p0, triangles[lane].edge1, triangles[lane].edge2);
+        }
+
+        const Point origin = Point(0) + 3 * (randomPoint() - Point(0));
+        const Ray ray { origin, (randomPoint() - origin).normalized() };
+
+        float expected = Infinity;
+        for (int lane = 0; lane < count; lane++)
+            expected = min(expected, intersectTriangle(triangles[lane], ray));
+
+        float t;
+        Vector2 barycentrics;
+        const int lane = pack.intersect(ray, count, Infinity, t, barycentrics);
+        REQUIRE( (lane >= 0) == (expected < Infinity) );
+        REQUIRE( pack.occluded(ray, count, Infinity) == (lane >= 0) );
+        if (lane >= 0) {
+            REQUIRE( lane < count );
+            REQUIRE( t == Catch::Approx(expected) );
+            REQUIRE( !pack.occluded(ray, count, t * 0.99f) );
+        }
+    }
+}
+
+} // namespace
+
+// clang-format off
+
+TEST_CASE( "Triangle pack tests", "[trianglepack]" ) {
+    SECTION( "Full packs match single triangle tests" ) {
+        comparePacks<4>(4);
+        comparePacks<8>(8);
+    }
+
+    SECTION( "Unused lanes are ignored" ) {
+        comparePacks<4>(3);
+        comparePacks<8>(5);
+    }
+}
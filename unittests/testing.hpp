@@ -0,0 +1,135 @@
+/**
+ * @file testing.hpp
+ * @brief Helpers that build small scenes for the unit tests.
+ */
+
+#pragma once
+
+#include <lightwave.hpp>
+
+#include <filesystem>
+#include <random>
+
+// clang-format off
+
+namespace lightwave::testing {
+
+/// @brief Creates an object of the given category and type from the registry.
+template <typename T>
+ref<T> create(const std::string &category, const std::string &type, const Properties &properties) {
+    return std::dynamic_pointer_cast<T>(Registry::create(category, type, properties));
+}
+
+/// @brief A constant texture of the given value.
+inline ref<Texture> constant(float value) {
+    Properties properties;
+    properties.set("value", Color(value));
+    return create<Texture>("texture", "constant", properties);
+}
+
+/// @brief A perspective camera at the origin that looks along the positive z
+/// axis, unless a transform is given.
+inline ref<Camera> createCamera(int width, int height, float fov, ref<Transform> transform = nullptr) {
+    Properties properties;
+    properties.set("width", width);
+    properties.set("height", height);
+    properties.set("fov", fov);
+    properties.set("fovAxis", std::string("x"));
+    properties.addChild(transform ? transform : create<Transform>("transform", "default", {}));
+    return create<Camera>("camera", "perspective", properties);
+}
+
+/// @brief A scene of the given camera and objects (instances and lights).
+inline ref<Scene> createScene(const ref<Camera> &camera, const std::vector<ref<Object>> &objects, const std::string &lightSampling = "power") {
+    Properties properties;
+    properties.set("lightSampling", lightSampling);
+    properties.addChild(camera);
+    for (const auto &object : objects)
+        properties.addChild(object);
+    return create<Scene>("scene", "default", properties);
+}
+
+/// @brief Creates an empty directory for the images and checkpoints of a test,
+/// which the test removes once done.
+inline std::filesystem::path createTemporaryDirectory() {
+    const auto directory = std::filesystem::temp_directory_path() /
+        tfm::format("lightwave-unittest-%08x", std::random_device()());
+    std::filesystem::create_directories(directory);
+    return directory;
+}
+
+/// @brief A rectangle of the given size that is rotated around the x axis
+/// and then moved to the given position.
+inline ref<Transform> placeRectangle(const Vector &size, float angle, const Vector &position) {
+    const auto transform = create<Transform>("transform", "default", {});
+    transform->scale(size);
+    transform->rotate(Vector(1, 0, 0), angle);
+    transform->translate(position);
+    return transform;
+}
+
+/**
+ * @brief A diffuse floor, ceiling and back wall that light each other, lit by
+ * two area lights of different power that hang below the ceiling outside of
+ * the view.
+ * All light therefore reaches the camera after one or more bounces, which
+ * makes the mean of the image a simple reference for comparing estimators.
+ */
+inline ref<Scene> createCornerScene(const std::string &lightSampling = "power") {
+    std::vector<ref<Object>> objects;
+    const auto diffuse = [&](const ref<Transform> &transform) {
+        Properties bsdfProperties;
+        bsdfProperties.set("albedo", constant(0.8f));
+        Properties properties;
+        properties.addChild(create<Shape>("shape", "rectangle", {}));
+        properties.addChild(create<Bsdf>("bsdf", "diffuse", bsdfProperties));
+        properties.addChild(transform);
+        objects.push_back(create<Instance>("instance", "default", properties));
+    };
+    const auto lamp = [&](float emission, const Vector &position) {
+        Properties emissionProperties;
+        emissionProperties.set("emission", constant(emission));
+        Properties properties;
+        properties.addChild(create<Shape>("shape", "rectangle", {}));
+        properties.addChild(create<Emission>("emission", "lambertian", emissionProperties));
+        properties.addChild(placeRectangle(Vector(0.3f, 0.3f, 1), Pi / 2, position));
+        const auto instance = create<Instance>("instance", "default", properties);
+
+        Properties lightProperties;
+        lightProperties.addChild(instance);
+        objects.push_back(instance);
+        objects.push_back(create<Light>("light", "area", lightProperties));
+    };
+
+    diffuse(placeRectangle(Vector(2, 2, -1), 0, Vector(0, 0, 3)));
+    diffuse(placeRectangle(Vector(2, 2, 1), -Pi / 2, Vector(0, -1, 2)));
+    diffuse(placeRectangle(Vector(2, 2, 1), Pi / 2, Vector(0, 2, 2)));
+    lamp(10, Vector(-0.5f, 1.8f, 1.5f));
+    lamp(30, Vector(0.8f, 1.8f, 2.5f));
+    return createScene(createCamera(16, 16, 60), objects, lightSampling);
+}
+
+/**
+ * @brief Renders the scene with the given integrator into an image in the
+ * given directory, and returns the mean luminance of the image.
+ * @param properties The properties of the integrator, to which the scene,
+ * sampler and image are added.
+ */
+inline float renderMean(const std::string &integrator, Properties properties, const ref<Scene> &scene, int samples, const std::filesystem::path &directory) {
+    Properties samplerProperties;
+    samplerProperties.set("count", samples);
+    const auto image = create<Image>("image", "default", Properties(directory));
+    image->setId(integrator);
+
+    properties.addChild(scene);
+    properties.addChild(create<Sampler>("sampler", "independent", samplerProperties));
+    properties.addChild(image);
+    create<Integrator>("integrator", integrator, properties)->execute();
+
+    float sum = 0;
+    for (auto pixel : image->bounds())
+        sum += image->get(pixel).luminance();
+    return sum / Vector2i(image->resolution()).product();
+}
+
+} // namespace lightwave::testing